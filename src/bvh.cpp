@@ -1,4 +1,6 @@
 #include "bvh.hpp"
+#include "render_stats.hpp"
+#include "utils/trace.hpp"
 #include <algorithm>
 
 namespace PT
@@ -30,9 +32,20 @@ struct BVHBuildShapeInfo
     std::shared_ptr< Shape > shape;
 };
 
+// the first few levels of the build get their own trace zones, deeper ones would only bloat the trace
+#define TRACED_BVH_BUILD_LEVELS 3
+
 static std::unique_ptr< BVHBuildNode > BuildBVHInteral( std::vector< BVHBuildShapeInfo >& buildShapeInfos, int start, int end,
-    std::vector< std::shared_ptr< Shape > >& orderedShapes, uint32_t& totalNodes, BVH::SplitMethod splitMethod )
+    std::vector< std::shared_ptr< Shape > >& orderedShapes, uint32_t& totalNodes, BVH::SplitMethod splitMethod, int depth = 0 )
 {
+#if USING( TRACING )
+    std::unique_ptr< Trace::Zone > traceZone;
+    if ( depth < TRACED_BVH_BUILD_LEVELS && Trace::IsRecording() )
+    {
+        traceZone = std::make_unique< Trace::Zone >( "BuildBVHInteral" );
+        traceZone->SetDetail( "depth " + std::to_string( depth ) + ", " + std::to_string( end - start ) + " shapes" );
+    }
+#endif // #if USING( TRACING )
     auto node = std::make_unique< BVHBuildNode >();
     ++totalNodes;
 
@@ -171,8 +184,8 @@ static std::unique_ptr< BVHBuildNode > BuildBVHInteral( std::vector< BVHBuildSha
     }
 
     int cutoff        = start + static_cast< int >( midShape - &buildShapeInfos[start] );
-    node->firstChild  = BuildBVHInteral( buildShapeInfos, start, cutoff, orderedShapes, totalNodes, splitMethod );
-    node->secondChild = BuildBVHInteral( buildShapeInfos, cutoff, end,   orderedShapes, totalNodes, splitMethod );
+    node->firstChild  = BuildBVHInteral( buildShapeInfos, start, cutoff, orderedShapes, totalNodes, splitMethod, depth + 1 );
+    node->secondChild = BuildBVHInteral( buildShapeInfos, cutoff, end,   orderedShapes, totalNodes, splitMethod, depth + 1 );
 
     return node;
 }
@@ -203,6 +216,7 @@ static int FlattenBVHBuild( LinearBVHNode* linearRoot, BVHBuildNode* buildNode,
 
 void BVH::Build( std::vector< std::shared_ptr< Shape > >& listOfShapes )
 {
+    TRACE_ZONE( "BVH::Build" );
     shapes = std::move( listOfShapes );
 
     assert( shapes.size() > 0 );
@@ -221,7 +235,9 @@ void BVH::Build( std::vector< std::shared_ptr< Shape > >& listOfShapes )
     shapes = std::move( orderedShapes );
 
     // flatten the bvh
-    nodes = new LinearBVHNode[totalNodes];
+    TRACE_ZONE( "FlattenBVHBuild" );
+    nodes    = new LinearBVHNode[totalNodes];
+    numNodes = totalNodes;
     uint32_t slot  = 0;
     FlattenBVHBuild( &nodes[0], buildRootNode.get(), slot );
     assert( slot == totalNodes );
@@ -235,15 +251,18 @@ bool BVH::Intersect( const Ray& ray, IntersectionData* hitData ) const
     glm::vec3 invRayDir  = glm::vec3( 1.0 ) / ray.direction;
     int isDirNeg[3]      = { invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0 };
     float oldMaxT = hitData->t;
+    STATS_ONLY( uint32_t nodesVisited = 0; uint32_t primitiveTests = 0; )
 
     while ( true )
     {
         const LinearBVHNode& node = nodes[currentNodeIndex];
+        STATS_ONLY( ++nodesVisited; )
         if ( intersect::RayAABBFastest( ray.position, invRayDir, isDirNeg, node.aabb.min, node.aabb.max, hitData->t ) )
         {
             // if this  is a leaf node, check each triangle
             if ( node.numShapes > 0 )
             {
+                STATS_ONLY( primitiveTests += node.numShapes; )
                 for ( int shapeIndex = node.firstIndexOffset; shapeIndex < node.firstIndexOffset + node.numShapes; ++shapeIndex )
                 {
                     shapes[shapeIndex]->Intersect( ray, hitData );
@@ -264,6 +283,8 @@ bool BVH::Intersect( const Ray& ray, IntersectionData* hitData ) const
         }
     }
 
+    STATS_ADD_CLOSEST_HIT_RAY( nodesVisited, primitiveTests, hitData->t < oldMaxT );
+
     return hitData->t < oldMaxT;
 }
 
@@ -274,10 +295,12 @@ bool BVH::Occluded( const Ray& ray, float tMax ) const
     int toVisitOffset    = 0;
     glm::vec3 invRayDir  = glm::vec3( 1.0 ) / ray.direction;
     int isDirNeg[3]      = { invRayDir.x < 0, invRayDir.y < 0, invRayDir.z < 0 };
+    STATS_ONLY( uint32_t nodesVisited = 0; uint32_t primitiveTests = 0; )
 
     while ( true )
     {
         const LinearBVHNode& node = nodes[currentNodeIndex];
+        STATS_ONLY( ++nodesVisited; )
         if ( intersect::RayAABBFastest( ray.position, invRayDir, isDirNeg, node.aabb.min, node.aabb.max, tMax ) )
         {
             // if this  is a leaf node, check each triangle
@@ -285,8 +308,10 @@ bool BVH::Occluded( const Ray& ray, float tMax ) const
             {
                 for ( int shapeIndex = node.firstIndexOffset; shapeIndex < node.firstIndexOffset + node.numShapes; ++shapeIndex )
                 {
+                    STATS_ONLY( ++primitiveTests; )
                     if ( shapes[shapeIndex]->TestIfHit( ray, tMax ) )
                     {
+                        STATS_ADD_SHADOW_RAY( nodesVisited, primitiveTests, true );
                         return true;
                     }
                 }
@@ -305,6 +330,7 @@ bool BVH::Occluded( const Ray& ray, float tMax ) const
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    STATS_ADD_SHADOW_RAY( nodesVisited, primitiveTests, false );
 
     return false;
 }
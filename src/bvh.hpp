@@ -36,6 +36,7 @@ public:
     SplitMethod splitMethod = SplitMethod::Middle;
     std::vector< std::shared_ptr< Shape > > shapes;
     LinearBVHNode* nodes = nullptr;
+    uint32_t numNodes    = 0;
 };
 
 } // namespace PT
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "bvh_quality.hpp"
+#include "resource/model.hpp"
+#include "utils/logger.hpp"
+#include "utils/time.hpp"
+#include <algorithm>
+#include <cstdio>
+
+namespace PT
+{
+
+static bool Overlaps( const AABB& a, const AABB& b )
+{
+    return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y && a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Sutherland-Hodgman clipping of the triangle against the 6 planes of the box, returns the area of what is left
+static float ClippedTriangleArea( const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const AABB& aabb )
+{
+    // each plane can add at most one vertex
+    glm::vec3 polygon[9] = { v0, v1, v2 };
+    glm::vec3 clipped[9];
+    int numVertices = 3;
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        for ( int side = 0; side < 2; ++side )
+        {
+            float plane = side == 0 ? aabb.min[axis] : aabb.max[axis];
+            float sign  = side == 0 ? 1.0f : -1.0f; // > 0 == inside
+            int numClipped = 0;
+            for ( int i = 0; i < numVertices; ++i )
+            {
+                const glm::vec3& a = polygon[i];
+                const glm::vec3& b = polygon[( i + 1 ) % numVertices];
+                float da           = sign * ( a[axis] - plane );
+                float db           = sign * ( b[axis] - plane );
+                if ( da >= 0 )
+                {
+                    clipped[numClipped++] = a;
+                }
+                if ( ( da >= 0 ) != ( db >= 0 ) )
+                {
+                    clipped[numClipped++] = a + ( b - a ) * ( da / ( da - db ) );
+                }
+            }
+            numVertices = numClipped;
+            if ( numVertices < 3 )
+            {
+                return 0;
+            }
+            std::copy( clipped, clipped + numVertices, polygon );
+        }
+    }
+
+    glm::vec3 areaVector( 0 );
+    for ( int i = 1; i + 1 < numVertices; ++i )
+    {
+        areaVector += glm::cross( polygon[i] - polygon[0], polygon[i + 1] - polygon[0] );
+    }
+
+    return 0.5f * glm::length( areaVector );
+}
+
+// Surface area of the shape inside of the box. Exact for triangles, for anything else the area is assumed to be
+// spread evenly over the shape's AABB
+static float ClippedArea( const Shape* shape, const AABB& aabb )
+{
+    if ( const Triangle* tri = dynamic_cast< const Triangle* >( shape ) )
+    {
+        const auto& vertices = tri->mesh->data.vertices;
+        return ClippedTriangleArea( vertices[tri->i0], vertices[tri->i1], vertices[tri->i2], aabb );
+    }
+
+    AABB shapeAABB = shape->WorldSpaceAABB();
+    glm::vec3 shapeExtent   = glm::max( shapeAABB.max - shapeAABB.min, glm::vec3( 1e-6f ) );
+    glm::vec3 overlapExtent = glm::max( glm::min( shapeAABB.max, aabb.max ) - glm::max( shapeAABB.min, aabb.min ), glm::vec3( 0 ) );
+    glm::vec3 fraction      = glm::min( overlapExtent / shapeExtent, glm::vec3( 1 ) );
+
+    return shape->Area() * fraction.x * fraction.y * fraction.z;
+}
+
+// [first, end) range of the ordered shapes under each node
+static void ComputeShapeRanges( const BVH& bvh, int nodeIndex, std::vector< glm::uvec2 >& ranges )
+{
+    const LinearBVHNode& node = bvh.nodes[nodeIndex];
+    if ( node.numShapes > 0 )
+    {
+        ranges[nodeIndex] = glm::uvec2( node.firstIndexOffset, node.firstIndexOffset + node.numShapes );
+        return;
+    }
+    ComputeShapeRanges( bvh, nodeIndex + 1, ranges );
+    ComputeShapeRanges( bvh, node.secondChildOffset, ranges );
+    ranges[nodeIndex] = glm::uvec2( ranges[nodeIndex + 1].x, ranges[node.secondChildOffset].y );
+}
+
+static float NodeCost( const LinearBVHNode& node )
+{
+    return node.numShapes > 0 ? BVH_INTERSECTION_COST * node.numShapes : BVH_TRAVERSAL_COST;
+}
+
+BVHQuality ComputeBVHQuality( const BVH& bvh, int maxEPOSamples )
+{
+    BVHQuality quality;
+    if ( !bvh.nodes || bvh.numNodes == 0 )
+    {
+        return quality;
+    }
+    quality.numNodes    = bvh.numNodes;
+    quality.memoryBytes = bvh.numNodes * sizeof( LinearBVHNode ) + bvh.shapes.size() * sizeof( bvh.shapes[0] );
+
+    // node count, depth, leaf sizes and SAH cost, in one pass over the tree
+    float rootArea = std::max( bvh.nodes[0].aabb.SurfaceArea(), 1e-12f );
+    std::vector< std::pair< int, int > > nodesToVisit = { { 0, 0 } }; // node index, depth
+    while ( !nodesToVisit.empty() )
+    {
+        auto [nodeIndex, depth] = nodesToVisit.back();
+        nodesToVisit.pop_back();
+        const LinearBVHNode& node = bvh.nodes[nodeIndex];
+        quality.maxDepth          = std::max( quality.maxDepth, depth );
+        quality.sahCost          += NodeCost( node ) * node.aabb.SurfaceArea() / rootArea;
+        if ( node.numShapes > 0 )
+        {
+            quality.numLeaves += 1;
+            quality.leafSizeHistogram[std::min< int >( node.numShapes, BVH_LEAF_HISTOGRAM_SIZE - 1 )] += 1;
+        }
+        else
+        {
+            nodesToVisit.push_back( { nodeIndex + 1, depth + 1 } );
+            nodesToVisit.push_back( { node.secondChildOffset, depth + 1 } );
+        }
+    }
+
+    // EPO: for each sampled shape, find all of the nodes its AABB overlaps, and add up its area inside of the
+    // ones that don't contain it. The shapes are sampled at even spacing, scaled up to the total count
+    std::vector< glm::uvec2 > shapeRanges( bvh.numNodes );
+    ComputeShapeRanges( bvh, 0, shapeRanges );
+    int numShapes  = static_cast< int >( bvh.shapes.size() );
+    int numSamples = std::min( numShapes, std::max( 1, maxEPOSamples ) );
+    double totalArea = 0;
+    #pragma omp parallel for reduction( + : totalArea )
+    for ( int i = 0; i < numShapes; ++i )
+    {
+        totalArea += bvh.shapes[i]->Area();
+    }
+
+    double overlapArea = 0;
+    #pragma omp parallel for schedule( dynamic, 64 ) reduction( + : overlapArea )
+    for ( int sample = 0; sample < numSamples; ++sample )
+    {
+        uint32_t shapeIndex = static_cast< uint32_t >( static_cast< int64_t >( sample ) * numShapes / numSamples );
+        const Shape* shape  = bvh.shapes[shapeIndex].get();
+        AABB shapeAABB      = shape->WorldSpaceAABB();
+        std::vector< int > stack = { 0 };
+        while ( !stack.empty() )
+        {
+            int nodeIndex = stack.back();
+            stack.pop_back();
+            const LinearBVHNode& node = bvh.nodes[nodeIndex];
+            if ( !Overlaps( node.aabb, shapeAABB ) )
+            {
+                continue;
+            }
+            const glm::uvec2& range = shapeRanges[nodeIndex];
+            if ( shapeIndex < range.x || shapeIndex >= range.y )
+            {
+                overlapArea += NodeCost( node ) * ClippedArea( shape, node.aabb );
+            }
+            if ( node.numShapes == 0 )
+            {
+                stack.push_back( nodeIndex + 1 );
+                stack.push_back( node.secondChildOffset );
+            }
+        }
+    }
+    if ( totalArea > 0 )
+    {
+        quality.epo = static_cast< float >( overlapArea * numShapes / numSamples / totalArea );
+    }
+
+    return quality;
+}
+
+void LogBVHQuality( const BVHQuality& quality )
+{
+    LOG( "BVH quality:" );
+    LOG( "\tNodes: ", quality.numNodes, " (", quality.numLeaves, " leaves), ", quality.memoryBytes / 1024.0f, " KB" );
+    LOG( "\tMax depth: ", quality.maxDepth );
+    LOG( "\tSAH cost: ", quality.sahCost );
+    LOG( "\tEPO: ", quality.epo );
+    std::string histogram;
+    for ( int size = 1; size < BVH_LEAF_HISTOGRAM_SIZE; ++size )
+    {
+        if ( quality.leafSizeHistogram[size] )
+        {
+            histogram += "  " + std::to_string( size ) + ( size == BVH_LEAF_HISTOGRAM_SIZE - 1 ? "+" : "" ) + ": " + std::to_string( quality.leafSizeHistogram[size] );
+        }
+    }
+    LOG( "\tLeaf sizes:", histogram );
+}
+
+void CompareBVHSplitMethods( const std::vector< std::shared_ptr< Shape > >& shapes )
+{
+    static const std::pair< BVH::SplitMethod, const char* > splitMethods[] =
+    {
+        { BVH::SplitMethod::SAH,         "SAH" },
+        { BVH::SplitMethod::Middle,      "Middle" },
+        { BVH::SplitMethod::EqualCounts, "EqualCounts" },
+    };
+
+    char line[256];
+    LOG( "Comparing BVH split methods for ", shapes.size(), " shapes:" );
+    LOG( "  split method   build ms      nodes     leaves  depth   SAH cost        EPO   memory KB" );
+    for ( const auto& [splitMethod, name] : splitMethods )
+    {
+        BVH bvh;
+        bvh.splitMethod = splitMethod;
+        std::vector< std::shared_ptr< Shape > > buildShapes = shapes;
+        auto startTime = Time::GetTimePoint();
+        bvh.Build( buildShapes );
+        float buildMs      = Time::GetDuration( startTime );
+        BVHQuality quality = ComputeBVHQuality( bvh );
+        snprintf( line, sizeof( line ), "%14s%11.1f%11u%11u%7d%11.2f%11.3f%12.1f", name, buildMs, quality.numNodes, quality.numLeaves,
+            quality.maxDepth, quality.sahCost, quality.epo, quality.memoryBytes / 1024.0f );
+        LOG( line );
+    }
+}
+
+} // namespace PT
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "bvh.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cost model of the SAH cost and EPO: one traversal step per interior node, one intersection test per shape in a leaf
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECTION_COST 1.0f
+
+// leaves with this many shapes or more share the last histogram bucket
+#define BVH_LEAF_HISTOGRAM_SIZE 9
+
+namespace PT
+{
+
+struct BVHQuality
+{
+    uint32_t numNodes  = 0;
+    uint32_t numLeaves = 0;
+    int maxDepth       = 0;
+    size_t memoryBytes = 0; // nodes plus the ordered shape pointers
+
+    // expected cost of a random ray that hits the root: SA(node) / SA(root) weighted sum of the node costs
+    float sahCost = 0;
+
+    // Effective primitive overlap (Aila et al. 2013, "On Quality Metrics of Bounding Volume Hierarchies"):
+    // the cost weighted surface area of the shapes that lies inside nodes not containing them, relative to the
+    // total surface area. Unlike the SAH cost it penalizes nodes overlapping, which is what makes rays visit both
+    // children. Estimated from up to maxEPOSamples evenly spaced shapes
+    float epo = 0;
+
+    uint32_t leafSizeHistogram[BVH_LEAF_HISTOGRAM_SIZE] = {}; // [n] == number of leaves with n shapes
+};
+
+BVHQuality ComputeBVHQuality( const BVH& bvh, int maxEPOSamples = 16384 );
+
+void LogBVHQuality( const BVHQuality& quality );
+
+// Builds the BVH of the shapes once with every split method, and logs a table of the build time and quality
+// of each, to pick the split method of the scene's "BVH" block
+void CompareBVHSplitMethods( const std::vector< std::shared_ptr< Shape > >& shapes );
+
+} // namespace PT
@@ -0,0 +1,106 @@
+#include "camera_path.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+namespace PT
+{
+
+bool CameraPath::Empty() const
+{
+    return keyframes.empty();
+}
+
+void CameraPath::Finalize( const Camera& baseCamera )
+{
+    std::stable_sort( keyframes.begin(), keyframes.end(), []( const CameraKeyframe& a, const CameraKeyframe& b ) { return a.frame < b.frame; } );
+
+    glm::vec3 position = baseCamera.position;
+    glm::vec3 rotation = baseCamera.rotation;
+    float vfov         = baseCamera.vfov;
+    for ( CameraKeyframe& key : keyframes )
+    {
+        position     = key.position.value_or( position );
+        rotation     = key.rotation.value_or( rotation );
+        vfov         = key.vfov.value_or( vfov );
+        key.position = position;
+        key.rotation = rotation;
+        key.vfov     = vfov;
+    }
+}
+
+// Cubic Hermite interpolation between p1 and p2 (at times t1 and t2), with Catmull-Rom tangents computed from
+// the neighbors p0 and p3. The tangents are divided by the time between the neighbors, so uneven keyframe
+// spacing does not cause the camera to overshoot or suddenly change speed
+static glm::vec3 CatmullRom( const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3,
+                             float t0, float t1, float t2, float t3, float t )
+{
+    glm::vec3 m1 = (p2 - p0) / std::max( t2 - t0, 1e-6f ) * (t2 - t1);
+    glm::vec3 m2 = (p3 - p1) / std::max( t3 - t1, 1e-6f ) * (t2 - t1);
+    float s      = (t - t1) / std::max( t2 - t1, 1e-6f );
+    float s2     = s * s;
+    float s3     = s2 * s;
+
+    return (2 * s3 - 3 * s2 + 1) * p1 + (s3 - 2 * s2 + s) * m1 + (-2 * s3 + 3 * s2) * p2 + (s3 - s2) * m2;
+}
+
+void CameraPath::Evaluate( float frame, Camera& camera ) const
+{
+    if ( keyframes.empty() )
+    {
+        return;
+    }
+
+    // keyframes[i] <= frame < keyframes[i + 1]
+    int last = static_cast< int >( keyframes.size() ) - 1;
+    int i    = 0;
+    while ( i < last && keyframes[i + 1].frame <= frame )
+    {
+        ++i;
+    }
+    if ( i == last || frame <= keyframes[0].frame )
+    {
+        const CameraKeyframe& key = frame <= keyframes[0].frame ? keyframes[0] : keyframes[last];
+        camera.position           = *key.position;
+        camera.rotation           = *key.rotation;
+        camera.vfov               = *key.vfov;
+        camera.UpdateOrientationVectors();
+        return;
+    }
+
+    // the end points are repeated to get the tangents at the first / last keyframe
+    const CameraKeyframe& k0 = keyframes[std::max( i - 1, 0 )];
+    const CameraKeyframe& k1 = keyframes[i];
+    const CameraKeyframe& k2 = keyframes[i + 1];
+    const CameraKeyframe& k3 = keyframes[std::min( i + 2, last )];
+    float t0 = static_cast< float >( k0.frame );
+    float t1 = static_cast< float >( k1.frame );
+    float t2 = static_cast< float >( k2.frame );
+    float t3 = static_cast< float >( k3.frame );
+
+    camera.position = CatmullRom( *k0.position, *k1.position, *k2.position, *k3.position, t0, t1, t2, t3, frame );
+    camera.rotation = CatmullRom( *k0.rotation, *k1.rotation, *k2.rotation, *k3.rotation, t0, t1, t2, t3, frame );
+    camera.vfov     = glm::mix( *k1.vfov, *k2.vfov, (frame - t1) / (t2 - t1) );
+    camera.UpdateOrientationVectors();
+}
+
+int CameraPath::GetNumFrames() const
+{
+    if ( numFrames > 0 || keyframes.empty() )
+    {
+        return numFrames;
+    }
+
+    return keyframes.back().frame + 1;
+}
+
+std::string GetFrameFilename( const std::string& filename, int frame )
+{
+    char frameString[16];
+    snprintf( frameString, sizeof( frameString ), "_%04d", frame );
+    std::filesystem::path path( filename );
+
+    return ( path.parent_path() / ( path.stem().string() + frameString + path.extension().string() ) ).string();
+}
+
+} // namespace PT
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "camera.hpp"
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+// Camera settings at one frame of a camera path. Values that are not set are taken from the previous keyframe
+// (or the scene's Camera for the first keyframe)
+struct CameraKeyframe
+{
+    int frame = 0;
+    std::optional< glm::vec3 > position;
+    std::optional< glm::vec3 > rotation; // radians
+    std::optional< float > vfov;         // radians
+};
+
+// Keyframed camera animation for rendering a sequence of frames from one loaded scene. Position and rotation
+// are interpolated with a Catmull-Rom style cubic Hermite spline (tangents from the neighboring keyframes, scaled
+// by the keyframe spacing), and vfov is interpolated linearly
+class CameraPath
+{
+public:
+    CameraPath() = default;
+
+    bool Empty() const;
+
+    // sorts the keyframes and fills in the unset values, starting from baseCamera
+    void Finalize( const Camera& baseCamera );
+
+    // sets the camera position, rotation and vfov for the given frame. Frames outside of the keyframes are clamped
+    void Evaluate( float frame, Camera& camera ) const;
+
+    // number of frames in the sequence. Defaults to all frames up to and including the last keyframe
+    int GetNumFrames() const;
+
+    std::vector< CameraKeyframe > keyframes;
+    int numFrames = 0; // 0 == up to the last keyframe
+};
+
+// "dir/name.png" -> "dir/name_0042.png"
+std::string GetFrameFilename( const std::string& filename, int frame );
+
+} // namespace PT
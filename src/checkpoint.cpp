@@ -0,0 +1,166 @@
+#include "checkpoint.hpp"
+#include "utils/logger.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace PT
+{
+
+bool WriteCheckpoint( const std::string& filename, const RenderCheckpoint& checkpoint )
+{
+    // write to a temporary file and rename it, so a crash while writing never destroys the previous checkpoint
+    std::string tmpFilename = filename + ".tmp";
+    {
+        std::ofstream out( tmpFilename, std::ios::binary );
+        if ( !out )
+        {
+            LOG_ERR( "Could not open checkpoint file '", tmpFilename, "' for writing" );
+            return false;
+        }
+
+        out.write( reinterpret_cast< const char* >( &checkpoint.header ), sizeof( CheckpointHeader ) );
+        out.write( reinterpret_cast< const char* >( checkpoint.sums.data() ), sizeof( glm::vec3 ) * checkpoint.sums.size() );
+        if ( checkpoint.header.hasLuminanceSquaredSums )
+        {
+            out.write( reinterpret_cast< const char* >( checkpoint.luminanceSquaredSums.data() ), sizeof( float ) * checkpoint.luminanceSquaredSums.size() );
+        }
+        if ( !out.good() )
+        {
+            LOG_ERR( "Could not write checkpoint file '", tmpFilename, "'" );
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename( tmpFilename, filename, ec );
+    if ( ec )
+    {
+        LOG_ERR( "Could not rename '", tmpFilename, "' to '", filename, "': ", ec.message() );
+        return false;
+    }
+
+    return true;
+}
+
+bool ReadCheckpoint( const std::string& filename, RenderCheckpoint& checkpoint )
+{
+    std::ifstream in( filename, std::ios::binary );
+    if ( !in )
+    {
+        LOG_ERR( "Could not open checkpoint file '", filename, "'" );
+        return false;
+    }
+
+    CheckpointHeader expected;
+    CheckpointHeader& header = checkpoint.header;
+    in.read( reinterpret_cast< char* >( &header ), sizeof( CheckpointHeader ) );
+    if ( !in || memcmp( header.magic, expected.magic, sizeof( expected.magic ) ) || header.version != expected.version )
+    {
+        LOG_ERR( "'", filename, "' is not a valid checkpoint file" );
+        return false;
+    }
+
+    size_t numPixels = static_cast< size_t >( header.window[2] ) * header.window[3];
+    checkpoint.sums.resize( numPixels );
+    in.read( reinterpret_cast< char* >( checkpoint.sums.data() ), sizeof( glm::vec3 ) * numPixels );
+    if ( header.hasLuminanceSquaredSums )
+    {
+        checkpoint.luminanceSquaredSums.resize( numPixels );
+        in.read( reinterpret_cast< char* >( checkpoint.luminanceSquaredSums.data() ), sizeof( float ) * numPixels );
+    }
+    if ( !in )
+    {
+        LOG_ERR( "Checkpoint file '", filename, "' is truncated" );
+        return false;
+    }
+
+    return true;
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    Wait();
+}
+
+bool CheckpointWriter::WriteAsync( const std::string& filename, RenderCheckpoint&& checkpoint )
+{
+    if ( m_pendingWrite.valid() && m_pendingWrite.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+    {
+        return false;
+    }
+    Wait();
+
+    m_pendingWrite = std::async( std::launch::async, [filename, checkpoint = std::move( checkpoint )]()
+    {
+        return WriteCheckpoint( filename, checkpoint );
+    });
+
+    return true;
+}
+
+bool CheckpointWriter::Wait()
+{
+    if ( !m_pendingWrite.valid() )
+    {
+        return true;
+    }
+
+    return m_pendingWrite.get();
+}
+
+static std::atomic< bool > s_terminationRequested( false );
+using SignalHandler = void ( * )( int );
+
+static std::atomic< int > s_terminationHandlerScopes( 0 );
+static SignalHandler s_previousTermHandler = SIG_DFL;
+static SignalHandler s_previousIntHandler  = SIG_DFL;
+
+static void TerminationHandler( int signal )
+{
+    if ( s_terminationHandlerScopes > 0 )
+    {
+        s_terminationRequested = true;
+        return;
+    }
+
+    // arrived while the scope was ending, nothing is left to flush a checkpoint
+    std::signal( signal, signal == SIGTERM ? s_previousTermHandler : s_previousIntHandler );
+    std::raise( signal );
+}
+
+static SignalHandler ValidHandler( SignalHandler handler )
+{
+    return handler == SIG_ERR ? SIG_DFL : handler;
+}
+
+TerminationHandlerScope::TerminationHandlerScope()
+{
+    if ( s_terminationHandlerScopes++ == 0 )
+    {
+        s_terminationRequested = false;
+        s_previousTermHandler  = ValidHandler( std::signal( SIGTERM, TerminationHandler ) );
+        s_previousIntHandler   = ValidHandler( std::signal( SIGINT, TerminationHandler ) );
+    }
+}
+
+TerminationHandlerScope::~TerminationHandlerScope()
+{
+    if ( --s_terminationHandlerScopes == 0 )
+    {
+        std::signal( SIGTERM, s_previousTermHandler );
+        std::signal( SIGINT, s_previousIntHandler );
+    }
+}
+
+bool TerminationRequested()
+{
+    return s_terminationRequested;
+}
+
+} // namespace PT
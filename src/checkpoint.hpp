@@ -0,0 +1,78 @@
+#pragma once
+
+#include "math.hpp"
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+#define CHECKPOINT_FILE_EXTENSION ".ptckpt"
+
+// State of an in-progress render. Checkpoints are only taken between sample batches, when every pixel has the same
+// number of samples, and renders with checkpoints seed every sample from its pixel and sample index (like the
+// coordinator's workers). So the sample count is all of the sampler / RNG state needed to continue exactly.
+// renderHash covers the scene's files and the settings that change the paths, so a resume after editing the scene
+// starts over instead of adding up two different images
+struct CheckpointHeader
+{
+    char magic[4]           = { 'P', 'T', 'C', 'K' };
+    uint32_t version        = 2;
+    uint64_t renderHash     = 0;
+    int32_t fullWidth       = 0;
+    int32_t fullHeight      = 0;
+    int32_t window[4]       = { 0, 0, 0, 0 };
+    int32_t samplesPerPixel = 0; // INT_MAX for time limited renders
+    int32_t sampleRange[2]  = { -1, -1 };
+    int32_t samplesTaken    = 0;
+    int32_t nextSample      = 0; // index of the first sample that is not in the sums yet
+    float elapsedSeconds    = 0; // render time so far, for the time limit
+    int32_t hasLuminanceSquaredSums = 0;
+};
+
+struct RenderCheckpoint
+{
+    CheckpointHeader header;
+    std::vector< glm::vec3 > sums;             // window.z * window.w radiance sums
+    std::vector< float > luminanceSquaredSums; // only for renders with a noise target
+};
+
+bool WriteCheckpoint( const std::string& filename, const RenderCheckpoint& checkpoint );
+
+bool ReadCheckpoint( const std::string& filename, RenderCheckpoint& checkpoint );
+
+// Writes checkpoints on a background thread, so the render threads only pay for copying the sums
+class CheckpointWriter
+{
+public:
+    CheckpointWriter() = default;
+    ~CheckpointWriter();
+
+    // returns false (and drops the checkpoint) if the previous one is still being written
+    bool WriteAsync( const std::string& filename, RenderCheckpoint&& checkpoint );
+
+    // waits for the pending write. Returns if it succeeded
+    bool Wait();
+
+private:
+    std::future< bool > m_pendingWrite;
+};
+
+// While a checkpointed render is running SIGTERM / SIGINT only set a flag, so that it can flush a final checkpoint
+// and exit cleanly instead of losing the render. The scope clears the flag when it starts, and puts the previous
+// handlers back when it ends, so the signals stop the process again outside of the render
+class TerminationHandlerScope
+{
+public:
+    TerminationHandlerScope();
+    ~TerminationHandlerScope();
+
+    TerminationHandlerScope( const TerminationHandlerScope& ) = delete;
+    TerminationHandlerScope& operator=( const TerminationHandlerScope& ) = delete;
+};
+
+bool TerminationRequested();
+
+} // namespace PT
@@ -0,0 +1,98 @@
+#include "cost_heatmap.hpp"
+#include "core_defines.hpp"
+#include "utils/logger.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace PT
+{
+
+void CostHeatmaps::Init( int width, int height )
+{
+    m_costs = Image( width, height );
+}
+
+void CostHeatmaps::AddPixel( int row, int col, uint64_t cycles, uint64_t nodesVisited, uint64_t primitiveTests )
+{
+    glm::vec3 cost( static_cast< float >( cycles ), static_cast< float >( nodesVisited ), static_cast< float >( primitiveTests ) );
+    m_costs.SetPixel( row, col, m_costs.GetPixel( row, col ) + cost );
+}
+
+// black -> blue -> cyan -> green -> yellow -> red, for x in [0, 1]
+static glm::vec3 FalseColor( float x )
+{
+    static const glm::vec3 colors[] =
+    {
+        glm::vec3( 0, 0, 0 ),
+        glm::vec3( 0, 0, 1 ),
+        glm::vec3( 0, 1, 1 ),
+        glm::vec3( 0, 1, 0 ),
+        glm::vec3( 1, 1, 0 ),
+        glm::vec3( 1, 0, 0 ),
+    };
+    float scaled = glm::clamp( x, 0.0f, 1.0f ) * ( ARRAY_COUNT( colors ) - 1 );
+    int index    = std::min( static_cast< int >( scaled ), ARRAY_COUNT( colors ) - 2 );
+
+    return glm::mix( colors[index], colors[index + 1], scaled - index );
+}
+
+bool CostHeatmaps::Save( const std::string& imageFilename, TileFileHeader header ) const
+{
+    if ( IsEmpty() )
+    {
+        return false;
+    }
+
+    auto path         = fs::path( imageFilename );
+    std::string stem  = ( path.parent_path() / path.stem() ).string();
+    int numPixels     = m_costs.GetWidth() * m_costs.GetHeight();
+    float numSamples  = static_cast< float >( std::max( 1, header.numSamples ) );
+    bool success      = true;
+    const char* names[3] = { "time", "nodes", "prims" };
+    const char* units[3] = { "cycles", "nodes", "primitive tests" };
+    for ( int channel = 0; channel < 3; ++channel )
+    {
+        // scale by a high percentile instead of the max, so a handful of outliers don't make the rest of the image black
+        std::vector< float > values( numPixels );
+        for ( int i = 0; i < numPixels; ++i )
+        {
+            values[i] = m_costs.GetPixels()[i][channel] / numSamples;
+        }
+        std::vector< float > sorted = values;
+        size_t percentileIndex      = std::min< size_t >( sorted.size() - 1, sorted.size() * 99 / 100 );
+        std::nth_element( sorted.begin(), sorted.begin() + percentileIndex, sorted.end() );
+        float scale = sorted[percentileIndex];
+        if ( scale <= 0 )
+        {
+            continue;
+        }
+
+        Image heatmap( m_costs.GetWidth(), m_costs.GetHeight() );
+        for ( int i = 0; i < numPixels; ++i )
+        {
+            heatmap.GetPixels()[i] = FalseColor( values[i] / scale );
+        }
+        std::string filename = stem + "_cost_" + names[channel] + ".png";
+        if ( !heatmap.Save( filename ) )
+        {
+            LOG_ERR( "Could not save cost heatmap '", filename, "'" );
+            success = false;
+            continue;
+        }
+        LOG( "Saved cost heatmap '", filename, "', red = ", scale, " ", units[channel], " per sample" );
+    }
+
+    std::string filename = stem + "_cost" + TILE_FILE_EXTENSION;
+    if ( !WriteTileFile( filename, header, m_costs ) )
+    {
+        LOG_ERR( "Could not save cost tile '", filename, "'" );
+        success = false;
+    }
+
+    return success;
+}
+
+} // namespace PT
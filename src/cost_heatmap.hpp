@@ -0,0 +1,48 @@
+#pragma once
+
+#include "image.hpp"
+#include "tile_file.hpp"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#if defined( _MSC_VER )
+#include <intrin.h>
+#elif defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+namespace PT
+{
+
+// Time stamp counter on x86, which is much cheaper to read per pixel than the OS clocks. Elsewhere, nanoseconds
+inline uint64_t ReadCycleCounter()
+{
+#if defined( _MSC_VER ) || defined( __x86_64__ ) || defined( __i386__ )
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+}
+
+// Per pixel cost of a render (scene->costHeatmaps): the cycles spent on the pixel, and the BVH nodes visited and
+// primitive intersection tests of its rays (from the render stats counters, so those need RENDER_STATS)
+class CostHeatmaps
+{
+public:
+    void Init( int width, int height );
+
+    // the counts are summed over all of the samples of the pixel. Each pixel is only written by one thread at a time
+    void AddPixel( int row, int col, uint64_t cycles, uint64_t nodesVisited, uint64_t primitiveTests );
+
+    // Writes the per sample averages next to the image: a false color png per metric (<stem>_cost_time.png,
+    // <stem>_cost_nodes.png, <stem>_cost_prims.png), scaled so the 99th percentile is the hottest color, and the
+    // raw sums as a tile file (<stem>_cost.pttile, r = cycles, g = nodes, b = primitive tests, header.numSamples set)
+    bool Save( const std::string& imageFilename, TileFileHeader header ) const;
+
+    bool IsEmpty() const { return m_costs.GetPixels() == nullptr; }
+
+private:
+    Image m_costs; // r = cycles, g = nodes visited, b = primitive tests
+};
+
+} // namespace PT
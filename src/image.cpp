@@ -1,6 +1,7 @@
 #include "image.hpp"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image/stb_image_write.h"
+#include "utils/trace.hpp"
 #include <iostream>
 
 namespace PT
@@ -42,6 +43,7 @@ namespace PT
 
     bool Image::Save( const std::string& filename ) const
     {
+        TRACE_ZONE_DETAIL( "Image::Save", filename );
         std::string ext;
         size_t i = filename.length();
         while ( filename[--i] != '.' && i >= 0 );
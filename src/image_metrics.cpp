@@ -0,0 +1,281 @@
+#include "image_metrics.hpp"
+#include "assert.hpp"
+#include "glm/gtc/constants.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace PT
+{
+
+float RMSE( const Image& test, const Image& reference )
+{
+    assert( test.GetWidth() == reference.GetWidth() && test.GetHeight() == reference.GetHeight() );
+    size_t numPixels = static_cast< size_t >( test.GetWidth() ) * test.GetHeight();
+    double sum       = 0;
+    for ( size_t i = 0; i < numPixels; ++i )
+    {
+        glm::vec3 d = test.GetPixels()[i] - reference.GetPixels()[i];
+        sum        += glm::dot( d, d );
+    }
+
+    return static_cast< float >( std::sqrt( sum / ( 3 * numPixels ) ) );
+}
+
+float RelMSE( const Image& test, const Image& reference )
+{
+    assert( test.GetWidth() == reference.GetWidth() && test.GetHeight() == reference.GetHeight() );
+    size_t numPixels = static_cast< size_t >( test.GetWidth() ) * test.GetHeight();
+    double sum       = 0;
+    for ( size_t i = 0; i < numPixels; ++i )
+    {
+        glm::vec3 d   = test.GetPixels()[i] - reference.GetPixels()[i];
+        glm::vec3 ref = reference.GetPixels()[i];
+        glm::vec3 rel = d * d / ( ref * ref + glm::vec3( 0.01f ) );
+        sum          += rel.x + rel.y + rel.z;
+    }
+
+    return static_cast< float >( sum / ( 3 * numPixels ) );
+}
+
+// FLIP constants from the paper. Colors are converted with the sRGB primaries and D65 white point
+namespace
+{
+    const glm::mat3 RGB_TO_XYZ = glm::transpose( glm::mat3(
+        0.4124564f, 0.3575761f, 0.1804375f,
+        0.2126729f, 0.7151522f, 0.0721750f,
+        0.0193339f, 0.1191920f, 0.9503041f ) );
+    const glm::mat3 XYZ_TO_RGB = glm::inverse( RGB_TO_XYZ );
+    const glm::vec3 WHITE_XYZ  = RGB_TO_XYZ * glm::vec3( 1 );
+
+    const float FLIP_QC = 0.7f;   // color difference exponent
+    const float FLIP_PC = 0.4f;   // color difference breakpoint, relative to the maximum
+    const float FLIP_PT = 0.95f;  // error at the breakpoint
+    const float FLIP_QF = 0.5f;   // feature difference exponent
+    const float FLIP_FEATURE_WIDTH = 0.082f; // degrees
+
+    // sum of gaussians in the spatial domain, of the contrast sensitivity functions of the Y, Cx and Cz channels
+    struct CSFParams
+    {
+        float a1, b1, a2, b2;
+    };
+    const CSFParams CSF_PARAMS[3] =
+    {
+        { 1.0f,  0.0047f, 0.0f,  1e-5f },
+        { 1.0f,  0.0053f, 0.0f,  1e-5f },
+        { 34.1f, 0.04f,   13.5f, 0.025f },
+    };
+} // namespace
+
+static float SRGBToLinear( float c )
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow( ( c + 0.055f ) / 1.055f, 2.4f );
+}
+
+static glm::vec3 XYZToYCxCz( const glm::vec3& xyz )
+{
+    glm::vec3 n = xyz / WHITE_XYZ;
+    return glm::vec3( 116 * n.y - 16, 500 * ( n.x - n.y ), 200 * ( n.y - n.z ) );
+}
+
+static glm::vec3 YCxCzToXYZ( const glm::vec3& ycxcz )
+{
+    float y = ( ycxcz.x + 16 ) / 116;
+    return glm::vec3( ycxcz.y / 500 + y, y, y - ycxcz.z / 200 ) * WHITE_XYZ;
+}
+
+static glm::vec3 XYZToLab( const glm::vec3& xyz )
+{
+    const float delta = 6.0f / 29.0f;
+    auto f            = [&]( float t ) { return t > delta * delta * delta ? std::cbrt( t ) : t / ( 3 * delta * delta ) + 4.0f / 29.0f; };
+    glm::vec3 n       = xyz / WHITE_XYZ;
+    return glm::vec3( 116 * f( n.y ) - 16, 500 * ( f( n.x ) - f( n.y ) ), 200 * ( f( n.y ) - f( n.z ) ) );
+}
+
+// Hunt effect: colors look less saturated at low luminance
+static glm::vec3 Hunt( const glm::vec3& lab )
+{
+    return glm::vec3( lab.x, 0.01f * lab.x * lab.y, 0.01f * lab.x * lab.z );
+}
+
+static float HyAB( const glm::vec3& a, const glm::vec3& b )
+{
+    glm::vec3 d = a - b;
+    return std::abs( d.x ) + std::sqrt( d.y * d.y + d.z * d.z );
+}
+
+static glm::vec3 LinearRGBToHuntLab( const glm::vec3& rgb )
+{
+    return Hunt( XYZToLab( RGB_TO_XYZ * rgb ) );
+}
+
+// 2D convolution with clamp to edge addressing. kernel is ( 2 * radius + 1 )^2, row major
+template < typename T >
+static std::vector< T > Convolve( const std::vector< T >& src, int width, int height, const std::vector< float >& kernel, int radius )
+{
+    std::vector< T > dst( src.size() );
+    int kernelWidth = 2 * radius + 1;
+    #pragma omp parallel for
+    for ( int row = 0; row < height; ++row )
+    {
+        for ( int col = 0; col < width; ++col )
+        {
+            T sum( 0 );
+            for ( int ky = -radius; ky <= radius; ++ky )
+            {
+                int r = std::clamp( row + ky, 0, height - 1 );
+                for ( int kx = -radius; kx <= radius; ++kx )
+                {
+                    int c = std::clamp( col + kx, 0, width - 1 );
+                    sum  += kernel[( ky + radius ) * kernelWidth + kx + radius] * src[r * width + c];
+                }
+            }
+            dst[row * width + col] = sum;
+        }
+    }
+
+    return dst;
+}
+
+// feature detection kernels from the derivatives of a gaussian, with the positive and negative weights each
+// normalized to sum up to 1, so that flat regions give 0
+static std::vector< float > FeatureKernel( int radius, float sigma, bool secondDerivative, bool transpose )
+{
+    int kernelWidth = 2 * radius + 1;
+    std::vector< float > kernel( kernelWidth * kernelWidth );
+    float positiveSum = 0, negativeSum = 0;
+    for ( int y = -radius; y <= radius; ++y )
+    {
+        for ( int x = -radius; x <= radius; ++x )
+        {
+            float d   = static_cast< float >( transpose ? y : x );
+            float g   = std::exp( -( x * x + y * y ) / ( 2 * sigma * sigma ) );
+            float w   = secondDerivative ? ( d * d / ( sigma * sigma ) - 1 ) * g : -d * g;
+            kernel[( y + radius ) * kernelWidth + x + radius] = w;
+            ( w > 0 ? positiveSum : negativeSum ) += w;
+        }
+    }
+    for ( float& w : kernel )
+    {
+        w /= w > 0 ? positiveSum : -negativeSum;
+    }
+
+    return kernel;
+}
+
+float FLIP( const Image& test, const Image& reference, float pixelsPerDegree )
+{
+    assert( test.GetWidth() == reference.GetWidth() && test.GetHeight() == reference.GetHeight() );
+    int width  = test.GetWidth();
+    int height = test.GetHeight();
+    size_t numPixels = static_cast< size_t >( width ) * height;
+
+    // contrast sensitivity filter kernel of each opponent channel, with the radius of the widest one
+    float maxB = 0;
+    for ( const CSFParams& p : CSF_PARAMS )
+    {
+        maxB = std::max( { maxB, p.b1, p.b2 } );
+    }
+    int csfRadius = static_cast< int >( std::ceil( 3 * std::sqrt( maxB / ( 2 * glm::pi< float >() * glm::pi< float >() ) ) * pixelsPerDegree ) );
+    std::vector< float > csfKernels[3];
+    for ( int channel = 0; channel < 3; ++channel )
+    {
+        const CSFParams& p = CSF_PARAMS[channel];
+        const float pi     = glm::pi< float >();
+        float sum          = 0;
+        for ( int y = -csfRadius; y <= csfRadius; ++y )
+        {
+            for ( int x = -csfRadius; x <= csfRadius; ++x )
+            {
+                float d2 = ( x * x + y * y ) / ( pixelsPerDegree * pixelsPerDegree );
+                float g  = p.a1 * std::sqrt( pi / p.b1 ) * std::exp( -pi * pi * d2 / p.b1 ) + p.a2 * std::sqrt( pi / p.b2 ) * std::exp( -pi * pi * d2 / p.b2 );
+                csfKernels[channel].push_back( g );
+                sum += g;
+            }
+        }
+        for ( float& w : csfKernels[channel] )
+        {
+            w /= sum;
+        }
+    }
+
+    float featureSigma  = 0.5f * FLIP_FEATURE_WIDTH * pixelsPerDegree;
+    int featureRadius   = static_cast< int >( std::ceil( 3 * featureSigma ) );
+    auto edgeKernelX    = FeatureKernel( featureRadius, featureSigma, false, false );
+    auto edgeKernelY    = FeatureKernel( featureRadius, featureSigma, false, true );
+    auto pointKernelX   = FeatureKernel( featureRadius, featureSigma, true, false );
+    auto pointKernelY   = FeatureKernel( featureRadius, featureSigma, true, true );
+
+    // filtered Hunt adjusted L*a*b, and the edge and point feature magnitudes of each image
+    std::vector< glm::vec3 > lab[2];
+    std::vector< glm::vec2 > features[2];
+    const Image* images[2] = { &test, &reference };
+    for ( int imageIndex = 0; imageIndex < 2; ++imageIndex )
+    {
+        std::vector< float > channels[3];
+        std::vector< float > achromatic( numPixels );
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            channels[channel].resize( numPixels );
+        }
+        for ( size_t i = 0; i < numPixels; ++i )
+        {
+            glm::vec3 srgb = glm::clamp( images[imageIndex]->GetPixels()[i], glm::vec3( 0 ), glm::vec3( 1 ) );
+            glm::vec3 rgb( SRGBToLinear( srgb.x ), SRGBToLinear( srgb.y ), SRGBToLinear( srgb.z ) );
+            glm::vec3 ycxcz = XYZToYCxCz( RGB_TO_XYZ * rgb );
+            for ( int channel = 0; channel < 3; ++channel )
+            {
+                channels[channel][i] = ycxcz[channel];
+            }
+            achromatic[i] = ( ycxcz.x + 16 ) / 116;
+        }
+
+        std::vector< float > filtered[3];
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            filtered[channel] = Convolve( channels[channel], width, height, csfKernels[channel], csfRadius );
+        }
+        lab[imageIndex].resize( numPixels );
+        for ( size_t i = 0; i < numPixels; ++i )
+        {
+            glm::vec3 ycxcz( filtered[0][i], filtered[1][i], filtered[2][i] );
+            glm::vec3 rgb = glm::clamp( XYZ_TO_RGB * YCxCzToXYZ( ycxcz ), glm::vec3( 0 ), glm::vec3( 1 ) );
+            lab[imageIndex][i] = LinearRGBToHuntLab( rgb );
+        }
+
+        auto edgeX  = Convolve( achromatic, width, height, edgeKernelX, featureRadius );
+        auto edgeY  = Convolve( achromatic, width, height, edgeKernelY, featureRadius );
+        auto pointX = Convolve( achromatic, width, height, pointKernelX, featureRadius );
+        auto pointY = Convolve( achromatic, width, height, pointKernelY, featureRadius );
+        features[imageIndex].resize( numPixels );
+        for ( size_t i = 0; i < numPixels; ++i )
+        {
+            features[imageIndex][i] = glm::vec2( std::hypot( edgeX[i], edgeY[i] ), std::hypot( pointX[i], pointY[i] ) );
+        }
+    }
+
+    // the largest color difference: between pure green and pure blue
+    float maxColorDiff = std::pow( HyAB( LinearRGBToHuntLab( glm::vec3( 0, 1, 0 ) ), LinearRGBToHuntLab( glm::vec3( 0, 0, 1 ) ) ), FLIP_QC );
+    float breakpoint   = FLIP_PC * maxColorDiff;
+    double errorSum    = 0;
+    for ( size_t i = 0; i < numPixels; ++i )
+    {
+        float colorDiff = std::pow( HyAB( lab[0][i], lab[1][i] ), FLIP_QC );
+        float colorError;
+        if ( colorDiff < breakpoint )
+        {
+            colorError = FLIP_PT / breakpoint * colorDiff;
+        }
+        else
+        {
+            colorError = FLIP_PT + ( colorDiff - breakpoint ) / ( maxColorDiff - breakpoint ) * ( 1 - FLIP_PT );
+        }
+        glm::vec2 featureDiff = glm::abs( features[0][i] - features[1][i] );
+        float featureError    = std::pow( std::max( featureDiff.x, featureDiff.y ) / std::sqrt( 2.0f ), FLIP_QF );
+        errorSum             += std::pow( colorError, 1 - featureError );
+    }
+
+    return static_cast< float >( errorSum / numPixels );
+}
+
+} // namespace PT
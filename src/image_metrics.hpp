@@ -0,0 +1,24 @@
+#pragma once
+
+#include "image.hpp"
+
+namespace PT
+{
+
+// Error metrics between a test image and a reference of the same size
+
+// root mean squared error of the linear HDR pixels, over all channels
+float RMSE( const Image& test, const Image& reference );
+
+// mean of ( test - ref )^2 / ( ref^2 + 0.01 ) of the linear HDR pixels, over all channels. Unlike the RMSE, dark
+// and bright regions count equally, which is what matters for the noise of a Monte Carlo render
+float RelMSE( const Image& test, const Image& reference );
+
+// Mean FLIP error (Andersson et al. 2020, "FLIP: A Difference Evaluator for Alternating Images") of the LDR
+// images, so both have to be tonemapped and gamma corrected to [0, 1] already. It models how visible the
+// differences are to a viewer at pixelsPerDegree (67 == a 0.7m wide 4K monitor at 0.7m distance), combining a
+// perceptual color difference after contrast sensitivity filtering with the differences of edges and points.
+// 0 == identical, 1 == maximum error
+float FLIP( const Image& test, const Image& reference, float pixelsPerDegree = 67.0f );
+
+} // namespace PT
@@ -16,6 +16,8 @@ struct IntersectionData
     glm::vec3 wo;
     Material* material;
     float t = FLT_MAX;
+    float uvAreaRatio = 0; // uv space area / world space area of the hit surface, 0 == unknown
+    float uvFootprint = 0; // width of the ray cone at the hit in uv units, for picking the texture mip level
 };
 
 namespace intersect
@@ -1,10 +1,26 @@
 #include "lights.hpp"
+#include "resource/skybox.hpp"
+#include "sampling.hpp"
 #include "scene.hpp"
 #include "shapes.hpp"
+#include "utils/random.hpp"
 
 namespace PT
 {
 
+static void CoordinateSystem( const glm::vec3& n, glm::vec3& t, glm::vec3& b )
+{
+    if ( std::abs( n.x ) > std::abs( n.y ) )
+    {
+        t = glm::vec3( -n.z, 0, n.x ) / std::sqrt( n.x * n.x + n.z * n.z );
+    }
+    else
+    {
+        t = glm::vec3( 0, n.z, -n.y ) / std::sqrt( n.y * n.y + n.z * n.z );
+    }
+    b = glm::cross( n, t );
+}
+
 glm::vec3 PointLight::Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const
 {
     wi  = glm::normalize( position - it.p );
@@ -22,6 +38,12 @@ glm::vec3 PointLight::Sample_Li( const Interaction& it, glm::vec3& wi, float& pd
     return Lemit / (distToLight*distToLight);
 }
 
+glm::vec3 PointLight::Sample_Le( Ray& ray, Scene* scene ) const
+{
+    ray = Ray( position, UniformSampleSphere( Random::Rand(), Random::Rand() ) );
+    return 4 * static_cast< float >( M_PI ) * Lemit;
+}
+
 glm::vec3 DirectionalLight::Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const
 {
     wi  = -direction;
@@ -37,6 +59,20 @@ glm::vec3 DirectionalLight::Sample_Li( const Interaction& it, glm::vec3& wi, flo
     return Lemit;
 }
 
+glm::vec3 DirectionalLight::Sample_Le( Ray& ray, Scene* scene ) const
+{
+    // emit from a disk the size of the scene's bounding sphere, placed just outside of it
+    AABB sceneAABB   = scene->bvh.GetAABB();
+    glm::vec3 center = sceneAABB.Centroid();
+    float radius     = glm::length( sceneAABB.max - center );
+    glm::vec3 t, b;
+    CoordinateSystem( direction, t, b );
+    glm::vec2 disk = ConcentricSampleDisk( Random::Rand(), Random::Rand(), radius );
+    ray            = Ray( center - radius * direction + disk.x * t + disk.y * b, direction );
+
+    return static_cast< float >( M_PI ) * radius * radius * Lemit;
+}
+
 glm::vec3 AreaLight::Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const
 {
     SurfaceInfo surfInfo = shape->SampleWithRespectToSolidAngle( it );
@@ -54,4 +90,101 @@ glm::vec3 AreaLight::Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf
     return glm::dot( -wi, surfInfo.normal ) > 0 ? Lemit : glm::vec3( 0 );
 }
 
+glm::vec3 AreaLight::Sample_Le( Ray& ray, Scene* scene ) const
+{
+    SurfaceInfo surfInfo = shape->SampleWithRespectToArea();
+    glm::vec3 t, b;
+    CoordinateSystem( surfInfo.normal, t, b );
+    glm::vec3 localDir = CosineSampleHemisphere( Random::Rand(), Random::Rand() );
+    ray                = Ray( surfInfo.position, localDir.x * t + localDir.y * b + localDir.z * surfInfo.normal );
+
+    return static_cast< float >( M_PI ) * shape->Area() * Lemit;
+}
+
+// A texel covers ( 2 / width ) * ( 2 / height ) of its face of the [-1, 1]^3 cube. Seen from the center, an area dA at
+// point d on the cube subtends dA / |d|^3 steradians, which is how the pdfs are converted to solid angle
+bool EnvironmentLight::Init( std::shared_ptr< Skybox > sky )
+{
+    skybox     = sky;
+    int width  = skybox->GetWidth();
+    int height = skybox->GetHeight();
+    std::vector< float > weights( 6 * width * height );
+    for ( int face = 0; face < 6; ++face )
+    {
+        for ( int r = 0; r < height; ++r )
+        {
+            for ( int c = 0; c < width; ++c )
+            {
+                glm::vec3 d      = Skybox::FaceDirection( face, glm::vec2( ( c + 0.5f ) / width, ( r + 0.5f ) / height ) );
+                float lengthSq   = glm::dot( d, d );
+                float solidAngle = 4.0f / ( width * height * lengthSq * std::sqrt( lengthSq ) );
+                float luminance  = std::max( 0.0f, Luminance( skybox->GetPixel( face, r, c ) ) );
+                weights[( face * height + r ) * width + c] = luminance * solidAngle;
+            }
+        }
+    }
+
+    return texels.Build( weights );
+}
+
+glm::vec3 EnvironmentLight::SampleDirection( int& texel, float& pdf ) const
+{
+    int width  = skybox->GetWidth();
+    int height = skybox->GetHeight();
+    texel      = texels.Sample( Random::Rand(), Random::Rand() );
+    int face   = texel / ( width * height );
+    int r      = ( texel / width ) % height;
+    int c      = texel % width;
+
+    glm::vec2 uv( ( c + Random::Rand() ) / width, ( r + Random::Rand() ) / height );
+    glm::vec3 d    = Skybox::FaceDirection( face, uv );
+    float lengthSq = glm::dot( d, d );
+    float length   = std::sqrt( lengthSq );
+    pdf            = texels.Pmf( texel ) * width * height / 4.0f * lengthSq * length;
+
+    return d / length;
+}
+
+float EnvironmentLight::Pdf( const glm::vec3& wi ) const
+{
+    int texel       = skybox->GetPixelIndex( wi );
+    glm::vec3 absWi = glm::abs( wi );
+    glm::vec3 d     = wi / std::max( absWi.x, std::max( absWi.y, absWi.z ) ); // on the cube
+    float lengthSq  = glm::dot( d, d );
+
+    return texels.Pmf( texel ) * skybox->GetWidth() * skybox->GetHeight() / 4.0f * lengthSq * std::sqrt( lengthSq );
+}
+
+glm::vec3 EnvironmentLight::Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const
+{
+    int texel;
+    wi = SampleDirection( texel, pdf );
+
+    // the paths only bounce into the hemisphere of the normal, so the sky below it can't light the surface either
+    Ray shadowRay( it.p, wi );
+    if ( glm::dot( wi, it.n ) <= 0 || scene->Occluded( shadowRay, FLT_MAX ) )
+    {
+        return glm::vec3( 0 );
+    }
+
+    return skybox->GetPixel( texel );
+}
+
+glm::vec3 EnvironmentLight::Sample_Le( Ray& ray, Scene* scene ) const
+{
+    // like a directional light coming from the sampled direction, from a disk the size of the scene's bounding sphere
+    int texel;
+    float pdf;
+    glm::vec3 wi     = SampleDirection( texel, pdf );
+    AABB sceneAABB   = scene->bvh.GetAABB();
+    glm::vec3 center = sceneAABB.Centroid();
+    float radius     = glm::length( sceneAABB.max - center );
+    glm::vec3 t, b;
+    CoordinateSystem( -wi, t, b );
+    glm::vec2 disk = ConcentricSampleDisk( Random::Rand(), Random::Rand(), radius );
+    ray            = Ray( center + radius * wi + disk.x * t + disk.y * b, -wi );
+
+    return static_cast< float >( M_PI ) * radius * radius * skybox->GetPixel( texel ) / pdf;
+}
+
 } // namespace PT
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "math.hpp"
+#include "sampling.hpp"
 #include <memory>
 
 namespace PT
@@ -24,6 +25,9 @@ struct Light
     int nSamples    = 1;
 
     virtual glm::vec3 Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const { return glm::vec3( 0 ); }
+
+    // samples a ray leaving the light (used for photon emission). Returns the flux carried by the ray
+    virtual glm::vec3 Sample_Le( Ray& ray, Scene* scene ) const { return glm::vec3( 0 ); }
 };
 
 struct PointLight : public Light
@@ -31,6 +35,7 @@ struct PointLight : public Light
     glm::vec3 position = glm::vec3( 0, 0, 0 );
 
     glm::vec3 Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const override;
+    glm::vec3 Sample_Le( Ray& ray, Scene* scene ) const override;
 };
 
 struct DirectionalLight : public Light
@@ -38,6 +43,7 @@ struct DirectionalLight : public Light
     glm::vec3 direction = glm::vec3( 0, -1, 0 );
 
     glm::vec3 Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const override;
+    glm::vec3 Sample_Le( Ray& ray, Scene* scene ) const override;
 };
 
 struct Shape;
@@ -49,6 +55,30 @@ struct AreaLight : public Light
     std::shared_ptr< Shape > shape;
 
     glm::vec3 Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const override;
+    glm::vec3 Sample_Le( Ray& ray, Scene* scene ) const override;
+};
+
+struct Skybox;
+// Created by the scene when it has a Skybox, so that the sky is sampled by the direct lighting instead of only
+// being found by paths that escape. The cubemap texels are picked proportional to their luminance times the
+// solid angle they cover, then a direction is picked uniformly on the texel's face area
+struct EnvironmentLight : public Light
+{
+    // false if the skybox is black everywhere
+    bool Init( std::shared_ptr< Skybox > skybox );
+
+    glm::vec3 Sample_Li( const Interaction& it, glm::vec3& wi, float& pdf, Scene* scene ) const override;
+    glm::vec3 Sample_Le( Ray& ray, Scene* scene ) const override;
+
+    // pdf with respect to solid angle of Sample_Li picking the (normalized) direction wi
+    float Pdf( const glm::vec3& wi ) const;
+
+    std::shared_ptr< Skybox > skybox;
+    AliasTable texels; // face * width * height + row * width + column, like the skybox pixels
+
+private:
+    // a direction towards the sky (normalized), its texel, and its pdf with respect to solid angle
+    glm::vec3 SampleDirection( int& texel, float& pdf ) const;
 };
 
 } // namespace PT
@@ -1,24 +1,379 @@
+#include "bvh_quality.hpp"
+#include "checkpoint.hpp"
 #include "configuration.hpp"
 #include "utils/logger.hpp"
 #include "path_tracer.hpp"
+#include "render_coordinator.hpp"
+#include "render_server.hpp"
 #include "resource/resource_manager.hpp"
+#include "tile_file.hpp"
+#include "tonemap.hpp"
+#include "utils/trace.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <filesystem>
+#include <future>
 #include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace PT;
 namespace fs = std::filesystem;
 
+static void PrintUsage()
+{
+    std::cout << "Usage: pathTracer SCENE_FILE [options]" << std::endl;
+    std::cout << "       pathTracer --serve [SOCKET_PATH] [--cacheSize N] [--threads N]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --crop X Y WIDTH HEIGHT  Only render the given window of the image, into a raw HDR tile file" << std::endl;
+    std::cout << "  --tileSize SIZE          Size of the tiles used by --tiles (default 64)" << std::endl;
+    std::cout << "  --tiles FIRST LAST       Only render tiles FIRST to LAST (inclusive, numbered row by row), one tile file each" << std::endl;
+    std::cout << "  --shots FILE             Render every shot (camera, resolution, SPP, output overrides) of FILE with the loaded scene" << std::endl;
+    std::cout << "  --frames FIRST LAST      Only render frames FIRST to LAST (inclusive) of the scene's CameraPath" << std::endl;
+    std::cout << "  --workers N              Split the samples among N local worker processes (see render_coordinator.hpp)" << std::endl;
+    std::cout << "  --worker DIR NAME        Render sample chunks from the work directory of a coordinator (can run on another host)" << std::endl;
+    std::cout << "  --threads N              Number of render threads" << std::endl;
+    std::cout << "  --heartbeatTimeout SEC   Seconds without a heartbeat before a worker's chunks are reassigned (default 30)" << std::endl;
+    std::cout << "  --checkpoint SEC         Save the render state every SEC seconds, and on SIGTERM / SIGINT" << std::endl;
+    std::cout << "  --resume                 Continue from the checkpoint of a previous, interrupted render" << std::endl;
+    std::cout << "  --compareBVH             Build the BVH with every split method, print their build times and quality, and exit" << std::endl;
+    std::cout << "  --costHeatmaps           Also write the per pixel time, BVH nodes and primitive tests as heatmaps next to the image" << std::endl;
+    std::cout << "  --trace FILE             Record a timeline of the loading and rendering into FILE (Chrome trace JSON)" << std::endl;
+    std::cout << "Server options (see render_server.hpp):" << std::endl;
+    std::cout << "  SOCKET_PATH              Listen on a Unix domain socket instead of reading requests from stdin" << std::endl;
+    std::cout << "  --cacheSize N            Number of loaded scenes kept in memory (default 4)" << std::endl;
+}
+
+static bool ParseServerCommandLine( int argc, char** argv, ServerSettings& settings, int& numThreads )
+{
+    for ( int i = 2; i < argc; ++i )
+    {
+        if ( !strcmp( argv[i], "--cacheSize" ) && i + 1 < argc )
+        {
+            settings.maxCachedScenes = std::max( 1, atoi( argv[i + 1] ) );
+            ++i;
+        }
+        else if ( !strcmp( argv[i], "--threads" ) && i + 1 < argc )
+        {
+            numThreads = std::max( 1, atoi( argv[i + 1] ) );
+            ++i;
+        }
+        else if ( argv[i][0] != '-' && settings.socketPath.empty() )
+        {
+            settings.socketPath = argv[i];
+        }
+        else
+        {
+            LOG_ERR( "Unknown or incomplete option '", argv[i], "'" );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct CommandLineOptions
+{
+    CoordinatorSettings coordinator;
+    std::string shotsFilename; // non-empty == batch mode
+    glm::ivec2 frameRange = glm::ivec2( 0, INT_MAX );
+    std::string workDir;       // non-empty == run as a worker
+    std::string workerName;
+    int numThreads = 0;        // 0 == OpenMP default
+    bool compareBVH = false;
+};
+
+// Options given on the command line override the ones in the scene file
+static bool ParseCommandLine( int argc, char** argv, Scene& scene, CommandLineOptions& options )
+{
+    for ( int i = 2; i < argc; ++i )
+    {
+        auto HasArgs = [&]( int count ) { return i + count < argc; };
+        if ( !strcmp( argv[i], "--crop" ) && HasArgs( 4 ) )
+        {
+            scene.cropWindow = glm::ivec4( atoi( argv[i + 1] ), atoi( argv[i + 2] ), atoi( argv[i + 3] ), atoi( argv[i + 4] ) );
+            i += 4;
+        }
+        else if ( !strcmp( argv[i], "--tileSize" ) && HasArgs( 1 ) )
+        {
+            scene.tileSize = std::max( 1, atoi( argv[i + 1] ) );
+            i += 1;
+        }
+        else if ( !strcmp( argv[i], "--tiles" ) && HasArgs( 2 ) )
+        {
+            scene.tileRange = glm::ivec2( atoi( argv[i + 1] ), atoi( argv[i + 2] ) );
+            i += 2;
+        }
+        else if ( !strcmp( argv[i], "--shots" ) && HasArgs( 1 ) )
+        {
+            options.shotsFilename = argv[i + 1];
+            i += 1;
+        }
+        else if ( !strcmp( argv[i], "--frames" ) && HasArgs( 2 ) )
+        {
+            options.frameRange = glm::ivec2( atoi( argv[i + 1] ), atoi( argv[i + 2] ) );
+            i += 2;
+        }
+        else if ( !strcmp( argv[i], "--workers" ) && HasArgs( 1 ) )
+        {
+            options.coordinator.numWorkers = std::max( 0, atoi( argv[i + 1] ) );
+            i += 1;
+        }
+        else if ( !strcmp( argv[i], "--worker" ) && HasArgs( 2 ) )
+        {
+            options.workDir    = argv[i + 1];
+            options.workerName = argv[i + 2];
+            i += 2;
+        }
+        else if ( !strcmp( argv[i], "--threads" ) && HasArgs( 1 ) )
+        {
+            options.numThreads                   = std::max( 1, atoi( argv[i + 1] ) );
+            options.coordinator.threadsPerWorker = options.numThreads;
+            i += 1;
+        }
+        else if ( !strcmp( argv[i], "--checkpoint" ) && HasArgs( 1 ) )
+        {
+            scene.checkpointIntervalSeconds = static_cast< float >( atof( argv[i + 1] ) );
+            i += 1;
+        }
+        else if ( !strcmp( argv[i], "--resume" ) )
+        {
+            scene.resumeFromCheckpoint = true;
+        }
+        else if ( !strcmp( argv[i], "--compareBVH" ) )
+        {
+            options.compareBVH = true;
+        }
+        else if ( !strcmp( argv[i], "--costHeatmaps" ) )
+        {
+            scene.costHeatmaps = true;
+        }
+        else if ( !strcmp( argv[i], "--trace" ) && HasArgs( 1 ) )
+        {
+            // already handled by GetTraceFilename
+            i += 1;
+        }
+        else if ( !strcmp( argv[i], "--heartbeatTimeout" ) && HasArgs( 1 ) )
+        {
+            options.coordinator.heartbeatTimeoutSeconds = static_cast< float >( atof( argv[i + 1] ) );
+            i += 1;
+        }
+        else
+        {
+            LOG_ERR( "Unknown or incomplete option '", argv[i], "'" );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The trace has to start before the scene is loaded, which is before the rest of the options are parsed
+static std::string GetTraceFilename( int argc, char** argv )
+{
+    for ( int i = 2; i + 1 < argc; ++i )
+    {
+        if ( !strcmp( argv[i], "--trace" ) )
+        {
+            return argv[i + 1];
+        }
+    }
+
+    return "";
+}
+
+// The command line that starts a worker: the scene and every option that changes how it renders, so the workers
+// render with the coordinator's settings. Without the coordinator's own options, RunCoordinator adds the worker
+// specific --worker and --threads
+static std::string GetWorkerCommand( int argc, char** argv )
+{
+    static const std::pair< const char*, int > s_coordinatorOptions[] = { { "--workers", 1 }, { "--worker", 2 }, { "--threads", 1 }, { "--heartbeatTimeout", 1 } };
+    std::string command = std::string( "\"" ) + argv[0] + "\" \"" + argv[1] + "\"";
+    for ( int i = 2; i < argc; ++i )
+    {
+        auto it = std::find_if( std::begin( s_coordinatorOptions ), std::end( s_coordinatorOptions ),
+            [&]( const std::pair< const char*, int >& option ) { return !strcmp( argv[i], option.first ); } );
+        if ( it != std::end( s_coordinatorOptions ) )
+        {
+            i += it->second;
+            continue;
+        }
+        command += std::string( " \"" ) + argv[i] + "\"";
+    }
+
+    return command;
+}
+
+static void EndTrace( const std::string& traceFilename )
+{
+    if ( !traceFilename.empty() )
+    {
+        Trace::EndSession( traceFilename );
+    }
+}
+
+// The windows of the image that should be rendered: either all of the tiles in the tile range, the crop window, or the full image
+static std::vector< glm::ivec4 > GetRenderWindows( const Scene& scene )
+{
+    if ( scene.tileRange.x < 0 )
+    {
+        return { scene.GetRenderWindow() };
+    }
+
+    std::vector< glm::ivec4 > windows;
+    int tilesX   = (scene.imageResolution.x + scene.tileSize - 1) / scene.tileSize;
+    int tilesY   = (scene.imageResolution.y + scene.tileSize - 1) / scene.tileSize;
+    int lastTile = std::min( scene.tileRange.y, tilesX * tilesY - 1 );
+    for ( int tile = scene.tileRange.x; tile <= lastTile; ++tile )
+    {
+        int x = (tile % tilesX) * scene.tileSize;
+        int y = (tile / tilesX) * scene.tileSize;
+        windows.emplace_back( x, y, std::min( scene.tileSize, scene.imageResolution.x - x ), std::min( scene.tileSize, scene.imageResolution.y - y ) );
+    }
+
+    return windows;
+}
+
+// Keeps at most one image write in flight, so that the encoding of one render overlaps the next one
+class PendingImageSave
+{
+public:
+    void Start( std::future< bool >&& save, const std::string& filename )
+    {
+        Finish();
+        m_save     = std::move( save );
+        m_filename = filename;
+    }
+
+    void Finish()
+    {
+        if ( m_save.valid() && !m_save.get() )
+        {
+            LOG_ERR( "Could not save image '", m_filename, "'" );
+        }
+    }
+
+private:
+    std::future< bool > m_save;
+    std::string m_filename;
+};
+
+// Renders all of the SPP entries of the scene's current shot. Returns false if the render was interrupted, or if a
+// distributed render failed
+static bool RenderShot( Scene& scene, PathTracer& pathTracer, const CommandLineOptions& options, const std::string& workerCommand, PendingImageSave& pendingSave )
+{
+    // Crops and tiles are written as raw HDR tile files, to be assembled later by ptMergeTiles
+    std::vector< glm::ivec4 > windows = GetRenderWindows( scene );
+    bool writeTiles = scene.tileRange.x >= 0 || windows[0] != glm::ivec4( 0, 0, scene.imageResolution );
+
+    bool useCoordinator = options.coordinator.numWorkers > 0;
+    int numRenderings = scene.HasRenderLimits() ? 1 : (int)scene.numSamplesPerPixel.size();
+    for ( int sppIteration = 0; sppIteration < numRenderings; ++sppIteration )
+    {
+        // if there are multiple renderings, tack on the suffix "_[spp]" to the filename"
+        auto path        = fs::path( scene.outputImageFilename );
+        std::string stem = path.stem().string();
+        if ( numRenderings > 1 )
+        {
+            stem += "_" + std::to_string( scene.numSamplesPerPixel[sppIteration] );
+        }
+
+        if ( useCoordinator )
+        {
+            std::string workDir = ( path.parent_path() / ( stem + ".work" ) ).string();
+            std::string filename = ( path.parent_path() / ( stem + path.extension().string() ) ).string();
+            TileFileHeader header;
+            Image image;
+            if ( !RunCoordinator( scene, sppIteration, options.coordinator, workDir, workerCommand, header, image ) )
+            {
+                LOG_ERR( "Distributed render failed, work directory '", workDir, "' is left for inspection" );
+                return false;
+            }
+            TonemapImage( image, header.exposure, header.gamma );
+            if ( !image.Save( filename ) )
+            {
+                LOG_ERR( "Could not save image '", filename, "'" );
+                return false;
+            }
+            continue;
+        }
+
+        for ( const glm::ivec4& window : windows )
+        {
+            std::string windowStem = stem;
+            if ( writeTiles )
+            {
+                windowStem += "_" + std::to_string( window.x ) + "_" + std::to_string( window.y );
+            }
+            scene.cropWindow         = window;
+            scene.checkpointFilename = ( path.parent_path() / ( windowStem + CHECKPOINT_FILE_EXTENSION ) ).string();
+            if ( !pathTracer.Render( &scene, sppIteration ) )
+            {
+                return false;
+            }
+
+            if ( writeTiles )
+            {
+                std::string filename = ( path.parent_path() / ( windowStem + TILE_FILE_EXTENSION ) ).string();
+                if ( !pathTracer.SaveTile( filename ) )
+                {
+                    LOG_ERR( "Could not save tile '", filename, "'" );
+                }
+            }
+            else
+            {
+                std::string filename = ( path.parent_path() / ( windowStem + path.extension().string() ) ).string();
+                pendingSave.Start( pathTracer.SaveImageAsync( filename ), filename );
+            }
+            if ( scene.costHeatmaps )
+            {
+                pathTracer.SaveCostHeatmaps( ( path.parent_path() / ( windowStem + path.extension().string() ) ).string() );
+            }
+        }
+    }
+
+    return true;
+}
+
 int main( int argc, char** argv )
 {
-    if ( argc != 2 )
+    if ( argc < 2 )
     {
-        std::cout << "Usage: pathTracer SCENE_FILE" << std::endl;
+        PrintUsage();
         return 0;
     }
 
     // initialize the logger
     g_Logger.Init();
 
+    if ( !strcmp( argv[1], "--serve" ) )
+    {
+        ServerSettings settings;
+        int numThreads = 0;
+        if ( !ParseServerCommandLine( argc, argv, settings, numThreads ) )
+        {
+            PrintUsage();
+            return 1;
+        }
+#ifdef _OPENMP
+        if ( numThreads > 0 )
+        {
+            omp_set_num_threads( numThreads );
+        }
+#endif
+        int exitCode = RunRenderServer( settings );
+        g_Logger.Shutdown();
+        return exitCode;
+    }
+
+    std::string traceFilename = GetTraceFilename( argc, argv );
+    if ( !traceFilename.empty() )
+    {
+        Trace::StartSession();
+    }
+
     // load the scene
     Scene scene;
     if ( !scene.Load( argv[1] ) )
@@ -26,27 +381,114 @@ int main( int argc, char** argv )
         LOG_ERR( "Could not load scene file '", argv[1], "'" );
         return 0;
     }
+    CommandLineOptions options;
+    if ( !ParseCommandLine( argc, argv, scene, options ) )
+    {
+        PrintUsage();
+        return 1;
+    }
+#ifdef _OPENMP
+    if ( options.numThreads > 0 && options.coordinator.numWorkers == 0 )
+    {
+        omp_set_num_threads( options.numThreads );
+    }
+#endif
+
+    if ( options.compareBVH )
+    {
+        CompareBVHSplitMethods( scene.bvh.shapes );
+        g_Logger.Shutdown();
+        return 0;
+    }
+
+    // workers only send back the sums of their chunks' samples, and chunks are too short lived to checkpoint
+    bool distributed = options.coordinator.numWorkers > 0 || !options.workDir.empty();
+    if ( distributed && ( scene.costHeatmaps || scene.checkpointIntervalSeconds > 0 || scene.resumeFromCheckpoint ) )
+    {
+        LOG_ERR( "--workers and --worker can not be combined with --costHeatmaps, --resume or checkpoints (--checkpoint / \"CheckpointInterval\")" );
+        return 1;
+    }
+
+    if ( !options.workDir.empty() )
+    {
+        // the workers of one coordinator all get the same --trace, so each writes its own file
+        if ( !traceFilename.empty() )
+        {
+            fs::path tracePath = traceFilename;
+            traceFilename      = ( tracePath.parent_path() / ( tracePath.stem().string() + "_" + options.workerName + tracePath.extension().string() ) ).string();
+        }
+        bool success = RunWorker( scene, options.workDir, options.workerName );
+        EndTrace( traceFilename );
+        g_Logger.Shutdown();
+        return success ? 0 : 1;
+    }
 
-    // Perform all scene.numSamplesPerPixel.size() of the renderings.
+    // Perform all scene.numSamplesPerPixel.size() of the renderings, for every shot.
     // Can specify to render the scene multiple times with different numbers of SPP using "SamplesPerPixel": [ 8, 32, etc... ]
-    for ( int sppIteration = 0; sppIteration < (int)scene.numSamplesPerPixel.size(); ++sppIteration )
+    // The same PathTracer is used for all of them so that the primary hit cache (if enabled) is only built once
+    // Time / noise limited renders ignore the SPP list and only render once
+    bool useCoordinator = options.coordinator.numWorkers > 0;
+    if ( useCoordinator && ( scene.tileRange.x >= 0 || scene.GetRenderWindow() != glm::ivec4( 0, 0, scene.imageResolution ) || scene.HasRenderLimits() ) )
     {
-        PathTracer pathTracer;
-        pathTracer.Render( &scene, sppIteration );
+        LOG_ERR( "--workers only supports full frame renders with a fixed number of samples" );
+        return 1;
+    }
+    std::string workerCommand = GetWorkerCommand( argc, argv );
 
-        // if there are multiple renderings, tack on the suffix "_[spp]" to the filename"
-        std::string filename = scene.outputImageFilename;
-        if ( scene.numSamplesPerPixel.size() > 1 )
+    // all shots render the already loaded scene (and BVH), only the camera / output settings change.
+    // A camera path is rendered as one shot per frame
+    std::vector< ShotSettings > shots;
+    if ( useCoordinator && ( !options.shotsFilename.empty() || !scene.cameraPath.Empty() ) )
+    {
+        LOG_ERR( "--workers can not be combined with --shots or a CameraPath" );
+        return 1;
+    }
+    if ( !options.shotsFilename.empty() )
+    {
+        if ( !scene.LoadShots( options.shotsFilename, shots ) )
         {
-            auto path = fs::path( filename );
-            filename  = path.stem().string() + "_" + std::to_string( scene.numSamplesPerPixel[sppIteration] ) + path.extension().string();
+            LOG_ERR( "Could not load shots file '", options.shotsFilename, "'" );
+            return 1;
         }
+    }
+    else if ( !scene.cameraPath.Empty() )
+    {
+        int firstFrame = std::max( 0, options.frameRange.x );
+        int lastFrame  = std::min( scene.cameraPath.GetNumFrames() - 1, options.frameRange.y );
+        for ( int frame = firstFrame; frame <= lastFrame; ++frame )
+        {
+            ShotSettings shot        = scene.GetShotSettings();
+            shot.outputImageFilename = GetFrameFilename( scene.outputImageFilename, frame );
+            scene.cameraPath.Evaluate( static_cast< float >( frame ), shot.camera );
+            shots.push_back( shot );
+        }
+    }
+    else
+    {
+        shots.push_back( scene.GetShotSettings() );
+    }
 
-        if ( !pathTracer.SaveImage( filename ) )
+    PathTracer pathTracer;
+    PendingImageSave pendingSave;
+    for ( size_t shot = 0; shot < shots.size(); ++shot )
+    {
+        // also undoes the crop window of the previous shot's last tile
+        scene.SetShotSettings( shots[shot] );
+        if ( shots.size() > 1 )
+        {
+            LOG( "\nShot ", shot + 1, " / ", shots.size(), ": '", scene.outputImageFilename, "'" );
+        }
+        if ( !RenderShot( scene, pathTracer, options, workerCommand, pendingSave ) )
         {
-            LOG_ERR( "Could not save image '", filename, "'" );
+            // interrupted (the checkpoint is all that is left to save) or failed
+            pendingSave.Finish();
+            EndTrace( traceFilename );
+            g_Logger.Shutdown();
+            return 1;
         }
     }
+    pendingSave.Finish();
+    EndTrace( traceFilename );
 
     g_Logger.Shutdown();
 
@@ -50,6 +50,11 @@ inline float AbsDot( const glm::vec3& v1, const glm::vec3& v2 )
     return glm::abs( glm::dot( v1, v2 ) );
 }
 
+inline float Luminance( const glm::vec3& color )
+{
+    return glm::dot( color, glm::vec3( 0.2126f, 0.7152f, 0.0722f ) );
+}
+
 namespace PT
 {
 
@@ -1,76 +1,39 @@
 #include "path_tracer.hpp"
+#include "checkpoint.hpp"
 #include "core_defines.hpp"
 #include "glm/ext.hpp"
+#include "photon_map.hpp"
+#include "render_stats.hpp"
+#include "resource/model_cache.hpp"
+#include "resource/texture_cache.hpp"
 #include "sampling.hpp"
+#include "tile_file.hpp"
 #include "tonemap.hpp"
 #include "utils/logger.hpp"
 #include "utils/random.hpp"
 #include "utils/time.hpp"
+#include "utils/trace.hpp"
 #include <algorithm>
 #include <atomic>
+#include <climits>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <optional>
+
+namespace fs = std::filesystem;
 
-#define TONEMAP_AND_GAMMA IN_USE
 #define PROGRESS_BAR_STR "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
 #define PROGRESS_BAR_WIDTH 60
 #define EPSILON 0.00001f
 
+// Spread angle (radians) of the ray cones after a diffuse bounce. The directions of a diffuse bounce cover the whole
+// hemisphere, so the texture lookups of indirect hits only need to be blurry enough to not thrash the caches
+#define DIFFUSE_CONE_SPREAD 0.1f
+
 namespace PT
 {   
 
-float Fresnel(const glm::vec3& I, const glm::vec3& N, const float &ior )
-{
-    // this happens when the material is reflective, but not refractive
-    if ( ior == 1 )
-    {
-        return 1;
-    }
-
-    float cosi = std::min( 1.0f, std::max( 1.0f, glm::dot( I, N ) ) );
-    float etai = 1, etat = ior;
-    if ( cosi > 0 )
-    {
-        std::swap(etai, etat);
-    }
-
-    float sint = etai / etat * sqrtf( std::max( 0.0f, 1 - cosi * cosi ) );
-
-    float kr;
-    if ( sint >= 1 )
-    {
-        kr = 1;
-    }
-    else
-    {
-        float cost = sqrtf( std::max( 0.0f, 1 - sint * sint ) );
-        cosi = fabsf( cosi );
-        float Rs = ((etat * cosi) - (etai * cost)) / ((etat * cosi) + (etai * cost));
-        float Rp = ((etai * cosi) - (etat * cost)) / ((etai * cosi) + (etat * cost));
-        kr = (Rs * Rs + Rp * Rp) / 2;
-    }
-
-    return kr;
-}
-
-glm::vec3 Refract(const glm::vec3& I, const glm::vec3& N, const float &ior ) 
-{ 
-    float cosi  = std::min( 1.0f, std::max( 1.0f, glm::dot( I, N ) ) );
-    float etai  = 1, etat = ior;
-    glm::vec3 n = N; 
-    if ( cosi < 0 )
-    {
-        cosi = -cosi;
-    }
-    else
-    {
-        std::swap( etai, etat );
-        n = -N;
-    } 
-    float eta = etai / etat; 
-    float k   = 1 - eta * eta * (1 - cosi * cosi); 
-    return k < 0 ? glm::vec3( 0 ) : eta * I + (eta * cosi - sqrtf( k )) * n; 
-} 
-
 glm::vec3 EstimateSingleDirect( Light* light, const IntersectionData& hitData, Scene* scene, const BRDF& brdf )
 {
     Interaction it{ hitData.position, hitData.normal };
@@ -84,7 +47,14 @@ glm::vec3 EstimateSingleDirect( Light* light, const IntersectionData& hitData, S
         return glm::vec3( 0 );
     }
 
-    return brdf.F( hitData.wo, wi ) * Li * AbsDot( hitData.normal, wi ) / lightPdf;
+    // the sky can also be found by the BRDF sampled paths (see Li), so the two are combined with MIS
+    float weight = 1;
+    if ( light == scene->environmentLight )
+    {
+        weight = PowerHeuristic( lightPdf, brdf.Pdf( hitData.wo, wi ) );
+    }
+
+    return weight * brdf.F( hitData.wo, wi ) * Li * AbsDot( hitData.normal, wi ) / lightPdf;
 }
 
 glm::vec3 LDirect( const IntersectionData& hitData, Scene* scene, const BRDF& brdf )
@@ -103,36 +73,124 @@ glm::vec3 LDirect( const IntersectionData& hitData, Scene* scene, const BRDF& br
     return L;
 }
 
-glm::vec3 Li( const Ray& ray, Scene* scene )
+// Angle between the camera rays of neighboring pixels, the initial spread of the ray cones
+static float PixelSpreadAngle( const Camera& cam, int imageHeight )
+{
+    return std::atan( 2 * std::tan( cam.vfov / 2 ) / imageHeight );
+}
+
+// Ray cone texture LOD (Akenine-Moller et al. 2019, "Texture Level of Detail Strategies for Real-Time Ray Tracing"):
+// the width of the cone where it hits the surface, stretched by the angle of incidence and converted to uv units
+static float ConeUVFootprint( const IntersectionData& hitData, const glm::vec3& rayDirection, float coneWidth )
+{
+    float cosTheta = std::max( AbsDot( hitData.normal, rayDirection ), 0.01f );
+    return coneWidth / cosTheta * std::sqrt( hitData.uvAreaRatio );
+}
+
+// if primaryHit is given, it is used instead of intersecting the scene with the initial ray.
+// pixelSpreadAngle is the initial spread of the ray cone used for the texture filtering
+glm::vec3 Li( const Ray& ray, Scene* scene, const PhotonMap* causticMap, float pixelSpreadAngle, const PrimaryHit* primaryHit = nullptr )
 {
     Ray currentRay           = ray;
     glm::vec3 L              = glm::vec3( 0 );
     glm::vec3 pathThroughput = glm::vec3( 1 );
+    bool specularBounce      = false;
+    bool diffuseVertex       = false; // whether the path went through a diffuse surface already
+    float brdfPdf            = 0; // of the direction of the last diffuse bounce
+    float coneWidth          = 0;
+    float coneSpread         = pixelSpreadAngle;
+    STATS_ADD_PATH();
     
     for ( int bounce = 0; bounce < scene->maxDepth; ++bounce )
     {
+        STATS_SET_DEPTH( bounce );
         IntersectionData hitData;
         hitData.wo = -currentRay.direction;
-        if ( !scene->Intersect( currentRay, hitData ) )
+        bool usePrimaryHit = bounce == 0 && primaryHit;
+        if ( usePrimaryHit )
+        {
+            if ( !primaryHit->material )
+            {
+                L += pathThroughput * primaryHit->albedo;
+                break;
+            }
+            hitData.position  = primaryHit->position;
+            hitData.normal    = primaryHit->normal;
+            hitData.tangent   = primaryHit->tangent;
+            hitData.bitangent = glm::cross( primaryHit->normal, primaryHit->tangent );
+            hitData.material  = primaryHit->material;
+        }
+        else if ( !scene->Intersect( currentRay, hitData ) )
         {
-            L += pathThroughput * scene->LEnvironment( currentRay );
+            // after a diffuse bounce the sky was also sampled by the direct lighting, so weight this path by MIS.
+            // Sky light reaching a diffuse vertex through specular bounces is a caustic, which the photon map holds
+            float weight = 1;
+            if ( bounce > 0 && !specularBounce && scene->environmentLight )
+            {
+                weight = PowerHeuristic( brdfPdf, scene->environmentLight->Pdf( currentRay.direction ) );
+            }
+            else if ( specularBounce && diffuseVertex && causticMap && scene->environmentLight )
+            {
+                weight = 0;
+            }
+            L += weight * pathThroughput * scene->LEnvironment( currentRay );
             break;
         }
+        float hitDistance = usePrimaryHit ? glm::length( hitData.position - currentRay.position ) : hitData.t;
+        coneWidth        += coneSpread * hitDistance;
+
+        // emitted light of current surface. Direct lighting can't be estimated through specular
+        // surfaces, so the emission has to be counted after those too, unless they lead back to a diffuse
+        // surface and the photon map has the caustic already
+        bool causticEmission = specularBounce && diffuseVertex && causticMap;
+        if ( (bounce == 0 || specularBounce) && !causticEmission && glm::dot( hitData.wo, hitData.normal ) > 0 )
+        {
+            L += pathThroughput * hitData.material->Ke;
+        }
+
+        // perfectly specular surfaces just reflect or refract the path, no direct lighting estimation
+        specularBounce = hitData.material->IsSpecular();
+        if ( specularBounce )
+        {
+            glm::vec3 weight;
+            glm::vec3 wi    = hitData.material->SampleSpecular( currentRay.direction, hitData.normal, weight );
+            pathThroughput *= weight;
+            if ( pathThroughput == glm::vec3( 0 ) )
+            {
+                break;
+            }
+            float side = glm::dot( wi, hitData.normal ) > 0 ? 1.0f : -1.0f;
+            currentRay = Ray( hitData.position + side * EPSILON * hitData.normal, wi );
+            continue;
+        }
 
         hitData.position += EPSILON * hitData.normal;
 
-        // emitted light of current surface
-        if ( bounce == 0 && glm::dot( hitData.wo, hitData.normal ) > 0 )
+        BRDF brdf;
+        if ( usePrimaryHit )
         {
-            L += pathThroughput * hitData.material->Ke;
+            brdf.Kd = primaryHit->albedo;
+            brdf.Ks = hitData.material->Ks;
+            brdf.T  = hitData.tangent;
+            brdf.B  = hitData.bitangent;
+            brdf.N  = hitData.normal;
+        }
+        else
+        {
+            hitData.uvFootprint = ConeUVFootprint( hitData, currentRay.direction, coneWidth );
+            brdf                = hitData.material->ComputeBRDF( &hitData );
         }
-
-        BRDF brdf = hitData.material->ComputeBRDF( &hitData ); 
 
         // estimate direct
         glm::vec3 Ld = LDirect( hitData, scene, brdf );
         L += pathThroughput * Ld;
 
+        // caustics (L S+ D paths) can't be sampled by the path, so they come from the photon map instead
+        if ( causticMap )
+        {
+            L += pathThroughput * causticMap->EstimateRadiance( hitData, brdf );
+        }
+
         // sample the BRDF to get the next ray's direction (wi)
         float pdf;
         glm::vec3 wi;
@@ -149,81 +207,616 @@ glm::vec3 Li( const Ray& ray, Scene* scene )
             break;
         }
 
-        currentRay = Ray( hitData.position, wi );
+        brdfPdf       = pdf;
+        diffuseVertex = true;
+        currentRay    = Ray( hitData.position, wi );
+        coneSpread = std::max( coneSpread, DIFFUSE_CONE_SPREAD );
     }
+    // rays traced outside of paths (primary hit cache, photons) count as depth 0
+    STATS_SET_DEPTH( 0 );
 
     return L;
 }
 
-void PathTracer::Render( Scene* scene, int samplesPerPixelIteration )
+bool PrimaryHitCache::IsValidFor( const Scene* scene ) const
 {
-    renderedImage = Image( scene->imageResolution.x, scene->imageResolution.y );
-    int samplesPerPixel = scene->numSamplesPerPixel[samplesPerPixelIteration];
-    LOG( "\nRendering scene with SPP = ", samplesPerPixel, "..." );
+    const Camera& cam = scene->camera;
+    return !hits.empty() && resolution == scene->imageResolution && window == scene->GetRenderWindow() && cameraPosition == cam.position && cameraRotation == cam.rotation &&
+        cameraVFov == cam.vfov && cameraAspectRatio == cam.aspectRatio && aaAlgorithm == cam.aaAlgorithm;
+}
 
-    auto timeStart = Time::GetTimePoint();
-    assert( renderedImage.GetPixels() );
-    Camera& cam = scene->camera;
+static bool CanCachePrimaryHits( const Scene* scene )
+{
+    return scene->cachePrimaryHits && scene->camera.aaAlgorithm != AntiAlias::Algorithm::JITTER_5;
+}
 
+static void GetImagePlane( const Camera& cam, int width, int height, glm::vec3& UL, glm::vec3& dU, glm::vec3& dV )
+{
     float halfHeight = std::tan( cam.vfov / 2 );
     float halfWidth  = halfHeight * cam.aspectRatio;
-    glm::vec3 UL     = cam.position + cam.GetViewDir() + halfHeight * cam.GetUpDir() - halfWidth * cam.GetRightDir();
-    glm::vec3 dU     = cam.GetRightDir() * (2 * halfWidth  / renderedImage.GetWidth());
-    glm::vec3 dV     = -cam.GetUpDir()   * (2 * halfHeight / renderedImage.GetHeight());
+    UL               = cam.position + cam.GetViewDir() + halfHeight * cam.GetUpDir() - halfWidth * cam.GetRightDir();
+    dU               = cam.GetRightDir() * (2 * halfWidth  / width);
+    dV               = -cam.GetUpDir()   * (2 * halfHeight / height);
     UL              += 0.5f * (dU + dV); // move to center of pixel
+}
+
+void PathTracer::BuildPrimaryHitCache( Scene* scene )
+{
+    TRACE_ZONE( "BuildPrimaryHitCache" );
+    auto timeStart          = Time::GetTimePoint();
+    const Camera& cam       = scene->camera;
+    PrimaryHitCache& cache  = m_primaryHitCache;
+    cache.resolution        = scene->imageResolution;
+    cache.window            = scene->GetRenderWindow();
+    cache.cameraPosition    = cam.position;
+    cache.cameraRotation    = cam.rotation;
+    cache.cameraVFov        = cam.vfov;
+    cache.cameraAspectRatio = cam.aspectRatio;
+    cache.aaAlgorithm       = cam.aaAlgorithm;
+    cache.positionsPerPixel = AntiAlias::GetIterations( cam.aaAlgorithm );
+    cache.hits.resize( static_cast< size_t >( cache.window.z ) * cache.window.w * cache.positionsPerPixel );
+
+    glm::vec3 UL, dU, dV;
+    GetImagePlane( cam, cache.resolution.x, cache.resolution.y, UL, dU, dV );
+    AntiAlias::AAFuncPointer samplePosition = AntiAlias::GetAlgorithm( cam.aaAlgorithm );
+    float pixelSpreadAngle                  = PixelSpreadAngle( cam, cache.resolution.y );
 
-    std::atomic< int > renderProgress( 0 );
-    int onePercent = static_cast< int >( std::ceil( renderedImage.GetHeight() / 100.0f ) );
-    
     #pragma omp parallel for schedule( dynamic )
-    for ( int row = 0; row < renderedImage.GetHeight(); ++row )
+    for ( int row = 0; row < cache.window.w; ++row )
     {
-        for ( int col = 0; col < renderedImage.GetWidth(); ++col )
+        for ( int col = 0; col < cache.window.z; ++col )
         {
-            glm::vec3 imagePlanePos = UL + dV * (float)row + dU * (float)col;
-
-            glm::vec3 totalColor = glm::vec3( 0 );
-            for ( int rayCounter = 0; rayCounter < samplesPerPixel; ++rayCounter )
+            glm::vec3 imagePlanePos = UL + dV * (float)(row + cache.window.y) + dU * (float)(col + cache.window.x);
+            for ( int position = 0; position < cache.positionsPerPixel; ++position )
             {
-                glm::vec3 antiAliasedPos = AntiAlias::Jitter( rayCounter, imagePlanePos, dU, dV );
-                Ray ray                  = Ray( cam.position, glm::normalize( antiAliasedPos - ray.position ) );
-                totalColor              += Li( ray, scene );
+                glm::vec3 samplePos = samplePosition( position, imagePlanePos, dU, dV );
+                Ray ray             = Ray( cam.position, glm::normalize( samplePos - cam.position ) );
+                PrimaryHit& hit     = cache.hits[(static_cast< size_t >( row ) * cache.window.z + col) * cache.positionsPerPixel + position];
+                IntersectionData hitData;
+                if ( scene->Intersect( ray, hitData ) )
+                {
+                    hit.position = hitData.position;
+                    hit.normal   = hitData.normal;
+                    hit.tangent  = hitData.tangent;
+                    hit.albedo   = hitData.material->GetAlbedo( hitData.texCoords, ConeUVFootprint( hitData, ray.direction, pixelSpreadAngle * hitData.t ) );
+                    hit.material = hitData.material;
+                }
+                else
+                {
+                    hit.albedo   = scene->LEnvironment( ray );
+                    hit.material = nullptr;
+                }
             }
+        }
+    }
 
-            renderedImage.SetPixel( row, col, totalColor / (float)samplesPerPixel );
+    LOG( "Built primary hit cache (", cache.hits.size() * sizeof( PrimaryHit ) / (1024 * 1024), " MB) in ", Time::GetDuration( timeStart ) / 1000, " seconds" );
+}
+
+// Root mean square of the per pixel relative standard error of the luminance mean, estimated from the
+// sum and squared sum of the luminance of each sample
+static float EstimateRelativeError( const Image& sums, const std::vector< float >& luminanceSquaredSums, int numSamples )
+{
+    if ( numSamples < 2 )
+    {
+        return FLT_MAX;
+    }
+
+    int width  = sums.GetWidth();
+    int height = sums.GetHeight();
+    double totalRelativeVariance = 0;
+    #pragma omp parallel for reduction( + : totalRelativeVariance )
+    for ( int row = 0; row < height; ++row )
+    {
+        for ( int col = 0; col < width; ++col )
+        {
+            float mean     = Luminance( sums.GetPixel( row, col ) ) / numSamples;
+            float variance = luminanceSquaredSums[row * width + col] / numSamples - mean * mean;
+            variance       = std::max( 0.0f, variance ) * numSamples / (numSamples - 1);
+            // the small constant keeps nearly black pixels from dominating the estimate
+            totalRelativeVariance += variance / numSamples / (mean * mean + 0.0001f);
         }
+    }
+
+    return static_cast< float >( std::sqrt( totalRelativeVariance / (width * height) ) );
+}
 
-        int rowsCompleted = ++renderProgress;
-        if ( rowsCompleted % onePercent == 0 )
+// FNV-1a of what a checkpoint's sums depend on, other than the resolution and sample counts in its header: the contents
+// of every file the scene was loaded from, and the settings that change the paths (which shots and the command line
+// can change without touching the files). Exposure and gamma are left out, they are only applied to the final image
+static uint64_t HashCheckpointedRender( const Scene* scene )
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto AddValue = [&hash]( const auto& value )
+    {
+        const unsigned char* bytes = reinterpret_cast< const unsigned char* >( &value );
+        for ( size_t i = 0; i < sizeof( value ); ++i )
         {
-            float progress = rowsCompleted / (float) renderedImage.GetHeight();
-            int val  = (int) (progress * 100);
-            int lpad = (int) (progress * PROGRESS_BAR_WIDTH);
-            int rpad = PROGRESS_BAR_WIDTH - lpad;
-            printf( "\r%3d%% [%.*s%*s]", val, lpad, PROGRESS_BAR_STR, rpad, "" );
-            fflush( stdout );
+            hash = ( hash ^ bytes[i] ) * 1099511628211ull;
         }
+    };
+
+    for ( const std::string& filename : scene->sourceFiles )
+    {
+        AddValue( HashFileContents( filename ) );
     }
+    const Camera& cam = scene->camera;
+    AddValue( cam.position );
+    AddValue( cam.rotation );
+    AddValue( cam.vfov );
+    AddValue( cam.aspectRatio );
+    AddValue( cam.aaAlgorithm );
+    AddValue( scene->maxDepth );
+    AddValue( scene->numSamplesPerAreaLight );
+    AddValue( scene->backgroundRadiance );
+    AddValue( scene->cachePrimaryHits );
+    const PhotonMapSettings& photons = scene->photonMapSettings;
+    AddValue( photons.enabled );
+    AddValue( photons.numPhotons );
+    AddValue( photons.radius );
+    AddValue( photons.progressive );
+    AddValue( photons.numPasses );
+    AddValue( photons.alpha );
+
+    return hash;
+}
 
-    LOG( "\nRendered scene in ", Time::GetDuration( timeStart ) / 1000, " seconds" );
-    
-#if USING( TONEMAP_AND_GAMMA )
-    renderedImage.ForAllPixels( [&]( const glm::vec3& pixel )
+bool PathTracer::Render( Scene* scene, int samplesPerPixelIteration )
+{
+    // only the window (the crop / tile being rendered) is stored in renderedImage
+    glm::ivec4 window = scene->GetRenderWindow();
+    TRACE_ZONE_DETAIL( "PathTracer::Render", "window " + std::to_string( window.x ) + ", " + std::to_string( window.y ) + ", " +
+                       std::to_string( window.z ) + " x " + std::to_string( window.w ) );
+    renderedImage     = Image( window.z, window.w );
+    m_fullResolution  = scene->imageResolution;
+    m_window          = window;
+    m_exposure        = scene->camera.exposure;
+    m_gamma           = scene->camera.gamma;
+    if ( window.z != scene->imageResolution.x || window.w != scene->imageResolution.y )
+    {
+        LOG( "\nRendering window x = ", window.x, ", y = ", window.y, ", width = ", window.z, ", height = ", window.w );
+    }
+
+    // With a time limit or noise target, passes of samplesPerPass samples are rendered until one of the limits is hit.
+    // The noise might never get down to the target, so without a time limit the last SamplesPerPixel entry caps the render.
+    // A sample range (used by the render coordinator's workers) only renders part of the samples of the SPP entry, and
+    // leaves them unnormalized so that the ranges can be summed up afterwards
+    bool sampleRangeRender = scene->sampleRange.x >= 0;
+    bool limitedRender     = scene->HasRenderLimits() && !sampleRangeRender;
+    int samplesPerPixel    = scene->numSamplesPerPixel[samplesPerPixelIteration];
+    if ( limitedRender )
+    {
+        samplesPerPixel = scene->timeLimitSeconds > 0 ? INT_MAX : scene->numSamplesPerPixel.back();
+        LOG( "\nRendering scene progressively with time limit = ", scene->timeLimitSeconds, " seconds, target noise = ", scene->targetNoise,
+             scene->timeLimitSeconds > 0 ? "" : ", max SPP = " + std::to_string( samplesPerPixel ), "..." );
+    }
+    else if ( sampleRangeRender )
+    {
+        LOG( "\nRendering samples [", scene->sampleRange.x, ", ", scene->sampleRange.y, ") of SPP = ", samplesPerPixel, "..." );
+    }
+    else
+    {
+        LOG( "\nRendering scene with SPP = ", samplesPerPixel, "..." );
+    }
+
+    auto timeStart = Time::GetTimePoint();
+    ResetRenderStats();
+    TextureCache::ResetStats();
+    bool recordCost = scene->costHeatmaps;
+    m_costHeatmaps  = CostHeatmaps();
+    if ( recordCost )
+    {
+        m_costHeatmaps.Init( window.z, window.w );
+#if !USING( RENDER_STATS )
+        LOG_WARN( "Cost heatmaps need RENDER_STATS for the BVH node and primitive test counts, only recording the time" );
+#endif // #if !USING( RENDER_STATS )
+    }
+    assert( renderedImage.GetPixels() );
+    Camera& cam = scene->camera;
+
+    glm::vec3 UL, dU, dV;
+    GetImagePlane( cam, scene->imageResolution.x, scene->imageResolution.y, UL, dU, dV );
+    float pixelSpreadAngle = PixelSpreadAngle( cam, scene->imageResolution.y );
+
+    // With a fixed sample pattern, the first hit of every sample can be looked up instead of traced.
+    // The cache survives across Render calls, so it is only built once for all of the SamplesPerPixel entries
+    const PrimaryHitCache* primaryHits = nullptr;
+    AntiAlias::AAFuncPointer samplePosition = AntiAlias::Jitter;
+    if ( CanCachePrimaryHits( scene ) )
+    {
+        if ( !m_primaryHitCache.IsValidFor( scene ) )
+        {
+            BuildPrimaryHitCache( scene );
+        }
+        primaryHits    = &m_primaryHitCache;
+        samplePosition = AntiAlias::GetAlgorithm( cam.aaAlgorithm );
+    }
+    else if ( scene->cachePrimaryHits )
+    {
+        LOG_WARN( "Primary hit cache needs a deterministic antialiasing pattern, not caching primary hits" );
+    }
+
+    // progressive photon mapping splits the samples into several passes, with a new photon map
+    // (using a smaller gather radius) for each pass
+    const PhotonMapSettings& photonSettings = scene->photonMapSettings;
+    bool progressivePhotons = photonSettings.enabled && photonSettings.progressive;
+    PhotonMap causticMap;
+    int numPasses = 1;
+    if ( limitedRender )
+    {
+        numPasses = INT_MAX;
+    }
+    else if ( progressivePhotons )
+    {
+        numPasses = std::max( 1, std::min( photonSettings.numPasses, samplesPerPixel ) );
+    }
+    if ( photonSettings.enabled && !progressivePhotons )
+    {
+        causticMap = BuildCausticPhotonMap( scene, photonSettings.radius );
+    }
+
+    // the noise estimate goes over the whole image, which is too slow to do after every sample
+    bool trackNoise    = scene->targetNoise > 0;
+    int samplesPerPass = scene->samplesPerPass > 0 ? scene->samplesPerPass : ( trackNoise ? 8 : 1 );
+    std::vector< float > luminanceSquaredSums;
+    if ( trackNoise )
+    {
+        luminanceSquaredSums.resize( renderedImage.GetWidth() * renderedImage.GetHeight(), 0 );
+    }
+
+    // samples [begin, end) of the given pass
+    auto GetPassRange = [&]( int pass, int samplesTaken )
+    {
+        if ( limitedRender )
         {
-            glm::vec3 newColor = pixel;
-            newColor = Uncharted2Tonemap( newColor, cam.exposure );
-            newColor = GammaCorrect( newColor, cam.gamma );
-            //newColor = PBRTGammaCorrect( newColor ) + glm::vec3( 1.0f / 512.0f );
-            newColor = glm::clamp( newColor, glm::vec3( 0 ), glm::vec3( 1 ) );
-            return newColor;
+            return glm::ivec2( samplesTaken, std::min( samplesPerPixel - samplesTaken, samplesPerPass ) + samplesTaken );
         }
-    );
-#endif // #if USING( TONEMAP_AND_GAMMA )
+        glm::ivec2 range( pass * static_cast< int64_t >( samplesPerPixel ) / numPasses, (pass + 1) * static_cast< int64_t >( samplesPerPixel ) / numPasses );
+        if ( sampleRangeRender )
+        {
+            range = glm::ivec2( std::max( range.x, scene->sampleRange.x ), std::min( range.y, scene->sampleRange.y ) );
+        }
+        return range;
+    };
+
+    // With checkpoints, the samples are rendered in batches of samplesPerPass, and the accumulation state can
+    // be saved between any two batches. Every sample is seeded from its pixel and index, so resuming gives the same image
+    bool checkpointing = !scene->checkpointFilename.empty() && ( scene->checkpointIntervalSeconds > 0 || scene->resumeFromCheckpoint );
+    bool deterministicSeeds = sampleRangeRender || checkpointing;
+    uint64_t renderHash     = checkpointing ? HashCheckpointedRender( scene ) : 0;
+    int samplesTaken        = 0;
+    int nextSample          = 0;
+    float previousSeconds   = 0; // render time before resuming
+    auto GetCheckpoint = [&]()
+    {
+        RenderCheckpoint checkpoint;
+        CheckpointHeader& header = checkpoint.header;
+        header.fullWidth         = scene->imageResolution.x;
+        header.fullHeight        = scene->imageResolution.y;
+        header.window[0]         = window.x;
+        header.window[1]         = window.y;
+        header.window[2]         = window.z;
+        header.window[3]         = window.w;
+        header.renderHash        = renderHash;
+        header.samplesPerPixel   = samplesPerPixel;
+        header.sampleRange[0]    = scene->sampleRange.x;
+        header.sampleRange[1]    = scene->sampleRange.y;
+        header.samplesTaken      = samplesTaken;
+        header.nextSample        = nextSample;
+        header.elapsedSeconds    = previousSeconds + Time::GetDuration( timeStart ) / 1000;
+        header.hasLuminanceSquaredSums = trackNoise;
+        checkpoint.sums.assign( renderedImage.GetPixels(), renderedImage.GetPixels() + window.z * window.w );
+        checkpoint.luminanceSquaredSums = luminanceSquaredSums;
+        return checkpoint;
+    };
+
+    if ( scene->resumeFromCheckpoint && fs::exists( scene->checkpointFilename ) )
+    {
+        RenderCheckpoint checkpoint;
+        RenderCheckpoint expected = GetCheckpoint();
+        if ( !ReadCheckpoint( scene->checkpointFilename, checkpoint ) )
+        {
+            LOG_WARN( "Could not read checkpoint, starting the render from the beginning" );
+        }
+        else if ( checkpoint.header.fullWidth != expected.header.fullWidth || checkpoint.header.fullHeight != expected.header.fullHeight ||
+                  memcmp( checkpoint.header.window, expected.header.window, sizeof( expected.header.window ) ) ||
+                  checkpoint.header.samplesPerPixel != expected.header.samplesPerPixel ||
+                  memcmp( checkpoint.header.sampleRange, expected.header.sampleRange, sizeof( expected.header.sampleRange ) ) ||
+                  checkpoint.header.hasLuminanceSquaredSums != expected.header.hasLuminanceSquaredSums ||
+                  checkpoint.header.renderHash != expected.header.renderHash )
+        {
+            LOG_WARN( "Checkpoint '", scene->checkpointFilename, "' is from a different render, starting the render from the beginning" );
+        }
+        else
+        {
+            memcpy( renderedImage.GetPixels(), checkpoint.sums.data(), checkpoint.sums.size() * sizeof( glm::vec3 ) );
+            luminanceSquaredSums = std::move( checkpoint.luminanceSquaredSums );
+            samplesTaken         = checkpoint.header.samplesTaken;
+            nextSample           = checkpoint.header.nextSample;
+            previousSeconds      = checkpoint.header.elapsedSeconds;
+            LOG( "Resuming from checkpoint '", scene->checkpointFilename, "' with ", samplesTaken, " samples per pixel done" );
+        }
+    }
+    std::optional< TerminationHandlerScope > terminationHandler;
+    if ( checkpointing )
+    {
+        terminationHandler.emplace();
+    }
+
+    // samples left to render, for the progress bar
+    int64_t samplesToRender = 0;
+    for ( int pass = 0; pass < numPasses && !limitedRender; ++pass )
+    {
+        glm::ivec2 range = GetPassRange( pass, 0 );
+        samplesToRender += std::max( 0, range.y - std::max( range.x, nextSample ) );
+    }
+
+    std::atomic< int64_t > renderProgress( 0 );
+    std::atomic< int > lastPercentPrinted( -1 );
+    int64_t totalWork = std::max< int64_t >( 1, samplesToRender * renderedImage.GetHeight() );
+    m_progress        = 0;
+
+    // adds the radiance of samples [sampleStart, sampleEnd) of every pixel to renderedImage
+    auto RenderSamples = [&]( int sampleStart, int sampleEnd, const PhotonMap* causticMapPtr )
+    {
+        #pragma omp parallel for schedule( dynamic )
+        for ( int row = 0; row < renderedImage.GetHeight(); ++row )
+        {
+            TRACE_ZONE_DETAIL( "Render row", "row " + std::to_string( row + window.y ) + ", samples " + std::to_string( sampleStart ) + " - " + std::to_string( sampleEnd ) );
+            // can't break out of an OpenMP loop, so skip the remaining rows instead
+            if ( IsCancelled() )
+            {
+                continue;
+            }
+            for ( int col = 0; col < renderedImage.GetWidth(); ++col )
+            {
+                glm::vec3 imagePlanePos = UL + dV * (float)(row + window.y) + dU * (float)(col + window.x);
+
+                glm::vec3 totalColor = glm::vec3( 0 );
+                float luminanceSquared = 0;
+                uint64_t pixelIndex = static_cast< uint64_t >( row + window.y ) * scene->imageResolution.x + col + window.x;
+                uint64_t startCycles = 0, startNodes = 0, startPrimitiveTests = 0;
+                if ( recordCost )
+                {
+                    GetThreadTraversalTotals( startNodes, startPrimitiveTests );
+                    startCycles = ReadCycleCounter();
+                }
+                for ( int rayCounter = sampleStart; rayCounter < sampleEnd; ++rayCounter )
+                {
+                    if ( deterministicSeeds )
+                    {
+                        // the same sample is the same path no matter which worker renders it, or when
+                        Random::Seed( Random::SampleSeed( pixelIndex, rayCounter ) );
+                    }
+                    const PrimaryHit* primaryHit = nullptr;
+                    int samplePatternIndex       = rayCounter;
+                    if ( primaryHits )
+                    {
+                        samplePatternIndex = rayCounter % primaryHits->positionsPerPixel;
+                        primaryHit         = &primaryHits->hits[(static_cast< size_t >( row ) * renderedImage.GetWidth() + col) * primaryHits->positionsPerPixel + samplePatternIndex];
+                    }
+                    glm::vec3 antiAliasedPos = samplePosition( samplePatternIndex, imagePlanePos, dU, dV );
+                    Ray ray                  = Ray( cam.position, glm::normalize( antiAliasedPos - cam.position ) );
+                    glm::vec3 color          = Li( ray, scene, causticMapPtr, pixelSpreadAngle, primaryHit );
+                    totalColor              += color;
+                    luminanceSquared        += Luminance( color ) * Luminance( color );
+                }
+
+                renderedImage.SetPixel( row, col, renderedImage.GetPixel( row, col ) + totalColor );
+                if ( recordCost )
+                {
+                    uint64_t cycles = ReadCycleCounter() - startCycles;
+                    uint64_t nodes, primitiveTests;
+                    GetThreadTraversalTotals( nodes, primitiveTests );
+                    m_costHeatmaps.AddPixel( row, col, cycles, nodes - startNodes, primitiveTests - startPrimitiveTests );
+                }
+                if ( trackNoise )
+                {
+                    luminanceSquaredSums[row * renderedImage.GetWidth() + col] += luminanceSquared;
+                }
+            }
+
+            if ( limitedRender )
+            {
+                continue;
+            }
+            float progress = ( renderProgress += sampleEnd - sampleStart ) / (float) totalWork;
+            int val        = (int) (progress * 100);
+            int lastVal    = lastPercentPrinted;
+            m_progress     = progress;
+            if ( printProgress && val > lastVal && lastPercentPrinted.compare_exchange_strong( lastVal, val ) )
+            {
+                int lpad = (int) (progress * PROGRESS_BAR_WIDTH);
+                int rpad = PROGRESS_BAR_WIDTH - lpad;
+                printf( "\r%3d%% [%.*s%*s]", val, lpad, PROGRESS_BAR_STR, rpad, "" );
+                fflush( stdout );
+            }
+        }
+    };
+
+    CheckpointWriter checkpointWriter;
+    auto lastCheckpoint = Time::GetTimePoint();
+    int resumedSamples  = samplesTaken;
+    int firstPass       = limitedRender ? nextSample / samplesPerPass : 0;
+    for ( int pass = firstPass; pass < numPasses && samplesTaken < samplesPerPixel; ++pass )
+    {
+        glm::ivec2 passRange = GetPassRange( pass, nextSample );
+        passRange.x         = std::max( passRange.x, nextSample );
+        if ( passRange.x >= passRange.y )
+        {
+            continue;
+        }
+
+        auto passStart = Time::GetTimePoint();
+        TRACE_ZONE_DETAIL( "Render pass", "pass " + std::to_string( pass ) );
+        if ( progressivePhotons )
+        {
+            causticMap = BuildCausticPhotonMap( scene, ProgressivePhotonRadius( photonSettings, pass ), pass );
+        }
+        int batchSize = checkpointing ? samplesPerPass : passRange.y - passRange.x;
+        for ( int batchStart = passRange.x; batchStart < passRange.y; batchStart += batchSize )
+        {
+            int batchEnd = std::min( passRange.y, batchStart + batchSize );
+            RenderSamples( batchStart, batchEnd, photonSettings.enabled ? &causticMap : nullptr );
+            samplesTaken += batchEnd - batchStart;
+            nextSample    = batchEnd;
+            if ( IsCancelled() )
+            {
+                LOG_WARN( "\nRender cancelled" );
+                return false;
+            }
+
+            if ( !checkpointing )
+            {
+                continue;
+            }
+            if ( TerminationRequested() )
+            {
+                checkpointWriter.Wait();
+                bool saved = WriteCheckpoint( scene->checkpointFilename, GetCheckpoint() );
+                LOG_WARN( "\nRender interrupted after ", samplesTaken, " samples per pixel", saved ? ", saved checkpoint '" + scene->checkpointFilename + "'" : "" );
+                m_numSamples = samplesTaken;
+                m_normalized = false;
+                return false;
+            }
+            if ( scene->checkpointIntervalSeconds > 0 && Time::GetDuration( lastCheckpoint ) / 1000 >= scene->checkpointIntervalSeconds )
+            {
+                // skipped if the previous checkpoint is still being written, the next batch will try again
+                if ( checkpointWriter.WriteAsync( scene->checkpointFilename, GetCheckpoint() ) )
+                {
+                    lastCheckpoint = Time::GetTimePoint();
+                }
+            }
+        }
+
+        if ( limitedRender )
+        {
+            // stop if the next pass (assuming it takes as long as this one) would go over the time budget
+            float elapsedSeconds = previousSeconds + Time::GetDuration( timeStart ) / 1000;
+            float passSeconds    = Time::GetDuration( passStart ) / 1000;
+            float noise          = trackNoise ? EstimateRelativeError( renderedImage, luminanceSquaredSums, samplesTaken ) : 0;
+            if ( scene->timeLimitSeconds > 0 )
+            {
+                m_progress = std::min( 1.0f, elapsedSeconds / scene->timeLimitSeconds );
+            }
+            else
+            {
+                m_progress = samplesTaken / (float) samplesPerPixel;
+            }
+            if ( printProgress )
+            {
+                printf( "\rPass %d: SPP = %d, time = %.2f seconds", pass + 1, samplesTaken, elapsedSeconds );
+                if ( trackNoise )
+                {
+                    printf( ", noise = %.5f   ", noise );
+                }
+                fflush( stdout );
+            }
+            if ( scene->timeLimitSeconds > 0 && elapsedSeconds + passSeconds > scene->timeLimitSeconds )
+            {
+                break;
+            }
+            if ( trackNoise && noise <= scene->targetNoise )
+            {
+                break;
+            }
+            if ( trackNoise && samplesTaken >= samplesPerPixel )
+            {
+                LOG_WARN( "\nReached the max SPP = ", samplesPerPixel, " (the last SamplesPerPixel entry) before the target noise" );
+            }
+        }
+    }
+
+    // the render is complete, so its checkpoint is only in the way of the next render
+    checkpointWriter.Wait();
+    if ( checkpointing )
+    {
+        std::error_code ec;
+        fs::remove( scene->checkpointFilename, ec );
+    }
+
+    float renderSeconds = Time::GetDuration( timeStart ) / 1000;
+    LOG( "\nRendered scene with SPP = ", samplesTaken, " in ", renderSeconds, " seconds" );
+    LogRenderStats( GatherRenderStats(), renderSeconds );
+    TextureCache::LogStats();
+
+    m_numSamples         = samplesTaken;
+    m_costHeatmapSamples = samplesTaken - resumedSamples;
+    m_normalized         = !sampleRangeRender;
+    if ( m_normalized )
+    {
+        renderedImage.ForAllPixels( [&]( const glm::vec3& pixel ) { return pixel / (float)samplesTaken; } );
+    }
+
+    return true;
+}
+
+bool PathTracer::SaveCostHeatmaps( const std::string& imageFilename ) const
+{
+    TileFileHeader header;
+    header.fullWidth  = m_fullResolution.x;
+    header.fullHeight = m_fullResolution.y;
+    header.x          = m_window.x;
+    header.y          = m_window.y;
+    header.width      = m_window.z;
+    header.height     = m_window.w;
+    header.numSamples = m_costHeatmapSamples;
+
+    return m_costHeatmaps.Save( imageFilename, header );
+}
+
+float PathTracer::GetProgress() const
+{
+    return m_progress;
+}
+
+int PathTracer::GetNumSamples() const
+{
+    return m_numSamples;
+}
+
+void PathTracer::SetCancelFlag( const std::atomic< bool >* cancel )
+{
+    m_cancel = cancel;
+}
+
+bool PathTracer::IsCancelled() const
+{
+    return m_cancel && *m_cancel;
 }
 
 bool PathTracer::SaveImage( const std::string& filename ) const
 {
-    return renderedImage.Save( filename );
+    return SaveImageAsync( filename ).get();
+}
+
+std::future< bool > PathTracer::SaveImageAsync( const std::string& filename ) const
+{
+    // only the copy happens on the calling thread, so renderedImage can be overwritten by the next Render right away
+    Image tonemappedImage( renderedImage.GetWidth(), renderedImage.GetHeight() );
+    memcpy( tonemappedImage.GetPixels(), renderedImage.GetPixels(), renderedImage.GetWidth() * renderedImage.GetHeight() * sizeof( glm::vec3 ) );
+
+    return std::async( std::launch::async, [image = std::move( tonemappedImage ), filename, exposure = m_exposure, gamma = m_gamma]() mutable
+    {
+        TonemapImage( image, exposure, gamma );
+        return image.Save( filename );
+    });
+}
+
+bool PathTracer::SaveTile( const std::string& filename ) const
+{
+    TileFileHeader header;
+    header.fullWidth  = m_fullResolution.x;
+    header.fullHeight = m_fullResolution.y;
+    header.x          = m_window.x;
+    header.y          = m_window.y;
+    header.width      = m_window.z;
+    header.height     = m_window.w;
+    header.exposure   = m_exposure;
+    header.gamma      = m_gamma;
+    header.numSamples = m_normalized ? 0 : m_numSamples;
+
+    return WriteTileFile( filename, header, renderedImage );
 }
 
 } // namespace PT
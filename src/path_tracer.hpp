@@ -1,21 +1,97 @@
 #pragma once
 
+#include "cost_heatmap.hpp"
 #include "image.hpp"
 #include "scene.hpp"
+#include <atomic>
+#include <future>
+#include <vector>
 
 namespace PT
 {
 
+// First hit of a camera ray, with the texture lookups of the BRDF already done
+struct PrimaryHit
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 tangent;
+    glm::vec3 albedo;             // BRDF Kd if the ray hit something, otherwise the environment radiance
+    Material* material = nullptr; // nullptr if the ray missed the scene
+};
+
+// G-buffer of the primary hits for every fixed sample position of every pixel. Only usable with the
+// deterministic anti-aliasing patterns, where every sample of a pixel re-traces one of a few camera rays
+struct PrimaryHitCache
+{
+    bool IsValidFor( const Scene* scene ) const;
+
+    std::vector< PrimaryHit > hits; // hits[(row * window.z + col) * positionsPerPixel + position], relative to the window
+    int positionsPerPixel = 0;
+    glm::ivec2 resolution = glm::ivec2( 0 );
+    glm::ivec4 window     = glm::ivec4( 0 );
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraRotation;
+    float cameraVFov;
+    float cameraAspectRatio;
+    AntiAlias::Algorithm aaAlgorithm;
+};
+
 class PathTracer
 {
 public:
     PathTracer() = default;
 
-    void Render( Scene* scene, int samplesPerPixelIteration = 0 );
+    // the primary hit cache (scene->cachePrimaryHits) is kept between calls, so the same PathTracer
+    // should be re-used for rendering the same view multiple times.
+    // Returns false if a checkpointed render was interrupted by SIGTERM / SIGINT (after saving the checkpoint),
+    // or if the render was cancelled
+    bool Render( Scene* scene, int samplesPerPixelIteration = 0 );
 
+    // tonemaps and writes the image as an LDR format (png, jpg, etc)
     bool SaveImage( const std::string& filename ) const;
 
+    // same as SaveImage, but the tonemapping and encoding happen on another thread, so they can overlap the next Render
+    std::future< bool > SaveImageAsync( const std::string& filename ) const;
+
+    // writes the linear HDR pixels and the position of the rendered window as a raw tile file (see tile_file.hpp)
+    bool SaveTile( const std::string& filename ) const;
+
+    // writes the per pixel cost heatmaps of the last Render call next to imageFilename, if scene->costHeatmaps was set
+    // (see cost_heatmap.hpp)
+    bool SaveCostHeatmaps( const std::string& imageFilename ) const;
+
+    // fraction of the rows of the current Render call that are done. Can be called from other threads
+    float GetProgress() const;
+
+    // samples per pixel taken by the last Render call (for time / noise limited renders, only known afterwards)
+    int GetNumSamples() const;
+
+    // Render stops (and returns false) soon after *cancel becomes true. nullptr == can't be cancelled
+    void SetCancelFlag( const std::atomic< bool >* cancel );
+
+    // print the progress bar to stdout while rendering
+    bool printProgress = true;
+
+    // linear HDR radiance of scene->GetRenderWindow() after Render. With a scene->sampleRange, the sum of the
+    // radiance of the samples instead (see SaveTile)
     Image renderedImage;
+
+private:
+    void BuildPrimaryHitCache( Scene* scene );
+    bool IsCancelled() const;
+
+    PrimaryHitCache m_primaryHitCache;
+    CostHeatmaps m_costHeatmaps;
+    int m_costHeatmapSamples    = 0; // samples per pixel in m_costHeatmaps, which excludes samples from a checkpoint
+    glm::ivec2 m_fullResolution = glm::ivec2( 0 );
+    glm::ivec4 m_window         = glm::ivec4( 0 );
+    float m_exposure            = 1;
+    float m_gamma               = 1;
+    int m_numSamples            = 0;
+    bool m_normalized           = true;
+    std::atomic< float > m_progress{ 0 };
+    const std::atomic< bool >* m_cancel = nullptr;
 };
 
 } // namespace PT
\ No newline at end of file
@@ -0,0 +1,224 @@
+#include "photon_map.hpp"
+#include "scene.hpp"
+#include "utils/logger.hpp"
+#include "utils/random.hpp"
+#include "utils/time.hpp"
+#include "utils/trace.hpp"
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define EPSILON 0.00001f
+
+namespace PT
+{
+
+void PhotonMap::Build( std::vector< Photon >&& photons, float gatherRadius )
+{
+    m_radius  = gatherRadius;
+    m_photons = std::move( photons );
+
+    // use a power of 2 table size roughly equal to the number of photons
+    uint32_t tableSize = 1;
+    while ( tableSize < m_photons.size() )
+    {
+        tableSize <<= 1;
+    }
+
+    // counting sort of the photons by bucket
+    std::vector< uint32_t > hashes( m_photons.size() );
+    m_cellStarts.assign( tableSize + 1, 0 );
+    for ( size_t i = 0; i < m_photons.size(); ++i )
+    {
+        hashes[i] = HashCell( GetCell( m_photons[i].position ) );
+        ++m_cellStarts[hashes[i] + 1];
+    }
+    for ( uint32_t h = 0; h < tableSize; ++h )
+    {
+        m_cellStarts[h + 1] += m_cellStarts[h];
+    }
+
+    std::vector< uint32_t > offsets( m_cellStarts.begin(), m_cellStarts.end() - 1 );
+    std::vector< Photon > sortedPhotons( m_photons.size() );
+    for ( size_t i = 0; i < m_photons.size(); ++i )
+    {
+        sortedPhotons[offsets[hashes[i]]++] = m_photons[i];
+    }
+    m_photons = std::move( sortedPhotons );
+}
+
+glm::vec3 PhotonMap::EstimateRadiance( const IntersectionData& hitData, const BRDF& brdf ) const
+{
+    if ( m_photons.empty() )
+    {
+        return glm::vec3( 0 );
+    }
+
+    glm::vec3 flux( 0 );
+    float radiusSquared = m_radius * m_radius;
+    glm::ivec3 center   = GetCell( hitData.position );
+    uint32_t visited[27];
+    int numVisited = 0;
+    for ( int z = -1; z <= 1; ++z )
+    {
+        for ( int y = -1; y <= 1; ++y )
+        {
+            for ( int x = -1; x <= 1; ++x )
+            {
+                // different cells can hash to the same bucket, don't count those photons twice
+                uint32_t h = HashCell( center + glm::ivec3( x, y, z ) );
+                if ( std::find( visited, visited + numVisited, h ) != visited + numVisited )
+                {
+                    continue;
+                }
+                visited[numVisited++] = h;
+
+                for ( uint32_t i = m_cellStarts[h]; i < m_cellStarts[h + 1]; ++i )
+                {
+                    const Photon& photon = m_photons[i];
+                    glm::vec3 d = photon.position - hitData.position;
+                    if ( glm::dot( d, d ) < radiusSquared && glm::dot( photon.wi, hitData.normal ) > 0 )
+                    {
+                        flux += brdf.F( hitData.wo, photon.wi ) * photon.power;
+                    }
+                }
+            }
+        }
+    }
+
+    return flux / ( static_cast< float >( M_PI ) * radiusSquared );
+}
+
+size_t PhotonMap::Size() const
+{
+    return m_photons.size();
+}
+
+float PhotonMap::GetRadius() const
+{
+    return m_radius;
+}
+
+uint32_t PhotonMap::HashCell( const glm::ivec3& cell ) const
+{
+    // https://matthias-research.github.io/pages/publications/tetraederCollision.pdf
+    uint32_t h = ( static_cast< uint32_t >( cell.x ) * 73856093u ) ^ ( static_cast< uint32_t >( cell.y ) * 19349663u ) ^ ( static_cast< uint32_t >( cell.z ) * 83492791u );
+    return h & static_cast< uint32_t >( m_cellStarts.size() - 2 );
+}
+
+glm::ivec3 PhotonMap::GetCell( const glm::vec3& p ) const
+{
+    return glm::ivec3( glm::floor( p / m_radius ) );
+}
+
+static void TraceCausticPhoton( Scene* scene, float photonScale, std::vector< Photon >& photons )
+{
+    int lightIndex = std::min( static_cast< int >( Random::Rand() * scene->lights.size() ), static_cast< int >( scene->lights.size() ) - 1 );
+    Ray ray;
+    glm::vec3 power = scene->lights[lightIndex]->Sample_Le( ray, scene ) * photonScale;
+    if ( power == glm::vec3( 0 ) )
+    {
+        return;
+    }
+
+    bool specularPath = false;
+    for ( int bounce = 0; bounce < scene->maxDepth; ++bounce )
+    {
+        IntersectionData hitData;
+        if ( !scene->Intersect( ray, hitData ) )
+        {
+            return;
+        }
+
+        const Material* material = hitData.material;
+        if ( !material->IsSpecular() )
+        {
+            // only L S+ D paths are stored, everything else is handled by the path tracer
+            if ( specularPath )
+            {
+                photons.push_back( { hitData.position, -ray.direction, power } );
+            }
+            return;
+        }
+
+        specularPath = true;
+        glm::vec3 weight;
+        glm::vec3 wi = material->SampleSpecular( ray.direction, hitData.normal, weight );
+        power       *= weight;
+        if ( power == glm::vec3( 0 ) )
+        {
+            return;
+        }
+        float side = glm::dot( wi, hitData.normal ) > 0 ? 1.0f : -1.0f;
+        ray        = Ray( hitData.position + side * EPSILON * hitData.normal, wi );
+    }
+}
+
+PhotonMap BuildCausticPhotonMap( Scene* scene, float gatherRadius, uint64_t seed )
+{
+    TRACE_ZONE( "BuildCausticPhotonMap" );
+    const PhotonMapSettings& settings = scene->photonMapSettings;
+    PhotonMap photonMap;
+    if ( scene->lights.empty() || settings.numPhotons <= 0 )
+    {
+        photonMap.Build( {}, gatherRadius );
+        return photonMap;
+    }
+
+    auto timeStart = Time::GetTimePoint();
+
+    // each light is picked uniformly, so scale by the number of lights to account for that
+    float photonScale = scene->lights.size() / static_cast< float >( settings.numPhotons );
+    int numThreads    = 1;
+#ifdef _OPENMP
+    numThreads = omp_get_max_threads();
+#endif
+    std::vector< std::vector< Photon > > threadPhotons( numThreads );
+
+    #pragma omp parallel
+    {
+        int threadIndex = 0;
+#ifdef _OPENMP
+        threadIndex = omp_get_thread_num();
+#endif
+        std::vector< Photon >& photons = threadPhotons[threadIndex];
+
+        #pragma omp for schedule( dynamic, 1024 )
+        for ( int i = 0; i < settings.numPhotons; ++i )
+        {
+            Random::Seed( Random::PhotonSeed( seed, i ) );
+            TraceCausticPhoton( scene, photonScale, photons );
+        }
+    }
+
+    size_t totalPhotons = 0;
+    for ( const auto& photons : threadPhotons )
+    {
+        totalPhotons += photons.size();
+    }
+    std::vector< Photon > mergedPhotons;
+    mergedPhotons.reserve( totalPhotons );
+    for ( auto& photons : threadPhotons )
+    {
+        mergedPhotons.insert( mergedPhotons.end(), photons.begin(), photons.end() );
+    }
+
+    photonMap.Build( std::move( mergedPhotons ), gatherRadius );
+    LOG( "Traced ", settings.numPhotons, " photons, stored ", photonMap.Size(), " caustic photons (radius = ", gatherRadius, ") in ", Time::GetDuration( timeStart ) / 1000, " seconds" );
+
+    return photonMap;
+}
+
+float ProgressivePhotonRadius( const PhotonMapSettings& settings, int pass )
+{
+    float radiusSquared = settings.radius * settings.radius;
+    for ( int i = 1; i <= pass; ++i )
+    {
+        radiusSquared *= ( i + settings.alpha ) / ( i + 1 );
+    }
+
+    return std::sqrt( radiusSquared );
+}
+
+} // namespace PT
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "intersection_tests.hpp"
+#include "math.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace PT
+{
+
+struct PhotonMapSettings
+{
+    bool enabled     = false;
+    int numPhotons   = 200000;
+    float radius     = 0.05f;  // gather radius (world units). Initial radius when progressive
+    bool progressive = false;  // re-emit photons and shrink the radius between render passes
+    int numPasses    = 4;      // only used when progressive
+    float alpha      = 0.7f;   // fraction of photons kept per pass for the radius reduction (PPM alpha)
+};
+
+struct Photon
+{
+    glm::vec3 position;
+    glm::vec3 wi; // direction towards where the photon came from
+    glm::vec3 power;
+};
+
+struct BRDF;
+class Scene;
+
+// Caustic photon map stored in a hashed uniform grid with a cell size equal to the gather radius,
+// so every lookup only has to check the 3x3x3 neighborhood of cells around the query point
+class PhotonMap
+{
+public:
+    PhotonMap() = default;
+
+    void Build( std::vector< Photon >&& photons, float gatherRadius );
+    glm::vec3 EstimateRadiance( const IntersectionData& hitData, const BRDF& brdf ) const;
+    size_t Size() const;
+    float GetRadius() const;
+
+private:
+    uint32_t HashCell( const glm::ivec3& cell ) const;
+    glm::ivec3 GetCell( const glm::vec3& p ) const;
+
+    float m_radius = 0;
+    std::vector< Photon > m_photons;      // sorted by cell hash
+    std::vector< uint32_t > m_cellStarts; // m_photons[m_cellStarts[h]] to m_photons[m_cellStarts[h+1]] are in bucket h
+};
+
+// Shoots scene.photonMapSettings.numPhotons photons from the scene's lights and stores the ones that hit a
+// diffuse surface after one or more specular bounces (L S+ D paths). Each thread traces into its own buffer,
+// and the buffers are merged once all photons are traced. Every photon is seeded from its index and the given
+// seed, so the same map is built by every process / resumed render
+PhotonMap BuildCausticPhotonMap( Scene* scene, float gatherRadius, uint64_t seed = 0 );
+
+// Radius for the given pass of progressive photon mapping: r_(i+1)^2 = r_i^2 * (i + alpha) / (i + 1)
+float ProgressivePhotonRadius( const PhotonMapSettings& settings, int pass );
+
+} // namespace PT
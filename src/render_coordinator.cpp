@@ -0,0 +1,356 @@
+#include "render_coordinator.hpp"
+#include "path_tracer.hpp"
+#include "utils/logger.hpp"
+#include "utils/time.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+#define CHUNK_TODO_EXTENSION ".todo"
+#define CHUNK_CLAIMED_EXTENSION ".claimed"
+#define HEARTBEAT_EXTENSION ".heartbeat"
+
+namespace PT
+{
+
+static std::string ChunkName( int chunk )
+{
+    return "chunk_" + std::to_string( chunk );
+}
+
+// Writes to a temporary file first, so that other processes never see a partially written file
+static bool WriteFileAtomically( const fs::path& path, const std::string& contents )
+{
+    fs::path tmpPath = path.string() + ".tmp";
+    {
+        std::ofstream out( tmpPath );
+        if ( !out )
+        {
+            return false;
+        }
+        out << contents;
+        if ( !out.good() )
+        {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename( tmpPath, path, ec );
+    return !ec;
+}
+
+// Renames all of the chunks claimed by the worker back to .todo, so other workers can render them
+static void ReleaseChunks( const fs::path& workDir, const std::string& workerName )
+{
+    std::string claimedSuffix = "." + workerName + CHUNK_CLAIMED_EXTENSION;
+    std::error_code ec;
+    for ( const auto& entry : fs::directory_iterator( workDir, ec ) )
+    {
+        std::string filename = entry.path().filename().string();
+        if ( filename.size() > claimedSuffix.size() && filename.compare( filename.size() - claimedSuffix.size(), claimedSuffix.size(), claimedSuffix ) == 0 )
+        {
+            std::string chunkName = filename.substr( 0, filename.size() - claimedSuffix.size() );
+            LOG_WARN( "Reassigning ", chunkName, " of worker '", workerName, "'" );
+            fs::rename( entry.path(), workDir / ( chunkName + CHUNK_TODO_EXTENSION ), ec );
+        }
+    }
+}
+
+struct LocalWorker
+{
+    std::string name;
+    std::thread thread;
+    std::atomic< bool > running{ false };
+    std::atomic< int > exitCode{ 0 };
+    int restarts = 0;
+};
+
+static void LaunchWorker( LocalWorker& worker, const std::string& command )
+{
+    worker.running = true;
+    worker.thread  = std::thread( [&worker, command]()
+    {
+        worker.exitCode = std::system( command.c_str() );
+        worker.running  = false;
+    });
+}
+
+bool RunCoordinator( const Scene& scene, int sppIteration, const CoordinatorSettings& settings, const std::string& workDirName,
+                     const std::string& workerCommand, TileFileHeader& header, Image& image )
+{
+    int samplesPerPixel = scene.numSamplesPerPixel[sppIteration];
+    int numChunks       = std::max( 1, std::min( samplesPerPixel, std::max( 1, settings.numWorkers ) * settings.chunksPerWorker ) );
+    LOG( "\nRendering scene with SPP = ", samplesPerPixel, " in ", numChunks, " chunks, with ", settings.numWorkers, " local workers. Work directory = '", workDirName, "'" );
+    auto timeStart = Time::GetTimePoint();
+
+    // leftovers of a previous (interrupted) render would be merged into this one
+    fs::path workDir( workDirName );
+    std::error_code ec;
+    fs::remove_all( workDir, ec );
+    fs::create_directories( workDir, ec );
+    if ( ec )
+    {
+        LOG_ERR( "Could not create work directory '", workDirName, "'" );
+        return false;
+    }
+
+    for ( int chunk = 0; chunk < numChunks; ++chunk )
+    {
+        int first = static_cast< int >( chunk * static_cast< int64_t >( samplesPerPixel ) / numChunks );
+        int end   = static_cast< int >( (chunk + 1) * static_cast< int64_t >( samplesPerPixel ) / numChunks );
+        std::string contents = std::to_string( sppIteration ) + " " + std::to_string( first ) + " " + std::to_string( end );
+        if ( !WriteFileAtomically( workDir / ( ChunkName( chunk ) + CHUNK_TODO_EXTENSION ), contents ) )
+        {
+            LOG_ERR( "Could not write chunk files to '", workDirName, "'" );
+            return false;
+        }
+    }
+
+    int threadsPerWorker = settings.threadsPerWorker;
+    if ( threadsPerWorker <= 0 )
+    {
+        threadsPerWorker = std::max( 1, static_cast< int >( std::thread::hardware_concurrency() ) / std::max( 1, settings.numWorkers ) );
+    }
+    std::vector< std::unique_ptr< LocalWorker > > workers( settings.numWorkers );
+    std::vector< std::string > workerCommands( settings.numWorkers );
+    for ( int i = 0; i < settings.numWorkers; ++i )
+    {
+        workers[i]        = std::make_unique< LocalWorker >();
+        workers[i]->name  = "local" + std::to_string( i );
+        workerCommands[i] = workerCommand + " --worker \"" + workDirName + "\" " + workers[i]->name + " --threads " + std::to_string( threadsPerWorker );
+        LaunchWorker( *workers[i], workerCommands[i] );
+    }
+
+    bool success = true;
+    std::vector< std::string > chunkFilenames( numChunks );
+    for ( int chunk = 0; chunk < numChunks; ++chunk )
+    {
+        chunkFilenames[chunk] = ( workDir / ( ChunkName( chunk ) + TILE_FILE_EXTENSION ) ).string();
+    }
+    while ( true )
+    {
+        int chunksDone = static_cast< int >( std::count_if( chunkFilenames.begin(), chunkFilenames.end(), []( const std::string& f ) { return fs::exists( f ); } ) );
+        printf( "\rChunks done: %d / %d", chunksDone, numChunks );
+        fflush( stdout );
+        if ( chunksDone == numChunks )
+        {
+            break;
+        }
+
+        // local workers that crashed: reassign their chunks and start them again
+        bool anyLocalAlive = false;
+        for ( int i = 0; i < settings.numWorkers; ++i )
+        {
+            LocalWorker& worker = *workers[i];
+            if ( !worker.running && worker.thread.joinable() )
+            {
+                worker.thread.join();
+                if ( worker.exitCode != 0 )
+                {
+                    LOG_WARN( "\nWorker '", worker.name, "' exited with code ", worker.exitCode.load() );
+                    ReleaseChunks( workDir, worker.name );
+                    fs::remove( workDir / ( worker.name + HEARTBEAT_EXTENSION ), ec );
+                    if ( worker.restarts < settings.maxRestarts )
+                    {
+                        ++worker.restarts;
+                        LaunchWorker( worker, workerCommands[i] );
+                    }
+                }
+            }
+            anyLocalAlive = anyLocalAlive || worker.running;
+        }
+
+        // workers (local or remote) that stopped sending heartbeats
+        bool anyHeartbeat = false;
+        auto now          = fs::file_time_type::clock::now();
+        for ( const auto& entry : fs::directory_iterator( workDir, ec ) )
+        {
+            if ( entry.path().extension() != HEARTBEAT_EXTENSION )
+            {
+                continue;
+            }
+            auto lastWrite = fs::last_write_time( entry.path(), ec );
+            if ( ec )
+            {
+                continue;
+            }
+            float age = std::chrono::duration< float >( now - lastWrite ).count();
+            if ( age > settings.heartbeatTimeoutSeconds )
+            {
+                std::string workerName = entry.path().stem().string();
+                LOG_WARN( "\nNo heartbeat from worker '", workerName, "' for ", age, " seconds, assuming it died" );
+                ReleaseChunks( workDir, workerName );
+                fs::remove( entry.path(), ec );
+            }
+            else
+            {
+                anyHeartbeat = true;
+            }
+        }
+
+        if ( settings.numWorkers > 0 && !anyLocalAlive && !anyHeartbeat )
+        {
+            LOG_ERR( "\nAll workers died, stopping the render" );
+            success = false;
+            break;
+        }
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
+    }
+
+    for ( auto& worker : workers )
+    {
+        if ( worker->thread.joinable() )
+        {
+            worker->thread.join();
+        }
+    }
+    if ( !success )
+    {
+        return false;
+    }
+
+    success = MergeTileFiles( chunkFilenames, header, image );
+    if ( success )
+    {
+        fs::remove_all( workDir, ec );
+    }
+    LOG( "\nRendered scene with SPP = ", samplesPerPixel, " in ", Time::GetDuration( timeStart ) / 1000, " seconds" );
+
+    return success;
+}
+
+// Claims any .todo chunk by renaming it. Returns the chunk name, or an empty string if there was none left
+static std::string ClaimChunk( const fs::path& workDir, const std::string& workerName, bool& chunksInProgress )
+{
+    chunksInProgress = false;
+    std::error_code ec;
+    for ( const auto& entry : fs::directory_iterator( workDir, ec ) )
+    {
+        fs::path extension = entry.path().extension();
+        if ( extension == CHUNK_CLAIMED_EXTENSION )
+        {
+            chunksInProgress = true;
+        }
+        else if ( extension == CHUNK_TODO_EXTENSION )
+        {
+            std::string chunkName = entry.path().stem().string();
+            fs::rename( entry.path(), workDir / ( chunkName + "." + workerName + CHUNK_CLAIMED_EXTENSION ), ec );
+            if ( !ec )
+            {
+                return chunkName;
+            }
+            // another worker was faster
+            ec.clear();
+        }
+    }
+
+    return "";
+}
+
+bool RunWorker( Scene& scene, const std::string& workDirName, const std::string& workerName )
+{
+    fs::path workDir( workDirName );
+    fs::path heartbeatPath = workDir / ( workerName + HEARTBEAT_EXTENSION );
+    PathTracer pathTracer;
+
+    std::atomic< bool > stopHeartbeat( false );
+    std::string currentChunk;
+    std::mutex chunkMutex;
+    std::thread heartbeatThread( [&]()
+    {
+        while ( !stopHeartbeat )
+        {
+            std::string status;
+            {
+                std::lock_guard< std::mutex > lock( chunkMutex );
+                status = currentChunk.empty() ? "idle" : currentChunk + " " + std::to_string( pathTracer.GetProgress() );
+            }
+            WriteFileAtomically( heartbeatPath, status + "\n" );
+            for ( int i = 0; i < 10 && !stopHeartbeat; ++i )
+            {
+                std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+            }
+        }
+    });
+
+    bool success = true;
+    std::error_code ec;
+    while ( fs::exists( workDir, ec ) )
+    {
+        bool chunksInProgress;
+        std::string chunkName = ClaimChunk( workDir, workerName, chunksInProgress );
+        if ( chunkName.empty() )
+        {
+            // chunks being rendered by other workers might still be reassigned if they die
+            if ( !chunksInProgress )
+            {
+                break;
+            }
+            std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+            continue;
+        }
+
+        fs::path claimedPath = workDir / ( chunkName + "." + workerName + CHUNK_CLAIMED_EXTENSION );
+        int sppIteration = -1;
+        glm::ivec2 range( -1 );
+        std::ifstream in( claimedPath );
+        bool validChunk = static_cast< bool >( in >> sppIteration >> range.x >> range.y );
+        if ( !validChunk || sppIteration < 0 || sppIteration >= static_cast< int >( scene.numSamplesPerPixel.size() ) )
+        {
+            LOG_ERR( "Invalid chunk file '", claimedPath.string(), "'" );
+            success = false;
+            break;
+        }
+
+        {
+            std::lock_guard< std::mutex > lock( chunkMutex );
+            currentChunk = chunkName;
+        }
+        scene.sampleRange = range;
+        pathTracer.Render( &scene, sppIteration );
+
+        // written under a temporary name, so the coordinator never merges a partially written chunk. The name
+        // is per worker since a reassigned chunk can be saved by its old and new worker at the same time
+        std::string tileFilename = ( workDir / ( chunkName + TILE_FILE_EXTENSION ) ).string();
+        std::string tempFilename = tileFilename + "." + workerName + ".tmp";
+        if ( pathTracer.SaveTile( tempFilename ) )
+        {
+            fs::rename( tempFilename, tileFilename, ec );
+        }
+        else
+        {
+            ec = std::make_error_code( std::errc::io_error );
+        }
+        if ( ec )
+        {
+            LOG_ERR( "Could not save chunk '", tileFilename, "'" );
+            success = false;
+            break;
+        }
+        // might have been reassigned already, if this worker was too slow to send a heartbeat
+        fs::remove( claimedPath, ec );
+        {
+            std::lock_guard< std::mutex > lock( chunkMutex );
+            currentChunk.clear();
+        }
+    }
+    scene.sampleRange = glm::ivec2( -1 );
+
+    stopHeartbeat = true;
+    heartbeatThread.join();
+    fs::remove( heartbeatPath, ec );
+
+    return success;
+}
+
+} // namespace PT
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "image.hpp"
+#include "scene.hpp"
+#include "tile_file.hpp"
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+// The coordinator splits the samples of a render into chunks of disjoint sample index ranges, and workers
+// (local processes, or processes on other hosts that share the work directory) render them. All of the
+// communication goes through files in the work directory:
+//   chunk_<i>.todo              - sample range waiting for a worker. Contains "sppIteration firstSample endSample"
+//   chunk_<i>.<worker>.claimed  - chunk being rendered. Claimed by atomically renaming the .todo file
+//   chunk_<i>.pttile            - finished chunk: unnormalized sample sums (see tile_file.hpp)
+//   <worker>.heartbeat          - rewritten every second by each worker with its current chunk and progress
+// If a worker process exits with an error, or its heartbeat goes stale, the coordinator renames its claimed
+// chunks back to .todo so that another worker picks them up. Samples are seeded by their pixel and sample index,
+// so a re-rendered chunk is identical no matter which worker renders it
+struct CoordinatorSettings
+{
+    int numWorkers                = 0;  // local worker processes to launch
+    int threadsPerWorker          = 0;  // 0 == hardware threads / numWorkers
+    int chunksPerWorker           = 4;  // more chunks == less work lost when a worker dies, but more files to merge
+    float heartbeatTimeoutSeconds = 30; // a worker is considered dead when its heartbeat file is older than this
+    int maxRestarts               = 3;  // per local worker, after it exited with an error
+};
+
+// Renders SPP entry sppIteration of the scene by splitting its samples among the workers, and merges the
+// chunks into the final (normalized) image. workerCommand is the command line that starts a worker, without
+// the worker specific "--worker DIR NAME --threads N" options
+bool RunCoordinator( const Scene& scene, int sppIteration, const CoordinatorSettings& settings, const std::string& workDir,
+                     const std::string& workerCommand, TileFileHeader& header, Image& image );
+
+// Renders chunks from workDir until all of them are finished
+bool RunWorker( Scene& scene, const std::string& workDir, const std::string& workerName );
+
+} // namespace PT
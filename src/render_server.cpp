@@ -0,0 +1,609 @@
+#include "render_server.hpp"
+#include "path_tracer.hpp"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "resource/resource_manager.hpp"
+#include "utils/logger.hpp"
+#include "utils/time.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define PT_UNIX_SOCKETS
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#define PROGRESS_EVENT_INTERVAL_MS 500
+
+namespace PT
+{
+
+using JsonWriter = rapidjson::Writer< rapidjson::StringBuffer >;
+
+// One client. Requests are read by a single thread per connection, events can be sent from any thread
+class Connection
+{
+public:
+    virtual ~Connection() = default;
+
+    virtual bool ReadLine( std::string& line ) = 0;
+
+    void Send( const std::string& message )
+    {
+        std::lock_guard< std::mutex > lock( m_sendLock );
+        Write( message + "\n" );
+    }
+
+protected:
+    virtual void Write( const std::string& data ) = 0;
+
+private:
+    std::mutex m_sendLock;
+};
+
+class StdioConnection : public Connection
+{
+public:
+    explicit StdioConnection( std::streambuf* stdoutBuffer ) : m_out( stdoutBuffer ) {}
+
+    bool ReadLine( std::string& line ) override
+    {
+        return static_cast< bool >( std::getline( std::cin, line ) );
+    }
+
+protected:
+    void Write( const std::string& data ) override
+    {
+        m_out << data << std::flush;
+    }
+
+private:
+    std::ostream m_out;
+};
+
+#ifdef PT_UNIX_SOCKETS
+class SocketConnection : public Connection
+{
+public:
+    explicit SocketConnection( int fd ) : m_fd( fd ) {}
+    ~SocketConnection() { close( m_fd ); }
+
+    bool ReadLine( std::string& line ) override
+    {
+        size_t newline;
+        while ( ( newline = m_buffer.find( '\n' ) ) == std::string::npos )
+        {
+            char data[4096];
+            ssize_t size = recv( m_fd, data, sizeof( data ), 0 );
+            if ( size <= 0 )
+            {
+                return false;
+            }
+            m_buffer.append( data, size );
+        }
+        line = m_buffer.substr( 0, newline );
+        m_buffer.erase( 0, newline + 1 );
+
+        return true;
+    }
+
+    // unblocks ReadLine, so the reading thread exits
+    void Shutdown()
+    {
+        shutdown( m_fd, SHUT_RDWR );
+    }
+
+protected:
+    void Write( const std::string& data ) override
+    {
+        // the client might be gone already, which just drops the event
+        size_t sent = 0;
+        while ( sent < data.size() )
+        {
+            ssize_t size = send( m_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+            if ( size <= 0 )
+            {
+                return;
+            }
+            sent += size;
+        }
+    }
+
+private:
+    int m_fd;
+    std::string m_buffer;
+};
+#endif // #ifdef PT_UNIX_SOCKETS
+
+static std::string MakeEvent( const std::string& id, const char* event, const std::function< void( JsonWriter& ) >& addMembers = nullptr )
+{
+    rapidjson::StringBuffer buffer;
+    JsonWriter writer( buffer );
+    writer.StartObject();
+    writer.Key( "id" );
+    writer.String( id.c_str() );
+    writer.Key( "event" );
+    writer.String( event );
+    if ( addMembers )
+    {
+        addMembers( writer );
+    }
+    writer.EndObject();
+
+    return buffer.GetString();
+}
+
+static std::string MakeErrorEvent( const std::string& id, const std::string& message )
+{
+    return MakeEvent( id, "error", [&]( JsonWriter& w ) { w.Key( "message" ); w.String( message.c_str() ); } );
+}
+
+struct RenderJob
+{
+    std::string id;
+    int priority      = 0;
+    uint64_t sequence = 0;
+    std::string sceneFilename;
+    rapidjson::Document shot; // null if the job uses the scene's own settings
+    std::shared_ptr< Connection > connection;
+    std::atomic< bool > cancelled{ false };
+};
+
+struct CachedScene
+{
+    std::string filename;
+    std::vector< std::pair< std::string, fs::file_time_type > > fileTimes;
+    std::unique_ptr< Scene > scene;
+    ShotSettings sceneSettings;
+    std::unique_ptr< PathTracer > pathTracer; // kept with the scene, for its primary hit cache
+};
+
+// LRU of loaded scenes, most recently used first. Only used by the render thread
+class SceneCache
+{
+public:
+    explicit SceneCache( size_t maxScenes ) : m_maxScenes( std::max< size_t >( 1, maxScenes ) ) {}
+
+    CachedScene* Get( const std::string& filename )
+    {
+        for ( auto it = m_scenes.begin(); it != m_scenes.end(); ++it )
+        {
+            if ( it->filename != filename )
+            {
+                continue;
+            }
+            if ( IsUpToDate( *it ) )
+            {
+                m_scenes.splice( m_scenes.begin(), m_scenes, it );
+                return &m_scenes.front();
+            }
+            LOG( "Scene '", filename, "' changed on disk, reloading it" );
+            m_scenes.erase( it );
+            break;
+        }
+
+        CachedScene entry;
+        entry.filename = filename;
+        entry.scene    = std::make_unique< Scene >();
+        // the resource manager is only used to look up resources by name while loading, and each scene keeps
+        // its own references. Clearing it keeps the names of one scene from resolving to another scene's resources
+        ResourceManager::Init();
+        if ( !entry.scene->Load( filename ) )
+        {
+            return nullptr;
+        }
+        for ( const std::string& file : entry.scene->sourceFiles )
+        {
+            std::error_code ec;
+            entry.fileTimes.emplace_back( file, fs::last_write_time( file, ec ) );
+        }
+        entry.sceneSettings = entry.scene->GetShotSettings();
+        entry.pathTracer    = std::make_unique< PathTracer >();
+        entry.pathTracer->printProgress = false;
+
+        m_scenes.push_front( std::move( entry ) );
+        while ( m_scenes.size() > m_maxScenes )
+        {
+            LOG( "Evicting scene '", m_scenes.back().filename, "' from the scene cache" );
+            m_scenes.pop_back();
+        }
+
+        return &m_scenes.front();
+    }
+
+private:
+    static bool IsUpToDate( const CachedScene& entry )
+    {
+        for ( const auto& [file, time] : entry.fileTimes )
+        {
+            std::error_code ec;
+            if ( fs::last_write_time( file, ec ) != time )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    size_t m_maxScenes;
+    std::list< CachedScene > m_scenes;
+};
+
+class RenderServer
+{
+public:
+    // stdoutBuffer: the real stdout, for the events in stdin mode
+    RenderServer( const ServerSettings& settings, std::streambuf* stdoutBuffer ) :
+        m_settings( settings ), m_stdoutBuffer( stdoutBuffer ), m_cache( settings.maxCachedScenes ) {}
+
+    int Run();
+
+private:
+    void ReadRequests( std::shared_ptr< Connection > connection, bool finishJobsOnClose );
+    void HandleRequest( const std::shared_ptr< Connection >& connection, const std::string& line );
+    std::shared_ptr< RenderJob > PopJob();
+    void RenderJobs();
+    void RunJob( RenderJob& job );
+    void Stop();
+
+    ServerSettings m_settings;
+    std::streambuf* m_stdoutBuffer;
+    SceneCache m_cache;
+
+    std::mutex m_lock; // guards everything below
+    std::condition_variable m_jobAdded;
+    std::vector< std::shared_ptr< RenderJob > > m_queue;
+    std::shared_ptr< RenderJob > m_runningJob;
+    const PathTracer* m_runningPathTracer = nullptr;
+    uint64_t m_nextSequence = 0;
+    bool m_stopping         = false; // shutdown request: drop the queued jobs and exit after the running one
+    bool m_inputClosed      = false; // stdin closed: finish the queued jobs, then exit
+    std::list< std::future< void > > m_pendingSaves;
+#ifdef PT_UNIX_SOCKETS
+    int m_listenFd = -1;
+    std::vector< std::shared_ptr< SocketConnection > > m_socketConnections;
+    std::vector< std::thread > m_connectionThreads;
+#endif
+};
+
+void RenderServer::ReadRequests( std::shared_ptr< Connection > connection, bool finishJobsOnClose )
+{
+    std::string line;
+    while ( connection->ReadLine( line ) )
+    {
+        if ( line.find_first_not_of( " \t\r" ) != std::string::npos )
+        {
+            HandleRequest( connection, line );
+        }
+    }
+
+    if ( finishJobsOnClose )
+    {
+        std::lock_guard< std::mutex > lock( m_lock );
+        m_inputClosed = true;
+        m_jobAdded.notify_all();
+    }
+}
+
+void RenderServer::HandleRequest( const std::shared_ptr< Connection >& connection, const std::string& line )
+{
+    rapidjson::Document request;
+    request.Parse( line.c_str() );
+    if ( request.HasParseError() || !request.IsObject() || !request.HasMember( "command" ) || !request["command"].IsString() )
+    {
+        connection->Send( MakeErrorEvent( "", "invalid request '" + line + "'" ) );
+        return;
+    }
+    std::string command = request["command"].GetString();
+    std::string id      = request.HasMember( "id" ) && request["id"].IsString() ? request["id"].GetString() : "";
+
+    std::lock_guard< std::mutex > lock( m_lock );
+    if ( command == "render" )
+    {
+        if ( !request.HasMember( "scene" ) || !request["scene"].IsString() )
+        {
+            connection->Send( MakeErrorEvent( id, "render request without a \"scene\"" ) );
+            return;
+        }
+        auto job           = std::make_shared< RenderJob >();
+        job->id            = id;
+        job->priority      = request.HasMember( "priority" ) && request["priority"].IsInt() ? request["priority"].GetInt() : 0;
+        job->sequence      = m_nextSequence++;
+        job->sceneFilename = fs::absolute( request["scene"].GetString() ).lexically_normal().string();
+        job->connection    = connection;
+        if ( request.HasMember( "shot" ) && request["shot"].IsObject() )
+        {
+            job->shot.CopyFrom( request["shot"], job->shot.GetAllocator() );
+        }
+        m_queue.push_back( job );
+        connection->Send( MakeEvent( id, "queued", [&]( JsonWriter& w ) { w.Key( "queueLength" ); w.Uint64( m_queue.size() ); } ) );
+        m_jobAdded.notify_all();
+    }
+    else if ( command == "cancel" )
+    {
+        auto it = std::find_if( m_queue.begin(), m_queue.end(), [&]( const auto& job ) { return job->id == id; } );
+        if ( it != m_queue.end() )
+        {
+            ( *it )->connection->Send( MakeEvent( id, "cancelled" ) );
+            m_queue.erase( it );
+        }
+        else if ( m_runningJob && m_runningJob->id == id )
+        {
+            // the render thread sends the "cancelled" event once the render stopped
+            m_runningJob->cancelled = true;
+        }
+        else
+        {
+            connection->Send( MakeErrorEvent( id, "no queued or running job with this id" ) );
+        }
+    }
+    else if ( command == "status" )
+    {
+        connection->Send( MakeEvent( id, "status", [&]( JsonWriter& w )
+        {
+            w.Key( "running" );
+            w.String( m_runningJob ? m_runningJob->id.c_str() : "" );
+            w.Key( "progress" );
+            w.Double( m_runningPathTracer ? m_runningPathTracer->GetProgress() : 0 );
+            w.Key( "queueLength" );
+            w.Uint64( m_queue.size() );
+        }));
+    }
+    else if ( command == "shutdown" )
+    {
+        connection->Send( MakeEvent( id, "shutdown" ) );
+        m_stopping = true;
+        m_jobAdded.notify_all();
+    }
+    else
+    {
+        connection->Send( MakeErrorEvent( id, "unknown command '" + command + "'" ) );
+    }
+}
+
+std::shared_ptr< RenderJob > RenderServer::PopJob()
+{
+    std::unique_lock< std::mutex > lock( m_lock );
+    m_jobAdded.wait( lock, [&]() { return m_stopping || !m_queue.empty() || m_inputClosed; } );
+    if ( m_stopping || m_queue.empty() )
+    {
+        for ( const auto& job : m_queue )
+        {
+            job->connection->Send( MakeEvent( job->id, "cancelled" ) );
+        }
+        m_queue.clear();
+        return nullptr;
+    }
+
+    // highest priority first, oldest first for the same priority
+    auto it = std::min_element( m_queue.begin(), m_queue.end(), []( const auto& a, const auto& b )
+    {
+        return a->priority != b->priority ? a->priority > b->priority : a->sequence < b->sequence;
+    });
+    m_runningJob = *it;
+    m_queue.erase( it );
+
+    return m_runningJob;
+}
+
+void RenderServer::RunJob( RenderJob& job )
+{
+    auto timeStart     = Time::GetTimePoint();
+    CachedScene* entry = m_cache.Get( job.sceneFilename );
+    if ( !entry )
+    {
+        job.connection->Send( MakeErrorEvent( job.id, "could not load scene '" + job.sceneFilename + "'" ) );
+        return;
+    }
+    float loadSeconds = Time::GetDuration( timeStart ) / 1000;
+
+    // every job starts from the settings of the scene file, including its full frame or crop window and tiles,
+    // so nothing of the previous job's shot carries over
+    Scene& scene      = *entry->scene;
+    ShotSettings shot = entry->sceneSettings;
+    if ( job.shot.IsObject() )
+    {
+        scene.ParseShot( job.shot, shot );
+    }
+    scene.SetShotSettings( shot );
+    if ( scene.numSamplesPerPixel.empty() )
+    {
+        job.connection->Send( MakeErrorEvent( job.id, "no SamplesPerPixel given" ) );
+        return;
+    }
+    if ( scene.tileRange.x >= 0 )
+    {
+        job.connection->Send( MakeErrorEvent( job.id, "tiles are not supported by the server, use a cropWindow" ) );
+        return;
+    }
+    job.connection->Send( MakeEvent( job.id, "started", [&]( JsonWriter& w ) { w.Key( "sceneLoadSeconds" ); w.Double( loadSeconds ); } ) );
+
+    // progress events are sent from a separate thread, while the render uses all of the OpenMP threads
+    PathTracer& pathTracer = *entry->pathTracer;
+    std::mutex progressLock;
+    std::condition_variable progressCondition;
+    bool renderDone = false;
+    std::thread progressThread( [&]()
+    {
+        std::unique_lock< std::mutex > lock( progressLock );
+        while ( !progressCondition.wait_for( lock, std::chrono::milliseconds( PROGRESS_EVENT_INTERVAL_MS ), [&]() { return renderDone; } ) )
+        {
+            float progress = pathTracer.GetProgress();
+            job.connection->Send( MakeEvent( job.id, "progress", [&]( JsonWriter& w ) { w.Key( "progress" ); w.Double( progress ); } ) );
+        }
+    });
+    pathTracer.SetCancelFlag( &job.cancelled );
+    {
+        std::lock_guard< std::mutex > lock( m_lock );
+        m_runningPathTracer = &pathTracer;
+    }
+    bool completed = pathTracer.Render( &scene, 0 );
+    pathTracer.SetCancelFlag( nullptr );
+    {
+        std::lock_guard< std::mutex > lock( progressLock );
+        renderDone = true;
+    }
+    progressCondition.notify_one();
+    progressThread.join();
+
+    if ( !completed )
+    {
+        job.connection->Send( MakeEvent( job.id, "cancelled" ) );
+        return;
+    }
+
+    // the image is encoded while the next job renders. The "done" event is sent once it is written
+    float renderSeconds = Time::GetDuration( timeStart ) / 1000;
+    std::string filename = scene.outputImageFilename;
+    auto save            = std::make_shared< std::future< bool > >( pathTracer.SaveImageAsync( filename ) );
+    auto connection      = job.connection;
+    std::string id       = job.id;
+    m_pendingSaves.push_back( std::async( std::launch::async, [save, connection, id, filename, renderSeconds]()
+    {
+        if ( save->get() )
+        {
+            connection->Send( MakeEvent( id, "done", [&]( JsonWriter& w )
+            {
+                w.Key( "output" );
+                w.String( filename.c_str() );
+                w.Key( "seconds" );
+                w.Double( renderSeconds );
+            }));
+        }
+        else
+        {
+            connection->Send( MakeErrorEvent( id, "could not save image '" + filename + "'" ) );
+        }
+    }));
+}
+
+void RenderServer::RenderJobs()
+{
+    while ( auto job = PopJob() )
+    {
+        RunJob( *job );
+        {
+            std::lock_guard< std::mutex > lock( m_lock );
+            m_runningJob        = nullptr;
+            m_runningPathTracer = nullptr;
+        }
+        m_pendingSaves.remove_if( []( std::future< void >& f ) { return f.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready; } );
+    }
+    m_pendingSaves.clear(); // waits for the remaining saves
+}
+
+void RenderServer::Stop()
+{
+#ifdef PT_UNIX_SOCKETS
+    std::lock_guard< std::mutex > lock( m_lock );
+    if ( m_listenFd >= 0 )
+    {
+        shutdown( m_listenFd, SHUT_RDWR );
+    }
+    for ( auto& connection : m_socketConnections )
+    {
+        connection->Shutdown();
+    }
+#endif // #ifdef PT_UNIX_SOCKETS
+}
+
+int RenderServer::Run()
+{
+    std::vector< std::thread > readers;
+    if ( m_settings.socketPath.empty() )
+    {
+        LOG( "Render server reading requests from stdin" );
+        readers.emplace_back( [this]() { ReadRequests( std::make_shared< StdioConnection >( m_stdoutBuffer ), true ); } );
+        // can't unblock a read on stdin, so this thread is left to exit with the process
+        readers.back().detach();
+    }
+    else
+    {
+#ifdef PT_UNIX_SOCKETS
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if ( m_settings.socketPath.size() >= sizeof( address.sun_path ) )
+        {
+            LOG_ERR( "Socket path '", m_settings.socketPath, "' is too long" );
+            return 1;
+        }
+        strcpy( address.sun_path, m_settings.socketPath.c_str() );
+        unlink( m_settings.socketPath.c_str() );
+        m_listenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( m_listenFd < 0 || bind( m_listenFd, reinterpret_cast< sockaddr* >( &address ), sizeof( address ) ) || listen( m_listenFd, 16 ) )
+        {
+            LOG_ERR( "Could not listen on socket '", m_settings.socketPath, "'" );
+            return 1;
+        }
+        LOG( "Render server listening on '", m_settings.socketPath, "'" );
+
+        readers.emplace_back( [this]()
+        {
+            int fd;
+            while ( ( fd = accept( m_listenFd, nullptr, nullptr ) ) >= 0 )
+            {
+                auto connection = std::make_shared< SocketConnection >( fd );
+                std::lock_guard< std::mutex > lock( m_lock );
+                m_socketConnections.push_back( connection );
+                m_connectionThreads.emplace_back( [this, connection]() { ReadRequests( connection, false ); } );
+            }
+        });
+#else // #ifdef PT_UNIX_SOCKETS
+        LOG_ERR( "Unix domain sockets are not supported on this platform, use stdin instead" );
+        return 1;
+#endif // #else // #ifdef PT_UNIX_SOCKETS
+    }
+
+    RenderJobs();
+
+    Stop();
+    for ( auto& reader : readers )
+    {
+        if ( reader.joinable() )
+        {
+            reader.join();
+        }
+    }
+#ifdef PT_UNIX_SOCKETS
+    // the accept thread is done, so no more connection threads get added
+    for ( auto& thread : m_connectionThreads )
+    {
+        thread.join();
+    }
+    if ( m_listenFd >= 0 )
+    {
+        close( m_listenFd );
+        unlink( m_settings.socketPath.c_str() );
+    }
+#endif // #ifdef PT_UNIX_SOCKETS
+    LOG( "Render server stopped" );
+
+    return 0;
+}
+
+int RunRenderServer( const ServerSettings& settings )
+{
+    // stdout is the event stream
+    StdoutToStderrRedirect redirect( settings.socketPath.empty() );
+    RenderServer server( settings, redirect.GetStdoutBuffer() );
+
+    return server.Run();
+}
+
+} // namespace PT
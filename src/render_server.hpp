@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace PT
+{
+
+// Long running render server, so that jobs do not pay for parsing the scene, importing models and building the
+// BVH every time. Requests are newline separated JSON objects, read from stdin or from a Unix domain socket:
+//   { "command": "render", "id": "job0", "scene": "scenes/cornell.json", "priority": 1, "shot": { ... } }
+//   { "command": "cancel", "id": "job0" }
+//   { "command": "status" }
+//   { "command": "shutdown" }
+// "shot" is optional and uses the shot schema (see Scene::LoadShots): "Camera", "OutputImageData" and
+// "SamplesPerPixel" (only the first SPP entry is rendered). A shot only applies to its own job, and "tiles" are not
+// supported (a "cropWindow" renders and saves just that window). Jobs with a higher priority are rendered first,
+// jobs with the same priority in the order they arrived.
+// Every event is sent back as a newline separated JSON object on the connection the job came from:
+//   { "id": "job0", "event": "queued" | "started" | "progress" | "done" | "cancelled" | "error", ... }
+// Loaded scenes (with their models, textures and BVH) are kept in an LRU cache keyed by the scene file path.
+// A cached scene is reloaded if the modification time of any file it was loaded from changed.
+// The texture cache (see texture_cache.hpp) is shared by the whole process. A scene's "TextureCache" block decides
+// whether that scene's textures are streamed, and the cache keeps the budget of the last scene that set one
+struct ServerSettings
+{
+    std::string socketPath;     // empty == requests from stdin, events to stdout (logging goes to stderr)
+    size_t maxCachedScenes = 4;
+};
+
+// Returns the process exit code once a "shutdown" request was received, or stdin was closed and all jobs are done
+int RunRenderServer( const ServerSettings& settings );
+
+} // namespace PT
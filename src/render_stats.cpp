@@ -0,0 +1,140 @@
+#include "render_stats.hpp"
+#include "utils/logger.hpp"
+#include <cstdio>
+
+namespace PT
+{
+
+void RayStats::Add( const RayStats& other )
+{
+    rays           += other.rays;
+    hits           += other.hits;
+    nodesVisited   += other.nodesVisited;
+    primitiveTests += other.primitiveTests;
+}
+
+void RenderStats::Add( const RenderStats& other )
+{
+    paths += other.paths;
+    for ( int depth = 0; depth < MAX_STATS_DEPTH; ++depth )
+    {
+        closestHit[depth].Add( other.closestHit[depth] );
+        shadow[depth].Add( other.shadow[depth] );
+    }
+}
+
+RayStats RenderStats::TotalClosestHit() const
+{
+    RayStats total;
+    for ( const RayStats& stats : closestHit )
+    {
+        total.Add( stats );
+    }
+
+    return total;
+}
+
+RayStats RenderStats::TotalShadow() const
+{
+    RayStats total;
+    for ( const RayStats& stats : shadow )
+    {
+        total.Add( stats );
+    }
+
+    return total;
+}
+
+#if USING( RENDER_STATS )
+
+thread_local int t_renderStatsDepth = 0;
+
+void ResetRenderStats()
+{
+    PerThread< RenderStats >::ForEach( []( RenderStats& threadStats ) { threadStats = RenderStats(); } );
+}
+
+RenderStats GatherRenderStats()
+{
+    RenderStats total;
+    PerThread< RenderStats >::ForEach( [&total]( const RenderStats& threadStats ) { total.Add( threadStats ); } );
+
+    return total;
+}
+
+void GetThreadTraversalTotals( uint64_t& nodesVisited, uint64_t& primitiveTests )
+{
+    const RenderStats& stats = ThreadRenderStats();
+    nodesVisited             = 0;
+    primitiveTests           = 0;
+    for ( int depth = 0; depth < MAX_STATS_DEPTH; ++depth )
+    {
+        nodesVisited   += stats.closestHit[depth].nodesVisited + stats.shadow[depth].nodesVisited;
+        primitiveTests += stats.closestHit[depth].primitiveTests + stats.shadow[depth].primitiveTests;
+    }
+}
+
+#else // #if USING( RENDER_STATS )
+
+void GetThreadTraversalTotals( uint64_t& nodesVisited, uint64_t& primitiveTests )
+{
+    nodesVisited   = 0;
+    primitiveTests = 0;
+}
+
+void ResetRenderStats()
+{
+}
+
+RenderStats GatherRenderStats()
+{
+    return RenderStats();
+}
+
+#endif // #else // #if USING( RENDER_STATS )
+
+static double PerRay( uint64_t count, uint64_t rays )
+{
+    return rays ? static_cast< double >( count ) / rays : 0;
+}
+
+void LogRenderStats( const RenderStats& stats, float renderSeconds )
+{
+#if USING( RENDER_STATS )
+    RayStats closest   = stats.TotalClosestHit();
+    RayStats shadow    = stats.TotalShadow();
+    uint64_t numRays   = closest.rays + shadow.rays;
+    double mraysPerSec = renderSeconds > 0 ? numRays / 1e6 / renderSeconds : 0;
+
+    char line[256];
+    LOG( "Ray stats: ", numRays, " rays (", closest.rays, " closest hit, ", shadow.rays, " shadow) for ", stats.paths, " paths" );
+    snprintf( line, sizeof( line ), "%.2f Mrays/s, %.2f rays per path", mraysPerSec, PerRay( numRays, stats.paths ) );
+    LOG( "  ", line );
+    snprintf( line, sizeof( line ), "closest hit: %.1f nodes, %.2f primitive tests per ray, %.1f%% hit", PerRay( closest.nodesVisited, closest.rays ),
+        PerRay( closest.primitiveTests, closest.rays ), 100 * PerRay( closest.hits, closest.rays ) );
+    LOG( "  ", line );
+    snprintf( line, sizeof( line ), "shadow:      %.1f nodes, %.2f primitive tests per ray, %.1f%% occluded", PerRay( shadow.nodesVisited, shadow.rays ),
+        PerRay( shadow.primitiveTests, shadow.rays ), 100 * PerRay( shadow.hits, shadow.rays ) );
+    LOG( "  ", line );
+
+    LOG( "  depth   closest rays  nodes/ray  prims/ray    shadow rays  nodes/ray  prims/ray" );
+    for ( int depth = 0; depth < MAX_STATS_DEPTH; ++depth )
+    {
+        const RayStats& c = stats.closestHit[depth];
+        const RayStats& s = stats.shadow[depth];
+        if ( c.rays == 0 && s.rays == 0 )
+        {
+            continue;
+        }
+        snprintf( line, sizeof( line ), "%5d%s%14llu%11.1f%11.2f%15llu%11.1f%11.2f", depth, depth == MAX_STATS_DEPTH - 1 ? "+" : " ",
+            static_cast< unsigned long long >( c.rays ), PerRay( c.nodesVisited, c.rays ), PerRay( c.primitiveTests, c.rays ),
+            static_cast< unsigned long long >( s.rays ), PerRay( s.nodesVisited, s.rays ), PerRay( s.primitiveTests, s.rays ) );
+        LOG( "  ", line );
+    }
+#else // #if USING( RENDER_STATS )
+    (void)stats;
+    (void)renderSeconds;
+#endif // #else // #if USING( RENDER_STATS )
+}
+
+} // namespace PT
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "core_defines.hpp"
+#include "utils/per_thread.hpp"
+#include <cstdint>
+
+// Ray and traversal counters. Each thread counts into its own RenderStats, which are only summed up when the
+// render is done, so there is no synchronization on the hot path. Turn off to compile the counters out entirely
+#define RENDER_STATS IN_USE
+
+// bounces at or beyond this depth are counted in the last bucket
+#define MAX_STATS_DEPTH 16
+
+namespace PT
+{
+
+struct RayStats
+{
+    uint64_t rays           = 0;
+    uint64_t hits           = 0;
+    uint64_t nodesVisited   = 0; // BVH nodes whose AABB was tested
+    uint64_t primitiveTests = 0;
+
+    void Add( const RayStats& other );
+};
+
+struct RenderStats
+{
+    uint64_t paths = 0; // calls to Li()
+    RayStats closestHit[MAX_STATS_DEPTH];
+    RayStats shadow[MAX_STATS_DEPTH];
+
+    void Add( const RenderStats& other );
+    RayStats TotalClosestHit() const;
+    RayStats TotalShadow() const;
+};
+
+#if USING( RENDER_STATS )
+
+// bounce of the path currently traced by this thread. A plain int, so that accessing it does not go through the TLS
+// initialization wrapper functions that a thread_local with a constructor would need
+extern thread_local int t_renderStatsDepth;
+
+// counters of the calling thread, registered so that GatherRenderStats can find them
+inline RenderStats& ThreadRenderStats()
+{
+    return PerThread< RenderStats >::Get();
+}
+
+inline void AddRayStats( RayStats& stats, uint32_t nodesVisited, uint32_t primitiveTests, bool hit )
+{
+    stats.rays           += 1;
+    stats.hits           += hit;
+    stats.nodesVisited   += nodesVisited;
+    stats.primitiveTests += primitiveTests;
+}
+
+#define STATS_ONLY( ... ) __VA_ARGS__
+#define STATS_SET_DEPTH( d ) PT::t_renderStatsDepth = ( d ) < MAX_STATS_DEPTH ? ( d ) : MAX_STATS_DEPTH - 1
+#define STATS_ADD_PATH() ++PT::ThreadRenderStats().paths
+#define STATS_ADD_CLOSEST_HIT_RAY( nodes, prims, hit ) PT::AddRayStats( PT::ThreadRenderStats().closestHit[PT::t_renderStatsDepth], nodes, prims, hit )
+#define STATS_ADD_SHADOW_RAY( nodes, prims, hit ) PT::AddRayStats( PT::ThreadRenderStats().shadow[PT::t_renderStatsDepth], nodes, prims, hit )
+
+#else // #if USING( RENDER_STATS )
+
+#define STATS_ONLY( ... )
+#define STATS_SET_DEPTH( d )
+#define STATS_ADD_PATH()
+#define STATS_ADD_CLOSEST_HIT_RAY( nodes, prims, hit )
+#define STATS_ADD_SHADOW_RAY( nodes, prims, hit )
+
+#endif // #else // #if USING( RENDER_STATS )
+
+// Nodes visited and primitive tests of every ray traced by the calling thread so far (all zero without RENDER_STATS).
+// The difference before and after a pixel is its traversal cost, for the cost heatmaps
+void GetThreadTraversalTotals( uint64_t& nodesVisited, uint64_t& primitiveTests );
+
+// Zeroes the counters of every thread. Should not be called while rendering
+void ResetRenderStats();
+
+// Sums up the counters of every thread. Should not be called while rendering
+RenderStats GatherRenderStats();
+
+// Logs the totals, Mrays/s and the per bounce breakdown
+void LogRenderStats( const RenderStats& stats, float renderSeconds );
+
+} // namespace PT
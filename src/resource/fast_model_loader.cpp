@@ -0,0 +1,1045 @@
+#include "resource/fast_model_loader.hpp"
+#include "utils/logger.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/time.hpp"
+#include "utils/trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+// bytes of an .obj file parsed by one task. Chunks start at the first line after the split
+#define OBJ_CHUNK_BYTES ( 4 * 1024 * 1024 )
+// vt / vn index of a face corner that doesn't have one
+#define OBJ_NO_INDEX INT32_MIN
+
+namespace fs = std::filesystem;
+
+namespace PT
+{
+
+static bool IsSpace( char c )
+{
+    return c == ' ' || c == '\t';
+}
+
+static bool IsDigit( char c )
+{
+    return static_cast< unsigned >( c - '0' ) < 10;
+}
+
+static const char* SkipSpaces( const char* p, const char* end )
+{
+    while ( p < end && IsSpace( *p ) )
+    {
+        ++p;
+    }
+    return p;
+}
+
+static const char* NextLine( const char* p, const char* end )
+{
+    const char* newLine = static_cast< const char* >( memchr( p, '\n', end - p ) );
+    return newLine ? newLine + 1 : end;
+}
+
+static bool StartsWith( const char* p, const char* end, const char* prefix )
+{
+    size_t length = strlen( prefix );
+    return static_cast< size_t >( end - p ) >= length && !memcmp( p, prefix, length );
+}
+
+// Decimal float with an optional sign, fraction and exponent. The first 19 significant digits are gathered into an
+// integer and scaled by an exact power of 10 in double precision, so the float is rounded correctly for all of
+// the numbers model files are written with. nullptr (instead of the end of the number) if there is no number
+static const char* ParseFloat( const char* p, const char* end, float& value )
+{
+    static const double s_powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    bool negative = false;
+    if ( p < end && ( *p == '-' || *p == '+' ) )
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int exponent      = 0;
+    int numDigits     = 0;
+    bool anyDigits    = false;
+    for ( ; p < end && IsDigit( *p ); ++p )
+    {
+        if ( numDigits < 19 )
+        {
+            mantissa   = 10 * mantissa + ( *p - '0' );
+            numDigits += mantissa != 0;
+        }
+        else
+        {
+            ++exponent;
+        }
+        anyDigits = true;
+    }
+    if ( p < end && *p == '.' )
+    {
+        for ( ++p; p < end && IsDigit( *p ); ++p )
+        {
+            if ( numDigits < 19 )
+            {
+                mantissa   = 10 * mantissa + ( *p - '0' );
+                numDigits += mantissa != 0;
+                --exponent;
+            }
+            anyDigits = true;
+        }
+    }
+    if ( !anyDigits )
+    {
+        return nullptr;
+    }
+    if ( p < end && ( *p == 'e' || *p == 'E' ) )
+    {
+        ++p;
+        bool negativeExponent = false;
+        if ( p < end && ( *p == '-' || *p == '+' ) )
+        {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if ( p == end || !IsDigit( *p ) )
+        {
+            return nullptr;
+        }
+        int e = 0;
+        for ( ; p < end && IsDigit( *p ); ++p )
+        {
+            e = std::min( 10 * e + ( *p - '0' ), 100000 );
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double d = static_cast< double >( mantissa );
+    if ( mantissa == 0 )
+    {
+        d = 0;
+    }
+    else if ( exponent >= 0 && exponent <= 22 )
+    {
+        d *= s_powersOf10[exponent];
+    }
+    else if ( exponent < 0 && exponent >= -22 )
+    {
+        d /= s_powersOf10[-exponent];
+    }
+    else
+    {
+        d *= std::pow( 10.0, exponent );
+    }
+    value = static_cast< float >( negative ? -d : d );
+
+    return p;
+}
+
+static const char* ParseInt( const char* p, const char* end, int64_t& value )
+{
+    bool negative = p < end && *p == '-';
+    if ( p < end && ( *p == '-' || *p == '+' ) )
+    {
+        ++p;
+    }
+    if ( p == end || !IsDigit( *p ) )
+    {
+        return nullptr;
+    }
+    int64_t v = 0;
+    for ( ; p < end && IsDigit( *p ); ++p )
+    {
+        v = std::min< int64_t >( 10 * v + ( *p - '0' ), INT64_C( 1 ) << 40 );
+    }
+    value = negative ? -v : v;
+
+    return p;
+}
+
+static std::shared_ptr< Material > CreateDefaultMaterial()
+{
+    auto material    = std::make_shared< Material >();
+    material->name   = "DefaultMaterial";
+    material->albedo = glm::vec3( 0.6f );
+
+    return material;
+}
+
+// Gives every triangle its own three vertices. Assimp imports meshes without normals that way and generates face
+// normals for them, so files without normals are faceted, not smoothed over the vertices the faces share
+static void UnshareVertices( Mesh& mesh )
+{
+    int64_t numCorners = static_cast< int64_t >( mesh.indices.size() );
+    std::vector< glm::vec3 > vertices( numCorners );
+    std::vector< glm::vec2 > uvs( numCorners );
+    #pragma omp parallel for
+    for ( int64_t i = 0; i < numCorners; ++i )
+    {
+        vertices[i]     = mesh.vertices[mesh.indices[i]];
+        uvs[i]          = mesh.uvs[mesh.indices[i]];
+        mesh.indices[i] = static_cast< uint32_t >( i );
+    }
+    mesh.vertices = std::move( vertices );
+    mesh.uvs      = std::move( uvs );
+}
+
+static void SetSingleMesh( Mesh&& mesh, const std::string& filename, ModelCacheContents& contents )
+{
+    if ( mesh.normals.empty() )
+    {
+        UnshareVertices( mesh );
+    }
+    contents = {};
+    mesh.name = fs::path( filename ).stem().string();
+    contents.meshes.push_back( std::move( mesh ) );
+    contents.meshMaterials      = { 0 };
+    contents.materials          = { CreateDefaultMaterial() };
+    contents.albedoTextureNames = { "" };
+    contents.sourceFiles        = { filename };
+}
+
+// indices of a face corner. Positive ones are 0 based into the whole file, while parsing the chunk, negative
+// ones are turned into 0 based indices relative to the chunk's first element (so possibly negative), until the
+// chunks are joined
+struct ObjCorner
+{
+    int32_t v;
+    int32_t vt;
+    int32_t vn;
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+    std::vector< glm::vec3 > positions;
+    std::vector< glm::vec2 > uvs;
+    std::vector< glm::vec3 > normals;
+    std::vector< ObjCorner > corners; // 3 per triangle
+    bool absoluteIndices = false;
+    bool relativeIndices = false;
+    std::string unsupported; // why the loader can't handle the file, empty == fine
+
+    // how the corners use the attributes, found once the indices are resolved
+    bool invalidIndices   = false;
+    bool anyUvs           = false;
+    bool anyNoUvs         = false;
+    bool anyNormals       = false;
+    bool anyNoNormals     = false;
+    bool uvsMatchVertices = true; // every vt index == the v index
+    bool normalsMatchVertices = true;
+};
+
+static bool ParseObjIndex( const char*& p, const char* end, size_t numInChunk, int32_t& index, ObjChunk& chunk )
+{
+    int64_t value;
+    p = ParseInt( p, end, value );
+    if ( !p || value == 0 || value > INT32_MAX || value < -INT32_MAX )
+    {
+        return false;
+    }
+    if ( value > 0 )
+    {
+        index                 = static_cast< int32_t >( value - 1 );
+        chunk.absoluteIndices = true;
+    }
+    else
+    {
+        index                 = static_cast< int32_t >( static_cast< int64_t >( numInChunk ) + value );
+        chunk.relativeIndices = true;
+    }
+
+    return true;
+}
+
+static const char* ParseObjFace( const char* p, const char* end, ObjChunk& chunk )
+{
+    ObjCorner first = {};
+    ObjCorner prev  = {};
+    for ( int n = 0; ; ++n )
+    {
+        p = SkipSpaces( p, end );
+        if ( p == end || *p == '\n' || *p == '\r' || *p == '#' )
+        {
+            break;
+        }
+        ObjCorner corner = { 0, OBJ_NO_INDEX, OBJ_NO_INDEX };
+        if ( !ParseObjIndex( p, end, chunk.positions.size(), corner.v, chunk ) )
+        {
+            return nullptr;
+        }
+        if ( p < end && *p == '/' )
+        {
+            ++p;
+            if ( p < end && *p != '/' && !ParseObjIndex( p, end, chunk.uvs.size(), corner.vt, chunk ) )
+            {
+                return nullptr;
+            }
+            if ( p < end && *p == '/' )
+            {
+                ++p;
+                if ( !ParseObjIndex( p, end, chunk.normals.size(), corner.vn, chunk ) )
+                {
+                    return nullptr;
+                }
+            }
+        }
+        if ( p < end && !IsSpace( *p ) && *p != '\n' && *p != '\r' )
+        {
+            return nullptr;
+        }
+
+        if ( n == 0 )
+        {
+            first = corner;
+        }
+        else if ( n >= 2 )
+        {
+            chunk.corners.push_back( first );
+            chunk.corners.push_back( prev );
+            chunk.corners.push_back( corner );
+        }
+        prev = corner;
+    }
+
+    return p;
+}
+
+static const char* ParseObjFloats( const char* p, const char* end, float* values, int numRequired, int numOptional )
+{
+    for ( int i = 0; i < numRequired + numOptional; ++i )
+    {
+        const char* start = SkipSpaces( p, end );
+        const char* next  = ParseFloat( start, end, values[i] );
+        if ( !next )
+        {
+            return i < numRequired ? nullptr : p;
+        }
+        p = next;
+    }
+
+    return p;
+}
+
+static void ParseObjChunk( ObjChunk& chunk )
+{
+    TRACE_ZONE( "ParseObjChunk" );
+    const char* end = chunk.end;
+    for ( const char* p = chunk.begin; p < end; p = NextLine( p, end ) )
+    {
+        p = SkipSpaces( p, end );
+        if ( end - p < 2 )
+        {
+            continue;
+        }
+        const char* lineStart = p;
+        if ( p[0] == 'v' && IsSpace( p[1] ) )
+        {
+            glm::vec3 position;
+            p = ParseObjFloats( p + 2, end, &position.x, 3, 0 );
+            chunk.positions.push_back( position );
+        }
+        else if ( p[0] == 'v' && p[1] == 't' && end - p > 2 && IsSpace( p[2] ) )
+        {
+            glm::vec2 uv( 0 );
+            p = ParseObjFloats( p + 3, end, &uv.x, 1, 1 );
+            chunk.uvs.push_back( uv );
+        }
+        else if ( p[0] == 'v' && p[1] == 'n' && end - p > 2 && IsSpace( p[2] ) )
+        {
+            glm::vec3 normal;
+            p = ParseObjFloats( p + 3, end, &normal.x, 3, 0 );
+            chunk.normals.push_back( normal );
+        }
+        else if ( p[0] == 'f' && IsSpace( p[1] ) )
+        {
+            p = ParseObjFace( p + 2, end, chunk );
+        }
+        else if ( StartsWith( p, end, "mtllib" ) || StartsWith( p, end, "usemtl" ) )
+        {
+            chunk.unsupported = "materials";
+            return;
+        }
+
+        if ( !p )
+        {
+            const char* lineEnd = std::find( lineStart, end, '\n' );
+            chunk.unsupported   = "the line '" + std::string( lineStart, std::min< size_t >( lineEnd - lineStart, 64 ) ) + "'";
+            return;
+        }
+    }
+}
+
+// Turns the chunks' indices into indices of the whole file, checks them, and finds how the corners use the uvs and normals
+static void ResolveObjIndices( ObjChunk& chunk, int64_t firstPosition, int64_t firstUv, int64_t firstNormal, int64_t numPositions, int64_t numUvs, int64_t numNormals )
+{
+    if ( !chunk.relativeIndices )
+    {
+        firstPosition = firstUv = firstNormal = 0;
+    }
+    for ( ObjCorner& corner : chunk.corners )
+    {
+        int64_t v = corner.v + firstPosition;
+        chunk.invalidIndices |= v < 0 || v >= numPositions;
+        corner.v = static_cast< int32_t >( v );
+        if ( corner.vt == OBJ_NO_INDEX )
+        {
+            chunk.anyNoUvs = true;
+        }
+        else
+        {
+            int64_t vt = corner.vt + firstUv;
+            chunk.invalidIndices   |= vt < 0 || vt >= numUvs;
+            chunk.uvsMatchVertices &= vt == v;
+            chunk.anyUvs            = true;
+            corner.vt               = static_cast< int32_t >( vt );
+        }
+        if ( corner.vn == OBJ_NO_INDEX )
+        {
+            chunk.anyNoNormals = true;
+        }
+        else
+        {
+            int64_t vn = corner.vn + firstNormal;
+            chunk.invalidIndices       |= vn < 0 || vn >= numNormals;
+            chunk.normalsMatchVertices &= vn == v;
+            chunk.anyNormals            = true;
+            corner.vn                   = static_cast< int32_t >( vn );
+        }
+    }
+}
+
+// one array of the whole file out of the chunks' arrays, which are freed. Empty if the array isn't needed
+template < typename T >
+static std::vector< T > JoinChunkArrays( std::vector< ObjChunk >& chunks, std::vector< T > ObjChunk::*member, bool needed )
+{
+    std::vector< size_t > offsets( chunks.size() + 1, 0 );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        offsets[i + 1] = offsets[i] + ( chunks[i].*member ).size();
+    }
+    std::vector< T > joined( needed ? offsets.back() : 0 );
+    int numChunks = static_cast< int >( chunks.size() );
+    #pragma omp parallel for schedule( dynamic, 1 )
+    for ( int i = 0; i < numChunks; ++i )
+    {
+        if ( needed )
+        {
+            std::copy( ( chunks[i].*member ).begin(), ( chunks[i].*member ).end(), joined.begin() + offsets[i] );
+        }
+        std::vector< T >().swap( chunks[i].*member );
+    }
+
+    return joined;
+}
+
+struct ObjVertexKey
+{
+    int32_t v, vt, vn;
+    bool operator==( const ObjVertexKey& k ) const { return v == k.v && vt == k.vt && vn == k.vn; }
+};
+
+struct ObjVertexKeyHash
+{
+    size_t operator()( const ObjVertexKey& k ) const
+    {
+        uint64_t h = static_cast< uint32_t >( k.v ) * 0x9E3779B97F4A7C15ull;
+        h ^= ( static_cast< uint64_t >( static_cast< uint32_t >( k.vt ) ) << 32 | static_cast< uint32_t >( k.vn ) ) * 0xC2B2AE3D27D4EB4Full;
+        return static_cast< size_t >( h ^ ( h >> 29 ) );
+    }
+};
+
+static bool LoadObj( const std::string& filename, const MappedFile& file, ModelCacheContents& contents )
+{
+    const char* data = file.Data();
+    const char* end  = data + file.Size();
+    std::vector< ObjChunk > chunks;
+    for ( const char* p = data; p < end; )
+    {
+        ObjChunk chunk;
+        chunk.begin = p;
+        chunk.end   = end - p > OBJ_CHUNK_BYTES ? NextLine( p + OBJ_CHUNK_BYTES, end ) : end;
+        p           = chunk.end;
+        chunks.push_back( std::move( chunk ) );
+    }
+    int numChunks = static_cast< int >( chunks.size() );
+    #pragma omp parallel for schedule( dynamic, 1 )
+    for ( int i = 0; i < numChunks; ++i )
+    {
+        ParseObjChunk( chunks[i] );
+    }
+
+    int64_t numPositions = 0, numUvs = 0, numNormals = 0, numCorners = 0;
+    std::vector< int64_t > firstPositions( numChunks ), firstUvs( numChunks ), firstNormals( numChunks );
+    for ( int i = 0; i < numChunks; ++i )
+    {
+        const ObjChunk& chunk = chunks[i];
+        if ( !chunk.unsupported.empty() || ( chunk.absoluteIndices && chunk.relativeIndices ) )
+        {
+            LOG( "'", filename, "' has ", chunk.unsupported.empty() ? "both absolute and relative indices" : chunk.unsupported,
+                ", which the native loader doesn't handle. Importing it with Assimp" );
+            return false;
+        }
+        firstPositions[i] = numPositions;
+        firstUvs[i]       = numUvs;
+        firstNormals[i]   = numNormals;
+        numPositions     += chunk.positions.size();
+        numUvs           += chunk.uvs.size();
+        numNormals       += chunk.normals.size();
+        numCorners       += chunk.corners.size();
+    }
+    // the corners have to fit the 32 bit indices, for files whose vertices end up one per corner
+    if ( numCorners == 0 || numCorners > UINT32_MAX )
+    {
+        return false;
+    }
+
+    #pragma omp parallel for schedule( dynamic, 1 )
+    for ( int i = 0; i < numChunks; ++i )
+    {
+        ResolveObjIndices( chunks[i], firstPositions[i], firstUvs[i], firstNormals[i], numPositions, numUvs, numNormals );
+    }
+    bool anyUvs = false, anyNoUvs = false, anyNormals = false, anyNoNormals = false;
+    bool uvsMatchVertices = true, normalsMatchVertices = true;
+    for ( const ObjChunk& chunk : chunks )
+    {
+        if ( chunk.invalidIndices )
+        {
+            return false;
+        }
+        anyUvs               |= chunk.anyUvs;
+        anyNoUvs             |= chunk.anyNoUvs;
+        anyNormals           |= chunk.anyNormals;
+        anyNoNormals         |= chunk.anyNoNormals;
+        uvsMatchVertices     &= chunk.uvsMatchVertices;
+        normalsMatchVertices &= chunk.normalsMatchVertices;
+    }
+    // files where only some of the faces have uvs or normals are rare, the others get zero uvs / recalculated normals
+    bool hasUvs     = anyUvs && !anyNoUvs;
+    bool hasNormals = anyNormals && !anyNoNormals;
+
+    std::vector< glm::vec3 > positions = JoinChunkArrays( chunks, &ObjChunk::positions, true );
+    std::vector< glm::vec2 > uvs       = JoinChunkArrays( chunks, &ObjChunk::uvs, hasUvs );
+    std::vector< glm::vec3 > normals   = JoinChunkArrays( chunks, &ObjChunk::normals, hasNormals );
+    std::vector< size_t > firstCorners( numChunks + 1, 0 );
+    for ( int i = 0; i < numChunks; ++i )
+    {
+        firstCorners[i + 1] = firstCorners[i] + chunks[i].corners.size();
+    }
+
+    Mesh mesh;
+    mesh.indices.resize( numCorners );
+    if ( ( !hasUvs || uvsMatchVertices ) && ( !hasNormals || normalsMatchVertices ) )
+    {
+        // every vertex of the file is one vertex of the mesh, the common case, and the one that needs no lookups
+        #pragma omp parallel for schedule( dynamic, 1 )
+        for ( int i = 0; i < numChunks; ++i )
+        {
+            uint32_t* indices = mesh.indices.data() + firstCorners[i];
+            for ( const ObjCorner& corner : chunks[i].corners )
+            {
+                *indices++ = static_cast< uint32_t >( corner.v );
+            }
+            std::vector< ObjCorner >().swap( chunks[i].corners );
+        }
+        mesh.vertices = std::move( positions );
+        mesh.uvs      = std::move( uvs );
+        mesh.uvs.resize( mesh.vertices.size(), glm::vec2( 0 ) );
+        if ( hasNormals )
+        {
+            mesh.normals = std::move( normals );
+            mesh.normals.resize( mesh.vertices.size(), glm::vec3( 0, 0, 1 ) );
+        }
+    }
+    else
+    {
+        // one mesh vertex per distinct v/vt/vn. Most positions only ever appear with one uv and normal, so the first
+        // vertex of every position is found directly, and only the others go through the map
+        TRACE_ZONE( "JoinObjVertices" );
+        std::vector< uint32_t > firstVertex( numPositions, UINT32_MAX );
+        std::vector< ObjVertexKey > vertexKeys;
+        std::unordered_map< ObjVertexKey, uint32_t, ObjVertexKeyHash > otherVertices;
+        size_t corner = 0;
+        for ( ObjChunk& chunk : chunks )
+        {
+            for ( const ObjCorner& c : chunk.corners )
+            {
+                ObjVertexKey key = { c.v, hasUvs ? c.vt : OBJ_NO_INDEX, hasNormals ? c.vn : OBJ_NO_INDEX };
+                uint32_t& first  = firstVertex[c.v];
+                uint32_t index;
+                if ( first != UINT32_MAX && vertexKeys[first] == key )
+                {
+                    index = first;
+                }
+                else
+                {
+                    auto it = first == UINT32_MAX ? otherVertices.end() : otherVertices.find( key );
+                    if ( it != otherVertices.end() )
+                    {
+                        index = it->second;
+                    }
+                    else
+                    {
+                        index = static_cast< uint32_t >( vertexKeys.size() );
+                        vertexKeys.push_back( key );
+                        if ( first == UINT32_MAX )
+                        {
+                            first = index;
+                        }
+                        else
+                        {
+                            otherVertices[key] = index;
+                        }
+                    }
+                }
+                mesh.indices[corner++] = index;
+            }
+            std::vector< ObjCorner >().swap( chunk.corners );
+        }
+
+        int64_t numVertices = static_cast< int64_t >( vertexKeys.size() );
+        mesh.vertices.resize( numVertices );
+        mesh.uvs.resize( numVertices, glm::vec2( 0 ) );
+        if ( hasNormals )
+        {
+            mesh.normals.resize( numVertices );
+        }
+        #pragma omp parallel for
+        for ( int64_t i = 0; i < numVertices; ++i )
+        {
+            const ObjVertexKey& key = vertexKeys[i];
+            mesh.vertices[i] = positions[key.v];
+            if ( hasUvs )
+            {
+                mesh.uvs[i] = uvs[key.vt];
+            }
+            if ( hasNormals )
+            {
+                mesh.normals[i] = normals[key.vn];
+            }
+        }
+    }
+    SetSingleMesh( std::move( mesh ), filename, contents );
+
+    return true;
+}
+
+enum class PlyType
+{
+    INT8,
+    UINT8,
+    INT16,
+    UINT16,
+    INT32,
+    UINT32,
+    FLOAT32,
+    FLOAT64,
+    INVALID
+};
+
+static PlyType ParsePlyType( const std::string& name )
+{
+    static const std::pair< const char*, PlyType > s_types[] = {
+        { "char", PlyType::INT8 }, { "int8", PlyType::INT8 }, { "uchar", PlyType::UINT8 }, { "uint8", PlyType::UINT8 },
+        { "short", PlyType::INT16 }, { "int16", PlyType::INT16 }, { "ushort", PlyType::UINT16 }, { "uint16", PlyType::UINT16 },
+        { "int", PlyType::INT32 }, { "int32", PlyType::INT32 }, { "uint", PlyType::UINT32 }, { "uint32", PlyType::UINT32 },
+        { "float", PlyType::FLOAT32 }, { "float32", PlyType::FLOAT32 }, { "double", PlyType::FLOAT64 }, { "float64", PlyType::FLOAT64 },
+    };
+    for ( const auto& type : s_types )
+    {
+        if ( name == type.first )
+        {
+            return type.second;
+        }
+    }
+
+    return PlyType::INVALID;
+}
+
+static size_t PlyTypeSize( PlyType type )
+{
+    static const size_t s_sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return s_sizes[static_cast< int >( type )];
+}
+
+// little endian value of the given type at p, which doesn't have to be aligned
+template < typename T >
+static T ReadPlyValue( const char* p, PlyType type )
+{
+    switch ( type )
+    {
+    case PlyType::INT8: return static_cast< T >( *reinterpret_cast< const int8_t* >( p ) );
+    case PlyType::UINT8: return static_cast< T >( *reinterpret_cast< const uint8_t* >( p ) );
+    case PlyType::INT16: { int16_t v; memcpy( &v, p, sizeof( v ) ); return static_cast< T >( v ); }
+    case PlyType::UINT16: { uint16_t v; memcpy( &v, p, sizeof( v ) ); return static_cast< T >( v ); }
+    case PlyType::INT32: { int32_t v; memcpy( &v, p, sizeof( v ) ); return static_cast< T >( v ); }
+    case PlyType::UINT32: { uint32_t v; memcpy( &v, p, sizeof( v ) ); return static_cast< T >( v ); }
+    case PlyType::FLOAT32: { float v; memcpy( &v, p, sizeof( v ) ); return static_cast< T >( v ); }
+    case PlyType::FLOAT64: { double v; memcpy( &v, p, sizeof( v ) ); return static_cast< T >( v ); }
+    default: return T( 0 );
+    }
+}
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type      = PlyType::INVALID;
+    PlyType countType = PlyType::INVALID; // of list properties, INVALID for scalars
+};
+
+struct PlyElement
+{
+    std::string name;
+    uint64_t count = 0;
+    std::vector< PlyProperty > properties;
+
+    bool HasLists() const
+    {
+        return std::any_of( properties.begin(), properties.end(), []( const PlyProperty& p ) { return p.countType != PlyType::INVALID; } );
+    }
+
+    // size of one element with only scalar properties
+    size_t Stride() const
+    {
+        size_t stride = 0;
+        for ( const PlyProperty& p : properties )
+        {
+            stride += PlyTypeSize( p.type );
+        }
+        return stride;
+    }
+
+    const PlyProperty* Find( const char* propertyName ) const
+    {
+        for ( const PlyProperty& p : properties )
+        {
+            if ( p.name == propertyName )
+            {
+                return &p;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// The elements of the header, and the offset of the data that follows it. An empty reason == a header the loader handles
+static std::string ParsePlyHeader( const MappedFile& file, std::vector< PlyElement >& elements, size_t& dataOffset )
+{
+    const char* p   = file.Data();
+    const char* end = p + file.Size();
+    if ( !StartsWith( p, end, "ply" ) )
+    {
+        return "no ply header";
+    }
+    for ( p = NextLine( p, end ); p < end; p = NextLine( p, end ) )
+    {
+        const char* lineEnd = std::find( p, end, '\n' );
+        std::vector< std::string > words;
+        for ( const char* w = SkipSpaces( p, lineEnd ); w < lineEnd && *w != '\r'; w = SkipSpaces( w, lineEnd ) )
+        {
+            const char* wordEnd = std::find_if( w, lineEnd, []( char c ) { return IsSpace( c ) || c == '\r'; } );
+            words.emplace_back( w, wordEnd );
+            w = wordEnd;
+        }
+        if ( words.empty() || words[0] == "comment" || words[0] == "obj_info" )
+        {
+            continue;
+        }
+        if ( words[0] == "end_header" )
+        {
+            dataOffset = NextLine( p, end ) - file.Data();
+            return "";
+        }
+        if ( words[0] == "format" )
+        {
+            if ( words.size() < 2 || words[1] != "binary_little_endian" )
+            {
+                return "the " + ( words.size() < 2 ? std::string( "unknown" ) : words[1] ) + " format";
+            }
+        }
+        else if ( words[0] == "element" && words.size() == 3 )
+        {
+            PlyElement element;
+            element.name  = words[1];
+            element.count = std::strtoull( words[2].c_str(), nullptr, 10 );
+            elements.push_back( element );
+        }
+        else if ( words[0] == "property" && !elements.empty() )
+        {
+            PlyProperty property;
+            if ( words.size() == 5 && words[1] == "list" )
+            {
+                property.countType = ParsePlyType( words[2] );
+                property.type      = ParsePlyType( words[3] );
+                property.name      = words[4];
+                if ( property.countType == PlyType::INVALID || property.countType == PlyType::FLOAT32 || property.countType == PlyType::FLOAT64 )
+                {
+                    return "a list property with the count type '" + words[2] + "'";
+                }
+            }
+            else if ( words.size() == 3 )
+            {
+                property.type = ParsePlyType( words[1] );
+                property.name = words[2];
+            }
+            if ( property.type == PlyType::INVALID )
+            {
+                return "the property '" + words.back() + "'";
+            }
+            elements.back().properties.push_back( property );
+        }
+        else
+        {
+            return "the header line '" + std::string( p, std::min< size_t >( lineEnd - p, 64 ) ) + "'";
+        }
+    }
+
+    return "no end_header";
+}
+
+static bool LoadPly( const std::string& filename, const MappedFile& file, ModelCacheContents& contents )
+{
+    uint16_t one = 1;
+    if ( *reinterpret_cast< const uint8_t* >( &one ) != 1 )
+    {
+        LOG( "The native loader only reads .ply files on little endian machines. Importing '", filename, "' with Assimp" );
+        return false;
+    }
+    std::vector< PlyElement > elements;
+    size_t offset      = 0;
+    std::string reason = ParsePlyHeader( file, elements, offset );
+    if ( !reason.empty() )
+    {
+        LOG( "'", filename, "' has ", reason, ", which the native loader doesn't handle. Importing it with Assimp" );
+        return false;
+    }
+
+    const char* data = file.Data();
+    size_t size      = file.Size();
+    Mesh mesh;
+    bool loadedVertices = false;
+    bool loadedFaces    = false;
+    for ( const PlyElement& element : elements )
+    {
+        if ( loadedVertices && loadedFaces )
+        {
+            break;
+        }
+        if ( element.name == "vertex" && !element.HasLists() )
+        {
+            size_t stride = element.Stride();
+            // offsets of the properties in each vertex
+            size_t propertyOffset = 0;
+            std::vector< size_t > offsets;
+            for ( const PlyProperty& p : element.properties )
+            {
+                offsets.push_back( propertyOffset );
+                propertyOffset += PlyTypeSize( p.type );
+            }
+            auto find = [&]( std::initializer_list< const char* > names ) -> int {
+                for ( const char* name : names )
+                {
+                    if ( const PlyProperty* p = element.Find( name ) )
+                    {
+                        return static_cast< int >( p - element.properties.data() );
+                    }
+                }
+                return -1;
+            };
+            int position[3] = { find( { "x" } ), find( { "y" } ), find( { "z" } ) };
+            int normal[3]   = { find( { "nx" } ), find( { "ny" } ), find( { "nz" } ) };
+            int uv[2]       = { find( { "u", "s", "texture_u", "texture_s" } ), find( { "v", "t", "texture_v", "texture_t" } ) };
+            bool hasNormals = normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+            bool hasUvs     = uv[0] >= 0 && uv[1] >= 0;
+            if ( position[0] < 0 || position[1] < 0 || position[2] < 0 || element.count > ( size - offset ) / stride || element.count > INT32_MAX )
+            {
+                return false;
+            }
+
+            int64_t numVertices = static_cast< int64_t >( element.count );
+            mesh.vertices.resize( numVertices );
+            mesh.uvs.resize( numVertices, glm::vec2( 0 ) );
+            if ( hasNormals )
+            {
+                mesh.normals.resize( numVertices );
+            }
+            const char* vertexData = data + offset;
+            auto read = [&]( const char* vertex, int property ) {
+                return ReadPlyValue< float >( vertex + offsets[property], element.properties[property].type );
+            };
+            #pragma omp parallel for
+            for ( int64_t i = 0; i < numVertices; ++i )
+            {
+                const char* vertex = vertexData + i * stride;
+                mesh.vertices[i]   = glm::vec3( read( vertex, position[0] ), read( vertex, position[1] ), read( vertex, position[2] ) );
+                if ( hasNormals )
+                {
+                    mesh.normals[i] = glm::vec3( read( vertex, normal[0] ), read( vertex, normal[1] ), read( vertex, normal[2] ) );
+                }
+                if ( hasUvs )
+                {
+                    mesh.uvs[i] = glm::vec2( read( vertex, uv[0] ), read( vertex, uv[1] ) );
+                }
+            }
+            offset        += element.count * stride;
+            loadedVertices = true;
+        }
+        else if ( element.name == "face" && loadedVertices )
+        {
+            // the vertex index list, and fixed size scalars before and after it
+            size_t listIndex = element.properties.size();
+            size_t before = 0, after = 0;
+            for ( size_t i = 0; i < element.properties.size(); ++i )
+            {
+                const PlyProperty& p = element.properties[i];
+                if ( p.countType != PlyType::INVALID )
+                {
+                    if ( listIndex != element.properties.size() || ( p.name != "vertex_indices" && p.name != "vertex_index" ) )
+                    {
+                        LOG( "'", filename, "' has face lists besides the vertex indices, which the native loader doesn't handle. Importing it with Assimp" );
+                        return false;
+                    }
+                    listIndex = i;
+                }
+                else
+                {
+                    ( listIndex == element.properties.size() ? before : after ) += PlyTypeSize( p.type );
+                }
+            }
+            if ( listIndex == element.properties.size() )
+            {
+                return false;
+            }
+            const PlyProperty& list = element.properties[listIndex];
+            size_t countSize        = PlyTypeSize( list.countType );
+            size_t indexSize        = PlyTypeSize( list.type );
+            int64_t numFaces        = static_cast< int64_t >( element.count );
+            uint32_t numVertices    = static_cast< uint32_t >( mesh.vertices.size() );
+
+            // scans are triangle meshes, so assume every face is a triangle, which puts them at a fixed stride and
+            // lets them be read in parallel. Otherwise they are read one after another
+            size_t triangleStride = before + countSize + 3 * indexSize + after;
+            bool allTriangles     = element.count <= ( size - offset ) / triangleStride && numFaces <= UINT32_MAX / 3;
+            if ( allTriangles )
+            {
+                const char* faceData = data + offset + before;
+                #pragma omp parallel for reduction( && : allTriangles )
+                for ( int64_t i = 0; i < numFaces; ++i )
+                {
+                    allTriangles = allTriangles && ReadPlyValue< int64_t >( faceData + i * triangleStride, list.countType ) == 3;
+                }
+            }
+            bool validIndices = true;
+            if ( allTriangles )
+            {
+                mesh.indices.resize( 3 * numFaces );
+                const char* faceData = data + offset + before + countSize;
+                #pragma omp parallel for reduction( && : validIndices )
+                for ( int64_t i = 0; i < numFaces; ++i )
+                {
+                    for ( int corner = 0; corner < 3; ++corner )
+                    {
+                        int64_t index               = ReadPlyValue< int64_t >( faceData + i * triangleStride + corner * indexSize, list.type );
+                        validIndices                = validIndices && index >= 0 && index < numVertices;
+                        mesh.indices[3 * i + corner] = static_cast< uint32_t >( index );
+                    }
+                }
+                offset += element.count * triangleStride;
+            }
+            else
+            {
+                mesh.indices.reserve( 3 * numFaces );
+                for ( int64_t i = 0; i < numFaces && validIndices; ++i )
+                {
+                    if ( size - offset < before + countSize )
+                    {
+                        return false;
+                    }
+                    int64_t n = ReadPlyValue< int64_t >( data + offset + before, list.countType );
+                    offset   += before + countSize;
+                    if ( n < 0 || static_cast< uint64_t >( n ) > ( size - offset ) / indexSize || size - offset - n * indexSize < after )
+                    {
+                        return false;
+                    }
+                    for ( int64_t corner = 2; corner < n; ++corner )
+                    {
+                        for ( int64_t k : { int64_t( 0 ), corner - 1, corner } )
+                        {
+                            int64_t index = ReadPlyValue< int64_t >( data + offset + k * indexSize, list.type );
+                            validIndices  = validIndices && index >= 0 && index < numVertices;
+                            mesh.indices.push_back( static_cast< uint32_t >( index ) );
+                        }
+                    }
+                    offset += n * indexSize + after;
+                }
+            }
+            if ( !validIndices )
+            {
+                return false;
+            }
+            loadedFaces = true;
+        }
+        else if ( !element.HasLists() && element.Stride() > 0 && element.count <= ( size - offset ) / element.Stride() )
+        {
+            offset += element.count * element.Stride();
+        }
+        else
+        {
+            LOG( "'", filename, "' has the element '", element.name, "' before its vertices or faces, which the native loader doesn't handle. Importing it with Assimp" );
+            return false;
+        }
+    }
+    if ( !loadedVertices || !loadedFaces || mesh.indices.empty() || mesh.indices.size() > UINT32_MAX )
+    {
+        return false;
+    }
+    SetSingleMesh( std::move( mesh ), filename, contents );
+
+    return true;
+}
+
+static std::string GetLowerCaseExtension( const std::string& filename )
+{
+    std::string extension = fs::path( filename ).extension().string();
+    std::transform( extension.begin(), extension.end(), extension.begin(), []( unsigned char c ) { return static_cast< char >( std::tolower( c ) ); } );
+    return extension;
+}
+
+namespace FastModelLoader
+{
+
+    bool CanLoad( const std::string& filename )
+    {
+        std::string extension = GetLowerCaseExtension( filename );
+        return extension == ".obj" || extension == ".ply";
+    }
+
+    bool Load( const std::string& filename, ModelCacheContents& contents )
+    {
+        TRACE_ZONE_DETAIL( "FastModelLoader::Load", filename );
+        auto startTime = Time::GetTimePoint();
+        MappedFile file;
+        if ( !file.Open( filename ) )
+        {
+            return false;
+        }
+        file.Prefetch();
+        bool loaded = GetLowerCaseExtension( filename ) == ".obj" ? LoadObj( filename, file, contents ) : LoadPly( filename, file, contents );
+        if ( loaded )
+        {
+            const Mesh& mesh = contents.meshes[0];
+            LOG( "Parsed '", filename, "' (", mesh.vertices.size(), " vertices, ", mesh.indices.size() / 3, " triangles) in ",
+                Time::GetDuration( startTime ) / 1000.0f, " seconds" );
+        }
+
+        return loaded;
+    }
+
+} // namespace FastModelLoader
+} // namespace PT
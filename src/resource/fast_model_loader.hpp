@@ -0,0 +1,30 @@
+#pragma once
+
+#include "resource/model_cache.hpp"
+#include <string>
+
+namespace PT
+{
+
+// Native loader for the formats large scans come in, used by Model::Load before Assimp. The file is mapped and
+// split into chunks that are parsed on all threads, straight into the arrays of a single mesh, without the
+// copies of Assimp's intermediate scene and its post processing:
+//
+//   .obj: v, vt, vn and f lines (polygons are fan triangulated, negative indices are supported). o, g and s are
+//         ignored, files with materials (mtllib / usemtl) are left to Assimp
+//   .ply: binary little endian only. The vertex element's x, y, z, nx, ny, nz and u, v (or s, t) properties and
+//         the face element's vertex index list. Ascii and big endian files are left to Assimp
+namespace FastModelLoader
+{
+
+    // whether the file's extension is one the loader handles
+    bool CanLoad( const std::string& filename );
+
+    // Loads the file as a single mesh with a default material. If the file has no normals, the mesh's normals
+    // are empty and every triangle has its own vertices, so the normals calculated for it are flat, like Assimp's.
+    // The tangents are always left to the caller. False if the file uses anything the loader doesn't
+    // handle, or is malformed, in which case Model::Load imports it with Assimp (which also reports the errors)
+    bool Load( const std::string& filename, ModelCacheContents& contents );
+
+} // namespace FastModelLoader
+} // namespace PT
@@ -7,6 +7,59 @@
 namespace PT
 {
 
+float Fresnel( const glm::vec3& I, const glm::vec3& N, const float& ior )
+{
+    // this happens when the material is reflective, but not refractive
+    if ( ior == 1 )
+    {
+        return 1;
+    }
+
+    float cosi = std::min( 1.0f, std::max( -1.0f, glm::dot( I, N ) ) );
+    float etai = 1, etat = ior;
+    if ( cosi > 0 )
+    {
+        std::swap(etai, etat);
+    }
+
+    float sint = etai / etat * sqrtf( std::max( 0.0f, 1 - cosi * cosi ) );
+
+    float kr;
+    if ( sint >= 1 )
+    {
+        kr = 1;
+    }
+    else
+    {
+        float cost = sqrtf( std::max( 0.0f, 1 - sint * sint ) );
+        cosi = fabsf( cosi );
+        float Rs = ((etat * cosi) - (etai * cost)) / ((etat * cosi) + (etai * cost));
+        float Rp = ((etai * cosi) - (etat * cost)) / ((etai * cosi) + (etat * cost));
+        kr = (Rs * Rs + Rp * Rp) / 2;
+    }
+
+    return kr;
+}
+
+glm::vec3 Refract( const glm::vec3& I, const glm::vec3& N, const float& ior )
+{ 
+    float cosi  = std::min( 1.0f, std::max( -1.0f, glm::dot( I, N ) ) );
+    float etai  = 1, etat = ior;
+    glm::vec3 n = N; 
+    if ( cosi < 0 )
+    {
+        cosi = -cosi;
+    }
+    else
+    {
+        std::swap( etai, etat );
+        n = -N;
+    } 
+    float eta = etai / etat; 
+    float k   = 1 - eta * eta * (1 - cosi * cosi); 
+    return k < 0 ? glm::vec3( 0 ) : eta * I + (eta * cosi - sqrtf( k )) * n; 
+}
+
 glm::vec3 FresnelSchlick( const glm::vec3& F0, float cosTheta )
 {
     return F0 + (glm::vec3( 1.0f ) - F0)*std::pow(1.0f - cosTheta, 5.0f );
@@ -14,7 +67,7 @@ glm::vec3 FresnelSchlick( const glm::vec3& F0, float cosTheta )
 
 glm::vec3 BRDF::F( const glm::vec3& worldSpace_wo, const glm::vec3& worldSpace_wi ) const
 {
-    return Kd / M_PI;
+    return Kd / static_cast< float >( M_PI );
 }
 
 glm::vec3 BRDF::Sample_F( const glm::vec3& worldSpace_wo, glm::vec3& worldSpace_wi, float& pdf ) const
@@ -31,12 +84,12 @@ float BRDF::Pdf( const glm::vec3& worldSpace_wo, const glm::vec3& worldSpace_wi
     return sameHemisphere ? AbsDot( worldSpace_wi, N ) / M_PI : 0;
 }
 
-glm::vec3 Material::GetAlbedo( const glm::vec2& texCoords ) const
+glm::vec3 Material::GetAlbedo( const glm::vec2& texCoords, float uvFootprint ) const
 {
     glm::vec3 color = albedo;
     if ( albedoTexture )
     {
-        color *= glm::vec3( albedoTexture->GetPixel( texCoords.x, texCoords.y ) );
+        color *= glm::vec3( albedoTexture->Sample( texCoords, uvFootprint ) );
     }
 
     return color;
@@ -45,7 +98,7 @@ glm::vec3 Material::GetAlbedo( const glm::vec2& texCoords ) const
 BRDF Material::ComputeBRDF( IntersectionData* surfaceInfo ) const
 {
     BRDF brdf;
-    brdf.Kd     = GetAlbedo( surfaceInfo->texCoords );
+    brdf.Kd     = GetAlbedo( surfaceInfo->texCoords, surfaceInfo->uvFootprint );
     brdf.Ks     = Ks;
     brdf.T      = surfaceInfo->tangent;
     brdf.B      = surfaceInfo->bitangent;
@@ -54,4 +107,28 @@ BRDF Material::ComputeBRDF( IntersectionData* surfaceInfo ) const
     return brdf;
 }
 
+bool Material::IsSpecular() const
+{
+    auto maxComponent = []( const glm::vec3& v ) { return std::max( v.x, std::max( v.y, v.z ) ); };
+    if ( albedoTexture || maxComponent( albedo ) > 0.02f )
+    {
+        return false;
+    }
+
+    return maxComponent( Ks ) > 0 || maxComponent( Tr ) > 0;
+}
+
+glm::vec3 Material::SampleSpecular( const glm::vec3& I, const glm::vec3& N, glm::vec3& weight ) const
+{
+    float kr = Fresnel( I, N, ior );
+    if ( Random::Rand() < kr )
+    {
+        weight = ior == 1 ? Ks : glm::vec3( 1 );
+        return glm::reflect( I, N );
+    }
+
+    weight = Tr != glm::vec3( 0 ) ? Tr : glm::vec3( 1 );
+    return glm::normalize( Refract( I, N, ior ) );
+}
+
 } // namespace PT
\ No newline at end of file
@@ -33,8 +33,22 @@ struct Material : public Resource
     float ior        = 1.0f;
     std::shared_ptr< Texture > albedoTexture;
 
-    glm::vec3 GetAlbedo( const glm::vec2& texCoords ) const;
+    // uvFootprint is the width of the lookup in uv units, which picks the mip level (see Texture::Sample)
+    glm::vec3 GetAlbedo( const glm::vec2& texCoords, float uvFootprint = 0 ) const;
     BRDF ComputeBRDF( IntersectionData* surfaceInfo ) const;
+
+    // Materials with a (near) black diffuse term and a specular or transmissive term are treated
+    // as perfectly specular: a mirror when ior == 1, otherwise a dielectric
+    bool IsSpecular() const;
+
+    // Picks the reflected or refracted direction for incoming direction I (pointing towards the surface),
+    // choosing between the two with probability given by the fresnel term. The color filter of the
+    // chosen lobe is returned in 'weight'
+    glm::vec3 SampleSpecular( const glm::vec3& I, const glm::vec3& N, glm::vec3& weight ) const;
 };
 
+float Fresnel( const glm::vec3& I, const glm::vec3& N, const float& ior );
+
+glm::vec3 Refract( const glm::vec3& I, const glm::vec3& N, const float& ior );
+
 } // namespace PT
\ No newline at end of file
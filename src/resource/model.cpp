@@ -1,15 +1,21 @@
 #include "resource/model.hpp"
+#include "assimp/DefaultIOSystem.h"
 #include "assimp/Importer.hpp"
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
 #include "configuration.hpp"
 #include "intersection_tests.hpp"
+#include "resource/fast_model_loader.hpp"
+#include "resource/model_cache.hpp"
 #include "resource/resource_manager.hpp"
 #include "utils/logger.hpp"
 #include "utils/time.hpp"
+#include "utils/trace.hpp"
 #include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <stack>
+#include <unordered_map>
 
 namespace PT
 {
@@ -20,73 +26,138 @@ namespace PT
         return s.substr( start, end - start + 1 );
     }
 
-    static std::shared_ptr< Texture > LoadAssimpTexture( const aiMaterial* pMaterial, aiTextureType texType )
+    static std::string GetAssimpTextureName( const aiMaterial* pMaterial, aiTextureType texType )
     {
-        namespace fs = std::filesystem;
         aiString path;
-        if ( pMaterial->GetTexture( texType, 0, &path, NULL, NULL, NULL, NULL, NULL ) == AI_SUCCESS )
+        if ( pMaterial->GetTexture( texType, 0, &path, NULL, NULL, NULL, NULL, NULL ) != AI_SUCCESS )
+        {
+            LOG_ERR( "Could not get texture of type: ", texType );
+            return "";
+        }
+
+        return TrimWhiteSpace( path.data );
+    }
+
+    // the name is either a path relative to the resource directory, or just searched for by its filename
+    static std::string FindTextureFile( const std::string& name )
+    {
+        namespace fs = std::filesystem;
+        if ( fs::exists( RESOURCE_DIR + name ) )
+        {
+            return RESOURCE_DIR + name;
+        }
+
+        return ResourceManager::FindResourceFile( fs::path( name ).filename().string() );
+    }
+
+    // Loads all of the textures a model references at once: the files are found through the resource index,
+    // identical images (by content hash) are only decoded once, and the decoding is spread over all threads.
+    // The image files that were read are added to sourceFiles
+    static bool LoadAssimpTextures( const std::vector< std::string >& names, std::unordered_map< std::string, std::shared_ptr< Texture > >& textures,
+                                    std::vector< std::string >& sourceFiles )
+    {
+        TRACE_ZONE( "LoadAssimpTextures" );
+        auto startTime = Time::GetTimePoint();
+        std::vector< std::string > toLoad;
+        std::vector< std::string > fullPaths;
+        for ( const std::string& name : names )
         {
-            std::string name = TrimWhiteSpace( path.data );
-            if ( ResourceManager::GetTexture( name ) )
+            if ( textures.count( name ) )
             {
-                return ResourceManager::GetTexture( name );
+                continue;
             }
-
-            std::string fullPath;
-            // search for texture starting with
-            if ( fs::exists( RESOURCE_DIR + name ) )
+            if ( auto existing = ResourceManager::GetTexture( name ) )
             {
-                fullPath = RESOURCE_DIR + name;
+                textures[name] = existing;
+                continue;
             }
-            else
+            std::string fullPath = FindTextureFile( name );
+            if ( fullPath.empty() )
             {
-                std::string basename = fs::path( name ).filename().string();
-                for( auto itEntry = fs::recursive_directory_iterator( RESOURCE_DIR ); itEntry != fs::recursive_directory_iterator(); ++itEntry )
-                {
-                    std::string itFile = itEntry->path().filename().string();
-                    if ( basename == itEntry->path().filename().string() )
-                    {
-                        fullPath = fs::absolute( itEntry->path() ).string();
-                        break;
-                    }
-                }
+                LOG_ERR( "Could not find image file '", name, "'" );
+                return false;
             }
-                    
-            if ( fullPath != "" )
+            textures[name] = nullptr;
+            toLoad.push_back( name );
+            fullPaths.push_back( fullPath );
+            sourceFiles.push_back( fullPath );
+        }
+        if ( toLoad.empty() )
+        {
+            return true;
+        }
+
+        int numTextures = static_cast< int >( toLoad.size() );
+        std::vector< uint64_t > hashes( numTextures );
+        #pragma omp parallel for schedule( dynamic, 1 )
+        for ( int i = 0; i < numTextures; ++i )
+        {
+            hashes[i] = HashFileContents( fullPaths[i] );
+        }
+
+        // the first texture with each hash is decoded, the others share it
+        std::vector< int > source( numTextures );
+        std::vector< int > unique;
+        std::unordered_map< uint64_t, int > hashToTexture;
+        for ( int i = 0; i < numTextures; ++i )
+        {
+            auto it = hashes[i] ? hashToTexture.find( hashes[i] ) : hashToTexture.end();
+            if ( it == hashToTexture.end() )
             {
-                TextureCreateInfo info;
-                info.name     = std::filesystem::path( fullPath ).stem().string();;
-                info.filename = fullPath;
-                auto ret = std::make_shared< Texture >();
-                if ( !ret->Load( info ) )
+                source[i] = i;
+                unique.push_back( i );
+                if ( hashes[i] )
                 {
-                    LOG_ERR( "Failed to load texture '", name, "' with default settings" );
-                    return nullptr;
+                    hashToTexture[hashes[i]] = i;
                 }
-                ret->name = name;
-                return ret;
             }
             else
             {
-                LOG_ERR( "Could not find image file '", name,"'" );
+                source[i] = it->second;
             }
         }
-        else
+
+        std::vector< std::shared_ptr< Texture > > loaded( numTextures );
+        int numUnique = static_cast< int >( unique.size() );
+        #pragma omp parallel for schedule( dynamic, 1 )
+        for ( int u = 0; u < numUnique; ++u )
         {
-            LOG_ERR( "Could not get texture of type: ", texType );
+            int i = unique[u];
+            TRACE_ZONE_DETAIL( "Texture::Load", fullPaths[i] );
+            TextureCreateInfo info;
+            info.name     = toLoad[i];
+            info.filename = fullPaths[i];
+            auto texture  = std::make_shared< Texture >();
+            if ( texture->Load( info ) )
+            {
+                loaded[i] = texture;
+            }
         }
 
-        return nullptr;
+        for ( int i = 0; i < numTextures; ++i )
+        {
+            if ( !loaded[source[i]] )
+            {
+                LOG_ERR( "Failed to load texture '", toLoad[i], "' with default settings" );
+                return false;
+            }
+            textures[toLoad[i]] = loaded[source[i]];
+        }
+        LOG( "Loaded ", numTextures, " textures (", numUnique, " unique) in ", Time::GetDuration( startTime ) / 1000.0f, " seconds" );
+
+        return true;
     }
 
-    static bool ParseMaterials( const std::string& filename, Model* model, const aiScene* scene )
+    // the materials of the imported scene, without their textures, which are loaded all at once afterwards
+    static bool ParseMaterials( const aiScene* scene, ModelCacheContents& contents )
     {
-        std::vector< std::shared_ptr< Material > > materials( scene->mNumMaterials );
+        contents.materials.resize( scene->mNumMaterials );
+        contents.albedoTextureNames.resize( scene->mNumMaterials );
         for ( uint32_t mtlIdx = 0; mtlIdx < scene->mNumMaterials; ++mtlIdx )
         {
             const aiMaterial* pMaterial = scene->mMaterials[mtlIdx];
             auto newMat = std::make_shared< Material >();
-            materials[mtlIdx] = newMat;
+            contents.materials[mtlIdx] = newMat;
 
             aiString name;
             aiColor3D color;
@@ -105,6 +176,10 @@ namespace PT
             pMaterial->Get( AI_MATKEY_SHININESS, tmp );
             newMat->Ns = tmp;
 
+            tmp = 1.0f;
+            pMaterial->Get( AI_MATKEY_REFRACTI, tmp );
+            newMat->ior = tmp;
+
             color = aiColor3D( 0.f, 0.f, 0.f );
             pMaterial->Get( AI_MATKEY_COLOR_EMISSIVE, color );
             newMat->Ke = { color.r, color.g, color.b };
@@ -112,22 +187,41 @@ namespace PT
             if ( pMaterial->GetTextureCount( aiTextureType_DIFFUSE ) > 0 )
             {
                 assert( pMaterial->GetTextureCount( aiTextureType_DIFFUSE ) == 1 );
-                newMat->albedoTexture = LoadAssimpTexture( pMaterial, aiTextureType_DIFFUSE );
-                if ( !newMat->albedoTexture )
+                contents.albedoTextureNames[mtlIdx] = GetAssimpTextureName( pMaterial, aiTextureType_DIFFUSE );
+                if ( contents.albedoTextureNames[mtlIdx].empty() )
                 {
                     return false;
                 }
             }
         }
 
-        for ( size_t i = 0 ; i < model->meshes.size(); i++ )
+        contents.meshMaterials.resize( scene->mNumMeshes );
+        for ( uint32_t i = 0 ; i < scene->mNumMeshes; i++ )
         {
-            model->meshes[i].material = materials[scene->mMeshes[i]->mMaterialIndex];
+            contents.meshMaterials[i] = scene->mMeshes[i]->mMaterialIndex;
         }
 
         return true;
     }
 
+    // Assimp's file system, noting down every file the importer opens (the model, and .mtl files and the like),
+    // which are the files the model cache depends on
+    class RecordingIOSystem : public Assimp::DefaultIOSystem
+    {
+    public:
+        Assimp::IOStream* Open( const char* pFile, const char* pMode = "rb" ) override
+        {
+            Assimp::IOStream* stream = Assimp::DefaultIOSystem::Open( pFile, pMode );
+            if ( stream && std::find( openedFiles.begin(), openedFiles.end(), pFile ) == openedFiles.end() )
+            {
+                openedFiles.push_back( pFile );
+            }
+            return stream;
+        }
+
+        std::vector< std::string > openedFiles;
+    };
+
     void Mesh::RecalculateNormals()
     {
         normals.clear();
@@ -155,10 +249,47 @@ namespace PT
         }
     }
 
-    bool Model::Load( const ModelCreateInfo& createInfo )
+    // normals for meshes without them (or all meshes, if asked to), and an arbitrary tangent basis for the
+    // meshes that had no uvs to derive one from
+    static void FinishMesh( Mesh& mesh, bool recalculateNormals )
     {
-        name = createInfo.name;
+        if ( recalculateNormals || mesh.normals.empty() )
+        {
+            mesh.RecalculateNormals();
+        }
+
+        if ( mesh.tangents.size() == 0 )
+        {
+            mesh.tangents.resize( mesh.vertices.size(), glm::vec3( 0 ) );
+            for ( size_t i = 0; i < mesh.indices.size(); i += 3 )
+            {
+                uint32_t i0  = mesh.indices[i + 0];
+                uint32_t i1  = mesh.indices[i + 1];
+                glm::vec3 v0 = mesh.vertices[i0];
+                glm::vec3 v1 = mesh.vertices[i1];
+                glm::vec3 n0 = mesh.normals[i0];
+                glm::vec3 n1 = mesh.normals[i1];
+                glm::vec3 t  = glm::normalize( v1 - v0 );
+                glm::vec3 t0 = glm::normalize( t - n0 * glm::dot( n0, t ) );
+                glm::vec3 t1 = glm::normalize( t - n1 * glm::dot( n1, t ) );
+                if ( mesh.tangents[i0] == glm::vec3( 0 ) )
+                {
+                    mesh.tangents[i0] = t0;
+                }
+                if ( mesh.tangents[i1] == glm::vec3( 0 ) )
+                {
+                    mesh.tangents[i1] = t1;
+                }
+            }
+        }
+    }
+
+    static bool ImportWithAssimp( const ModelCreateInfo& createInfo, ModelCacheContents& contents )
+    {
+        TRACE_ZONE_DETAIL( "ImportWithAssimp", createInfo.filename );
         Assimp::Importer importer;
+        auto ioSystem = new RecordingIOSystem; // owned by the importer
+        importer.SetIOHandler( ioSystem );
         const aiScene* scene = importer.ReadFile( createInfo.filename.c_str(),
             aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_JoinIdenticalVertices | aiProcess_CalcTangentSpace | aiProcess_RemoveRedundantMaterials );
         if ( !scene )
@@ -167,6 +298,7 @@ namespace PT
             return false;
         }
 
+        std::vector< Mesh >& meshes = contents.meshes;
         meshes.resize( scene->mNumMeshes );
         for ( size_t meshIdx = 0; meshIdx < meshes.size(); ++meshIdx )
         {
@@ -219,43 +351,79 @@ namespace PT
                 mesh.indices.push_back( face.mIndices[2] );
             }
 
-            if ( createInfo.recalculateNormals )
-            {
-                mesh.RecalculateNormals();
-            }
+            FinishMesh( mesh, createInfo.recalculateNormals );
+        }
+
+        if ( !ParseMaterials( scene, contents ) )
+        {
+            LOG_ERR( "Could not load the model's materials" );
+            return false;
+        }
+        contents.sourceFiles = ioSystem->openedFiles;
+
+        return true;
+    }
 
-            if ( mesh.tangents.size() == 0 )
+    bool Model::Load( const ModelCreateInfo& createInfo )
+    {
+        TRACE_ZONE_DETAIL( "Model::Load", createInfo.filename );
+        name = createInfo.name;
+        auto startTime = Time::GetTimePoint();
+        ModelCacheContents contents;
+        std::string cacheFilename = ModelCache::GetCacheFilename( createInfo.filename );
+        if ( createInfo.useCache && ModelCache::Load( cacheFilename, createInfo.recalculateNormals, contents ) )
+        {
+            LOG( "Loaded model '", createInfo.filename, "' from its cache in ", Time::GetDuration( startTime ) / 1000.0f, " seconds" );
+        }
+        else
+        {
+            // OBJ and PLY files are parsed natively, unless they use something only Assimp handles
+            if ( FastModelLoader::CanLoad( createInfo.filename ) && FastModelLoader::Load( createInfo.filename, contents ) )
             {
-                // std::cout << "WARNING: model '" << name << "', mesh '" << mesh.name << "' had no uvs, so assimp could not generate tangents. Generating arbitrary tangent basis." << std::endl;
-                mesh.tangents.resize( mesh.vertices.size(), glm::vec3( 0 ) );
-                for ( size_t i = 0; i < mesh.indices.size(); i += 3 )
+                for ( Mesh& mesh : contents.meshes )
                 {
-                    uint32_t i0  = mesh.indices[i + 0];
-                    uint32_t i1  = mesh.indices[i + 1];
-                    glm::vec3 v0 = mesh.vertices[i0];
-                    glm::vec3 v1 = mesh.vertices[i1];
-                    glm::vec3 n0 = mesh.normals[i0];
-                    glm::vec3 n1 = mesh.normals[i1];
-                    glm::vec3 t  = glm::normalize( v1 - v0 );
-                    glm::vec3 t0 = glm::normalize( t - n0 * glm::dot( n0, t ) );
-                    glm::vec3 t1 = glm::normalize( t - n1 * glm::dot( n1, t ) );
-                    if ( mesh.tangents[i0] == glm::vec3( 0 ) )
-                    {
-                        mesh.tangents[i0] = t0;
-                    }
-                    if ( mesh.tangents[i1] == glm::vec3( 0 ) )
-                    {
-                        mesh.tangents[i1] = t1;
-                    }
+                    FinishMesh( mesh, createInfo.recalculateNormals );
                 }
             }
+            else if ( !ImportWithAssimp( createInfo, contents ) )
+            {
+                return false;
+            }
+            // a model that can't be cached (read only directory, ...) is still fine to render
+            if ( createInfo.useCache )
+            {
+                ModelCache::Write( cacheFilename, createInfo.recalculateNormals, contents );
+            }
         }
 
-        if ( !ParseMaterials( createInfo.filename, this, scene ) )
+        std::vector< std::string > allNames;
+        for ( const std::string& name : contents.albedoTextureNames )
+        {
+            if ( !name.empty() )
+            {
+                allNames.push_back( name );
+            }
+        }
+        std::unordered_map< std::string, std::shared_ptr< Texture > > textures;
+        sourceFiles = contents.sourceFiles;
+        if ( !LoadAssimpTextures( allNames, textures, sourceFiles ) )
         {
             LOG_ERR( "Could not load the model's materials" );
             return false;
         }
+        for ( size_t mtlIdx = 0; mtlIdx < contents.materials.size(); ++mtlIdx )
+        {
+            if ( !contents.albedoTextureNames[mtlIdx].empty() )
+            {
+                contents.materials[mtlIdx]->albedoTexture = textures[contents.albedoTextureNames[mtlIdx]];
+            }
+        }
+
+        meshes = std::move( contents.meshes );
+        for ( size_t i = 0; i < meshes.size(); ++i )
+        {
+            meshes[i].material = contents.materials[contents.meshMaterials[i]];
+        }
 
         return true;
     }
@@ -268,21 +436,26 @@ namespace PT
         }
     }
 
+    // below this many vertices / triangles the loops of a mesh instance aren't worth splitting over threads
+    #define MESH_INSTANCE_PARALLEL_THRESHOLD 16384
+
     MeshInstance::MeshInstance( const Mesh& localMesh, const Transform& _localToWorld, std::shared_ptr< Material > newMaterial ) :
         localToWorld( _localToWorld ),
         worldToLocal( _localToWorld.Inverse() )
     {
-        size_t numVertices = localMesh.vertices.size();
-        assert( localMesh.normals.size() == numVertices && localMesh.tangents.size() == numVertices );
+        int64_t numVertices = static_cast< int64_t >( localMesh.vertices.size() );
+        assert( localMesh.normals.size() == localMesh.vertices.size() && localMesh.tangents.size() == localMesh.vertices.size() );
         data.vertices.resize( numVertices );
-        for ( size_t i = 0; i < numVertices; ++i )
-            data.vertices[i] = localToWorld.TransformPoint( localMesh.vertices[i] );
         data.normals.resize( numVertices );
-        for ( size_t i = 0; i < numVertices; ++i )
-            data.normals[i] = glm::normalize( worldToLocal.Transpose().TransformVector( localMesh.normals[i] ) );
         data.tangents.resize( numVertices );
-        for ( size_t i = 0; i < numVertices; ++i )
+        Transform normalTransform = worldToLocal.Transpose();
+        #pragma omp parallel for if ( numVertices > MESH_INSTANCE_PARALLEL_THRESHOLD )
+        for ( int64_t i = 0; i < numVertices; ++i )
+        {
+            data.vertices[i] = localToWorld.TransformPoint( localMesh.vertices[i] );
+            data.normals[i]  = glm::normalize( normalTransform.TransformVector( localMesh.normals[i] ) );
             data.tangents[i] = localToWorld.TransformVector( localMesh.tangents[i] );
+        }
         data.uvs      = localMesh.uvs;
         data.indices  = localMesh.indices;
         data.material = newMaterial ? newMaterial : localMesh.material;
@@ -291,26 +464,31 @@ namespace PT
     void MeshInstance::EmitTrianglesAndLights( std::vector< std::shared_ptr< Shape > >& shapes,
         std::vector< Light* >& lights, std::shared_ptr< MeshInstance > meshPtr ) const
     {
-        shapes.reserve( shapes.size() + data.indices.size() / 3 );
-        if ( data.material->Ke != glm::vec3( 0 ) )
+        int64_t numTris   = static_cast< int64_t >( data.indices.size() / 3 );
+        size_t firstShape = shapes.size();
+        size_t firstLight = lights.size();
+        bool emissive     = data.material->Ke != glm::vec3( 0 );
+        shapes.resize( firstShape + numTris );
+        if ( emissive )
         {
-            lights.reserve( lights.size() + data.indices.size() / 3 );
+            lights.resize( firstLight + numTris );
         }
 
-        for ( size_t face = 0; face < data.indices.size() / 3; ++face )
+        #pragma omp parallel for if ( numTris > MESH_INSTANCE_PARALLEL_THRESHOLD )
+        for ( int64_t face = 0; face < numTris; ++face )
         {
             auto tri           = std::make_shared< Triangle >();
             tri->mesh          = meshPtr;
             tri->i0            = data.indices[3*face + 0];
             tri->i1            = data.indices[3*face + 1];
             tri->i2            = data.indices[3*face + 2];
-            shapes.push_back( tri );
-            if ( data.material->Ke != glm::vec3( 0 ) )
+            shapes[firstShape + face] = tri;
+            if ( emissive )
             {
                 auto areaLight   = new AreaLight;
                 areaLight->Lemit = data.material->Ke;
                 areaLight->shape = tri;
-                lights.push_back( areaLight );
+                lights[firstLight + face] = areaLight;
             }
         }
     }
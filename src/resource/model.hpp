@@ -18,6 +18,7 @@ namespace PT
         std::string name;
         std::string filename;
         bool recalculateNormals = true;
+        bool useCache           = true; // load from / write the binary model cache next to the file (see model_cache.hpp)
     };
 
     struct Mesh
@@ -43,6 +44,7 @@ namespace PT
         void RecalculateNormals();
         
         std::vector< Mesh > meshes;
+        std::vector< std::string > sourceFiles; // the model file, the other files the importer read (.mtl, ...) and the textures
     };
 
     class MeshInstance
@@ -0,0 +1,297 @@
+#include "resource/model_cache.hpp"
+#include "utils/logger.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/time.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace PT
+{
+
+uint64_t HashFileContents( const std::string& filename )
+{
+    std::ifstream in( filename, std::ios::binary );
+    if ( !in )
+    {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[64 * 1024];
+    while ( in )
+    {
+        in.read( buffer, sizeof( buffer ) );
+        for ( std::streamsize i = 0; i < in.gcount(); ++i )
+        {
+            hash = ( hash ^ static_cast< unsigned char >( buffer[i] ) ) * 1099511628211ull;
+        }
+    }
+
+    return hash;
+}
+
+// Sequential reads out of the mapped file. Any read past the end fails every read after it
+class CacheReader
+{
+public:
+    CacheReader( const char* data, size_t size ) : m_data( data ), m_size( size ) {}
+
+    bool Read( void* dst, size_t bytes )
+    {
+        if ( !m_ok || bytes > m_size - m_offset )
+        {
+            m_ok = false;
+            return false;
+        }
+        memcpy( dst, m_data + m_offset, bytes );
+        m_offset += bytes;
+        return true;
+    }
+
+    template < typename T >
+    T Read()
+    {
+        T value = {};
+        Read( &value, sizeof( T ) );
+        return value;
+    }
+
+    std::string ReadString()
+    {
+        std::string s( ReadCount( 1 ), '\0' );
+        Read( s.data(), s.size() );
+        return s;
+    }
+
+    template < typename T >
+    void ReadArray( std::vector< T >& v )
+    {
+        v.resize( ReadCount( sizeof( T ) ) );
+        Read( v.data(), v.size() * sizeof( T ) );
+    }
+
+    bool Ok() const { return m_ok; }
+
+private:
+    // a count that fits in the rest of the file, so a corrupt one can't allocate gigabytes
+    size_t ReadCount( size_t elementSize )
+    {
+        uint64_t count = Read< uint64_t >();
+        if ( !m_ok || count > ( m_size - m_offset ) / elementSize )
+        {
+            m_ok = false;
+            return 0;
+        }
+        return static_cast< size_t >( count );
+    }
+
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset = 0;
+    bool m_ok       = true;
+};
+
+class CacheWriter
+{
+public:
+    void Write( const void* src, size_t bytes )
+    {
+        const char* bytePtr = static_cast< const char* >( src );
+        m_bytes.insert( m_bytes.end(), bytePtr, bytePtr + bytes );
+    }
+
+    template < typename T >
+    void Write( const T& value )
+    {
+        Write( &value, sizeof( T ) );
+    }
+
+    void WriteString( const std::string& s )
+    {
+        Write< uint64_t >( s.size() );
+        Write( s.data(), s.size() );
+    }
+
+    template < typename T >
+    void WriteArray( const std::vector< T >& v )
+    {
+        Write< uint64_t >( v.size() );
+        Write( v.data(), v.size() * sizeof( T ) );
+    }
+
+    const std::vector< char >& Bytes() const { return m_bytes; }
+
+private:
+    std::vector< char > m_bytes;
+};
+
+static int64_t GetModificationTime( const std::string& filename, std::error_code& ec )
+{
+    return static_cast< int64_t >( fs::last_write_time( filename, ec ).time_since_epoch().count() );
+}
+
+namespace ModelCache
+{
+
+    std::string GetCacheFilename( const std::string& modelFilename )
+    {
+        return modelFilename + MODEL_CACHE_FILE_EXTENSION;
+    }
+
+    bool Load( const std::string& cacheFilename, bool recalculateNormals, ModelCacheContents& contents )
+    {
+        MappedFile file;
+        if ( !file.Open( cacheFilename ) )
+        {
+            return false;
+        }
+        CacheReader reader( file.Data(), file.Size() );
+        ModelCacheHeader expected;
+        ModelCacheHeader header = reader.Read< ModelCacheHeader >();
+        if ( !reader.Ok() || memcmp( header.magic, expected.magic, sizeof( expected.magic ) ) || header.version != expected.version ||
+             header.recalculateNormals != static_cast< uint32_t >( recalculateNormals ) )
+        {
+            return false;
+        }
+
+        // every material and mesh takes more than a byte, so bigger counts can only be corruption
+        if ( header.numMaterials > file.Size() || header.numMeshes > file.Size() )
+        {
+            return false;
+        }
+
+        contents = {};
+        for ( uint32_t i = 0; i < header.numDependencies && reader.Ok(); ++i )
+        {
+            std::string filename = reader.ReadString();
+            int64_t mtime        = reader.Read< int64_t >();
+            uint64_t size        = reader.Read< uint64_t >();
+            uint64_t hash        = reader.Read< uint64_t >();
+            std::error_code ec;
+            uint64_t currentSize = fs::file_size( filename, ec );
+            if ( !reader.Ok() || ec || currentSize != size )
+            {
+                return false;
+            }
+            // touching or copying the source doesn't make the cache stale, only changing its contents does
+            if ( GetModificationTime( filename, ec ) != mtime && HashFileContents( filename ) != hash )
+            {
+                return false;
+            }
+            contents.sourceFiles.push_back( filename );
+        }
+
+        contents.materials.resize( header.numMaterials );
+        contents.albedoTextureNames.resize( header.numMaterials );
+        for ( uint32_t i = 0; i < header.numMaterials && reader.Ok(); ++i )
+        {
+            auto material    = std::make_shared< Material >();
+            material->name   = reader.ReadString();
+            material->albedo = reader.Read< glm::vec3 >();
+            material->Ks     = reader.Read< glm::vec3 >();
+            material->Ke     = reader.Read< glm::vec3 >();
+            material->Ns     = reader.Read< float >();
+            material->ior    = reader.Read< float >();
+
+            contents.materials[i]          = material;
+            contents.albedoTextureNames[i] = reader.ReadString();
+        }
+
+        contents.meshes.resize( header.numMeshes );
+        contents.meshMaterials.resize( header.numMeshes );
+        for ( uint32_t i = 0; i < header.numMeshes && reader.Ok(); ++i )
+        {
+            Mesh& mesh                = contents.meshes[i];
+            mesh.name                 = reader.ReadString();
+            contents.meshMaterials[i] = reader.Read< uint32_t >();
+            reader.ReadArray( mesh.vertices );
+            reader.ReadArray( mesh.normals );
+            reader.ReadArray( mesh.uvs );
+            reader.ReadArray( mesh.tangents );
+            reader.ReadArray( mesh.indices );
+            if ( contents.meshMaterials[i] >= header.numMaterials )
+            {
+                return false;
+            }
+        }
+        if ( !reader.Ok() )
+        {
+            LOG_WARN( "Model cache '", cacheFilename, "' is truncated or corrupt, importing the model again" );
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Write( const std::string& cacheFilename, bool recalculateNormals, const ModelCacheContents& contents )
+    {
+        ModelCacheHeader header;
+        header.recalculateNormals = recalculateNormals;
+        header.numDependencies    = static_cast< uint32_t >( contents.sourceFiles.size() );
+        header.numMaterials       = static_cast< uint32_t >( contents.materials.size() );
+        header.numMeshes          = static_cast< uint32_t >( contents.meshes.size() );
+
+        CacheWriter writer;
+        writer.Write( header );
+        for ( const std::string& filename : contents.sourceFiles )
+        {
+            std::error_code ec;
+            int64_t mtime = GetModificationTime( filename, ec );
+            uint64_t size = fs::file_size( filename, ec );
+            if ( ec )
+            {
+                LOG_WARN( "Could not stat '", filename, "', not caching the model" );
+                return false;
+            }
+            writer.WriteString( filename );
+            writer.Write( mtime );
+            writer.Write( size );
+            writer.Write( HashFileContents( filename ) );
+        }
+        for ( size_t i = 0; i < contents.materials.size(); ++i )
+        {
+            const Material& material = *contents.materials[i];
+            writer.WriteString( material.name );
+            writer.Write( material.albedo );
+            writer.Write( material.Ks );
+            writer.Write( material.Ke );
+            writer.Write( material.Ns );
+            writer.Write( material.ior );
+            writer.WriteString( contents.albedoTextureNames[i] );
+        }
+        for ( size_t i = 0; i < contents.meshes.size(); ++i )
+        {
+            const Mesh& mesh = contents.meshes[i];
+            writer.WriteString( mesh.name );
+            writer.Write( contents.meshMaterials[i] );
+            writer.WriteArray( mesh.vertices );
+            writer.WriteArray( mesh.normals );
+            writer.WriteArray( mesh.uvs );
+            writer.WriteArray( mesh.tangents );
+            writer.WriteArray( mesh.indices );
+        }
+
+        // written to a temporary file first, like the tiled textures, so other processes never map a partial cache
+        std::string tempFilename = cacheFilename + ".tmp" + std::to_string( Time::GetTimePoint().time_since_epoch().count() );
+        std::ofstream out( tempFilename, std::ios::binary );
+        out.write( writer.Bytes().data(), writer.Bytes().size() );
+        out.close();
+        std::error_code ec;
+        if ( out )
+        {
+            fs::rename( tempFilename, cacheFilename, ec );
+        }
+        if ( !out || ec )
+        {
+            LOG_WARN( "Could not write model cache '", cacheFilename, "'" );
+            fs::remove( tempFilename, ec );
+            return false;
+        }
+
+        return true;
+    }
+
+} // namespace ModelCache
+} // namespace PT
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "resource/model.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+#define MODEL_CACHE_FILE_EXTENSION ".ptmodel"
+
+// Binary model cache, written next to a model the first time Assimp imports it, so later loads skip the import and
+// its post processing. The file is mapped and the arrays are copied straight into the meshes:
+//
+//   ModelCacheHeader
+//   numDependencies x { path, mtime, size, hash }  every file the importer read (the model, .mtl files, ...)
+//   numMaterials    x { name, albedo, Ks, Ke, Ns, ior, albedo texture name }
+//   numMeshes       x { name, material index, vertices, normals, uvs, tangents, indices }
+//
+// Strings and arrays are a uint64 count followed by the elements. Everything is in the native byte order, since
+// the cache is only ever read by the machine that wrote it
+struct ModelCacheHeader
+{
+    char magic[4]               = { 'P', 'T', 'M', 'C' };
+    uint32_t version            = 2;
+    uint32_t recalculateNormals = 0;
+    uint32_t numDependencies    = 0;
+    uint32_t numMaterials       = 0;
+    uint32_t numMeshes          = 0;
+};
+
+// What Model::Load needs from the importer, besides the textures
+struct ModelCacheContents
+{
+    std::vector< Mesh > meshes; // without their materials
+    std::vector< uint32_t > meshMaterials; // index into materials of every mesh
+    std::vector< std::shared_ptr< Material > > materials; // without their textures
+    std::vector< std::string > albedoTextureNames; // of every material, empty == no texture
+    std::vector< std::string > sourceFiles; // the model file and every other file the importer read for it
+};
+
+// FNV-1a of the file's contents. 0 if it can't be read
+uint64_t HashFileContents( const std::string& filename );
+
+namespace ModelCache
+{
+
+    std::string GetCacheFilename( const std::string& modelFilename );
+
+    // false if the cache doesn't exist, is from another version, or any of its source files changed (a different
+    // size, or a different modification time and contents hash)
+    bool Load( const std::string& cacheFilename, bool recalculateNormals, ModelCacheContents& contents );
+
+    bool Write( const std::string& cacheFilename, bool recalculateNormals, const ModelCacheContents& contents );
+
+} // namespace ModelCache
+} // namespace PT
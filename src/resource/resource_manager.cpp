@@ -1,23 +1,41 @@
 #include "resource/resource_manager.hpp"
+#include "configuration.hpp"
+#include "utils/logger.hpp"
+#include "utils/time.hpp"
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 
 namespace PT
 {
 
+// the scene loads its models and textures in parallel, which look up and add resources concurrently
+static std::shared_mutex s_resourcesLock;
 static std::unordered_map< std::string, std::shared_ptr< Material > > s_materials;
 static std::unordered_map< std::string, std::shared_ptr< Model > > s_models;
 static std::unordered_map< std::string, std::shared_ptr< Skybox > > s_skyboxes;
 static std::unordered_map< std::string, std::shared_ptr< Texture > > s_textures;
 
+static std::mutex s_resourceIndexLock;
+static bool s_resourceIndexBuilt = false;
+static std::unordered_map< std::string, std::string > s_resourceIndex; // filename -> full path
+
 namespace ResourceManager
 {
 
     void Init()
     {
-        s_materials.clear();
-        s_models.clear();
-        s_skyboxes.clear();
-        s_textures.clear();
+        {
+            std::unique_lock< std::shared_mutex > lock( s_resourcesLock );
+            s_materials.clear();
+            s_models.clear();
+            s_skyboxes.clear();
+            s_textures.clear();
+        }
+        std::lock_guard< std::mutex > lock( s_resourceIndexLock );
+        s_resourceIndex.clear();
+        s_resourceIndexBuilt = false;
     }
 
     void Shutdown()
@@ -28,11 +46,13 @@ namespace ResourceManager
     void AddMaterial( std::shared_ptr< Material > res )
     {
         assert( res->name != "" );
+        std::unique_lock< std::shared_mutex > lock( s_resourcesLock );
         s_materials[res->name] = res;
     }
 
     std::shared_ptr< Material > GetMaterial( const std::string& name )
     {
+        std::shared_lock< std::shared_mutex > lock( s_resourcesLock );
         auto it = s_materials.find( name );
         if ( it == s_materials.end() )
         {
@@ -44,11 +64,13 @@ namespace ResourceManager
     void AddModel( std::shared_ptr< Model > res )
     {
         assert( res->name != "" );
+        std::unique_lock< std::shared_mutex > lock( s_resourcesLock );
         s_models[res->name] = res;
     }
 
     std::shared_ptr< Model > GetModel( const std::string& name )
     {
+        std::shared_lock< std::shared_mutex > lock( s_resourcesLock );
         auto it = s_models.find( name );
         if ( it == s_models.end() )
         {
@@ -60,11 +82,13 @@ namespace ResourceManager
     void AddSkybox( std::shared_ptr< Skybox > res )
     {
         assert( res->name != "" );
+        std::unique_lock< std::shared_mutex > lock( s_resourcesLock );
         s_skyboxes[res->name] = res;
     }
 
     std::shared_ptr< Skybox > GetSkybox( const std::string& name )
     {
+        std::shared_lock< std::shared_mutex > lock( s_resourcesLock );
         auto it = s_skyboxes.find( name );
         if ( it == s_skyboxes.end() )
         {
@@ -76,11 +100,13 @@ namespace ResourceManager
     void AddTexture( std::shared_ptr< Texture > res )
     {
         assert( res->name != "" );
+        std::unique_lock< std::shared_mutex > lock( s_resourcesLock );
         s_textures[res->name] = res;
     }
 
     std::shared_ptr< Texture > GetTexture( const std::string& name )
     {
+        std::shared_lock< std::shared_mutex > lock( s_resourcesLock );
         auto it = s_textures.find( name );
         if ( it == s_textures.end() )
         {
@@ -89,5 +115,37 @@ namespace ResourceManager
         return it->second;
     }
 
+    std::string FindResourceFile( const std::string& filename )
+    {
+        namespace fs = std::filesystem;
+        std::lock_guard< std::mutex > lock( s_resourceIndexLock );
+        if ( !s_resourceIndexBuilt )
+        {
+            auto startTime = Time::GetTimePoint();
+            std::error_code ec;
+            for ( auto it = fs::recursive_directory_iterator( RESOURCE_DIR, ec ); it != fs::recursive_directory_iterator(); it.increment( ec ) )
+            {
+                if ( ec )
+                {
+                    break;
+                }
+                if ( it->is_regular_file( ec ) )
+                {
+                    // emplace keeps the first one found, if several directories have a file with the same name
+                    s_resourceIndex.emplace( it->path().filename().string(), fs::absolute( it->path() ).string() );
+                }
+            }
+            s_resourceIndexBuilt = true;
+            LOG( "Indexed ", s_resourceIndex.size(), " resource files in ", Time::GetDuration( startTime ), " ms" );
+        }
+
+        auto it = s_resourceIndex.find( filename );
+        if ( it == s_resourceIndex.end() )
+        {
+            return "";
+        }
+        return it->second;
+    }
+
 } // namespace ResourceManager
 } // namespace PT
\ No newline at end of file
@@ -27,5 +27,9 @@ namespace ResourceManager
     void AddTexture( std::shared_ptr< Texture > res );
     std::shared_ptr< Texture > GetTexture( const std::string& name );
 
+    // Full path of the first file with the given name (no directories) anywhere under RESOURCE_DIR, or "" if
+    // there is none. The resource tree is walked once, on the first call after Init
+    std::string FindResourceFile( const std::string& filename );
+
 } // namespace ResourceManager
 } // namespace PT
\ No newline at end of file
@@ -2,22 +2,45 @@
 #include "configuration.hpp"
 #include "stb_image/stb_image.h"
 #include "utils/logger.hpp"
+#include "utils/trace.hpp"
+#include "glm/gtc/packing.hpp"
 #include <algorithm>
+#include <cstring>
 #include <vector>
+#if defined( __F16C__ )
+#include <immintrin.h>
+#endif
 
 namespace PT
 {
 
-Skybox::~Skybox()
+// The 3 halfs at h to floats. With F16C (-mf16c or -march=native) that's one instruction for all of them, otherwise
+// the exponent and mantissa bits are moved into place and a float multiply rebiases the exponent, which also
+// normalizes the denormals. Branch free, so the compiler vectorizes it. No infinities or NaNs are ever stored
+static inline glm::vec3 HalfToFloat3( const uint16_t* h )
 {
-    if ( m_pixels )
+#if defined( __F16C__ )
+    __m128 f = _mm_cvtph_ps( _mm_loadl_epi64( reinterpret_cast< const __m128i* >( h ) ) );
+    alignas( 16 ) float out[4];
+    _mm_store_ps( out, f );
+    return glm::vec3( out[0], out[1], out[2] );
+#else
+    float out[3];
+    for ( int i = 0; i < 3; ++i )
     {
-        free( m_pixels );
+        uint32_t bits = ( static_cast< uint32_t >( h[i] ) & 0x7FFFu ) << 13;
+        float magnitude;
+        memcpy( &magnitude, &bits, sizeof( float ) );
+        magnitude *= 5.192296858534828e+33f; // 2^112 == 2^( 127 - 15 )
+        out[i]     = ( h[i] & 0x8000u ) ? -magnitude : magnitude;
     }
+    return glm::vec3( out[0], out[1], out[2] );
+#endif
 }
 
 bool Skybox::Load( const SkyboxCreateInfo& info )
 {
+    TRACE_ZONE_DETAIL( "Skybox::Load", info.name );
     name = info.name;
     std::vector< std::string > filenames( 6 );
     filenames[0] = RESOURCE_DIR + info.right;
@@ -27,37 +50,58 @@ bool Skybox::Load( const SkyboxCreateInfo& info )
     filenames[4] = RESOURCE_DIR + info.back;
     filenames[5] = RESOURCE_DIR + info.front;
 
+    // the faces are decoded in parallel. The ldr to hdr settings are global in stb_image, so they're set once up front
+    stbi_ldr_to_hdr_scale( 1.0f );
+    stbi_ldr_to_hdr_gamma( 1.0f );
     std::vector< float* > pixelData( 6 );
-    for ( size_t i = 0; i < 6; ++i )
+    std::vector< glm::ivec2 > sizes( 6 );
+    #pragma omp parallel for schedule( dynamic, 1 )
+    for ( int i = 0; i < 6; ++i )
     {
-        stbi_set_flip_vertically_on_load( info.flipVertically );
-        stbi_ldr_to_hdr_scale( 1.0f );
-        stbi_ldr_to_hdr_gamma( 1.0f );
-        int w, h, nc;
-        pixelData[i] = stbi_loadf( filenames[i].c_str(), &w, &h, &nc, 4 );
+        stbi_set_flip_vertically_on_load_thread( info.flipVertically );
+        int nc;
+        pixelData[i] = stbi_loadf( filenames[i].c_str(), &sizes[i].x, &sizes[i].y, &nc, 3 );
+    }
 
+    bool success = true;
+    for ( int i = 0; i < 6; ++i )
+    {
         if ( !pixelData[i] )
         {
             LOG_ERR( "Failed to load image '", filenames[i], "'" );
-            return false;
+            success = false;
         }
-        if ( i == 0 )
+        else if ( sizes[i] != sizes[0] )
         {
-            m_width         = w;
-            m_height        = h;
+            LOG_ERR( "Skybox face '", filenames[i], "' is ", sizes[i].x, " x ", sizes[i].y, ", the first face is ", sizes[0].x, " x ", sizes[0].y );
+            success = false;
         }
-        assert( w == m_width && h == m_height );
     }
-
-    size_t pixelsPerFace = m_width * m_height;
-    size_t totalPixels   = 6 * pixelsPerFace;
-    m_pixels         = static_cast< glm::vec4* >( malloc( totalPixels * sizeof( glm::vec4 ) ) );
-    for ( size_t i = 0; i < 6; ++i )
+    if ( success )
+    {
+        m_width  = sizes[0].x;
+        m_height = sizes[0].y;
+        size_t pixelsPerFace = static_cast< size_t >( m_width ) * m_height;
+        m_pixels.assign( 3 * 6 * pixelsPerFace + 1, 0 );
+        #pragma omp parallel for
+        for ( int i = 0; i < 6; ++i )
+        {
+            uint16_t* face = m_pixels.data() + 3 * i * pixelsPerFace;
+            for ( size_t p = 0; p < 3 * pixelsPerFace; ++p )
+            {
+                face[p] = glm::packHalf1x16( std::clamp( pixelData[i][p], 0.0f, 65504.0f ) );
+            }
+        }
+    }
+    for ( float* data : pixelData )
     {
-        memcpy( m_pixels + i * pixelsPerFace, pixelData[i], pixelsPerFace * sizeof( glm::vec4 ) );
+        if ( data )
+        {
+            stbi_image_free( data );
+        }
     }
 
-    return true;
+    return success;
 }
     
 int Skybox::GetWidth() const
@@ -70,21 +114,26 @@ int Skybox::GetHeight() const
     return m_height;
 }
 
-glm::vec4* Skybox::GetPixels() const
+size_t Skybox::GetMemoryBytes() const
+{
+    return m_pixels.size() * sizeof( uint16_t );
+}
+
+glm::vec3 Skybox::GetPixel( int index ) const
 {
-    return m_pixels;
+    return HalfToFloat3( m_pixels.data() + 3 * static_cast< size_t >( index ) );
 }
 
-glm::vec4 Skybox::GetPixel( int face, int r, int c ) const
+glm::vec3 Skybox::GetPixel( int face, int r, int c ) const
 {
-    return m_pixels[face * m_width * m_height + r * m_width + c];
+    return GetPixel( face * m_width * m_height + r * m_width + c );
 }
 
 // https://www.gamedev.net/forums/topic/687535-implementing-a-cube-map-lookup-function/
-glm::vec4 Skybox::GetPixel( const Ray& ray ) const
+int Skybox::GetPixelIndex( const glm::vec3& direction ) const
 {
-    const auto& v    = ray.direction;
-    glm::vec3 absDir = glm::abs( ray.direction );
+    const auto& v    = direction;
+    glm::vec3 absDir = glm::abs( direction );
     int faceIndex;
 	float ma;
 	glm::vec2 uv;
@@ -114,7 +163,27 @@ glm::vec4 Skybox::GetPixel( const Ray& ray ) const
     w     = std::min( w, m_width - 1 );
     h     = std::min( h, m_height - 1 );
     
-    return GetPixel( faceIndex, h, w );
+    return faceIndex * m_width * m_height + h * m_width + w;
+}
+
+glm::vec3 Skybox::GetPixel( const Ray& ray ) const
+{
+    return GetPixel( GetPixelIndex( ray.direction ) );
+}
+
+glm::vec3 Skybox::FaceDirection( int face, const glm::vec2& uv )
+{
+    float a = 2 * uv.x - 1;
+    float b = 2 * uv.y - 1;
+    switch ( face )
+    {
+        case 0: return glm::vec3( 1, b, -a );
+        case 1: return glm::vec3( -1, b, a );
+        case 2: return glm::vec3( a, 1, -b );
+        case 3: return glm::vec3( a, -1, -b );
+        case 4: return glm::vec3( a, b, 1 );
+        default: return glm::vec3( -a, b, -1 );
+    }
 }
 
 } // namespace PT
\ No newline at end of file
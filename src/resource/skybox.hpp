@@ -2,6 +2,8 @@
 
 #include "math.hpp"
 #include "resource/resource.hpp"
+#include <cstdint>
+#include <vector>
 
 namespace PT
 {
@@ -18,23 +20,31 @@ struct SkyboxCreateInfo
     bool flipVertically = true;
 };
 
+// The pixels are stored as RGB half floats (6 bytes instead of the 16 of a glm::vec4), which keeps the full range
+// and precision of the 8 bit sources and leaves room for HDR ones
 struct Skybox : public Resource
 {
     Skybox() = default;
-    ~Skybox();
 
     bool Load( const SkyboxCreateInfo& info );
     
     int GetWidth() const;
     int GetHeight() const;
-    glm::vec4* GetPixels() const;
-    glm::vec4 GetPixel( int face, int r, int c ) const;
-    glm::vec4 GetPixel( const Ray& ray ) const;
+    size_t GetMemoryBytes() const;
+    glm::vec3 GetPixel( int index ) const; // face * width * height + row * width + column
+    glm::vec3 GetPixel( int face, int r, int c ) const;
+    glm::vec3 GetPixel( const Ray& ray ) const;
+
+    // index of the pixel seen in the given direction
+    int GetPixelIndex( const glm::vec3& direction ) const;
+
+    // Inverse of the lookup in GetPixel: the point at uv on the given face of the [-1, 1]^3 cube. Not normalized
+    static glm::vec3 FaceDirection( int face, const glm::vec2& uv );
 
 private:
-    int m_width         = 0;
-    int m_height        = 0;
-    glm::vec4* m_pixels = nullptr;
+    int m_width  = 0;
+    int m_height = 0;
+    std::vector< uint16_t > m_pixels; // 3 halfs per pixel, plus one of padding at the end for the 4 wide loads
 };
 
 } // namespace PT
\ No newline at end of file
@@ -1,9 +1,19 @@
 #include "math.hpp"
 #include "resource/texture.hpp"
+#include "resource/texture_cache.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image/stb_image.h"
 #include "utils/logger.hpp"
+#include "utils/time.hpp"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
 
 namespace PT
 {
@@ -16,21 +26,481 @@ Texture::~Texture()
     }
 }
 
+// 8 bit sRGB -> linear, so the lookups of albedo textures only cost a table read per channel
+static const std::array< float, 256 > s_sRGBToLinear = []()
+{
+    std::array< float, 256 > table;
+    for ( int i = 0; i < 256; ++i )
+    {
+        float c  = i / 255.0f;
+        table[i] = c <= 0.04045f ? c / 12.92f : std::pow( ( c + 0.055f ) / 1.055f, 2.4f );
+    }
+    return table;
+}();
+
+static unsigned char LinearToSRGB8( float linear )
+{
+    float c = linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow( linear, 1.0f / 2.4f ) - 0.055f;
+    return static_cast< unsigned char >( std::clamp( c, 0.0f, 1.0f ) * 255.0f + 0.5f );
+}
+
+// RGBA8 -> linear RGBA. Alpha is never sRGB encoded
+static inline glm::vec4 DecodeTexel( const unsigned char* texel, bool sRGB )
+{
+    if ( sRGB )
+    {
+        return glm::vec4( s_sRGBToLinear[texel[0]], s_sRGBToLinear[texel[1]], s_sRGBToLinear[texel[2]], texel[3] * ( 1.0f / 255.0f ) );
+    }
+
+    return 1.0f / 255.0f * glm::vec4( texel[0], texel[1], texel[2], texel[3] );
+}
+
+// 2x2 box filter of the previous level. For odd sizes the last row / column is only averaged with itself. The
+// colors of sRGB textures are averaged in linear space, otherwise the smaller levels get darker
+static void DownsampleMipLevel( const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight, bool sRGB )
+{
+    for ( int y = 0; y < dstHeight; ++y )
+    {
+        int y0 = std::min( 2 * y, srcHeight - 1 );
+        int y1 = std::min( 2 * y + 1, srcHeight - 1 );
+        for ( int x = 0; x < dstWidth; ++x )
+        {
+            int x0 = std::min( 2 * x, srcWidth - 1 );
+            int x1 = std::min( 2 * x + 1, srcWidth - 1 );
+            for ( int c = 0; c < 4; ++c )
+            {
+                unsigned char t00 = src[4 * (y0 * srcWidth + x0) + c];
+                unsigned char t01 = src[4 * (y0 * srcWidth + x1) + c];
+                unsigned char t10 = src[4 * (y1 * srcWidth + x0) + c];
+                unsigned char t11 = src[4 * (y1 * srcWidth + x1) + c];
+                if ( sRGB && c < 3 )
+                {
+                    float sum = s_sRGBToLinear[t00] + s_sRGBToLinear[t01] + s_sRGBToLinear[t10] + s_sRGBToLinear[t11];
+                    dst[4 * (y * dstWidth + x) + c] = LinearToSRGB8( sum / 4 );
+                }
+                else
+                {
+                    dst[4 * (y * dstWidth + x) + c] = static_cast< unsigned char >( (t00 + t01 + t10 + t11 + 2) / 4 );
+                }
+            }
+        }
+    }
+}
+
+struct LinearMipLevel
+{
+    int width;
+    int height;
+    size_t offset;
+};
+
+// all of the levels of the image, row by row, in one buffer which is only 1/3 bigger than the full resolution level
+static std::vector< unsigned char > GenerateMipChain( int width, int height, const unsigned char* rgba, bool sRGB, std::vector< LinearMipLevel >& levels )
+{
+    levels.clear();
+    size_t totalSize = 0;
+    while ( true )
+    {
+        levels.push_back( { width, height, totalSize } );
+        totalSize += 4 * static_cast< size_t >( width ) * height;
+        if ( width == 1 && height == 1 )
+        {
+            break;
+        }
+        width  = std::max( 1, width / 2 );
+        height = std::max( 1, height / 2 );
+    }
+
+    std::vector< unsigned char > pixels( totalSize );
+    memcpy( pixels.data(), rgba, 4 * static_cast< size_t >( levels[0].width ) * levels[0].height );
+    for ( size_t level = 1; level < levels.size(); ++level )
+    {
+        const LinearMipLevel& src = levels[level - 1];
+        const LinearMipLevel& dst = levels[level];
+        DownsampleMipLevel( pixels.data() + src.offset, src.width, src.height, pixels.data() + dst.offset, dst.width, dst.height, sRGB );
+    }
+
+    return pixels;
+}
+
+static uint16_t PackRGB565( const glm::vec3& color )
+{
+    glm::ivec3 c = glm::ivec3( glm::clamp( color, glm::vec3( 0 ), glm::vec3( 255 ) ) * glm::vec3( 31, 63, 31 ) / 255.0f + 0.5f );
+    return static_cast< uint16_t >( ( c.r << 11 ) | ( c.g << 5 ) | c.b );
+}
+
+static glm::ivec3 UnpackRGB565( uint16_t c )
+{
+    int r = ( c >> 11 ) & 31;
+    int g = ( c >> 5 ) & 63;
+    int b = c & 31;
+    return glm::ivec3( ( r << 3 ) | ( r >> 2 ), ( g << 2 ) | ( g >> 4 ), ( b << 3 ) | ( b >> 2 ) );
+}
+
+// the 4 colors of a block, for c0 > c1 (always the case for the blocks encoded here)
+static void BC1Palette( uint16_t c0, uint16_t c1, glm::ivec3 palette[4] )
+{
+    palette[0] = UnpackRGB565( c0 );
+    palette[1] = UnpackRGB565( c1 );
+    palette[2] = ( 2 * palette[0] + palette[1] ) / 3;
+    palette[3] = ( palette[0] + 2 * palette[1] ) / 3;
+}
+
+// 16 RGBA8 texels -> 8 bytes. The endpoints are the extremes of the texels along their principal axis
+static void EncodeBC1Block( const unsigned char texels[64], unsigned char* block )
+{
+    glm::vec3 colors[16];
+    glm::vec3 mean( 0 );
+    for ( int i = 0; i < 16; ++i )
+    {
+        colors[i] = glm::vec3( texels[4 * i + 0], texels[4 * i + 1], texels[4 * i + 2] );
+        mean     += colors[i] / 16.0f;
+    }
+    glm::mat3 covariance( 0 );
+    for ( int i = 0; i < 16; ++i )
+    {
+        glm::vec3 d = colors[i] - mean;
+        covariance += glm::outerProduct( d, d );
+    }
+    glm::vec3 axis( 1, 1, 1 );
+    for ( int iteration = 0; iteration < 8; ++iteration )
+    {
+        axis = covariance * axis;
+        float length = glm::length( axis );
+        if ( length < 1e-6f )
+        {
+            break;
+        }
+        axis /= length;
+    }
+    float minT = 0, maxT = 0;
+    for ( int i = 0; i < 16; ++i )
+    {
+        float t = glm::dot( colors[i] - mean, axis );
+        minT    = std::min( minT, t );
+        maxT    = std::max( maxT, t );
+    }
+
+    uint16_t c0 = PackRGB565( mean + maxT * axis );
+    uint16_t c1 = PackRGB565( mean + minT * axis );
+    if ( c0 < c1 )
+    {
+        std::swap( c0, c1 );
+    }
+    // c0 == c1 is a single color block: all indices 0
+    uint32_t indices = 0;
+    if ( c0 != c1 )
+    {
+        glm::ivec3 palette[4];
+        BC1Palette( c0, c1, palette );
+        for ( int i = 0; i < 16; ++i )
+        {
+            int best = 0, bestDistance = INT_MAX;
+            for ( int p = 0; p < 4; ++p )
+            {
+                glm::ivec3 d = glm::ivec3( colors[i] ) - palette[p];
+                int distance = d.x * d.x + d.y * d.y + d.z * d.z;
+                if ( distance < bestDistance )
+                {
+                    best         = p;
+                    bestDistance = distance;
+                }
+            }
+            indices |= static_cast< uint32_t >( best ) << ( 2 * i );
+        }
+    }
+
+    block[0] = c0 & 0xFF;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xFF;
+    block[3] = c1 >> 8;
+    for ( int i = 0; i < 4; ++i )
+    {
+        block[4 + i] = ( indices >> ( 8 * i ) ) & 0xFF;
+    }
+}
+
+// 8 bytes -> 16 RGBA8 texels, alpha is always 255
+static void DecodeBC1Block( const unsigned char* block, unsigned char texels[64] )
+{
+    uint16_t c0 = static_cast< uint16_t >( block[0] | ( block[1] << 8 ) );
+    uint16_t c1 = static_cast< uint16_t >( block[2] | ( block[3] << 8 ) );
+    glm::ivec3 palette[4];
+    BC1Palette( c0, c1, palette );
+    if ( c0 <= c1 )
+    {
+        // 3 color mode, not produced by EncodeBC1Block, but part of the format
+        palette[2] = ( palette[0] + palette[1] ) / 2;
+        palette[3] = glm::ivec3( 0 );
+    }
+    uint32_t indices = block[4] | ( block[5] << 8 ) | ( block[6] << 16 ) | ( static_cast< uint32_t >( block[7] ) << 24 );
+    for ( int i = 0; i < 16; ++i )
+    {
+        const glm::ivec3& color = palette[( indices >> ( 2 * i ) ) & 3];
+        texels[4 * i + 0] = static_cast< unsigned char >( color.r );
+        texels[4 * i + 1] = static_cast< unsigned char >( color.g );
+        texels[4 * i + 2] = static_cast< unsigned char >( color.b );
+        texels[4 * i + 3] = 255;
+    }
+}
+
+// Partial blocks past the right / bottom edge repeat the last row / column, so they don't pull the endpoints
+// towards colors that are never looked up
+static void EncodeBC1Level( const unsigned char* rgba, int width, int height, unsigned char* blocks )
+{
+    int blocksX = ( width + 3 ) / 4;
+    int blocksY = ( height + 3 ) / 4;
+    #pragma omp parallel for
+    for ( int by = 0; by < blocksY; ++by )
+    {
+        unsigned char texels[64];
+        for ( int bx = 0; bx < blocksX; ++bx )
+        {
+            for ( int i = 0; i < 16; ++i )
+            {
+                int x = std::min( 4 * bx + ( i & 3 ), width - 1 );
+                int y = std::min( 4 * by + ( i >> 2 ), height - 1 );
+                memcpy( texels + 4 * i, rgba + 4 * ( static_cast< size_t >( y ) * width + x ), 4 );
+            }
+            EncodeBC1Block( texels, blocks + BC1_BLOCK_BYTES * ( static_cast< size_t >( by ) * blocksX + bx ) );
+        }
+    }
+}
+
+static TextureLayout s_defaultTextureLayout = TextureLayout::Tiled;
+static std::atomic< uint32_t > s_nextTextureId( 1 );
+
+void SetDefaultTextureLayout( TextureLayout layout )
+{
+    s_defaultTextureLayout = layout;
+}
+
+TextureLayout GetDefaultTextureLayout()
+{
+    return s_defaultTextureLayout;
+}
+
+static int NumCacheTiles( int size )
+{
+    return ( size + TEXTURE_CACHE_TILE_SIZE - 1 ) / TEXTURE_CACHE_TILE_SIZE;
+}
+
+// Decodes the source image and writes it as a tiled texture file. Written to a temporary file first, so other
+// processes loading the same scene at the same time never see a partial file
+static bool ConvertToTiledTextureFile( const TextureCreateInfo& info, const std::string& tiledFilename )
+{
+    auto startTime = Time::GetTimePoint();
+    stbi_set_flip_vertically_on_load_thread( info.flipVertically );
+    int width, height, nc;
+    unsigned char* rgba = stbi_load( info.filename.c_str(), &width, &height, &nc, 4 );
+    if ( !rgba )
+    {
+        LOG_ERR( "Failed to load image '", info.filename, "'" );
+        return false;
+    }
+    std::vector< LinearMipLevel > levels;
+    std::vector< unsigned char > pixels = GenerateMipChain( width, height, rgba, info.sRGB, levels );
+    stbi_image_free( rgba );
+
+    TiledTextureHeader header;
+    header.width          = width;
+    header.height         = height;
+    header.numMipLevels   = static_cast< int32_t >( levels.size() );
+    header.flipVertically = info.flipVertically;
+    header.sRGB           = info.sRGB;
+    std::string tempFilename = tiledFilename + ".tmp" + std::to_string( Time::GetTimePoint().time_since_epoch().count() );
+    std::ofstream out( tempFilename, std::ios::binary );
+    if ( !out )
+    {
+        LOG_ERR( "Could not open tiled texture '", tempFilename, "' for writing" );
+        return false;
+    }
+    out.write( reinterpret_cast< const char* >( &header ), sizeof( TiledTextureHeader ) );
+    std::vector< unsigned char > tile( TEXTURE_CACHE_TILE_BYTES );
+    for ( const LinearMipLevel& level : levels )
+    {
+        for ( int ty = 0; ty < NumCacheTiles( level.height ); ++ty )
+        {
+            for ( int tx = 0; tx < NumCacheTiles( level.width ); ++tx )
+            {
+                std::fill( tile.begin(), tile.end(), 0 );
+                int x0 = tx * TEXTURE_CACHE_TILE_SIZE;
+                int y0 = ty * TEXTURE_CACHE_TILE_SIZE;
+                int tileWidth  = std::min( TEXTURE_CACHE_TILE_SIZE, level.width - x0 );
+                int tileHeight = std::min( TEXTURE_CACHE_TILE_SIZE, level.height - y0 );
+                for ( int y = 0; y < tileHeight; ++y )
+                {
+                    const unsigned char* row = pixels.data() + level.offset + 4 * ( static_cast< size_t >( y0 + y ) * level.width + x0 );
+                    memcpy( tile.data() + 4 * y * TEXTURE_CACHE_TILE_SIZE, row, 4 * tileWidth );
+                }
+                out.write( reinterpret_cast< const char* >( tile.data() ), tile.size() );
+            }
+        }
+    }
+    out.close();
+    std::error_code ec;
+    if ( out )
+    {
+        fs::rename( tempFilename, tiledFilename, ec );
+    }
+    if ( !out || ec )
+    {
+        LOG_ERR( "Could not write tiled texture '", tiledFilename, "'" );
+        fs::remove( tempFilename, ec );
+        return false;
+    }
+    LOG( "Converted '", info.filename, "' to tiled texture '", tiledFilename, "' in ", Time::GetDuration( startTime ) / 1000.0f, " seconds" );
+
+    return true;
+}
+
 bool Texture::Load( const TextureCreateInfo& info )
 {
-    name = info.name;
+    if ( TextureCache::IsEnabled() )
+    {
+        return LoadStreamed( info );
+    }
 
-    stbi_set_flip_vertically_on_load( info.flipVertically );
-    int nc;
-    m_pixels = stbi_load( info.filename.c_str(), &m_width, &m_height, &nc, 4 );
+    stbi_set_flip_vertically_on_load_thread( info.flipVertically );
+    int width, height, nc;
+    unsigned char* pixels = stbi_load( info.filename.c_str(), &width, &height, &nc, 4 );
 
-    if ( !m_pixels )
+    if ( !pixels )
     {
         LOG_ERR( "Failed to load image '", info.filename, "'" );
         return false;
     }
+    Create( info.name, width, height, pixels, info.layout, info.sRGB );
+    stbi_image_free( pixels );
+
+    return true;
+}
+
+bool Texture::LoadStreamed( const TextureCreateInfo& info )
+{
+    // the tiled file is reused as long as it is newer than the source image and was made with the same settings
+    std::string tiledFilename = TextureCache::GetTiledFilename( info.filename );
+    auto file = std::make_unique< TiledTextureFile >();
+    std::error_code ec;
+    bool upToDate = fs::exists( tiledFilename, ec ) && fs::last_write_time( tiledFilename, ec ) >= fs::last_write_time( info.filename, ec ) &&
+                    file->Open( tiledFilename ) && file->GetHeader().flipVertically == static_cast< int32_t >( info.flipVertically ) &&
+                    file->GetHeader().sRGB == static_cast< int32_t >( info.sRGB );
+    if ( !upToDate )
+    {
+        file = std::make_unique< TiledTextureFile >();
+        if ( !ConvertToTiledTextureFile( info, tiledFilename ) || !file->Open( tiledFilename ) )
+        {
+            return false;
+        }
+    }
+
+    const TiledTextureHeader& header = file->GetHeader();
+    name     = info.name;
+    m_width  = header.width;
+    m_height = header.height;
+    m_layout = TextureLayout::Tiled;
+    m_sRGB   = info.sRGB;
+    if ( m_pixels )
+    {
+        free( m_pixels );
+        m_pixels = nullptr;
+    }
+    m_memoryBytes = 0;
+    m_mipLevels.clear();
+    size_t firstTile = 0;
+    int width = m_width, height = m_height;
+    for ( int level = 0; level < header.numMipLevels; ++level )
+    {
+        m_mipLevels.push_back( { width, height, NumCacheTiles( width ), firstTile } );
+        firstTile += static_cast< size_t >( NumCacheTiles( width ) ) * NumCacheTiles( height );
+        width  = std::max( 1, width / 2 );
+        height = std::max( 1, height / 2 );
+    }
+    m_tileFile = std::move( file );
+
     return true;
 }
+
+void Texture::Create( const std::string& textureName, int width, int height, const unsigned char* rgba, TextureLayout layout, bool sRGB )
+{
+    name     = textureName;
+    m_width  = width;
+    m_height = height;
+    m_layout = layout;
+    m_sRGB   = sRGB;
+    m_tileFile.reset();
+    if ( m_pixels )
+    {
+        free( m_pixels );
+    }
+
+    // the mip chain is generated in the linear layout first, and then reordered if needed
+    std::vector< LinearMipLevel > linearLevels;
+    std::vector< unsigned char > linear = GenerateMipChain( width, height, rgba, sRGB, linearLevels );
+    m_mipLevels.clear();
+    size_t totalSize = 0;
+    for ( const LinearMipLevel& level : linearLevels )
+    {
+        int tilesX = ( level.width + TEXTURE_TILE_SIZE - 1 ) / TEXTURE_TILE_SIZE;
+        int tilesY = ( level.height + TEXTURE_TILE_SIZE - 1 ) / TEXTURE_TILE_SIZE;
+        m_mipLevels.push_back( { level.width, level.height, tilesX, totalSize } );
+        if ( layout == TextureLayout::Tiled )
+        {
+            totalSize += 4 * static_cast< size_t >( tilesX ) * tilesY * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+        }
+        else if ( layout == TextureLayout::BC1 )
+        {
+            totalSize += BC1_BLOCK_BYTES * static_cast< size_t >( tilesX ) * tilesY;
+        }
+        else
+        {
+            totalSize += 4 * static_cast< size_t >( level.width ) * level.height;
+        }
+    }
+
+    // calloc, so the padding of partial tiles is deterministic
+    m_pixels      = static_cast< unsigned char* >( calloc( totalSize, 1 ) );
+    m_memoryBytes = totalSize;
+    m_id          = s_nextTextureId++;
+    if ( layout == TextureLayout::BC1 )
+    {
+        for ( size_t level = 0; level < m_mipLevels.size(); ++level )
+        {
+            EncodeBC1Level( linear.data() + linearLevels[level].offset, m_mipLevels[level].width, m_mipLevels[level].height,
+                m_pixels + m_mipLevels[level].offset );
+        }
+        return;
+    }
+    if ( layout == TextureLayout::Linear )
+    {
+        memcpy( m_pixels, linear.data(), linear.size() );
+        return;
+    }
+    for ( size_t level = 0; level < m_mipLevels.size(); ++level )
+    {
+        const LinearMipLevel& src = linearLevels[level];
+        const MipLevel& dst       = m_mipLevels[level];
+        for ( int y = 0; y < dst.height; ++y )
+        {
+            for ( int x = 0; x < dst.width; ++x )
+            {
+                memcpy( m_pixels + TexelOffset( dst, x, y ), linear.data() + src.offset + 4 * ( static_cast< size_t >( y ) * src.width + x ), 4 );
+            }
+        }
+    }
+}
+
+size_t Texture::TexelOffset( const MipLevel& level, int x, int y ) const
+{
+    if ( m_layout == TextureLayout::Linear )
+    {
+        return level.offset + 4 * ( static_cast< size_t >( y ) * level.width + x );
+    }
+
+    // TEXTURE_TILE_SIZE == 4: tile index * 16 texels, plus the texel's index inside of the tile
+    size_t tile = static_cast< size_t >( y >> 2 ) * level.tilesX + ( x >> 2 );
+    return level.offset + 4 * ( tile * 16 + ( ( y & 3 ) << 2 ) + ( x & 3 ) );
+}
     
 int Texture::GetWidth() const
 {
@@ -41,9 +511,34 @@ int Texture::GetHeight() const
     return m_height;
 }
 
-unsigned char* Texture::GetPixels() const
+int Texture::GetNumMipLevels() const
+{
+    return static_cast< int >( m_mipLevels.size() );
+}
+
+TextureLayout Texture::GetLayout() const
 {
-    return m_pixels;
+    return m_layout;
+}
+
+bool Texture::IsSRGB() const
+{
+    return m_sRGB;
+}
+
+bool Texture::IsStreamed() const
+{
+    return m_tileFile != nullptr;
+}
+
+size_t Texture::GetMemoryBytes() const
+{
+    return m_memoryBytes;
+}
+
+unsigned char* Texture::GetPixels( int mipLevel ) const
+{
+    return m_pixels ? m_pixels + m_mipLevels[mipLevel].offset : nullptr;
 }
 
 glm::vec4 Texture::GetPixel( float u, float v ) const
@@ -54,14 +549,100 @@ glm::vec4 Texture::GetPixel( float u, float v ) const
     u = u < 0 ? u + 1 : u;
     v = fmodf( v, 1 );
     v = v < 0 ? v + 1 : v;
-    int w           = std::min( m_width - 1, static_cast< int >( u * m_width ) );
-    int h           = std::min( m_height - 1, static_cast< int >( v * m_height ) );
-    unsigned char r = m_pixels[4 * (h * m_width + w) + 0];
-    unsigned char g = m_pixels[4 * (h * m_width + w) + 1];
-    unsigned char b = m_pixels[4 * (h * m_width + w) + 2];
-    unsigned char a = m_pixels[4 * (h * m_width + w) + 3];
-
-    glm::vec4 color = 1.0f / 255.0f * glm::vec4( r, g, b, a );
+    int w = std::min( m_width - 1, static_cast< int >( u * m_width ) );
+    int h = std::min( m_height - 1, static_cast< int >( v * m_height ) );
+
+    return Fetch( m_mipLevels[0], w, h );
+}
+
+// texel x, y of the level, wrapping around like GetPixel
+glm::vec4 Texture::Fetch( const MipLevel& level, int x, int y ) const
+{
+    x = x % level.width;
+    x = x < 0 ? x + level.width : x;
+    y = y % level.height;
+    y = y < 0 ? y + level.height : y;
+    const unsigned char* texel;
+    if ( m_tileFile )
+    {
+        size_t tile = level.offset + static_cast< size_t >( y / TEXTURE_CACHE_TILE_SIZE ) * level.tilesX + x / TEXTURE_CACHE_TILE_SIZE;
+        texel       = TextureCache::Fetch( *m_tileFile, static_cast< uint32_t >( tile ), x % TEXTURE_CACHE_TILE_SIZE, y % TEXTURE_CACHE_TILE_SIZE );
+    }
+    else if ( m_layout == TextureLayout::BC1 )
+    {
+        texel = FetchBC1( level, x, y );
+    }
+    else
+    {
+        texel = m_pixels + TexelOffset( level, x, y );
+    }
+
+    return DecodeTexel( texel, m_sRGB );
+}
+
+// Bilinear and trilinear lookups fetch 4 - 8 texels, mostly from the same few blocks, so the blocks are decoded
+// into a small per thread cache instead of once per texel. Keys are ( texture id << 40 | block index ), and
+// texture ids start at 1, so the zero initialized slots are empty
+#define BC1_DECODED_BLOCK_CACHE_SIZE 16
+
+struct DecodedBC1Block
+{
+    uint64_t key;
+    unsigned char texels[64];
+};
+
+static thread_local DecodedBC1Block t_decodedBC1Blocks[BC1_DECODED_BLOCK_CACHE_SIZE];
+
+// the texel stays valid until the thread decodes another block into the same slot
+const unsigned char* Texture::FetchBC1( const MipLevel& level, int x, int y ) const
+{
+    size_t blockIndex      = ( level.offset / BC1_BLOCK_BYTES ) + static_cast< size_t >( y >> 2 ) * level.tilesX + ( x >> 2 );
+    uint64_t key           = ( static_cast< uint64_t >( m_id ) << 40 ) | blockIndex;
+    DecodedBC1Block& block = t_decodedBC1Blocks[( blockIndex ^ ( blockIndex >> 4 ) ^ m_id ) & ( BC1_DECODED_BLOCK_CACHE_SIZE - 1 )];
+    if ( block.key != key )
+    {
+        DecodeBC1Block( m_pixels + blockIndex * BC1_BLOCK_BYTES, block.texels );
+        block.key = key;
+    }
+
+    return block.texels + 4 * ( ( ( y & 3 ) << 2 ) + ( x & 3 ) );
+}
+
+glm::vec4 Texture::SampleBilinear( const MipLevel& level, const glm::vec2& uv ) const
+{
+    // texel centers are at half integer coordinates
+    float x  = ( uv.x - std::floor( uv.x ) ) * level.width - 0.5f;
+    float y  = ( uv.y - std::floor( uv.y ) ) * level.height - 0.5f;
+    int x0   = static_cast< int >( std::floor( x ) );
+    int y0   = static_cast< int >( std::floor( y ) );
+    float fx = x - x0;
+    float fy = y - y0;
+
+    glm::vec4 top    = glm::mix( Fetch( level, x0, y0 ),     Fetch( level, x0 + 1, y0 ),     fx );
+    glm::vec4 bottom = glm::mix( Fetch( level, x0, y0 + 1 ), Fetch( level, x0 + 1, y0 + 1 ), fx );
+
+    return glm::mix( top, bottom, fy );
+}
+
+glm::vec4 Texture::Sample( const glm::vec2& uv, float uvFootprint ) const
+{
+    // level 0 texels are 1 / size wide, every level doubles that
+    float texelFootprint = uvFootprint * std::sqrt( static_cast< float >( m_width ) * m_height );
+    float lod            = texelFootprint > 1 ? std::log2( texelFootprint ) : 0;
+    int maxLevel         = static_cast< int >( m_mipLevels.size() ) - 1;
+    if ( lod >= maxLevel )
+    {
+        return SampleBilinear( m_mipLevels[maxLevel], uv );
+    }
+
+    int level        = static_cast< int >( lod );
+    float blend      = lod - level;
+    glm::vec4 color  = SampleBilinear( m_mipLevels[level], uv );
+    if ( blend > 0 )
+    {
+        color = glm::mix( color, SampleBilinear( m_mipLevels[level + 1], uv ), blend );
+    }
+
     return color;
 }
 
@@ -2,15 +2,36 @@
 
 #include "math.hpp"
 #include "resource/resource.hpp"
+#include "resource/texture_cache.hpp"
+#include <memory>
+#include <vector>
 
 namespace PT
 {
 
+// How the texels of each mip level are stored in memory. Linear and Tiled only affect performance, BC1 trades
+// some quality for 1/8th of the memory
+enum class TextureLayout
+{
+    Linear, // RGBA8, row by row
+    Tiled,  // RGBA8, 4x4 texel tiles (64 bytes == one cache line), tiles row by row. 2D footprints touch far fewer lines
+    BC1,    // 4x4 texel blocks of two RGB565 endpoints and 2 bit indices (8 bytes), blocks row by row. No alpha
+};
+
+#define TEXTURE_TILE_SIZE 4
+#define BC1_BLOCK_BYTES 8
+
+// layout of the textures that don't pick their own, like the ones loaded with models
+void SetDefaultTextureLayout( TextureLayout layout );
+TextureLayout GetDefaultTextureLayout();
+
 struct TextureCreateInfo
 {
     std::string name;
     std::string filename;
-    bool flipVertically = true;
+    bool flipVertically  = true;
+    TextureLayout layout = GetDefaultTextureLayout();
+    bool sRGB            = true; // texels are sRGB encoded (albedo), and decoded to linear on lookup. false == already linear
 };
 
 struct Texture : public Resource
@@ -18,17 +39,60 @@ struct Texture : public Resource
     Texture() = default;
     ~Texture();
 
+    // Loads the image and generates its mip chain, down to 1x1. With the texture cache enabled, the image is
+    // converted to a tiled texture file instead (once, unless the source image changes), and the texels are
+    // paged in through the cache as they are looked up
     bool Load( const TextureCreateInfo& info );
-    
+
+    // same as Load, from width x height RGBA8 texels in memory, row by row
+    void Create( const std::string& name, int width, int height, const unsigned char* rgba, TextureLayout layout = TextureLayout::Tiled,
+                 bool sRGB = true );
+
     int GetWidth() const;
     int GetHeight() const;
-    unsigned char* GetPixels() const;
+    int GetNumMipLevels() const;
+    TextureLayout GetLayout() const;
+    bool IsSRGB() const;
+    bool IsStreamed() const;
+    size_t GetMemoryBytes() const; // of the texels of all of the levels (0 for streamed textures)
+
+    // the texels (or BC1 blocks) of the level, ordered by the layout. nullptr for streamed textures
+    unsigned char* GetPixels( int mipLevel = 0 ) const;
+
+    // nearest texel of the full resolution level. Like Sample, the color is linear (sRGB textures are decoded)
     glm::vec4 GetPixel( float u, float v ) const;
 
+    // Trilinear filtered lookup. The mip level is picked so that one of its texels is as wide as uvFootprint, the
+    // width of the area being looked up in uv units (the ray cone footprint). 0 == bilinear from the full resolution
+    glm::vec4 Sample( const glm::vec2& uv, float uvFootprint ) const;
+
 private:
+    struct MipLevel
+    {
+        int width;
+        int height;
+        int tilesX;    // tiles per row: 4x4 tiles / blocks for Tiled and BC1, cache tiles for streamed textures
+        size_t offset; // of the first byte of the level in m_pixels, or of its first tile in m_tileFile
+    };
+
+    bool LoadStreamed( const TextureCreateInfo& info );
+
+    // byte offset of the texel in m_pixels, x and y already wrapped into the level
+    size_t TexelOffset( const MipLevel& level, int x, int y ) const;
+
+    glm::vec4 Fetch( const MipLevel& level, int x, int y ) const;
+    const unsigned char* FetchBC1( const MipLevel& level, int x, int y ) const;
+    glm::vec4 SampleBilinear( const MipLevel& level, const glm::vec2& uv ) const;
+
     int m_width             = 0;
     int m_height            = 0;
-    unsigned char* m_pixels = nullptr;
+    TextureLayout m_layout  = TextureLayout::Linear;
+    bool m_sRGB             = true;
+    unsigned char* m_pixels = nullptr; // texels of all of the levels, level 0 first
+    size_t m_memoryBytes    = 0;
+    uint32_t m_id           = 0; // unique for the lifetime of the process, tags the decoded BC1 blocks
+    std::vector< MipLevel > m_mipLevels;
+    std::unique_ptr< TiledTextureFile > m_tileFile; // only for streamed textures, which have no m_pixels
 };
 
 } // namespace PT
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include "resource/texture_cache.hpp"
+#include "utils/logger.hpp"
+#include "utils/per_thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// power of 2
+#define TEXTURE_CACHE_SHARDS 16
+#define THREAD_TILE_SLOTS 8
+
+namespace PT
+{
+
+static std::atomic< uint32_t > s_nextFileId( 1 );
+
+bool TiledTextureFile::Open( const std::string& filename )
+{
+    m_file.open( filename, std::ios::binary );
+    if ( !m_file )
+    {
+        LOG_ERR( "Could not open tiled texture '", filename, "'" );
+        return false;
+    }
+
+    TiledTextureHeader expected;
+    m_file.read( reinterpret_cast< char* >( &m_header ), sizeof( TiledTextureHeader ) );
+    if ( !m_file || memcmp( m_header.magic, expected.magic, sizeof( expected.magic ) ) || m_header.tileSize != expected.tileSize )
+    {
+        LOG_ERR( "'", filename, "' is not a valid tiled texture file" );
+        m_file.close();
+        return false;
+    }
+    // not an error, files of older versions are just converted again
+    if ( m_header.version != expected.version )
+    {
+        m_file.close();
+        return false;
+    }
+    m_filename = filename;
+    m_id       = s_nextFileId++;
+
+    return true;
+}
+
+bool TiledTextureFile::ReadTile( uint32_t tileIndex, unsigned char* dst ) const
+{
+    std::lock_guard< std::mutex > lock( m_lock );
+    m_file.seekg( sizeof( TiledTextureHeader ) + static_cast< std::streamoff >( tileIndex ) * TEXTURE_CACHE_TILE_BYTES );
+    m_file.read( reinterpret_cast< char* >( dst ), TEXTURE_CACHE_TILE_BYTES );
+    if ( !m_file )
+    {
+        m_file.clear();
+        return false;
+    }
+
+    return true;
+}
+
+struct TileData
+{
+    unsigned char texels[TEXTURE_CACHE_TILE_BYTES];
+};
+using TilePtr = std::shared_ptr< const TileData >;
+
+struct CacheShard
+{
+    std::mutex lock;
+    std::list< uint64_t > lru; // keys, most recently used first
+    std::unordered_map< uint64_t, std::pair< TilePtr, std::list< uint64_t >::iterator > > tiles;
+    size_t capacity    = 1;
+    uint64_t hits      = 0;
+    uint64_t misses    = 0;
+    uint64_t evictions = 0;
+};
+
+// The tiles a thread used last, direct mapped by key. Key 0 (file 0) is never used, so zeroed slots are empty.
+// The counters are summed and reset by the thread calling GetStats / ResetStats, not by their owner. The current
+// callers only do that between renders, but relaxed atomics keep it race free if stats are ever read mid render, and
+// only the owning thread adds to them, so the adds cost the same as plain ones
+struct ThreadTileCache
+{
+    uint64_t keys[THREAD_TILE_SLOTS] = {};
+    TilePtr tiles[THREAD_TILE_SLOTS];
+    std::atomic< uint64_t > lookups    = 0;
+    std::atomic< uint64_t > threadHits = 0;
+};
+
+static CacheShard s_shards[TEXTURE_CACHE_SHARDS];
+static bool s_enabled = false;
+static std::string s_directory;
+
+static uint64_t HashKey( uint64_t key )
+{
+    return key * 0x9E3779B97F4A7C15ull;
+}
+
+static TilePtr GetTile( const TiledTextureFile& file, uint32_t tileIndex, uint64_t key )
+{
+    CacheShard& shard = s_shards[( HashKey( key ) >> 32 ) & ( TEXTURE_CACHE_SHARDS - 1 )];
+    {
+        std::lock_guard< std::mutex > lock( shard.lock );
+        auto it = shard.tiles.find( key );
+        if ( it != shard.tiles.end() )
+        {
+            shard.lru.splice( shard.lru.begin(), shard.lru, it->second.second );
+            ++shard.hits;
+            return it->second.first;
+        }
+    }
+
+    // read without holding the lock, so the other threads of the shard don't wait on the disk. A failed read
+    // leaves the tile black instead of failing the render
+    auto tile = std::make_shared< TileData >();
+    if ( !file.ReadTile( tileIndex, tile->texels ) )
+    {
+        static std::atomic< bool > s_reportedError( false );
+        if ( !s_reportedError.exchange( true ) )
+        {
+            LOG_ERR( "Could not read tile ", tileIndex, " of tiled texture ", file.GetId(), ", using black texels" );
+        }
+    }
+
+    std::lock_guard< std::mutex > lock( shard.lock );
+    ++shard.misses;
+    auto it = shard.tiles.find( key );
+    if ( it != shard.tiles.end() )
+    {
+        // another thread loaded it in the meantime
+        return it->second.first;
+    }
+    shard.lru.push_front( key );
+    shard.tiles[key] = { tile, shard.lru.begin() };
+    while ( shard.tiles.size() > shard.capacity )
+    {
+        shard.tiles.erase( shard.lru.back() );
+        shard.lru.pop_back();
+        ++shard.evictions;
+    }
+
+    return tile;
+}
+
+namespace TextureCache
+{
+
+    // drops the cached tiles if the capacity changes, they are read again on demand
+    static void SetShardCapacity( size_t capacity, bool force )
+    {
+        for ( CacheShard& shard : s_shards )
+        {
+            std::lock_guard< std::mutex > lock( shard.lock );
+            if ( force || shard.capacity != capacity )
+            {
+                shard.tiles.clear();
+                shard.lru.clear();
+                shard.capacity = capacity;
+            }
+        }
+    }
+
+    void Init( const TextureCacheSettings& settings )
+    {
+        s_enabled   = settings.budgetMB > 0;
+        s_directory = settings.directory;
+        if ( !s_enabled )
+        {
+            // textures streamed by a scene loaded earlier (and still cached by the server) keep reading through
+            // the cache, so it keeps their budget instead of shrinking to nothing under them
+            return;
+        }
+        size_t capacityTiles = settings.budgetMB * 1024 * 1024 / TEXTURE_CACHE_TILE_BYTES;
+        SetShardCapacity( std::max< size_t >( 1, capacityTiles / TEXTURE_CACHE_SHARDS ), false );
+        if ( !s_directory.empty() )
+        {
+            std::error_code ec;
+            fs::create_directories( s_directory, ec );
+        }
+    }
+
+    void Shutdown()
+    {
+        s_enabled = false;
+        s_directory.clear();
+        SetShardCapacity( 1, true );
+        PerThread< ThreadTileCache >::ForEach( []( ThreadTileCache& threadCache )
+        {
+            for ( int slot = 0; slot < THREAD_TILE_SLOTS; ++slot )
+            {
+                threadCache.keys[slot] = 0;
+                threadCache.tiles[slot].reset();
+            }
+            threadCache.lookups.store( 0, std::memory_order_relaxed );
+            threadCache.threadHits.store( 0, std::memory_order_relaxed );
+        });
+    }
+
+    bool IsEnabled()
+    {
+        return s_enabled;
+    }
+
+    std::string GetTiledFilename( const std::string& sourceFilename )
+    {
+        if ( s_directory.empty() )
+        {
+            return sourceFilename + TILED_TEXTURE_FILE_EXTENSION;
+        }
+
+        // images with the same name in different directories must not share a tiled file
+        std::error_code ec;
+        fs::path source = fs::absolute( sourceFilename, ec );
+        size_t pathHash = std::hash< std::string >()( source.string() );
+        char hashString[32];
+        snprintf( hashString, sizeof( hashString ), "%016llx", static_cast< unsigned long long >( pathHash ) );
+
+        return ( fs::path( s_directory ) / ( source.filename().string() + "_" + hashString + TILED_TEXTURE_FILE_EXTENSION ) ).string();
+    }
+
+    const unsigned char* Fetch( const TiledTextureFile& file, uint32_t tileIndex, int x, int y )
+    {
+        ThreadTileCache& threadCache = PerThread< ThreadTileCache >::Get();
+        uint64_t key = ( static_cast< uint64_t >( file.GetId() ) << 32 ) | tileIndex;
+        int slot     = static_cast< int >( HashKey( key ) >> 61 ) & ( THREAD_TILE_SLOTS - 1 );
+        threadCache.lookups.fetch_add( 1, std::memory_order_relaxed );
+        if ( threadCache.keys[slot] == key )
+        {
+            threadCache.threadHits.fetch_add( 1, std::memory_order_relaxed );
+        }
+        else
+        {
+            threadCache.tiles[slot] = GetTile( file, tileIndex, key );
+            threadCache.keys[slot]  = key;
+        }
+
+        return threadCache.tiles[slot]->texels + 4 * ( y * TEXTURE_CACHE_TILE_SIZE + x );
+    }
+
+    TextureCacheStats GetStats()
+    {
+        TextureCacheStats stats;
+        for ( CacheShard& shard : s_shards )
+        {
+            std::lock_guard< std::mutex > lock( shard.lock );
+            stats.hits          += shard.hits;
+            stats.misses        += shard.misses;
+            stats.evictions     += shard.evictions;
+            stats.residentTiles += shard.tiles.size();
+            stats.capacityTiles += shard.capacity;
+        }
+        stats.bytesRead = stats.misses * TEXTURE_CACHE_TILE_BYTES;
+        PerThread< ThreadTileCache >::ForEach( [&stats]( const ThreadTileCache& threadCache )
+        {
+            stats.lookups    += threadCache.lookups.load( std::memory_order_relaxed );
+            stats.threadHits += threadCache.threadHits.load( std::memory_order_relaxed );
+        });
+
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        for ( CacheShard& shard : s_shards )
+        {
+            std::lock_guard< std::mutex > lock( shard.lock );
+            shard.hits      = 0;
+            shard.misses    = 0;
+            shard.evictions = 0;
+        }
+        PerThread< ThreadTileCache >::ForEach( []( ThreadTileCache& threadCache )
+        {
+            threadCache.lookups.store( 0, std::memory_order_relaxed );
+            threadCache.threadHits.store( 0, std::memory_order_relaxed );
+        });
+    }
+
+    void LogStats()
+    {
+        TextureCacheStats stats = GetStats();
+        if ( stats.lookups == 0 )
+        {
+            return;
+        }
+        uint64_t sharedLookups = stats.hits + stats.misses;
+        LOG( "Texture cache:" );
+        LOG( "\tTexel lookups: ", stats.lookups, ", ", 100.0 * stats.threadHits / stats.lookups, "% from the per thread tiles" );
+        LOG( "\tShared cache: ", stats.hits, " hits, ", stats.misses, " misses (", sharedLookups ? 100.0 * stats.hits / sharedLookups : 0.0, "% hit rate), ",
+            stats.evictions, " evictions" );
+        LOG( "\tRead ", stats.bytesRead / ( 1024.0 * 1024.0 ), " MB, ", stats.residentTiles * TEXTURE_CACHE_TILE_BYTES / ( 1024.0 * 1024.0 ), " of ",
+            stats.capacityTiles * TEXTURE_CACHE_TILE_BYTES / ( 1024.0 * 1024.0 ), " MB resident" );
+    }
+
+} // namespace TextureCache
+} // namespace PT
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "math.hpp"
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace PT
+{
+
+#define TILED_TEXTURE_FILE_EXTENSION ".pttex"
+
+// Width and height of a tile in texels. 32 x 32 RGBA8 == 4KB, one page
+#define TEXTURE_CACHE_TILE_SIZE 32
+#define TEXTURE_CACHE_TILE_BYTES ( 4 * TEXTURE_CACHE_TILE_SIZE * TEXTURE_CACHE_TILE_SIZE )
+
+// Tiled texture file, converted once from a source image by Texture::Load when the texture cache is enabled.
+// The header is followed by the tiles of every mip level, level 0 first, each level's tiles row by row. Each
+// tile is TEXTURE_CACHE_TILE_SIZE^2 RGBA8 texels, row by row, zero padded past the right / bottom edge of the level
+struct TiledTextureHeader
+{
+    char magic[4]          = { 'P', 'T', 'T', 'X' };
+    uint32_t version       = 2;
+    int32_t width          = 0;
+    int32_t height         = 0;
+    int32_t numMipLevels   = 0;
+    int32_t tileSize       = TEXTURE_CACHE_TILE_SIZE;
+    int32_t flipVertically = 0;
+    int32_t sRGB           = 0; // the mips of sRGB textures are averaged in linear space
+};
+
+// Open tiled texture file that the cache reads tiles from on a miss
+class TiledTextureFile
+{
+public:
+    TiledTextureFile() = default;
+
+    TiledTextureFile( const TiledTextureFile& ) = delete;
+    TiledTextureFile& operator=( const TiledTextureFile& ) = delete;
+
+    bool Open( const std::string& filename );
+
+    // reads tile number 'tileIndex' of the file (counting through all of the levels) into dst, TEXTURE_CACHE_TILE_BYTES long
+    bool ReadTile( uint32_t tileIndex, unsigned char* dst ) const;
+
+    const TiledTextureHeader& GetHeader() const { return m_header; }
+    uint32_t GetId() const { return m_id; }
+
+private:
+    TiledTextureHeader m_header;
+    std::string m_filename;
+    uint32_t m_id = 0; // unique for the lifetime of the process, part of the cache keys
+    mutable std::ifstream m_file;
+    mutable std::mutex m_lock; // seek + read
+};
+
+struct TextureCacheSettings
+{
+    size_t budgetMB = 0;   // 0 == disabled, textures are fully decoded into memory
+    std::string directory; // where the tiled files go. Empty == next to the source images
+};
+
+struct TextureCacheStats
+{
+    uint64_t lookups     = 0; // texel fetches of streamed textures
+    uint64_t threadHits  = 0; // served by the tiles a thread used last, without touching the shared cache
+    uint64_t hits        = 0; // found in the shared cache
+    uint64_t misses      = 0; // read from disk
+    uint64_t evictions   = 0;
+    uint64_t bytesRead   = 0;
+    size_t residentTiles = 0;
+    size_t capacityTiles = 0;
+};
+
+// Fixed size LRU cache of texture tiles, shared by all threads, so that the texture memory is bounded by the
+// budget no matter how big the scene's textures are. Split into independently locked shards so the threads
+// rarely wait on each other. On top of that every thread keeps a few of the tiles it used last, which serves
+// most of the lookups of coherent paths (and is the only thing that can exceed the budget, by a few tiles per thread)
+namespace TextureCache
+{
+
+    // Process wide: the settings decide whether the textures loaded from now on are streamed. A budget of 0 leaves the
+    // tiles and capacity of the cache alone, for the streamed textures that were loaded before
+    void Init( const TextureCacheSettings& settings );
+    void Shutdown(); // only while nothing is rendering, it drops the tiles the threads hold on to
+    bool IsEnabled();
+
+    // name of the tiled file of a source image
+    std::string GetTiledFilename( const std::string& sourceFilename );
+
+    // RGBA8 texel (x, y) of tile 'tileIndex' of the file, x and y inside of the tile. Valid until the thread's next Fetch
+    const unsigned char* Fetch( const TiledTextureFile& file, uint32_t tileIndex, int x, int y );
+
+    TextureCacheStats GetStats();
+    void ResetStats();
+    void LogStats();
+
+} // namespace TextureCache
+} // namespace PT
@@ -1,5 +1,6 @@
 #include "sampling.hpp"
 #include <algorithm>
+#include <numeric>
 
 namespace PT
 {
@@ -66,4 +67,64 @@ glm::vec2 UniformSampleTriangle( float u1, float u2 )
     return { 1 - su0, u2 * su0 };
 }
 
+bool AliasTable::Build( const std::vector< float >& weights )
+{
+    int n = static_cast< int >( weights.size() );
+    m_threshold.assign( n, 1.0f );
+    m_alias.resize( n );
+    m_pmf.assign( n, 0.0f );
+    double sum = std::accumulate( weights.begin(), weights.end(), 0.0 );
+    if ( n == 0 || !( sum > 0 ) )
+    {
+        m_threshold.clear();
+        m_alias.clear();
+        m_pmf.clear();
+        return false;
+    }
+
+    // scale so the average entry is 1, then fill every under full entry with the excess of an over full one
+    std::vector< double > scaled( n );
+    std::vector< int > small, large;
+    for ( int i = 0; i < n; ++i )
+    {
+        m_pmf[i]   = static_cast< float >( weights[i] / sum );
+        scaled[i]  = weights[i] * n / sum;
+        m_alias[i] = i;
+        ( scaled[i] < 1 ? small : large ).push_back( i );
+    }
+    while ( !small.empty() && !large.empty() )
+    {
+        int s = small.back();
+        int l = large.back();
+        small.pop_back();
+        m_threshold[s] = static_cast< float >( scaled[s] );
+        m_alias[s]     = l;
+        scaled[l]     -= 1 - scaled[s];
+        if ( scaled[l] < 1 )
+        {
+            large.pop_back();
+            small.push_back( l );
+        }
+    }
+    // whatever is left is full, up to rounding errors. Entries that can't be sampled must never be returned though
+    int largest = static_cast< int >( std::max_element( weights.begin(), weights.end() ) - weights.begin() );
+    for ( int i : small )
+    {
+        if ( weights[i] <= 0 )
+        {
+            m_threshold[i] = 0;
+            m_alias[i]     = largest;
+        }
+    }
+
+    return true;
+}
+
+int AliasTable::Sample( float u1, float u2 ) const
+{
+    int n     = static_cast< int >( m_threshold.size() );
+    int index = std::min( static_cast< int >( u1 * n ), n - 1 );
+    return u2 < m_threshold[index] ? index : m_alias[index];
+}
+
 } // namespace PT
\ No newline at end of file
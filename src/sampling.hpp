@@ -1,6 +1,7 @@
 #pragma once
 
 #include "math.hpp"
+#include <vector>
 
 namespace PT
 {
@@ -17,4 +18,37 @@ glm::vec3 UniformSampleSphere( float u1, float u2 );
 
 glm::vec2 UniformSampleTriangle( float u1, float u2 );
 
+// Veach's power heuristic (beta = 2) weight of a sample taken with pdf fPdf, when the other strategy could have taken
+// it with pdf gPdf. One sample of each strategy
+inline float PowerHeuristic( float fPdf, float gPdf )
+{
+    float f = fPdf * fPdf;
+    float g = gPdf * gPdf;
+    return f + g > 0 ? f / ( f + g ) : 0;
+}
+
+// Walker's alias table (built with Vose's method): picks index i of a discrete distribution with probability
+// weights[i] / sum( weights ) in constant time, no matter how many entries there are
+class AliasTable
+{
+public:
+    AliasTable() = default;
+
+    // false if there is no weight > 0 to sample
+    bool Build( const std::vector< float >& weights );
+
+    // u1 and u2 are uniform in [0, 1)
+    int Sample( float u1, float u2 ) const;
+
+    // probability of Sample returning index
+    float Pmf( int index ) const { return m_pmf[index]; }
+
+    int Size() const { return static_cast< int >( m_pmf.size() ); }
+
+private:
+    std::vector< float > m_threshold; // probability of keeping the picked entry instead of taking its alias
+    std::vector< int > m_alias;
+    std::vector< float > m_pmf;
+};
+
 } // namespace PT
\ No newline at end of file
@@ -1,11 +1,16 @@
 #include "scene.hpp"
 #include "assert.hpp"
+#include "bvh_quality.hpp"
 #include "configuration.hpp"
 #include "intersection_tests.hpp"
 #include "resource/resource_manager.hpp"
+#include "resource/texture_cache.hpp"
 #include "utils/json_parsing.hpp"
 #include "utils/logger.hpp"
 #include "utils/time.hpp"
+#include "utils/trace.hpp"
+#include <algorithm>
+#include <filesystem>
 
 namespace PT
 {
@@ -89,6 +94,38 @@ static void ParseCamera( rapidjson::Value& v, Scene* scene )
     camera.UpdateOrientationVectors();
 }
 
+static void ParseCameraPath( rapidjson::Value& value, Scene* scene )
+{
+    static FunctionMapper< void, CameraKeyframe& > keyframeMapping(
+    {
+        { "frame",    []( rapidjson::Value& v, CameraKeyframe& k ) { k.frame    = ParseNumber< int >( v ); } },
+        { "position", []( rapidjson::Value& v, CameraKeyframe& k ) { k.position = ParseVec3( v ); } },
+        { "rotation", []( rapidjson::Value& v, CameraKeyframe& k ) { k.rotation = glm::radians( ParseVec3( v ) ); } },
+        { "vfov",     []( rapidjson::Value& v, CameraKeyframe& k ) { k.vfov     = glm::radians( ParseNumber< float >( v ) ); } },
+    });
+    static FunctionMapper< void, CameraPath& > mapping(
+    {
+        { "numFrames", []( rapidjson::Value& v, CameraPath& path ) { path.numFrames = ParseNumber< int >( v ); } },
+        { "keyframes", []( rapidjson::Value& v, CameraPath& path )
+            {
+                for ( auto& keyValue : v.GetArray() )
+                {
+                    CameraKeyframe key;
+                    keyframeMapping.ForEachMember( keyValue, key );
+                    path.keyframes.push_back( key );
+                }
+            }
+        },
+    });
+
+    mapping.ForEachMember( value, scene->cameraPath );
+}
+
+static void ParseCheckpointInterval( rapidjson::Value& value, Scene* scene )
+{
+    scene->checkpointIntervalSeconds = ParseNumber< float >( value );
+}
+
 static void ParseDirectionalLight( rapidjson::Value& value, Scene* scene )
 {
     static FunctionMapper< void, DirectionalLight* > mapping(
@@ -137,23 +174,20 @@ static void ParseMaxDepth( rapidjson::Value& v, Scene* scene )
     scene->maxDepth = v.GetInt();
 }
 
-static void ParseModel( rapidjson::Value& v, Scene* scene )
+static ModelCreateInfo ParseModelCreateInfo( rapidjson::Value& v )
 {
     static FunctionMapper< void, ModelCreateInfo& > mapping(
     {
         { "name",               []( rapidjson::Value& v, ModelCreateInfo& m ) { m.name     = v.GetString(); } },
         { "filename",           []( rapidjson::Value& v, ModelCreateInfo& m ) { m.filename = RESOURCE_DIR + std::string( v.GetString() ); } },
         { "recalculateNormals", []( rapidjson::Value& v, ModelCreateInfo& m ) { m.recalculateNormals = v.GetBool(); } },
+        { "useCache",           []( rapidjson::Value& v, ModelCreateInfo& m ) { m.useCache           = v.GetBool(); } },
     });
 
     ModelCreateInfo info;
     mapping.ForEachMember( v, info );
 
-    auto model = std::make_shared< Model >();
-    if ( model->Load( info ) )
-    {
-        ResourceManager::AddModel( model );
-    }
+    return info;
 }
 
 static void ParseModelInstance( rapidjson::Value& value, Scene* scene )
@@ -176,16 +210,27 @@ static void ParseModelInstance( rapidjson::Value& value, Scene* scene )
     mapping.ForEachMember( value, info );
 
     std::shared_ptr< Model > model = ResourceManager::GetModel( info.modelName );
-    assert( model );
+    if ( !model )
+    {
+        LOG_ERR( "No model with name '", info.modelName, "' loaded, skipping the ModelInstance" );
+        return;
+    }
     std::shared_ptr< Material > material = nullptr;
     if ( info.materialName != "" )
     {
         material = ResourceManager::GetMaterial( info.materialName );
         assert( material );
     }
-    for ( auto& mesh : model->meshes )
+    // the meshes are transformed in parallel, unless there is only one, which then transforms its vertices in parallel instead
+    int numMeshes = static_cast< int >( model->meshes.size() );
+    std::vector< std::shared_ptr< MeshInstance > > meshInstances( numMeshes );
+    #pragma omp parallel for schedule( dynamic, 1 ) if ( numMeshes > 1 )
+    for ( int i = 0; i < numMeshes; ++i )
+    {
+        meshInstances[i] = std::make_shared< MeshInstance >( model->meshes[i], info.transform, material );
+    }
+    for ( const auto& meshInstance : meshInstances )
     {
-        auto meshInstance = std::make_shared< MeshInstance >( mesh, info.transform, material );
         meshInstance->EmitTrianglesAndLights( scene->shapes, scene->lights, meshInstance );
     }
 }
@@ -201,11 +246,40 @@ static void ParseOutputImageData( rapidjson::Value& value, Scene* scene )
                 s.imageResolution.y = ParseNumber< int >( v[1] );
             }
         },
+        { "cropWindow", []( rapidjson::Value& v, Scene& s )
+            {
+                assert( v.IsArray() && v.Size() == 4 );
+                s.cropWindow = glm::ivec4( ParseNumber< int >( v[0] ), ParseNumber< int >( v[1] ), ParseNumber< int >( v[2] ), ParseNumber< int >( v[3] ) );
+            }
+        },
+        { "tileSize",   []( rapidjson::Value& v, Scene& s ) { s.tileSize = std::max( 1, ParseNumber< int >( v ) ); } },
+        { "tiles",      []( rapidjson::Value& v, Scene& s )
+            {
+                s.tileRange.x = ParseNumber< int >( v[0] );
+                s.tileRange.y = ParseNumber< int >( v[1] );
+            }
+        },
     });
 
     mapping.ForEachMember( value, *scene );
 }
 
+static void ParsePhotonMap( rapidjson::Value& value, Scene* scene )
+{
+    static FunctionMapper< void, PhotonMapSettings& > mapping(
+    {
+        { "enabled",     []( rapidjson::Value& v, PhotonMapSettings& s ) { s.enabled     = v.GetBool(); } },
+        { "numPhotons",  []( rapidjson::Value& v, PhotonMapSettings& s ) { s.numPhotons  = ParseNumber< int >( v ); } },
+        { "radius",      []( rapidjson::Value& v, PhotonMapSettings& s ) { s.radius      = ParseNumber< float >( v ); } },
+        { "progressive", []( rapidjson::Value& v, PhotonMapSettings& s ) { s.progressive = v.GetBool(); } },
+        { "numPasses",   []( rapidjson::Value& v, PhotonMapSettings& s ) { s.numPasses   = ParseNumber< int >( v ); } },
+        { "alpha",       []( rapidjson::Value& v, PhotonMapSettings& s ) { s.alpha       = ParseNumber< float >( v ); } },
+    });
+
+    scene->photonMapSettings.enabled = true;
+    mapping.ForEachMember( value, scene->photonMapSettings );
+}
+
 static void ParsePointLight( rapidjson::Value& value, Scene* scene )
 {
     static FunctionMapper< void, PointLight* > mapping(
@@ -218,6 +292,11 @@ static void ParsePointLight( rapidjson::Value& value, Scene* scene )
     mapping.ForEachMember( value, (PointLight*)scene->lights[scene->lights.size() - 1] );
 }
 
+static void ParsePrimaryHitCache( rapidjson::Value& value, Scene* scene )
+{
+    scene->cachePrimaryHits = value.GetBool();
+}
+
 static void ParseSamplesPerAreaLight( rapidjson::Value& value, Scene* scene )
 {
     scene->numSamplesPerAreaLight = value.GetInt();
@@ -232,7 +311,12 @@ static void ParseSamplesPerPixel( rapidjson::Value& value, Scene* scene )
     }
 }
 
-static void ParseSkybox( rapidjson::Value& value, Scene* scene )
+static void ParseSamplesPerPass( rapidjson::Value& value, Scene* scene )
+{
+    scene->samplesPerPass = std::max( 1, value.GetInt() );
+}
+
+static SkyboxCreateInfo ParseSkyboxCreateInfo( rapidjson::Value& value )
 {
     static FunctionMapper< void, SkyboxCreateInfo& > mapping(
     {
@@ -249,12 +333,7 @@ static void ParseSkybox( rapidjson::Value& value, Scene* scene )
     SkyboxCreateInfo info;
     mapping.ForEachMember( value, info );
 
-    auto res = std::make_shared< Skybox >();
-    if ( res->Load( info ) )
-    {
-        ResourceManager::AddSkybox( res );
-        scene->skybox = res;
-    }
+    return info;
 }
 
 static void ParseSphere( rapidjson::Value& value, Scene* scene )
@@ -273,26 +352,188 @@ static void ParseSphere( rapidjson::Value& value, Scene* scene )
     o->worldToLocal = Transform( o->position, o->rotation, glm::vec3( o->radius ) ).Inverse();
 }
 
-static void ParseTexture( rapidjson::Value& value, Scene* scene )
+static void ParseTargetNoise( rapidjson::Value& value, Scene* scene )
+{
+    scene->targetNoise = ParseNumber< float >( value );
+}
+
+static std::unordered_map< std::string, TextureLayout > s_stringToTextureLayout =
+{
+    { "Linear", TextureLayout::Linear },
+    { "Tiled", TextureLayout::Tiled },
+    { "BC1", TextureLayout::BC1 },
+};
+
+static TextureCreateInfo ParseTextureCreateInfo( rapidjson::Value& value )
 {
     static FunctionMapper< void, TextureCreateInfo& > mapping(
     {
         { "name",           []( rapidjson::Value& v, TextureCreateInfo& info ) { info.name           = v.GetString(); } },
         { "filename",       []( rapidjson::Value& v, TextureCreateInfo& info ) { info.filename       = RESOURCE_DIR + std::string( v.GetString() ); } },
         { "flipVertically", []( rapidjson::Value& v, TextureCreateInfo& info ) { info.flipVertically = v.GetBool(); } },
+        { "sRGB",           []( rapidjson::Value& v, TextureCreateInfo& info ) { info.sRGB           = v.GetBool(); } },
+        { "layout",         []( rapidjson::Value& v, TextureCreateInfo& info )
+            {
+                auto it = s_stringToTextureLayout.find( v.GetString() );
+                if ( it == s_stringToTextureLayout.end() )
+                {
+                    LOG_WARN( "No texture layout with name '", v.GetString(), "' found! Using the default" );
+                }
+                else
+                {
+                    info.layout = it->second;
+                }
+            }
+        },
     });
 
     TextureCreateInfo info;
     mapping.ForEachMember( value, info );
-    auto res = std::make_shared< Texture >();
-    if ( res->Load( info ) )
+
+    return info;
+}
+
+static TextureCacheSettings ParseTextureCacheSettings( rapidjson::Value& value )
+{
+    static FunctionMapper< void, TextureCacheSettings& > mapping(
+    {
+        { "budgetMB",  []( rapidjson::Value& v, TextureCacheSettings& s ) { s.budgetMB = std::max( 0, ParseNumber< int >( v ) ); } },
+        { "directory", []( rapidjson::Value& v, TextureCacheSettings& s )
+            {
+                // relative to the resource directory, like the other filenames, unless it is absolute
+                s.directory = v.GetString();
+                if ( !std::filesystem::path( s.directory ).is_absolute() )
+                {
+                    s.directory = RESOURCE_DIR + s.directory;
+                }
+            }
+        },
+    });
+    TextureCacheSettings settings;
+    mapping.ForEachMember( value, settings );
+
+    return settings;
+}
+
+static void ParseTextureLayout( rapidjson::Value& value, Scene* scene )
+{
+    auto it = s_stringToTextureLayout.find( value.GetString() );
+    if ( it == s_stringToTextureLayout.end() )
     {
-        ResourceManager::AddTexture( res );
+        LOG_WARN( "No texture layout with name '", value.GetString(), "' found! Using Tiled" );
+        SetDefaultTextureLayout( TextureLayout::Tiled );
+    }
+    else
+    {
+        SetDefaultTextureLayout( it->second );
+    }
+}
+
+static void ParseTimeLimitSeconds( rapidjson::Value& value, Scene* scene )
+{
+    scene->timeLimitSeconds = ParseNumber< float >( value );
+}
+
+// Textures, skyboxes and models are the bulk of the load time, and only depend on each other through the textures
+// that models can share by name. So they are loaded up front, in two parallel stages: the textures, and then the
+// models and skyboxes. They are added to the resource manager in the order of the file, so if several have the
+// same name the last one still wins, and the sequential pass over the file only has to look them up
+static void LoadResources( rapidjson::Document& document, Scene* scene )
+{
+    TRACE_ZONE( "LoadResources" );
+    std::vector< TextureCreateInfo > textureInfos;
+    std::vector< ModelCreateInfo > modelInfos;
+    std::vector< SkyboxCreateInfo > skyboxInfos;
+    for ( auto member = document.MemberBegin(); member != document.MemberEnd(); ++member )
+    {
+        std::string memberName = member->name.GetString();
+        if ( memberName == "Texture" )
+        {
+            textureInfos.push_back( ParseTextureCreateInfo( member->value ) );
+            scene->sourceFiles.push_back( textureInfos.back().filename );
+        }
+        else if ( memberName == "Model" )
+        {
+            modelInfos.push_back( ParseModelCreateInfo( member->value ) );
+            scene->sourceFiles.push_back( modelInfos.back().filename );
+        }
+        else if ( memberName == "Skybox" )
+        {
+            skyboxInfos.push_back( ParseSkyboxCreateInfo( member->value ) );
+            const SkyboxCreateInfo& info = skyboxInfos.back();
+            for ( const std::string* face : { &info.right, &info.left, &info.top, &info.bottom, &info.back, &info.front } )
+            {
+                scene->sourceFiles.push_back( RESOURCE_DIR + *face );
+            }
+        }
+    }
+
+    int numTextures = static_cast< int >( textureInfos.size() );
+    std::vector< std::shared_ptr< Texture > > textures( numTextures );
+    // a single texture or model keeps all of the threads for the parallel loops inside of its own load
+    #pragma omp parallel for schedule( dynamic, 1 ) if ( numTextures > 1 )
+    for ( int i = 0; i < numTextures; ++i )
+    {
+        auto texture = std::make_shared< Texture >();
+        if ( texture->Load( textureInfos[i] ) )
+        {
+            textures[i] = texture;
+        }
+    }
+    for ( const auto& texture : textures )
+    {
+        if ( texture )
+        {
+            ResourceManager::AddTexture( texture );
+        }
+    }
+
+    // one loop for both, so a skybox loads next to the models instead of after them
+    int numModels = static_cast< int >( modelInfos.size() );
+    int numJobs   = numModels + static_cast< int >( skyboxInfos.size() );
+    std::vector< std::shared_ptr< Model > > models( numModels );
+    std::vector< std::shared_ptr< Skybox > > skyboxes( skyboxInfos.size() );
+    #pragma omp parallel for schedule( dynamic, 1 ) if ( numJobs > 1 )
+    for ( int job = 0; job < numJobs; ++job )
+    {
+        if ( job < numModels )
+        {
+            auto model = std::make_shared< Model >();
+            if ( model->Load( modelInfos[job] ) )
+            {
+                models[job] = model;
+            }
+        }
+        else
+        {
+            auto skybox = std::make_shared< Skybox >();
+            if ( skybox->Load( skyboxInfos[job - numModels] ) )
+            {
+                skyboxes[job - numModels] = skybox;
+            }
+        }
+    }
+    for ( const auto& model : models )
+    {
+        if ( model )
+        {
+            ResourceManager::AddModel( model );
+            scene->sourceFiles.insert( scene->sourceFiles.end(), model->sourceFiles.begin(), model->sourceFiles.end() );
+        }
+    }
+    for ( const auto& skybox : skyboxes )
+    {
+        if ( skybox )
+        {
+            ResourceManager::AddSkybox( skybox );
+            scene->skybox = skybox;
+        }
     }
 }
 
 bool Scene::Load( const std::string& filename )
 {
+    TRACE_ZONE_DETAIL( "Scene::Load", filename );
     auto startTime = Time::GetTimePoint();
     LOG( "Loading scene '", filename, "'..." );
 
@@ -301,28 +542,62 @@ bool Scene::Load( const std::string& filename )
     {
         return false;
     }
+    sourceFiles.push_back( filename );
+
+    // the texture cache and default layout have to be set up before the first texture is loaded, wherever they are in the file.
+    // Both are process wide, so a scene without them resets them instead of inheriting the ones of the last loaded scene
+    SetDefaultTextureLayout( TextureLayout::Tiled );
+    TextureCacheSettings textureCacheSettings;
+    auto textureCacheMember = document.FindMember( "TextureCache" );
+    if ( textureCacheMember != document.MemberEnd() )
+    {
+        textureCacheSettings = ParseTextureCacheSettings( textureCacheMember->value );
+    }
+    TextureCache::Init( textureCacheSettings );
+    auto textureLayoutMember = document.FindMember( "TextureLayout" );
+    if ( textureLayoutMember != document.MemberEnd() )
+    {
+        ParseTextureLayout( textureLayoutMember->value, this );
+    }
+    LoadResources( document, this );
 
     static FunctionMapper< void, Scene* > mapping(
     {
         { "BackgroundColor",     ParseBackgroundRadiance },
         { "BVH",                 ParseBVH },
         { "Camera",              ParseCamera },
+        { "CameraPath",          ParseCameraPath },
+        { "CheckpointInterval",  ParseCheckpointInterval },
         { "DirectionalLight",    ParseDirectionalLight },
         { "LogFile",             ParseLogFile },
         { "Material",            ParseMaterial },
         { "MaxDepth",            ParseMaxDepth },
-        { "Model",               ParseModel },
+        { "Model",               []( rapidjson::Value&, Scene* ) {} }, // loaded by LoadResources
         { "ModelInstance",       ParseModelInstance },
         { "OutputImageData",     ParseOutputImageData },
+        { "PhotonMap",           ParsePhotonMap },
         { "PointLight",          ParsePointLight },
+        { "PrimaryHitCache",     ParsePrimaryHitCache },
         { "SamplesPerAreaLight", ParseSamplesPerAreaLight },
+        { "SamplesPerPass",      ParseSamplesPerPass },
         { "SamplesPerPixel",     ParseSamplesPerPixel },
-        { "Skybox",              ParseSkybox },
+        { "Skybox",              []( rapidjson::Value&, Scene* ) {} }, // loaded by LoadResources
         { "Sphere",              ParseSphere },
-        { "Texture",             ParseTexture },
+        { "TargetNoise",         ParseTargetNoise },
+        { "Texture",             []( rapidjson::Value&, Scene* ) {} }, // loaded by LoadResources
+        { "TextureCache",        []( rapidjson::Value&, Scene* ) {} }, // parsed before everything else
+        { "TextureLayout",       []( rapidjson::Value&, Scene* ) {} }, // parsed before everything else
+        { "TimeLimitSeconds",    ParseTimeLimitSeconds },
     });
 
     mapping.ForEachMember( document, this );
+    cameraPath.Finalize( camera );
+
+    if ( shapes.empty() )
+    {
+        LOG_ERR( "Scene '", filename, "' has no shapes to render" );
+        return false;
+    }
 
     float sceneLoadTime = Time::GetDuration( startTime ) / 1000.0f;
     LOG( "Building BVH..." );
@@ -337,10 +612,23 @@ bool Scene::Load( const std::string& filename )
             light->nSamples = numSamplesPerAreaLight;
         }
     }
+    if ( skybox )
+    {
+        environmentLight = new EnvironmentLight;
+        if ( environmentLight->Init( skybox ) )
+        {
+            lights.push_back( environmentLight );
+        }
+        else
+        {
+            delete environmentLight;
+            environmentLight = nullptr;
+        }
+    }
 
     // compute some scene statistics
     size_t numSpheres = 0, numTris = 0;
-    size_t numPointLights = 0, numDirectionalLights = 0, numAreaLights = 0;
+    size_t numPointLights = 0, numDirectionalLights = 0, numAreaLights = 0, numEnvironmentLights = 0;
     for ( const auto& shape : bvh.shapes )
     {
         if ( std::dynamic_pointer_cast< Sphere >( shape ) ) numSpheres += 1;
@@ -351,6 +639,7 @@ bool Scene::Load( const std::string& filename )
         if ( dynamic_cast< AreaLight* >( light ) ) numAreaLights += 1;
         else if ( dynamic_cast< PointLight* >( light ) ) numPointLights += 1;
         else if ( dynamic_cast< DirectionalLight* >( light ) ) numDirectionalLights += 1;
+        else if ( dynamic_cast< EnvironmentLight* >( light ) ) numEnvironmentLights += 1;
     }
     LOG( "Scene stats:" );
     LOG( "------------------------------------------------------" );
@@ -363,6 +652,8 @@ bool Scene::Load( const std::string& filename )
     LOG( "\tAreaLight: ", numAreaLights );
     LOG( "\tPointLight: ", numPointLights );
     LOG( "\tDirectionalLights: ", numDirectionalLights );
+    LOG( "\tEnvironmentLights: ", numEnvironmentLights );
+    LogBVHQuality( ComputeBVHQuality( bvh ) );
 
     return true;
 }
@@ -383,13 +674,87 @@ bool Scene::Occluded( const Ray& ray, float tMax )
     return bvh.Occluded( ray, tMax );
 }
 
+bool Scene::HasRenderLimits() const
+{
+    return timeLimitSeconds > 0 || targetNoise > 0;
+}
+
+glm::ivec4 Scene::GetRenderWindow() const
+{
+    if ( cropWindow.z <= 0 || cropWindow.w <= 0 )
+    {
+        return glm::ivec4( 0, 0, imageResolution.x, imageResolution.y );
+    }
+
+    glm::ivec2 start = glm::clamp( glm::ivec2( cropWindow.x, cropWindow.y ), glm::ivec2( 0 ), imageResolution - 1 );
+    glm::ivec2 end   = glm::min( glm::ivec2( cropWindow.x + cropWindow.z, cropWindow.y + cropWindow.w ), imageResolution );
+    return glm::ivec4( start, glm::max( end - start, glm::ivec2( 1 ) ) );
+}
+
 glm::vec3 Scene::LEnvironment( const Ray& ray )
 {
     if ( skybox )
     {
-        return glm::vec3( skybox->GetPixel( ray ) );
+        return skybox->GetPixel( ray );
     }
     return backgroundRadiance;
 }
 
+ShotSettings Scene::GetShotSettings() const
+{
+    return { camera, outputImageFilename, imageResolution, cropWindow, tileSize, tileRange, numSamplesPerPixel };
+}
+
+void Scene::SetShotSettings( const ShotSettings& shot )
+{
+    camera              = shot.camera;
+    outputImageFilename = shot.outputImageFilename;
+    imageResolution     = shot.imageResolution;
+    cropWindow          = shot.cropWindow;
+    tileSize            = shot.tileSize;
+    tileRange           = shot.tileRange;
+    numSamplesPerPixel  = shot.numSamplesPerPixel;
+}
+
+bool Scene::LoadShots( const std::string& filename, std::vector< ShotSettings >& shots )
+{
+    auto document = ParseJSONFile( filename );
+    if ( document.IsNull() )
+    {
+        return false;
+    }
+    if ( !document.HasMember( "Shots" ) || !document["Shots"].IsArray() )
+    {
+        LOG_ERR( "Shots file '", filename, "' has no \"Shots\" array" );
+        return false;
+    }
+
+    ShotSettings sceneSettings = GetShotSettings();
+    for ( auto& value : document["Shots"].GetArray() )
+    {
+        ShotSettings shot = sceneSettings;
+        ParseShot( value, shot );
+        shots.push_back( shot );
+    }
+
+    return true;
+}
+
+void Scene::ParseShot( rapidjson::Value& value, ShotSettings& shot )
+{
+    static FunctionMapper< void, Scene* > mapping(
+    {
+        { "Camera",          ParseCamera },
+        { "OutputImageData", ParseOutputImageData },
+        { "SamplesPerPixel", ParseSamplesPerPixel },
+    });
+
+    // the parse functions write to the scene, so parse into it and restore its settings afterwards
+    ShotSettings sceneSettings = GetShotSettings();
+    SetShotSettings( shot );
+    mapping.ForEachMember( value, this );
+    shot = GetShotSettings();
+    SetShotSettings( sceneSettings );
+}
+
 } // namespace PT
@@ -2,16 +2,32 @@
 
 #include "bvh.hpp"
 #include "camera.hpp"
+#include "camera_path.hpp"
 #include "lights.hpp"
+#include "photon_map.hpp"
 #include "resource/material.hpp"
 #include "shapes.hpp"
 #include "resource/skybox.hpp"
+#include "rapidjson/fwd.h"
 #include <string>
 #include <vector>
 
 namespace PT
 {
 
+// The settings of a scene that can change between renders without reloading it. A batch of shots
+// (see Scene::LoadShots) renders the same loaded scene with different ShotSettings
+struct ShotSettings
+{
+    Camera camera;
+    std::string outputImageFilename;
+    glm::ivec2 imageResolution;
+    glm::ivec4 cropWindow;
+    int tileSize;
+    glm::ivec2 tileRange;
+    std::vector< int > numSamplesPerPixel;
+};
+
 class Scene
 {
 public:
@@ -23,18 +39,52 @@ public:
     bool Intersect( const Ray& ray, IntersectionData& hitData );
     bool Occluded( const Ray& ray, float tMax = FLT_MAX );
     glm::vec3 LEnvironment( const Ray& ray );
+
+    // true if the render should stop based on time or noise instead of numSamplesPerPixel. Without a time limit, the last
+    // numSamplesPerPixel entry is still the most samples a noise limited render takes
+    bool HasRenderLimits() const;
+
+    // the part of the image to render, clamped to the image: x, y (top left pixel), width, height
+    glm::ivec4 GetRenderWindow() const;
+
+    ShotSettings GetShotSettings() const;
+    void SetShotSettings( const ShotSettings& shot );
+
+    // Parses a list of shots: { "Shots": [ { "Camera": {...}, "OutputImageData": {...}, "SamplesPerPixel": [...] }, ... ] },
+    // using the same schema as the scene file. Each shot starts from the settings of the scene file, and only overrides
+    // the values it lists
+    bool LoadShots( const std::string& filename, std::vector< ShotSettings >& shots );
+
+    // Applies the "Camera", "OutputImageData" and "SamplesPerPixel" members of value on top of shot
+    void ParseShot( rapidjson::Value& value, ShotSettings& shot );
     
     Camera camera;
+    CameraPath cameraPath; // if not empty, the scene is rendered as a sequence of frames
     std::vector< std::shared_ptr< Shape > > shapes; // invalid after bvh is built. Use bvh.shapes
     std::vector< Light* > lights;
     glm::vec3 backgroundRadiance    = glm::vec3( 0 );
     std::shared_ptr< Skybox > skybox;
+    EnvironmentLight* environmentLight = nullptr; // importance samples the skybox, owned by lights
     std::string outputImageFilename = "rendered.png";
     glm::ivec2 imageResolution      = glm::ivec2( 1280, 720 );
+    glm::ivec4 cropWindow           = glm::ivec4( 0 ); // x, y, width, height. A width or height of 0 == render the full image
+    int tileSize                    = 64;              // tiles are numbered row by row
+    glm::ivec2 tileRange            = glm::ivec2( -1 ); // first and last tile to render (inclusive). -1 == no tiles
     int maxDepth                    = 5;
     int numSamplesPerAreaLight      = 1;
     std::vector< int > numSamplesPerPixel = { 32 };
+    PhotonMapSettings photonMapSettings;
+    bool cachePrimaryHits           = false;
+    float timeLimitSeconds          = 0; // 0 == no limit
+    float targetNoise               = 0; // target relative error of the pixel means. 0 == no target
+    int samplesPerPass              = 0; // pass size for the time / noise limited renders. 0 == 8 with a noise target, 1 otherwise
+    glm::ivec2 sampleRange          = glm::ivec2( -1 ); // [first, end) sample indices to render, unnormalized and deterministically seeded. -1 == all samples
+    float checkpointIntervalSeconds = 0;     // 0 == no periodic checkpoints (see checkpoint.hpp)
+    std::string checkpointFilename;          // set per render by main, next to the output image
+    bool resumeFromCheckpoint       = false; // continue from checkpointFilename if it matches the render
+    bool costHeatmaps               = false; // record the per pixel render cost (see cost_heatmap.hpp)
     BVH bvh;
+    std::vector< std::string > sourceFiles; // every file read by Load: the scene file, models (with their .mtl files and textures), textures and skybox faces
 };
 
 } // namespace PT
@@ -72,6 +72,9 @@ bool Sphere::Intersect( const Ray& ray, IntersectionData* hitData ) const
     hitData->tangent   = glm::vec3( -sin( theta ), 0, cos( theta ) );
     hitData->bitangent = glm::cross( hitData->normal, hitData->tangent );
 
+    // the uv square is spread over the whole sphere, so this is the average
+    hitData->uvAreaRatio = 1.0f / Area();
+
     return true;
 }
 
@@ -128,6 +131,12 @@ bool Triangle::Intersect( const Ray& ray, IntersectionData* hitData ) const
         
         hitData->bitangent = glm::cross( hitData->normal, hitData->tangent );
         hitData->texCoords = ( 1 - u - v ) * obj.uvs[i0] + u * obj.uvs[i1] + v * obj.uvs[i2];
+
+        glm::vec2 duv1       = obj.uvs[i1] - obj.uvs[i0];
+        glm::vec2 duv2       = obj.uvs[i2] - obj.uvs[i0];
+        float uvArea         = std::abs( duv1.x * duv2.y - duv1.y * duv2.x );
+        float worldArea      = glm::length( glm::cross( obj.vertices[i1] - obj.vertices[i0], obj.vertices[i2] - obj.vertices[i0] ) );
+        hitData->uvAreaRatio = worldArea > 0 ? uvArea / worldArea : 0;
         return true;
     }
     return false;
@@ -0,0 +1,132 @@
+#include "tile_file.hpp"
+#include "utils/logger.hpp"
+#include <cstring>
+#include <fstream>
+
+namespace PT
+{
+
+bool WriteTileFile( const std::string& filename, const TileFileHeader& header, const Image& image )
+{
+    assert( header.width == image.GetWidth() && header.height == image.GetHeight() );
+    std::ofstream out( filename, std::ios::binary );
+    if ( !out )
+    {
+        LOG_ERR( "Could not open tile file '", filename, "' for writing" );
+        return false;
+    }
+
+    out.write( reinterpret_cast< const char* >( &header ), sizeof( TileFileHeader ) );
+    out.write( reinterpret_cast< const char* >( image.GetPixels() ), sizeof( glm::vec3 ) * image.GetWidth() * image.GetHeight() );
+
+    return out.good();
+}
+
+bool ReadTileFile( const std::string& filename, TileFileHeader& header, Image& image )
+{
+    std::ifstream in( filename, std::ios::binary );
+    if ( !in )
+    {
+        LOG_ERR( "Could not open tile file '", filename, "'" );
+        return false;
+    }
+
+    TileFileHeader expected;
+    in.read( reinterpret_cast< char* >( &header ), sizeof( TileFileHeader ) );
+    if ( !in || memcmp( header.magic, expected.magic, sizeof( expected.magic ) ) || header.version != expected.version )
+    {
+        LOG_ERR( "'", filename, "' is not a valid tile file" );
+        return false;
+    }
+
+    image = Image( header.width, header.height );
+    in.read( reinterpret_cast< char* >( image.GetPixels() ), sizeof( glm::vec3 ) * header.width * header.height );
+    if ( !in )
+    {
+        LOG_ERR( "Tile file '", filename, "' is truncated" );
+        return false;
+    }
+
+    return true;
+}
+
+bool MergeTileFiles( const std::vector< std::string >& filenames, TileFileHeader& fullHeader, Image& fullImage )
+{
+    std::vector< float > weights;
+    for ( size_t i = 0; i < filenames.size(); ++i )
+    {
+        TileFileHeader header;
+        Image tile;
+        if ( !ReadTileFile( filenames[i], header, tile ) )
+        {
+            return false;
+        }
+
+        if ( i == 0 )
+        {
+            fullHeader            = header;
+            fullHeader.x          = 0;
+            fullHeader.y          = 0;
+            fullHeader.width      = header.fullWidth;
+            fullHeader.height     = header.fullHeight;
+            fullHeader.numSamples = 0;
+            fullImage             = Image( header.fullWidth, header.fullHeight );
+            memset( fullImage.GetPixels(), 0, sizeof( glm::vec3 ) * header.fullWidth * header.fullHeight );
+            weights.resize( header.fullWidth * header.fullHeight, 0 );
+        }
+        else if ( header.fullWidth != fullHeader.fullWidth || header.fullHeight != fullHeader.fullHeight )
+        {
+            LOG_ERR( "Tile '", filenames[i], "' is from a ", header.fullWidth, "x", header.fullHeight, " image, expected ", fullHeader.fullWidth, "x", fullHeader.fullHeight );
+            return false;
+        }
+
+        if ( header.x < 0 || header.y < 0 || header.x + header.width > header.fullWidth || header.y + header.height > header.fullHeight )
+        {
+            LOG_ERR( "Tile '", filenames[i], "' is outside of the image bounds" );
+            return false;
+        }
+
+        bool overlapped = false;
+        float weight    = header.numSamples > 0 ? static_cast< float >( header.numSamples ) : 1.0f;
+        for ( int row = 0; row < header.height; ++row )
+        {
+            for ( int col = 0; col < header.width; ++col )
+            {
+                int index   = (header.y + row) * header.fullWidth + header.x + col;
+                overlapped |= header.numSamples == 0 && weights[index] > 0;
+                // sums already carry their sample count as weight, normalized tiles are weighted by 1
+                fullImage.SetPixel( header.y + row, header.x + col, fullImage.GetPixel( header.y + row, header.x + col ) + tile.GetPixel( row, col ) );
+                weights[index] += weight;
+            }
+        }
+        if ( overlapped )
+        {
+            LOG_WARN( "Tile '", filenames[i], "' overlaps a previous tile, averaging the overlapping pixels" );
+        }
+    }
+
+    size_t missingPixels = 0;
+    for ( int row = 0; row < fullHeader.fullHeight; ++row )
+    {
+        for ( int col = 0; col < fullHeader.fullWidth; ++col )
+        {
+            float weight = weights[row * fullHeader.fullWidth + col];
+            if ( weight > 0 )
+            {
+                fullImage.SetPixel( row, col, fullImage.GetPixel( row, col ) / weight );
+            }
+            else
+            {
+                ++missingPixels;
+            }
+        }
+    }
+    if ( missingPixels )
+    {
+        LOG_WARN( missingPixels, " pixels were not covered by any tile" );
+    }
+
+    return !filenames.empty();
+}
+
+} // namespace PT
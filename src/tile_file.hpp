@@ -0,0 +1,39 @@
+#pragma once
+
+#include "image.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+#define TILE_FILE_EXTENSION ".pttile"
+
+// Raw linear HDR pixels of a sub rectangle of a frame, before tonemapping. Written by crop / tile renders
+// and sample range workers, and assembled into the final image by the ptMergeTiles tool
+struct TileFileHeader
+{
+    char magic[4]      = { 'P', 'T', 'T', 'L' };
+    uint32_t version   = 2;
+    int32_t fullWidth  = 0;
+    int32_t fullHeight = 0;
+    int32_t x          = 0; // column of the top left pixel of the tile in the full frame
+    int32_t y          = 0; // row of the top left pixel of the tile in the full frame
+    int32_t width      = 0;
+    int32_t height     = 0;
+    float exposure     = 1;
+    float gamma        = 1;
+    int32_t numSamples = 0; // 0 == pixels are the final radiance, otherwise they are the unnormalized sum of numSamples samples
+};
+
+bool WriteTileFile( const std::string& filename, const TileFileHeader& header, const Image& image );
+
+bool ReadTileFile( const std::string& filename, TileFileHeader& header, Image& image );
+
+// Assembles the tiles into one full frame image. Tiles of sample sums (numSamples > 0) that cover the same
+// pixels are combined by a sample count weighted sum, so disjoint sample ranges merge into the same result
+// as rendering all of the samples at once. The returned header describes the full, normalized image
+bool MergeTileFiles( const std::vector< std::string >& filenames, TileFileHeader& fullHeader, Image& fullImage );
+
+} // namespace PT
@@ -1,4 +1,8 @@
 #include "tonemap.hpp"
+#include "core_defines.hpp"
+#include "utils/trace.hpp"
+
+#define TONEMAP_AND_GAMMA IN_USE
 
 namespace PT
 {
@@ -51,4 +55,22 @@ glm::vec3 Uncharted2Tonemap( const glm::vec3& pixel, float exposure )
     glm::vec3 color      = curr * whiteScale;
     return color;
 }
+
+void TonemapImage( Image& image, float exposure, float gamma )
+{
+    TRACE_ZONE( "TonemapImage" );
+#if USING( TONEMAP_AND_GAMMA )
+    image.ForAllPixels( [&]( const glm::vec3& pixel )
+        {
+            glm::vec3 newColor = pixel;
+            newColor = Uncharted2Tonemap( newColor, exposure );
+            newColor = GammaCorrect( newColor, gamma );
+            //newColor = PBRTGammaCorrect( newColor ) + glm::vec3( 1.0f / 512.0f );
+            newColor = glm::clamp( newColor, glm::vec3( 0 ), glm::vec3( 1 ) );
+            return newColor;
+        }
+    );
+#endif // #if USING( TONEMAP_AND_GAMMA )
+}
+
 } // namespace PT
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "image.hpp"
 #include "math.hpp"
 
 namespace PT
@@ -10,4 +11,7 @@ glm::vec3 PBRTGammaCorrect( const glm::vec3& pixel );
 glm::vec3 ReinhardTonemap( const glm::vec3& pixel, float exposure = 1 );
 glm::vec3 Uncharted2Tonemap( const glm::vec3& pixel, float exposure = 1 );
 
+// converts a linear HDR image into the final displayable image (tonemapping + gamma + clamping)
+void TonemapImage( Image& image, float exposure, float gamma );
+
 } // namepsace PT
\ No newline at end of file
@@ -0,0 +1,862 @@
+#include "configuration.hpp"
+#include "bvh.hpp"
+#include "intersection_tests.hpp"
+#include "path_tracer.hpp"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include "render_stats.hpp"
+#include "resource/model.hpp"
+#include "resource/resource_manager.hpp"
+#include "resource/texture.hpp"
+#include "sampling.hpp"
+#include "scene.hpp"
+#include "utils/logger.hpp"
+#include "utils/string_utils.hpp"
+#include "utils/time.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace PT;
+namespace fs = std::filesystem;
+
+using JsonWriter = rapidjson::PrettyWriter< rapidjson::StringBuffer >;
+
+// Benchmark suite for tracking performance over time. Results are written as JSON:
+//   micro:     ns per call of the ray / shape intersection tests
+//   build:     BVH build time of every split method, on synthetic and bundled meshes
+//   traversal: BVH::Intersect / Occluded throughput on fixed ray sets (camera, diffuse bounce and shadow rays)
+//   texture:   ns and cache misses per lookup of a large texture in each layout, for several access patterns
+//   render:    full frame renders of resources/scenes/*.json at a fixed SPP, for each thread count
+static void PrintUsage()
+{
+    std::cout << "Usage: ptBench [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --out FILE           Write the JSON results to FILE instead of stdout" << std::endl;
+    std::cout << "  --only GROUP[,...]   Only run the given groups: micro, build, traversal, texture, render" << std::endl;
+    std::cout << "  --minTime SEC        Minimum time spent on each micro / traversal benchmark (default 0.25)" << std::endl;
+    std::cout << "  --spp N              Samples per pixel of the scene renders (default 4)" << std::endl;
+    std::cout << "  --width W            Width of the scene renders, the height keeps the aspect ratio (default 320)" << std::endl;
+    std::cout << "  --threads N[,N...]   Thread counts of the render sweep (default 1, 2, 4, ... up to all cores)" << std::endl;
+}
+
+struct BenchOptions
+{
+    std::string outputFilename;
+    std::vector< std::string > groups = { "micro", "build", "traversal", "texture", "render" };
+    float minSeconds                  = 0.25f;
+    int spp                           = 4;
+    int width                         = 320;
+    std::vector< int > threadCounts;
+};
+
+static bool ParseCommandLine( int argc, char** argv, BenchOptions& options )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool hasArg = i + 1 < argc;
+        if ( !strcmp( argv[i], "--out" ) && hasArg )
+        {
+            options.outputFilename = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--only" ) && hasArg )
+        {
+            options.groups = SplitList( argv[++i] );
+        }
+        else if ( !strcmp( argv[i], "--minTime" ) && hasArg )
+        {
+            options.minSeconds = static_cast< float >( atof( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--spp" ) && hasArg )
+        {
+            options.spp = std::max( 1, atoi( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--width" ) && hasArg )
+        {
+            options.width = std::max( 1, atoi( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--threads" ) && hasArg )
+        {
+            for ( const std::string& count : SplitList( argv[++i] ) )
+            {
+                options.threadCounts.push_back( std::max( 1, atoi( count.c_str() ) ) );
+            }
+        }
+        else
+        {
+            LOG_ERR( "Unknown or incomplete option '", argv[i], "'" );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Calls func( i ) for every i in [0, count) over and over, until at least minSeconds passed.
+// Returns the number of calls made and the seconds they took
+template < typename Func >
+static std::pair< uint64_t, double > RunTimed( size_t count, float minSeconds, Func func )
+{
+    uint64_t calls = 0;
+    auto start     = Time::GetTimePoint();
+    double seconds;
+    do
+    {
+        for ( size_t i = 0; i < count; ++i )
+        {
+            func( i );
+        }
+        calls  += count;
+        seconds = Time::GetDuration( start ) / 1000.0;
+    } while ( seconds < minSeconds );
+
+    return { calls, seconds };
+}
+
+// keeps the compiler from optimizing away the benchmarked calls
+static volatile uint64_t s_sink;
+
+struct MicroRay
+{
+    glm::vec3 position;
+    glm::vec3 direction;
+    glm::vec3 invDirection;
+    int isDirNeg[3];
+};
+
+static void RunMicroBenchmarks( JsonWriter& w, const BenchOptions& options )
+{
+    // rays from random points on a sphere of radius 4 towards random points inside the unit cube, so that
+    // roughly half of the tests hit
+    std::mt19937 rng( 1234 );
+    std::uniform_real_distribution< float > dist( 0, 1 );
+    std::vector< MicroRay > rays( 1 << 14 );
+    for ( MicroRay& ray : rays )
+    {
+        ray.position     = 4.0f * UniformSampleSphere( dist( rng ), dist( rng ) );
+        glm::vec3 target = glm::vec3( dist( rng ), dist( rng ), dist( rng ) ) * 2.0f - 1.0f;
+        ray.direction    = glm::normalize( target - ray.position );
+        ray.invDirection = glm::vec3( 1 ) / ray.direction;
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            ray.isDirNeg[axis] = ray.invDirection[axis] < 0;
+        }
+    }
+    const glm::vec3 v0( -1, -1, 0 ), v1( 1, -1, 0 ), v2( 0, 1, 0 );
+    const glm::vec3 boxMin( -0.5f ), boxMax( 0.5f );
+
+    uint64_t hits = 0;
+    auto report   = [&]( const char* name, std::pair< uint64_t, double > result )
+    {
+        w.StartObject();
+        w.Key( "name" );        w.String( name );
+        w.Key( "calls" );       w.Uint64( result.first );
+        w.Key( "nsPerCall" );   w.Double( 1e9 * result.second / result.first );
+        w.Key( "hitFraction" ); w.Double( static_cast< double >( hits ) / result.first );
+        w.EndObject();
+        LOG( "  ", name, ": ", 1e9 * result.second / result.first, " ns" );
+        s_sink = hits;
+        hits   = 0;
+    };
+
+    LOG( "Running micro benchmarks" );
+    w.Key( "micro" );
+    w.StartArray();
+    report( "RaySphere", RunTimed( rays.size(), options.minSeconds, [&]( size_t i )
+    {
+        float t;
+        hits += intersect::RaySphere( rays[i].position, rays[i].direction, glm::vec3( 0 ), 0.75f, t );
+    }));
+    report( "RayTriangle", RunTimed( rays.size(), options.minSeconds, [&]( size_t i )
+    {
+        float t, u, v;
+        hits += intersect::RayTriangle( rays[i].position, rays[i].direction, v0, v1, v2, t, u, v );
+    }));
+    report( "RayAABB", RunTimed( rays.size(), options.minSeconds, [&]( size_t i )
+    {
+        hits += intersect::RayAABB( rays[i].position, rays[i].invDirection, boxMin, boxMax );
+    }));
+    report( "RayAABBFastest", RunTimed( rays.size(), options.minSeconds, [&]( size_t i )
+    {
+        hits += intersect::RayAABBFastest( rays[i].position, rays[i].invDirection, rays[i].isDirNeg, boxMin, boxMax );
+    }));
+    w.EndArray();
+}
+
+struct BenchMesh
+{
+    std::string name;
+    std::vector< std::shared_ptr< MeshInstance > > instances;
+    AABB aabb;
+};
+
+static void FillVertexAttributes( Mesh& mesh )
+{
+    mesh.normals.assign( mesh.vertices.size(), glm::vec3( 0 ) );
+    for ( size_t i = 0; i < mesh.indices.size(); i += 3 )
+    {
+        const glm::vec3& p0 = mesh.vertices[mesh.indices[i + 0]];
+        const glm::vec3& p1 = mesh.vertices[mesh.indices[i + 1]];
+        const glm::vec3& p2 = mesh.vertices[mesh.indices[i + 2]];
+        glm::vec3 n         = glm::cross( p1 - p0, p2 - p0 );
+        for ( int v = 0; v < 3; ++v )
+        {
+            mesh.normals[mesh.indices[i + v]] += n;
+        }
+    }
+    for ( glm::vec3& n : mesh.normals )
+    {
+        n = glm::length( n ) > 0 ? glm::normalize( n ) : glm::vec3( 0, 1, 0 );
+    }
+    mesh.tangents.assign( mesh.vertices.size(), glm::vec3( 1, 0, 0 ) );
+    mesh.uvs.assign( mesh.vertices.size(), glm::vec2( 0 ) );
+}
+
+// finely tessellated sphere: a coherent, evenly sized mesh
+static Mesh MakeSphereMesh( int rings, int segments )
+{
+    Mesh mesh;
+    for ( int r = 0; r <= rings; ++r )
+    {
+        float theta = glm::pi< float >() * r / rings;
+        for ( int s = 0; s <= segments; ++s )
+        {
+            float phi = 2 * glm::pi< float >() * s / segments;
+            mesh.vertices.emplace_back( std::sin( theta ) * std::cos( phi ), std::cos( theta ), std::sin( theta ) * std::sin( phi ) );
+        }
+    }
+    for ( int r = 0; r < rings; ++r )
+    {
+        for ( int s = 0; s < segments; ++s )
+        {
+            uint32_t i0 = r * ( segments + 1 ) + s;
+            uint32_t i1 = i0 + segments + 1;
+            mesh.indices.insert( mesh.indices.end(), { i0, i1, i0 + 1, i0 + 1, i1, i1 + 1 } );
+        }
+    }
+    FillVertexAttributes( mesh );
+
+    return mesh;
+}
+
+// randomly placed and oriented small triangles: the worst case for the BVH, lots of overlap
+static Mesh MakeTriangleSoupMesh( int numTriangles )
+{
+    std::mt19937 rng( 5678 );
+    std::uniform_real_distribution< float > dist( -1, 1 );
+    Mesh mesh;
+    for ( int i = 0; i < numTriangles; ++i )
+    {
+        glm::vec3 center( dist( rng ), dist( rng ), dist( rng ) );
+        for ( int v = 0; v < 3; ++v )
+        {
+            mesh.indices.push_back( static_cast< uint32_t >( mesh.vertices.size() ) );
+            mesh.vertices.push_back( center + 0.03f * glm::vec3( dist( rng ), dist( rng ), dist( rng ) ) );
+        }
+    }
+    FillVertexAttributes( mesh );
+
+    return mesh;
+}
+
+static std::vector< BenchMesh > LoadBenchMeshes()
+{
+    auto material    = std::make_shared< Material >();
+    material->albedo = glm::vec3( 0.5f );
+
+    std::vector< BenchMesh > benchMeshes;
+    auto addMesh = [&]( const std::string& name, const std::vector< Mesh >& meshes )
+    {
+        BenchMesh benchMesh;
+        benchMesh.name = name;
+        for ( const Mesh& mesh : meshes )
+        {
+            auto instance = std::make_shared< MeshInstance >( mesh, Transform(), material );
+            for ( const glm::vec3& v : instance->data.vertices )
+            {
+                benchMesh.aabb.Union( v );
+            }
+            benchMesh.instances.push_back( instance );
+        }
+        benchMeshes.push_back( benchMesh );
+    };
+
+    addMesh( "synthetic_sphere", { MakeSphereMesh( 256, 512 ) } );
+    addMesh( "synthetic_soup", { MakeTriangleSoupMesh( 200000 ) } );
+
+    // the bundled meshes, skipping the tiny test ones
+    std::vector< fs::path > modelFiles;
+    for ( const char* dir : { "models", "cornell-box" } )
+    {
+        std::error_code ec;
+        for ( const auto& entry : fs::directory_iterator( RESOURCE_DIR + std::string( dir ), ec ) )
+        {
+            if ( entry.path().extension() == ".obj" )
+            {
+                modelFiles.push_back( entry.path() );
+            }
+        }
+    }
+    std::sort( modelFiles.begin(), modelFiles.end() );
+    for ( const fs::path& file : modelFiles )
+    {
+        Model model;
+        ModelCreateInfo info;
+        info.name     = file.stem().string();
+        info.filename = file.string();
+        if ( !model.Load( info ) )
+        {
+            continue;
+        }
+        size_t numTriangles = 0;
+        for ( const Mesh& mesh : model.meshes )
+        {
+            numTriangles += mesh.indices.size() / 3;
+        }
+        if ( numTriangles >= 100 )
+        {
+            addMesh( info.name, model.meshes );
+        }
+    }
+
+    return benchMeshes;
+}
+
+static std::vector< std::shared_ptr< Shape > > GetShapes( const BenchMesh& benchMesh )
+{
+    std::vector< std::shared_ptr< Shape > > shapes;
+    std::vector< Light* > lights;
+    for ( const auto& instance : benchMesh.instances )
+    {
+        instance->EmitTrianglesAndLights( shapes, lights, instance );
+    }
+
+    return shapes;
+}
+
+static const std::pair< BVH::SplitMethod, const char* > s_splitMethods[] =
+{
+    { BVH::SplitMethod::SAH,         "SAH" },
+    { BVH::SplitMethod::Middle,      "Middle" },
+    { BVH::SplitMethod::EqualCounts, "EqualCounts" },
+};
+
+static void RunBuildBenchmarks( JsonWriter& w, const std::vector< BenchMesh >& benchMeshes )
+{
+    LOG( "Running BVH build benchmarks" );
+    w.Key( "build" );
+    w.StartArray();
+    for ( const BenchMesh& benchMesh : benchMeshes )
+    {
+        for ( const auto& [splitMethod, splitName] : s_splitMethods )
+        {
+            // the fastest of a few builds, since a single build is short and noisy
+            double bestMs       = 1e30;
+            size_t numTriangles = 0;
+            for ( int run = 0; run < 3; ++run )
+            {
+                BVH bvh;
+                bvh.splitMethod = splitMethod;
+                auto shapes     = GetShapes( benchMesh );
+                numTriangles    = shapes.size();
+                auto start      = Time::GetTimePoint();
+                bvh.Build( shapes );
+                bestMs = std::min< double >( bestMs, Time::GetDuration( start ) );
+            }
+            w.StartObject();
+            w.Key( "mesh" );        w.String( benchMesh.name.c_str() );
+            w.Key( "triangles" );   w.Uint64( numTriangles );
+            w.Key( "splitMethod" ); w.String( splitName );
+            w.Key( "ms" );          w.Double( bestMs );
+            w.EndObject();
+            LOG( "  ", benchMesh.name, " (", numTriangles, " triangles) ", splitName, ": ", bestMs, " ms" );
+        }
+    }
+    w.EndArray();
+}
+
+struct RaySet
+{
+    const char* name;
+    std::vector< Ray > rays;
+    std::vector< float > tMax; // only for the shadow rays
+};
+
+// Camera rays at the mesh, diffuse bounce rays from where they hit, and shadow rays from the hits towards a
+// point above the mesh. Recorded once with an SAH BVH, so every split method traces the exact same rays
+static std::vector< RaySet > RecordRaySets( const BenchMesh& benchMesh, const BVH& bvh )
+{
+    std::mt19937 rng( 91011 );
+    std::uniform_real_distribution< float > dist( 0, 1 );
+    RaySet primary{ "camera" }, diffuse{ "diffuse" }, shadow{ "shadow" };
+
+    glm::vec3 center = benchMesh.aabb.Centroid();
+    glm::vec3 extent = benchMesh.aabb.max - benchMesh.aabb.min;
+    float size       = std::max( { extent.x, extent.y, extent.z } );
+    glm::vec3 eye    = center + glm::vec3( 0.3f, 0.4f, 1.0f ) * 1.5f * size;
+    glm::vec3 light  = center + glm::vec3( -0.5f, 2.0f, 0.5f ) * size;
+    const int res    = 384;
+    for ( int y = 0; y < res; ++y )
+    {
+        for ( int x = 0; x < res; ++x )
+        {
+            glm::vec3 target = benchMesh.aabb.min + extent * glm::vec3( ( x + 0.5f ) / res, ( y + 0.5f ) / res, 0.5f );
+            Ray ray( eye, glm::normalize( target - eye ) );
+            primary.rays.push_back( ray );
+
+            IntersectionData hit;
+            if ( !bvh.Intersect( ray, &hit ) )
+            {
+                continue;
+            }
+            glm::vec3 N = glm::dot( hit.normal, ray.direction ) < 0 ? hit.normal : -hit.normal;
+            glm::vec3 T = glm::normalize( glm::abs( N.x ) > 0.9f ? glm::cross( N, glm::vec3( 0, 1, 0 ) ) : glm::cross( N, glm::vec3( 1, 0, 0 ) ) );
+            glm::vec3 B = glm::cross( N, T );
+            glm::vec3 d = CosineSampleHemisphere( dist( rng ), dist( rng ) );
+            glm::vec3 origin = hit.position + 1e-4f * size * N;
+            diffuse.rays.emplace_back( origin, glm::normalize( d.x * T + d.y * B + d.z * N ) );
+
+            glm::vec3 toLight = light - origin;
+            shadow.rays.emplace_back( origin, glm::normalize( toLight ) );
+            shadow.tMax.push_back( glm::length( toLight ) );
+        }
+    }
+
+    return { primary, diffuse, shadow };
+}
+
+static void RunTraversalBenchmarks( JsonWriter& w, const std::vector< BenchMesh >& benchMeshes, const BenchOptions& options )
+{
+    LOG( "Running BVH traversal benchmarks" );
+    w.Key( "traversal" );
+    w.StartArray();
+    for ( const BenchMesh& benchMesh : benchMeshes )
+    {
+        std::vector< RaySet > raySets;
+        for ( const auto& [splitMethod, splitName] : s_splitMethods )
+        {
+            BVH bvh;
+            bvh.splitMethod = splitMethod;
+            auto shapes     = GetShapes( benchMesh );
+            bvh.Build( shapes );
+            if ( raySets.empty() )
+            {
+                raySets = RecordRaySets( benchMesh, bvh );
+            }
+
+            for ( const RaySet& raySet : raySets )
+            {
+                if ( raySet.rays.empty() )
+                {
+                    continue;
+                }
+                // single threaded, so the numbers are comparable between machines with different core counts
+                uint64_t hits = 0;
+                ResetRenderStats();
+                std::pair< uint64_t, double > result;
+                if ( raySet.tMax.empty() )
+                {
+                    result = RunTimed( raySet.rays.size(), options.minSeconds, [&]( size_t i )
+                    {
+                        IntersectionData hit;
+                        hits += bvh.Intersect( raySet.rays[i], &hit );
+                    });
+                }
+                else
+                {
+                    result = RunTimed( raySet.rays.size(), options.minSeconds, [&]( size_t i )
+                    {
+                        hits += bvh.Occluded( raySet.rays[i], raySet.tMax[i] );
+                    });
+                }
+                s_sink       = hits;
+                double mrays = result.first / 1e6 / result.second;
+
+                w.StartObject();
+                w.Key( "mesh" );        w.String( benchMesh.name.c_str() );
+                w.Key( "splitMethod" ); w.String( splitName );
+                w.Key( "raySet" );      w.String( raySet.name );
+                w.Key( "function" );    w.String( raySet.tMax.empty() ? "Intersect" : "Occluded" );
+                w.Key( "rays" );        w.Uint64( raySet.rays.size() );
+                w.Key( "mraysPerSec" ); w.Double( mrays );
+                w.Key( "hitFraction" ); w.Double( static_cast< double >( hits ) / result.first );
+#if USING( RENDER_STATS )
+                RenderStats stats = GatherRenderStats();
+                RayStats rayStats = raySet.tMax.empty() ? stats.TotalClosestHit() : stats.TotalShadow();
+                w.Key( "nodesPerRay" ); w.Double( rayStats.rays ? static_cast< double >( rayStats.nodesVisited ) / rayStats.rays : 0 );
+                w.Key( "primitiveTestsPerRay" ); w.Double( rayStats.rays ? static_cast< double >( rayStats.primitiveTests ) / rayStats.rays : 0 );
+#endif // #if USING( RENDER_STATS )
+                w.EndObject();
+                LOG( "  ", benchMesh.name, " ", splitName, " ", raySet.name, ": ", mrays, " Mrays/s" );
+            }
+        }
+    }
+    w.EndArray();
+}
+
+// Hardware cache miss counters of the calling thread (perf_event_open), Linux only. Often not available in
+// containers and VMs, or with a high kernel.perf_event_paranoid, in which case the results leave them out
+class CacheMissCounters
+{
+public:
+    CacheMissCounters()
+    {
+#ifdef __linux__
+        // last level cache misses, and L1 data cache read misses
+        const std::pair< uint32_t, uint64_t > events[2] =
+        {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) },
+        };
+        for ( int i = 0; i < 2; ++i )
+        {
+            perf_event_attr attr = {};
+            attr.size           = sizeof( attr );
+            attr.type           = events[i].first;
+            attr.config         = events[i].second;
+            attr.disabled       = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            m_fds[i] = static_cast< int >( syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ) );
+        }
+#endif // #ifdef __linux__
+    }
+
+    ~CacheMissCounters()
+    {
+#ifdef __linux__
+        for ( int fd : m_fds )
+        {
+            if ( fd >= 0 )
+            {
+                close( fd );
+            }
+        }
+#endif // #ifdef __linux__
+    }
+
+    bool IsAvailable( int counter ) const { return m_fds[counter] >= 0; }
+
+    void Start()
+    {
+#ifdef __linux__
+        for ( int fd : m_fds )
+        {
+            if ( fd >= 0 )
+            {
+                ioctl( fd, PERF_EVENT_IOC_RESET, 0 );
+                ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+            }
+        }
+#endif // #ifdef __linux__
+    }
+
+    // counts since Start(): [0] = last level cache misses, [1] = L1 data cache read misses
+    void Stop( uint64_t counts[2] )
+    {
+        for ( int i = 0; i < 2; ++i )
+        {
+            counts[i] = 0;
+#ifdef __linux__
+            if ( m_fds[i] >= 0 )
+            {
+                ioctl( m_fds[i], PERF_EVENT_IOC_DISABLE, 0 );
+                if ( read( m_fds[i], &counts[i], sizeof( counts[i] ) ) != sizeof( counts[i] ) )
+                {
+                    counts[i] = 0;
+                }
+            }
+#endif // #ifdef __linux__
+        }
+    }
+
+private:
+    int m_fds[2] = { -1, -1 };
+};
+
+struct TextureLookupSet
+{
+    const char* name;
+    std::vector< glm::vec3 > lookups; // uv, uvFootprint
+};
+
+// Access patterns of a 'res' x 'res' texture: scanning it row by row and column by column, random texels, and the
+// screen space order of a tiled plane seen at a grazing angle, where the footprint grows with the distance
+static std::vector< TextureLookupSet > MakeTextureLookupSets( int res )
+{
+    TextureLookupSet rows{ "rowScan" }, columns{ "columnScan" }, random{ "random" }, plane{ "grazingPlane" };
+    float texel = 1.0f / res;
+    for ( int y = 0; y < res; ++y )
+    {
+        for ( int x = 0; x < res; ++x )
+        {
+            rows.lookups.emplace_back( ( x + 0.5f ) * texel, ( y + 0.5f ) * texel, 0 );
+            columns.lookups.emplace_back( ( y + 0.5f ) * texel, ( x + 0.5f ) * texel, 0 );
+        }
+    }
+
+    std::mt19937 rng( 5678 );
+    std::uniform_real_distribution< float > dist( 0, 1 );
+    random.lookups.resize( rows.lookups.size() );
+    for ( glm::vec3& lookup : random.lookups )
+    {
+        lookup = glm::vec3( dist( rng ), dist( rng ), 0 );
+    }
+
+    // camera one unit above the plane, looking down at it at a grazing angle. Screen row s in (0, 1] sees the
+    // plane at distance 1 / s, so both the uv spacing and the footprint grow with 1 / s^2 towards the horizon
+    const int screenRes   = 1024;
+    const float uvPerUnit = 0.25f;
+    for ( int sy = 0; sy < screenRes; ++sy )
+    {
+        float s         = ( sy + 1.0f ) / screenRes;
+        float distance  = 1.0f / s;
+        float footprint = std::max( distance, distance * distance ) * uvPerUnit / screenRes;
+        for ( int sx = 0; sx < screenRes; ++sx )
+        {
+            float u = ( ( sx + 0.5f ) / screenRes - 0.5f ) * distance * uvPerUnit;
+            plane.lookups.emplace_back( u, distance * uvPerUnit, footprint );
+        }
+    }
+
+    return { rows, columns, random, plane };
+}
+
+static void RunTextureBenchmarks( JsonWriter& w, const BenchOptions& options )
+{
+    LOG( "Running texture benchmarks" );
+    // big enough that the full resolution level (16MB) doesn't fit in the caches. Value noise, so the texels
+    // aren't all the same
+    const int res = 2048;
+    std::vector< unsigned char > rgba( 4 * static_cast< size_t >( res ) * res );
+    std::mt19937 rng( 4321 );
+    for ( unsigned char& c : rgba )
+    {
+        c = static_cast< unsigned char >( rng() & 0xFF );
+    }
+    std::vector< TextureLookupSet > lookupSets = MakeTextureLookupSets( res );
+
+    static const std::pair< TextureLayout, const char* > layouts[] =
+    {
+        { TextureLayout::Linear, "Linear" },
+        { TextureLayout::Tiled,  "Tiled" },
+        { TextureLayout::BC1,    "BC1" },
+    };
+    CacheMissCounters counters;
+    if ( !counters.IsAvailable( 0 ) )
+    {
+        LOG_WARN( "Hardware cache miss counters are not available, only timing the texture lookups" );
+    }
+    w.Key( "texture" );
+    w.StartArray();
+    for ( const auto& [layout, layoutName] : layouts )
+    {
+        Texture texture;
+        texture.Create( "bench", res, res, rgba.data(), layout );
+        for ( const TextureLookupSet& lookupSet : lookupSets )
+        {
+            float sum = 0;
+            counters.Start();
+            auto result = RunTimed( lookupSet.lookups.size(), options.minSeconds, [&]( size_t i )
+            {
+                const glm::vec3& lookup = lookupSet.lookups[i];
+                sum += texture.Sample( glm::vec2( lookup ), lookup.z ).x;
+            });
+            uint64_t misses[2];
+            counters.Stop( misses );
+            s_sink = static_cast< uint64_t >( sum );
+            double nsPerLookup = 1e9 * result.second / result.first;
+
+            w.StartObject();
+            w.Key( "layout" );      w.String( layoutName );
+            w.Key( "pattern" );     w.String( lookupSet.name );
+            w.Key( "bytes" );       w.Uint64( texture.GetMemoryBytes() );
+            w.Key( "lookups" );     w.Uint64( result.first );
+            w.Key( "nsPerLookup" ); w.Double( nsPerLookup );
+            w.Key( "cacheMissesPerLookup" );
+            counters.IsAvailable( 0 ) ? w.Double( static_cast< double >( misses[0] ) / result.first ) : w.Null();
+            w.Key( "l1dMissesPerLookup" );
+            counters.IsAvailable( 1 ) ? w.Double( static_cast< double >( misses[1] ) / result.first ) : w.Null();
+            w.EndObject();
+            LOG( "  ", layoutName, " ", lookupSet.name, ": ", nsPerLookup, " ns / lookup" );
+        }
+    }
+    w.EndArray();
+}
+
+static void RunRenderBenchmarks( JsonWriter& w, const BenchOptions& options )
+{
+    std::vector< int > threadCounts = options.threadCounts;
+    if ( threadCounts.empty() )
+    {
+        int maxThreads = 1;
+#ifdef _OPENMP
+        maxThreads = omp_get_max_threads();
+#endif
+        for ( int count = 1; count < maxThreads; count *= 2 )
+        {
+            threadCounts.push_back( count );
+        }
+        threadCounts.push_back( maxThreads );
+    }
+
+    std::vector< fs::path > sceneFiles;
+    std::error_code ec;
+    for ( const auto& entry : fs::directory_iterator( RESOURCE_DIR + std::string( "scenes" ), ec ) )
+    {
+        if ( entry.path().extension() == ".json" )
+        {
+            sceneFiles.push_back( entry.path() );
+        }
+    }
+    std::sort( sceneFiles.begin(), sceneFiles.end() );
+
+    LOG( "Running render benchmarks" );
+    w.Key( "render" );
+    w.StartArray();
+    for ( const fs::path& sceneFile : sceneFiles )
+    {
+        ResourceManager::Init();
+        Scene scene;
+        auto loadStart = Time::GetTimePoint();
+        bool loaded = scene.Load( sceneFile.string() ) && !scene.bvh.shapes.empty();
+        // a missing model or texture still loads, but the timings would not be comparable
+        loaded = loaded && std::all_of( scene.sourceFiles.begin(), scene.sourceFiles.end(), []( const std::string& file ) { return fs::exists( file ); } );
+        if ( !loaded )
+        {
+            LOG_WARN( "Skipping scene '", sceneFile.filename().string(), "', it or some of its files could not be loaded" );
+            continue;
+        }
+        float loadSeconds = Time::GetDuration( loadStart ) / 1000;
+
+        glm::ivec2 resolution = scene.imageResolution;
+        scene.imageResolution = glm::ivec2( options.width, std::max( 1, options.width * resolution.y / resolution.x ) );
+        scene.numSamplesPerPixel = { options.spp };
+        scene.checkpointIntervalSeconds = 0;
+
+        double baselineSeconds = 0;
+        for ( int threads : threadCounts )
+        {
+#ifdef _OPENMP
+            omp_set_num_threads( threads );
+#endif
+            PathTracer pathTracer;
+            pathTracer.printProgress = false;
+            auto start               = Time::GetTimePoint();
+            pathTracer.Render( &scene, 0 );
+            double seconds = Time::GetDuration( start ) / 1000.0;
+            if ( baselineSeconds == 0 )
+            {
+                baselineSeconds = seconds;
+            }
+
+            w.StartObject();
+            w.Key( "scene" );       w.String( sceneFile.filename().string().c_str() );
+            w.Key( "loadSeconds" ); w.Double( loadSeconds );
+            w.Key( "resolution" );
+            w.StartArray(); w.Int( scene.imageResolution.x ); w.Int( scene.imageResolution.y ); w.EndArray();
+            w.Key( "spp" );         w.Int( options.spp );
+            w.Key( "threads" );     w.Int( threads );
+            w.Key( "seconds" );     w.Double( seconds );
+            w.Key( "speedup" );     w.Double( baselineSeconds / seconds ); // relative to the first thread count
+#if USING( RENDER_STATS )
+            RenderStats stats = GatherRenderStats();
+            uint64_t numRays  = stats.TotalClosestHit().rays + stats.TotalShadow().rays;
+            w.Key( "rays" );        w.Uint64( numRays );
+            w.Key( "mraysPerSec" ); w.Double( numRays / 1e6 / seconds );
+#endif // #if USING( RENDER_STATS )
+            w.EndObject();
+            LOG( "  ", sceneFile.filename().string(), " with ", threads, " threads: ", seconds, " seconds" );
+        }
+    }
+    w.EndArray();
+}
+
+int main( int argc, char** argv )
+{
+    g_Logger.Init();
+    BenchOptions options;
+    if ( !ParseCommandLine( argc, argv, options ) )
+    {
+        PrintUsage();
+        return 1;
+    }
+    // stdout is for the results
+    StdoutToStderrRedirect redirect( options.outputFilename.empty() );
+    auto runGroup = [&]( const char* group )
+    {
+        return std::find( options.groups.begin(), options.groups.end(), group ) != options.groups.end();
+    };
+
+    rapidjson::StringBuffer buffer;
+    JsonWriter w( buffer );
+    w.StartObject();
+    w.Key( "version" ); w.Int( 1 );
+    int maxThreads = 1;
+#ifdef _OPENMP
+    maxThreads = omp_get_max_threads();
+#endif
+    w.Key( "maxThreads" ); w.Int( maxThreads );
+    w.Key( "renderStats" ); w.Bool( USING( RENDER_STATS ) );
+
+    if ( runGroup( "micro" ) )
+    {
+        RunMicroBenchmarks( w, options );
+    }
+    if ( runGroup( "build" ) || runGroup( "traversal" ) )
+    {
+        std::vector< BenchMesh > benchMeshes = LoadBenchMeshes();
+        if ( runGroup( "build" ) )
+        {
+            RunBuildBenchmarks( w, benchMeshes );
+        }
+        if ( runGroup( "traversal" ) )
+        {
+            RunTraversalBenchmarks( w, benchMeshes, options );
+        }
+    }
+    if ( runGroup( "texture" ) )
+    {
+        RunTextureBenchmarks( w, options );
+    }
+    if ( runGroup( "render" ) )
+    {
+        RunRenderBenchmarks( w, options );
+    }
+    w.EndObject();
+
+    if ( options.outputFilename.empty() )
+    {
+        redirect.Restore();
+        std::cout << buffer.GetString() << std::endl;
+    }
+    else
+    {
+        std::ofstream out( options.outputFilename );
+        out << buffer.GetString() << std::endl;
+        if ( !out )
+        {
+            LOG_ERR( "Could not write results to '", options.outputFilename, "'" );
+            return 1;
+        }
+        LOG( "Wrote results to '", options.outputFilename, "'" );
+    }
+
+    ResourceManager::Shutdown();
+    g_Logger.Shutdown();
+
+    return 0;
+}
@@ -0,0 +1,439 @@
+#include "configuration.hpp"
+#include "image_metrics.hpp"
+#include "path_tracer.hpp"
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include "resource/resource_manager.hpp"
+#include "scene.hpp"
+#include "tile_file.hpp"
+#include "tonemap.hpp"
+#include "utils/json_parsing.hpp"
+#include "utils/logger.hpp"
+#include "utils/string_utils.hpp"
+#include "utils/time.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace PT;
+namespace fs = std::filesystem;
+
+using JsonWriter = rapidjson::PrettyWriter< rapidjson::StringBuffer >;
+
+// Convergence regression harness: renders scenes with increasing time budgets and measures the error against
+// high SPP references, so that changes to the sampling are judged by quality per second instead of raw speed.
+// The efficiency of a render is 1 / ( relMSE * seconds ), which stays constant as long as the error falls off
+// with 1 / time like an unbiased Monte Carlo estimate should. Exits with 1 if the efficiency of any render
+// dropped by more than the tolerance compared to the baseline
+static void PrintUsage()
+{
+    std::cout << "Usage: ptConvergence [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --scenes A.json[,...]    Scenes to test (default: cornell, sponza and dragon from resources/scenes)" << std::endl;
+    std::cout << "  --references DIR         Directory of the reference tiles (default resources/references)" << std::endl;
+    std::cout << "  --budgets SEC[,...]      Time budgets of the test renders (default 0.25, 0.5, 1, 2)" << std::endl;
+    std::cout << "  --out FILE               Write the JSON results to FILE instead of stdout" << std::endl;
+    std::cout << "  --baseline FILE          Compare the efficiency against the results stored in FILE" << std::endl;
+    std::cout << "  --updateBaseline         Store the results as the new baseline in the --baseline FILE" << std::endl;
+    std::cout << "  --tolerance T            Allowed relative efficiency drop before failing (default 0.2)" << std::endl;
+    std::cout << "  --makeReferences SPP     Render the references with SPP samples per pixel instead of testing" << std::endl;
+    std::cout << "  --width W                Width of the new references, the height keeps the aspect ratio (default 128)" << std::endl;
+}
+
+struct HarnessOptions
+{
+    std::vector< std::string > scenes = { "cornell.json", "sponza.json", "dragon.json" };
+    std::string referenceDir          = RESOURCE_DIR "references";
+    std::vector< float > budgets      = { 0.25f, 0.5f, 1.0f, 2.0f };
+    std::string outputFilename;
+    std::string baselineFilename;
+    bool updateBaseline               = false;
+    float tolerance                   = 0.2f;
+    int referenceSpp                  = 0; // > 0 == make references
+    int referenceWidth                = 128;
+};
+
+static bool ParseCommandLine( int argc, char** argv, HarnessOptions& options )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool hasArg = i + 1 < argc;
+        if ( !strcmp( argv[i], "--scenes" ) && hasArg )
+        {
+            options.scenes = SplitList( argv[++i] );
+        }
+        else if ( !strcmp( argv[i], "--references" ) && hasArg )
+        {
+            options.referenceDir = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--budgets" ) && hasArg )
+        {
+            options.budgets.clear();
+            for ( const std::string& budget : SplitList( argv[++i] ) )
+            {
+                options.budgets.push_back( static_cast< float >( atof( budget.c_str() ) ) );
+            }
+        }
+        else if ( !strcmp( argv[i], "--out" ) && hasArg )
+        {
+            options.outputFilename = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--baseline" ) && hasArg )
+        {
+            options.baselineFilename = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--updateBaseline" ) )
+        {
+            options.updateBaseline = true;
+        }
+        else if ( !strcmp( argv[i], "--tolerance" ) && hasArg )
+        {
+            options.tolerance = static_cast< float >( atof( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--makeReferences" ) && hasArg )
+        {
+            options.referenceSpp = std::max( 1, atoi( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--width" ) && hasArg )
+        {
+            options.referenceWidth = std::max( 1, atoi( argv[++i] ) );
+        }
+        else
+        {
+            LOG_ERR( "Unknown or incomplete option '", argv[i], "'" );
+            return false;
+        }
+    }
+    if ( options.updateBaseline && options.baselineFilename.empty() )
+    {
+        LOG_ERR( "--updateBaseline needs a --baseline FILE" );
+        return false;
+    }
+
+    return true;
+}
+
+// scene names are looked up in resources/scenes, unless they are a path
+static std::string GetScenePath( const std::string& scene )
+{
+    if ( fs::exists( scene ) )
+    {
+        return scene;
+    }
+
+    return RESOURCE_DIR "scenes/" + scene;
+}
+
+static std::string GetReferencePath( const HarnessOptions& options, const std::string& scene )
+{
+    return ( fs::path( options.referenceDir ) / ( fs::path( scene ).stem().string() + TILE_FILE_EXTENSION ) ).string();
+}
+
+static bool LoadScene( const std::string& scene, Scene& loadedScene )
+{
+    ResourceManager::Init();
+    std::string path = GetScenePath( scene );
+    if ( !loadedScene.Load( path ) )
+    {
+        return false;
+    }
+    // a scene with a missing model or texture still loads, but does not match its reference
+    for ( const std::string& file : loadedScene.sourceFiles )
+    {
+        if ( !fs::exists( file ) )
+        {
+            LOG_WARN( "Scene '", scene, "' is missing file '", file, "'" );
+            return false;
+        }
+    }
+    loadedScene.cropWindow                = glm::ivec4( 0 );
+    loadedScene.tileRange                 = glm::ivec2( -1 );
+    loadedScene.sampleRange               = glm::ivec2( -1 );
+    loadedScene.checkpointIntervalSeconds = 0;
+    loadedScene.targetNoise               = 0;
+
+    return true;
+}
+
+static bool MakeReferences( const HarnessOptions& options )
+{
+    std::error_code ec;
+    fs::create_directories( options.referenceDir, ec );
+    bool success = true;
+    for ( const std::string& sceneName : options.scenes )
+    {
+        Scene scene;
+        if ( !LoadScene( sceneName, scene ) )
+        {
+            LOG_WARN( "Skipping reference for scene '", sceneName, "'" );
+            continue;
+        }
+        glm::ivec2 resolution       = scene.imageResolution;
+        scene.imageResolution       = glm::ivec2( options.referenceWidth, std::max( 1, options.referenceWidth * resolution.y / resolution.x ) );
+        scene.numSamplesPerPixel    = { options.referenceSpp };
+        scene.timeLimitSeconds      = 0;
+
+        PathTracer pathTracer;
+        pathTracer.Render( &scene, 0 );
+        std::string filename = GetReferencePath( options, sceneName );
+        if ( !pathTracer.SaveTile( filename ) )
+        {
+            LOG_ERR( "Could not save reference '", filename, "'" );
+            success = false;
+            continue;
+        }
+        LOG( "Saved reference '", filename, "'" );
+    }
+
+    return success;
+}
+
+static Image CopyImage( const Image& image )
+{
+    Image copy( image.GetWidth(), image.GetHeight() );
+    std::copy( image.GetPixels(), image.GetPixels() + image.GetWidth() * image.GetHeight(), copy.GetPixels() );
+
+    return copy;
+}
+
+struct CurvePoint
+{
+    float budgetSeconds;
+    float seconds;
+    int spp;
+    float rmse;
+    float relMSE;
+    float flip;
+    float efficiency;
+};
+
+struct SceneResult
+{
+    std::string scene;
+    int referenceSpp;
+    glm::ivec2 resolution;
+    std::vector< CurvePoint > curve;
+};
+
+static bool TestScene( const HarnessOptions& options, const std::string& sceneName, SceneResult& result )
+{
+    std::string referenceFilename = GetReferencePath( options, sceneName );
+    TileFileHeader referenceHeader;
+    Image reference;
+    if ( !fs::exists( referenceFilename ) || !ReadTileFile( referenceFilename, referenceHeader, reference ) )
+    {
+        LOG_WARN( "Skipping scene '", sceneName, "', no reference '", referenceFilename, "' (see --makeReferences)" );
+        return false;
+    }
+    if ( referenceHeader.numSamples > 0 )
+    {
+        reference.ForAllPixels( [&]( const glm::vec3& p ) { return p / static_cast< float >( referenceHeader.numSamples ); } );
+    }
+    Scene scene;
+    if ( !LoadScene( sceneName, scene ) )
+    {
+        LOG_WARN( "Skipping scene '", sceneName, "', it could not be loaded" );
+        return false;
+    }
+    scene.imageResolution = glm::ivec2( referenceHeader.fullWidth, referenceHeader.fullHeight );
+    scene.samplesPerPass  = 1;
+
+    Image ldrReference = CopyImage( reference );
+    TonemapImage( ldrReference, referenceHeader.exposure, referenceHeader.gamma );
+
+    result.scene        = fs::path( sceneName ).stem().string();
+    result.resolution   = scene.imageResolution;
+    result.referenceSpp = 0;
+    for ( float budget : options.budgets )
+    {
+        scene.timeLimitSeconds = budget;
+        PathTracer pathTracer;
+        pathTracer.printProgress = false;
+        auto start               = Time::GetTimePoint();
+        pathTracer.Render( &scene, 0 );
+
+        CurvePoint point;
+        point.budgetSeconds = budget;
+        point.seconds       = Time::GetDuration( start ) / 1000;
+        point.spp           = pathTracer.GetNumSamples();
+        point.rmse          = RMSE( pathTracer.renderedImage, reference );
+        point.relMSE        = RelMSE( pathTracer.renderedImage, reference );
+        Image ldrTest       = CopyImage( pathTracer.renderedImage );
+        TonemapImage( ldrTest, scene.camera.exposure, scene.camera.gamma );
+        point.flip          = FLIP( ldrTest, ldrReference );
+        point.efficiency    = 1.0f / std::max( point.relMSE * point.seconds, 1e-12f );
+        result.curve.push_back( point );
+        LOG( "  ", result.scene, ": ", point.seconds, "s, ", point.spp, " spp, RMSE = ", point.rmse, ", relMSE = ", point.relMSE,
+             ", FLIP = ", point.flip, ", efficiency = ", point.efficiency );
+    }
+
+    return true;
+}
+
+static void WriteResults( JsonWriter& w, const std::vector< SceneResult >& results )
+{
+    w.Key( "scenes" );
+    w.StartArray();
+    for ( const SceneResult& result : results )
+    {
+        w.StartObject();
+        w.Key( "scene" ); w.String( result.scene.c_str() );
+        w.Key( "resolution" );
+        w.StartArray(); w.Int( result.resolution.x ); w.Int( result.resolution.y ); w.EndArray();
+        w.Key( "curve" );
+        w.StartArray();
+        for ( const CurvePoint& point : result.curve )
+        {
+            w.StartObject();
+            w.Key( "budgetSeconds" ); w.Double( point.budgetSeconds );
+            w.Key( "seconds" );       w.Double( point.seconds );
+            w.Key( "spp" );           w.Int( point.spp );
+            w.Key( "rmse" );          w.Double( point.rmse );
+            w.Key( "relMSE" );        w.Double( point.relMSE );
+            w.Key( "flip" );          w.Double( point.flip );
+            w.Key( "efficiency" );    w.Double( point.efficiency );
+            w.EndObject();
+        }
+        w.EndArray();
+        w.EndObject();
+    }
+    w.EndArray();
+}
+
+// Compares each render to the baseline render of the same scene and budget. Returns false on a regression
+static bool CompareToBaseline( const HarnessOptions& options, const std::vector< SceneResult >& results, JsonWriter& w )
+{
+    auto document = ParseJSONFile( options.baselineFilename );
+    if ( document.IsNull() || !document.HasMember( "scenes" ) )
+    {
+        LOG_ERR( "Could not read baseline '", options.baselineFilename, "'" );
+        return false;
+    }
+
+    bool passed = true;
+    w.Key( "comparison" );
+    w.StartArray();
+    for ( const SceneResult& result : results )
+    {
+        for ( const auto& baselineScene : document["scenes"].GetArray() )
+        {
+            if ( result.scene != baselineScene["scene"].GetString() )
+            {
+                continue;
+            }
+            for ( const CurvePoint& point : result.curve )
+            {
+                for ( const auto& baselinePoint : baselineScene["curve"].GetArray() )
+                {
+                    if ( std::abs( baselinePoint["budgetSeconds"].GetFloat() - point.budgetSeconds ) > 1e-4f )
+                    {
+                        continue;
+                    }
+                    float baselineEfficiency = baselinePoint["efficiency"].GetFloat();
+                    float ratio              = point.efficiency / baselineEfficiency;
+                    bool regressed           = ratio < 1 - options.tolerance;
+                    passed                   = passed && !regressed;
+                    w.StartObject();
+                    w.Key( "scene" );              w.String( result.scene.c_str() );
+                    w.Key( "budgetSeconds" );      w.Double( point.budgetSeconds );
+                    w.Key( "baselineEfficiency" ); w.Double( baselineEfficiency );
+                    w.Key( "efficiency" );         w.Double( point.efficiency );
+                    w.Key( "ratio" );              w.Double( ratio );
+                    w.Key( "regressed" );          w.Bool( regressed );
+                    w.EndObject();
+                    if ( regressed )
+                    {
+                        LOG_ERR( result.scene, " at ", point.budgetSeconds, "s: efficiency dropped to ", 100 * ratio, "% of the baseline" );
+                    }
+                }
+            }
+        }
+    }
+    w.EndArray();
+
+    return passed;
+}
+
+static bool WriteFile( const std::string& filename, const std::string& contents )
+{
+    std::ofstream out( filename );
+    out << contents << std::endl;
+    if ( !out )
+    {
+        LOG_ERR( "Could not write '", filename, "'" );
+        return false;
+    }
+
+    return true;
+}
+
+int main( int argc, char** argv )
+{
+    g_Logger.Init();
+    HarnessOptions options;
+    if ( !ParseCommandLine( argc, argv, options ) )
+    {
+        PrintUsage();
+        return 1;
+    }
+    if ( options.referenceSpp > 0 )
+    {
+        return MakeReferences( options ) ? 0 : 1;
+    }
+
+    // stdout is for the results
+    StdoutToStderrRedirect redirect( options.outputFilename.empty() );
+
+    std::vector< SceneResult > results;
+    for ( const std::string& scene : options.scenes )
+    {
+        SceneResult result;
+        if ( TestScene( options, scene, result ) )
+        {
+            results.push_back( result );
+        }
+    }
+
+    rapidjson::StringBuffer buffer;
+    JsonWriter w( buffer );
+    w.StartObject();
+    w.Key( "version" ); w.Int( 1 );
+    WriteResults( w, results );
+    bool passed = true;
+    if ( !options.baselineFilename.empty() && !options.updateBaseline )
+    {
+        passed = CompareToBaseline( options, results, w );
+    }
+    w.Key( "passed" ); w.Bool( passed );
+    w.EndObject();
+
+    bool success = passed;
+    if ( options.outputFilename.empty() )
+    {
+        redirect.Restore();
+        std::cout << buffer.GetString() << std::endl;
+    }
+    else
+    {
+        success = WriteFile( options.outputFilename, buffer.GetString() ) && success;
+    }
+    if ( options.updateBaseline )
+    {
+        success = WriteFile( options.baselineFilename, buffer.GetString() ) && success;
+        LOG( "Updated baseline '", options.baselineFilename, "'" );
+    }
+    if ( results.empty() )
+    {
+        LOG_ERR( "No scene could be tested" );
+        success = false;
+    }
+
+    ResourceManager::Shutdown();
+    g_Logger.Shutdown();
+
+    return success ? 0 : 1;
+}
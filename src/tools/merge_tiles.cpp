@@ -0,0 +1,55 @@
+#include "tile_file.hpp"
+#include "tonemap.hpp"
+#include "utils/logger.hpp"
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+using namespace PT;
+namespace fs = std::filesystem;
+
+// Assembles the raw HDR tile files written by 'pathTracer --crop/--tiles' (or sample range workers) into the
+// full image. The tiles are merged before tonemapping, so the result is identical to rendering the full frame
+// at once. If the output has the tile file extension, the merged image is written untonemapped as a single
+// full frame tile (useful for merging in several steps)
+int main( int argc, char** argv )
+{
+    if ( argc < 3 )
+    {
+        std::cout << "Usage: ptMergeTiles OUTPUT_IMAGE TILE_FILE [TILE_FILE ...]" << std::endl;
+        return 0;
+    }
+
+    g_Logger.Init();
+
+    std::string outputFilename = argv[1];
+    std::vector< std::string > tileFilenames( argv + 2, argv + argc );
+    TileFileHeader fullHeader;
+    Image fullImage;
+    if ( !MergeTileFiles( tileFilenames, fullHeader, fullImage ) )
+    {
+        return 1;
+    }
+
+    bool success;
+    if ( fs::path( outputFilename ).extension() == TILE_FILE_EXTENSION )
+    {
+        success = WriteTileFile( outputFilename, fullHeader, fullImage );
+    }
+    else
+    {
+        TonemapImage( fullImage, fullHeader.exposure, fullHeader.gamma );
+        success = fullImage.Save( outputFilename );
+    }
+
+    if ( !success )
+    {
+        LOG_ERR( "Could not save merged image '", outputFilename, "'" );
+        return 1;
+    }
+    LOG( "Merged ", tileFilenames.size(), " tiles into '", outputFilename, "'" );
+
+    g_Logger.Shutdown();
+
+    return 0;
+}
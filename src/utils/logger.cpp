@@ -27,3 +27,32 @@ void Logger::Shutdown()
 {
     outputs.clear();
 }
+
+StdoutToStderrRedirect::StdoutToStderrRedirect( bool enabled ) :
+    m_stdoutBuffer( std::cout.rdbuf() ),
+    m_redirected( enabled )
+{
+    if ( !enabled )
+    {
+        return;
+    }
+    if ( LoggerOutputLocation* location = g_Logger.GetLocation( "stdout" ) )
+    {
+        m_stdoutLogColored = location->colored;
+    }
+    std::cout.rdbuf( std::cerr.rdbuf() );
+    g_Logger.RemoveLocation( "stdout" );
+    g_Logger.AddLocation( "stderr", &std::cerr, false );
+}
+
+void StdoutToStderrRedirect::Restore()
+{
+    if ( !m_redirected )
+    {
+        return;
+    }
+    m_redirected = false;
+    std::cout.rdbuf( m_stdoutBuffer );
+    g_Logger.RemoveLocation( "stderr" );
+    g_Logger.AddLocation( "stdout", &std::cout, m_stdoutLogColored );
+}
@@ -69,6 +69,37 @@ public:
     {
     }
 
+    // file locations own their stream, so they can only be moved (when the outputs vector grows)
+    LoggerOutputLocation( const LoggerOutputLocation& ) = delete;
+    LoggerOutputLocation& operator=( const LoggerOutputLocation& ) = delete;
+
+    LoggerOutputLocation( LoggerOutputLocation&& other ) noexcept :
+        name( std::move( other.name ) ),
+        output( other.output ),
+        colored( other.colored ),
+        isFile( other.isFile )
+    {
+        other.output = nullptr;
+    }
+
+    LoggerOutputLocation& operator=( LoggerOutputLocation&& other ) noexcept
+    {
+        if ( this != &other )
+        {
+            if ( isFile && output )
+            {
+                delete output;
+            }
+            name         = std::move( other.name );
+            output       = other.output;
+            colored      = other.colored;
+            isFile       = other.isFile;
+            other.output = nullptr;
+        }
+
+        return *this;
+    }
+
     ~LoggerOutputLocation()
     {
         if ( isFile && output )
@@ -201,3 +232,26 @@ private:
 };
 
 extern Logger g_Logger;
+
+// For the programs whose stdout carries data (results JSON, the render server's events): while it is alive, the
+// log and anything else printed to std::cout go to stderr. The data is written through GetStdoutBuffer(), or to
+// std::cout after Restore(). Restored when it goes out of scope too
+class StdoutToStderrRedirect
+{
+public:
+    // does nothing if not enabled, for when the data goes somewhere else
+    explicit StdoutToStderrRedirect( bool enabled = true );
+    ~StdoutToStderrRedirect() { Restore(); }
+
+    StdoutToStderrRedirect( const StdoutToStderrRedirect& ) = delete;
+    StdoutToStderrRedirect& operator=( const StdoutToStderrRedirect& ) = delete;
+
+    void Restore();
+
+    std::streambuf* GetStdoutBuffer() const { return m_stdoutBuffer; }
+
+private:
+    std::streambuf* m_stdoutBuffer;
+    bool m_redirected;
+    bool m_stdoutLogColored = true;
+};
@@ -0,0 +1,66 @@
+#include "utils/mapped_file.hpp"
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PT
+{
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if ( m_data )
+    {
+        munmap( const_cast< char* >( m_data ), m_size );
+    }
+#endif
+}
+
+bool MappedFile::Open( const std::string& filename )
+{
+#ifdef _WIN32
+    std::ifstream in( filename, std::ios::binary );
+    m_buffer.assign( std::istreambuf_iterator< char >( in ), std::istreambuf_iterator< char >() );
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return m_size > 0;
+#else
+    int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        return false;
+    }
+    struct stat info;
+    void* data = MAP_FAILED;
+    if ( fstat( fd, &info ) == 0 && info.st_size > 0 )
+    {
+        data = mmap( nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    close( fd );
+    if ( data == MAP_FAILED )
+    {
+        return false;
+    }
+    m_data = static_cast< const char* >( data );
+    m_size = info.st_size;
+    return true;
+#endif
+}
+
+void MappedFile::Prefetch() const
+{
+#ifndef _WIN32
+    if ( m_data )
+    {
+        madvise( const_cast< char* >( m_data ), m_size, MADV_WILLNEED );
+    }
+#endif
+}
+
+} // namespace PT
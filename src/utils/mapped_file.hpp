@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+// Read only view of a whole file. Mapped where mmap exists, so only the pages that are touched get read,
+// and read into memory otherwise
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    // false if the file can't be opened or is empty
+    bool Open( const std::string& filename );
+
+    // starts reading the whole file in the background, for files that are about to be read all over
+    void Prefetch() const;
+
+    const char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size      = 0;
+#ifdef _WIN32
+    std::vector< char > m_buffer;
+#endif
+};
+
+} // namespace PT
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PT
+{
+
+// One T per thread, created on the thread's first Get, for counters and buffers that every thread fills on its own
+// and that are gathered afterwards. The Ts are owned by the registry instead of by the threads, so the data of threads
+// that exited (like async image saves) is not lost. There is one registry per type T.
+// Get is a plain thread_local pointer read after the first call, which doesn't go through the TLS initialization
+// wrapper functions that a thread_local with a constructor would need
+template< typename T >
+class PerThread
+{
+public:
+    static T& Get()
+    {
+        return t_local ? *t_local : Register();
+    }
+
+    // calls func( T& ) for the T of every thread that called Get so far. Threads calling Get for the first time wait
+    template< typename Func >
+    static void ForEach( Func&& func )
+    {
+        std::lock_guard< std::mutex > lock( s_lock );
+        for ( auto& data : s_all )
+        {
+            func( *data );
+        }
+    }
+
+private:
+    static T& Register()
+    {
+        std::lock_guard< std::mutex > lock( s_lock );
+        s_all.push_back( std::make_unique< T >() );
+        t_local = s_all.back().get();
+
+        return *t_local;
+    }
+
+    static inline std::mutex s_lock;
+    static inline std::vector< std::unique_ptr< T > > s_all;
+    static inline thread_local T* t_local = nullptr;
+};
+
+} // namespace PT
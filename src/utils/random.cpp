@@ -6,12 +6,45 @@ namespace PT
 namespace Random
 {
 
+// PCG32 (https://www.pcg-random.org). Unlike std::mt19937, re-seeding is as cheap as generating
+// a number, which matters when every sample of every pixel gets its own seed
+struct PCG32
+{
+    void Seed( uint64_t seed )
+    {
+        state = 0;
+        Next();
+        state += seed;
+        Next();
+    }
+
+    uint32_t Next()
+    {
+        uint64_t oldState = state;
+        state = oldState * 6364136223846793005ull + increment;
+        uint32_t xorShifted = static_cast< uint32_t >( ((oldState >> 18u) ^ oldState) >> 27u );
+        uint32_t rot        = static_cast< uint32_t >( oldState >> 59u );
+        return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+    }
+
+    uint64_t state     = 0;
+    uint64_t increment = 1442695040888963407ull;
+};
+
+static PCG32 CreateGenerator()
+{
+    std::random_device rd;
+    PCG32 generator;
+    generator.Seed( (static_cast< uint64_t >( rd() ) << 32) | rd() );
+    return generator;
+}
+
+static thread_local PCG32 generator = CreateGenerator();
+
 float Rand()
 {
-    static thread_local std::random_device rd;
-    static thread_local std::mt19937 generator( rd() );
-    std::uniform_real_distribution< float > distribution( 0, 1 );
-    return distribution( generator );
+    // top 24 bits, so that the result is exactly representable and always < 1
+    return (generator.Next() >> 8) * (1.0f / 16777216.0f);
     //return rand() / (float) RAND_MAX;
 }
 
@@ -20,5 +53,26 @@ float RandFloat( float l, float h )
     return Rand() * (h - l) + l;
 }
 
+void Seed( uint64_t seed )
+{
+    generator.Seed( seed );
+}
+
+uint64_t SampleSeed( uint64_t pixelIndex, uint64_t sampleIndex )
+{
+    // splitmix64 finalizer, so that neighboring pixels / samples get unrelated seeds
+    uint64_t z = pixelIndex * 0x9E3779B97F4A7C15ull + sampleIndex;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+uint64_t PhotonSeed( uint64_t pass, uint64_t photonIndex )
+{
+    // tagged with the top bit, which pixel indices never reach, so photon i of pass p doesn't replay the random
+    // numbers of sample i of pixel p
+    return SampleSeed( pass | (1ull << 63), photonIndex );
+}
+
 } // namespace Random
-} // namespace PT
\ No newline at end of file
+} // namespace PT
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 
 namespace PT
 {
@@ -11,5 +12,15 @@ float RandFloat( float l, float h );
 
 float Rand();
 
+// Re-seeds the calling thread's generator, so that a sequence of Rand() calls can be reproduced
+// independently of which thread / process runs it
+void Seed( uint64_t seed );
+
+// Deterministic seed for one sample of one pixel
+uint64_t SampleSeed( uint64_t pixelIndex, uint64_t sampleIndex );
+
+// Deterministic seed for one photon of one photon pass, never the same as the seed of a camera sample
+uint64_t PhotonSeed( uint64_t pass, uint64_t photonIndex );
+
 } // namespace Random
 } // namespace PT
@@ -0,0 +1,20 @@
+#include "utils/string_utils.hpp"
+#include <sstream>
+
+namespace PT
+{
+
+std::vector< std::string > SplitList( const std::string& list )
+{
+    std::vector< std::string > items;
+    std::stringstream ss( list );
+    std::string item;
+    while ( std::getline( ss, item, ',' ) )
+    {
+        items.push_back( item );
+    }
+
+    return items;
+}
+
+} // namespace PT
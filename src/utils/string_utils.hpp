@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace PT
+{
+
+// Splits a comma separated command line list ("a,b,c") into its items
+std::vector< std::string > SplitList( const std::string& list );
+
+} // namespace PT
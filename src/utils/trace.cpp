@@ -0,0 +1,138 @@
+#include "trace.hpp"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "utils/logger.hpp"
+#include "utils/per_thread.hpp"
+#include <atomic>
+#include <fstream>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace PT
+{
+namespace Trace
+{
+
+    struct Event
+    {
+        const char* name;
+        std::string detail;
+        steady_clock::time_point start;
+        steady_clock::time_point end;
+    };
+
+    static std::atomic< int > s_numThreads( 0 );
+
+    // events of one thread, kept in a PerThread registry
+    struct ThreadEvents
+    {
+        int threadIndex = s_numThreads++;
+        std::vector< Event > events;
+    };
+
+    static std::atomic< bool > s_recording( false );
+    static steady_clock::time_point s_sessionStart;
+    static int s_mainThreadIndex = 0;
+
+    static ThreadEvents& GetThreadEvents()
+    {
+        return PerThread< ThreadEvents >::Get();
+    }
+
+    void StartSession()
+    {
+        PerThread< ThreadEvents >::ForEach( []( ThreadEvents& threadEvents ) { threadEvents.events.clear(); } );
+        s_mainThreadIndex = GetThreadEvents().threadIndex;
+        s_sessionStart    = steady_clock::now();
+        s_recording       = true;
+    }
+
+    bool EndSession( const std::string& filename )
+    {
+        s_recording = false;
+
+        // Chrome trace event format: complete ("X") events with microsecond timestamps, one row per thread
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer< rapidjson::StringBuffer > w( buffer );
+        auto Microseconds = []( steady_clock::duration d ) { return duration_cast< nanoseconds >( d ).count() / 1000.0; };
+        size_t numEvents = 0;
+        w.StartObject();
+        w.Key( "displayTimeUnit" ); w.String( "ms" );
+        w.Key( "traceEvents" );
+        w.StartArray();
+        PerThread< ThreadEvents >::ForEach( [&]( ThreadEvents& threadEvents )
+        {
+            std::string threadName = threadEvents.threadIndex == s_mainThreadIndex ? "Main" : "Thread " + std::to_string( threadEvents.threadIndex );
+            w.StartObject();
+            w.Key( "name" ); w.String( "thread_name" );
+            w.Key( "ph" );   w.String( "M" );
+            w.Key( "pid" );  w.Int( 1 );
+            w.Key( "tid" );  w.Int( threadEvents.threadIndex );
+            w.Key( "args" );
+            w.StartObject();
+            w.Key( "name" ); w.String( threadName.c_str() );
+            w.EndObject();
+            w.EndObject();
+
+            for ( const Event& event : threadEvents.events )
+            {
+                w.StartObject();
+                w.Key( "name" ); w.String( event.name );
+                w.Key( "ph" );   w.String( "X" );
+                w.Key( "pid" );  w.Int( 1 );
+                w.Key( "tid" );  w.Int( threadEvents.threadIndex );
+                w.Key( "ts" );   w.Double( Microseconds( event.start - s_sessionStart ) );
+                w.Key( "dur" );  w.Double( Microseconds( event.end - event.start ) );
+                if ( !event.detail.empty() )
+                {
+                    w.Key( "args" );
+                    w.StartObject();
+                    w.Key( "detail" ); w.String( event.detail.c_str() );
+                    w.EndObject();
+                }
+                w.EndObject();
+            }
+            numEvents += threadEvents.events.size();
+            threadEvents.events.clear();
+        });
+        w.EndArray();
+        w.EndObject();
+
+        std::ofstream out( filename, std::ios::binary );
+        out.write( buffer.GetString(), buffer.GetSize() );
+        if ( !out )
+        {
+            LOG_ERR( "Could not write trace file '", filename, "'" );
+            return false;
+        }
+        LOG( "Wrote ", numEvents, " trace events to '", filename, "'" );
+
+        return true;
+    }
+
+    bool IsRecording()
+    {
+        return s_recording.load( std::memory_order_relaxed );
+    }
+
+    Zone::Zone( const char* name ) : m_name( nullptr )
+    {
+        if ( IsRecording() )
+        {
+            m_name  = name;
+            m_start = steady_clock::now();
+        }
+    }
+
+    Zone::~Zone()
+    {
+        // zones still open when the session ends are dropped
+        if ( m_name && IsRecording() )
+        {
+            GetThreadEvents().events.push_back( { m_name, std::move( m_detail ), m_start, steady_clock::now() } );
+        }
+    }
+
+} // namespace Trace
+} // namespace PT
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "core_defines.hpp"
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Scoped timeline zones (scene loading, BVH build, render passes and rows, tonemapping, image saves), written as
+// Chrome trace JSON that can be opened with chrome://tracing or ui.perfetto.dev. Each thread appends to its own
+// event buffer, so recording takes no locks. When no session is running a zone only checks one flag.
+// Turn off to compile the zones out entirely
+#define TRACING IN_USE
+
+#define TRACE_CONCAT_INTERNAL( a, b ) a##b
+#define TRACE_CONCAT( a, b ) TRACE_CONCAT_INTERNAL( a, b )
+
+namespace PT
+{
+namespace Trace
+{
+
+    // Discards the events of any previous session and starts recording
+    void StartSession();
+
+    // Stops recording and writes the events of every thread to filename. Zones that are still open on other
+    // threads are lost, so this should only be called once the work being traced is done
+    bool EndSession( const std::string& filename );
+
+    bool IsRecording();
+
+    class Zone
+    {
+    public:
+        // name has to be a string literal (or otherwise outlive the session), only the pointer is stored
+        Zone( const char* name );
+        ~Zone();
+
+        Zone( const Zone& ) = delete;
+        Zone& operator=( const Zone& ) = delete;
+
+        // false if no session was running when the zone opened
+        bool IsActive() const { return m_name != nullptr; }
+
+        // extra text shown with the zone, like the name of the file being loaded
+        void SetDetail( const std::string& detail ) { m_detail = detail; }
+
+    private:
+        const char* m_name;
+        std::string m_detail;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+} // namespace Trace
+} // namespace PT
+
+#if USING( TRACING )
+
+#define TRACE_ZONE( name ) PT::Trace::Zone TRACE_CONCAT( traceZone, __LINE__ )( name )
+
+// the detail expression is only evaluated while recording
+#define TRACE_ZONE_DETAIL( name, detail )                                 \
+    PT::Trace::Zone TRACE_CONCAT( traceZone, __LINE__ )( name );          \
+    if ( TRACE_CONCAT( traceZone, __LINE__ ).IsActive() )                 \
+    {                                                                     \
+        TRACE_CONCAT( traceZone, __LINE__ ).SetDetail( detail );          \
+    }
+
+#else // #if USING( TRACING )
+
+#define TRACE_ZONE( name )
+#define TRACE_ZONE_DETAIL( name, detail )
+
+#endif // #else // #if USING( TRACING )